@@ -0,0 +1,223 @@
+/*____________________________________________________________________
+|
+| File: LoadBMPFile.cpp
+|
+| Description: Function to read an uncompressed 24-bit BMP file into
+|   an RGB buffer ready to pass to glTexImage2D().  The file is read
+|   from an asset pack or mapped from disk (see pack.h).  Validates the
+|   header against the file size, copies the rows without their padding
+|   (bottom row first, flipping top-down images) and swaps BGR to RGB
+|   (using SSSE3 when the CPU has it).
+|
+| Functions: loadBMPfile
+|            SwizzleBGR
+|            SwizzleBGR_SSSE3
+|            ReadU16
+|            ReadU32
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "math3d.h"
+#include "memtrack.h"
+#include "cpu.h"
+#include "pack.h"
+#include "trace.h"
+#include "LoadBMPFile.h"
+
+#ifdef CPU_X86
+#include <tmmintrin.h>    // SSSE3
+#endif
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define FILE_HEADER_SIZE  14    // BITMAPFILEHEADER
+#define INFO_HEADER_SIZE  40    // BITMAPINFOHEADER (later versions are longer but start the same way)
+#define MAX_DIMENSION     32768
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+#ifdef CPU_X86
+static void SwizzleBGR_SSSE3 (unsigned char *pixels, int num_pixels);
+#endif
+static unsigned ReadU16 (const unsigned char *p);
+static unsigned ReadU32 (const unsigned char *p);
+
+/*____________________________________________________________________
+|
+| Function: loadBMPfile
+|
+| Output: Loads the data from a BMP file.  Returns true on success,
+|   false on any error.  Caller should Mem_Free() the buffer when
+|   done using it.
+|___________________________________________________________________*/
+
+bool loadBMPfile (char *filename, int *width, int *height, unsigned char **data)
+{
+  PackFile file;
+  TraceScope trace("loadBMPfile");
+
+  // Init variables
+  *data = 0;  // buffer is not created yet
+
+  // Open the file
+  if (NOT Pack_ReadFile(filename, &file)) {
+    printf ("%s: file not opened\n", filename);
+    return false;
+  }
+
+  // Check the headers
+  const unsigned char *header = file.data;
+  if (file.size < FILE_HEADER_SIZE + INFO_HEADER_SIZE OR header[0] != 'B' OR header[1] != 'M') {
+    printf ("%s: not a correct BMP file\n", filename);
+    Pack_CloseFile (&file);
+    return false;
+  }
+  unsigned data_pos    = ReadU32 (header + 0x0A);
+  unsigned header_size = ReadU32 (header + 0x0E);
+  int      w           = (int) ReadU32 (header + 0x12);
+  int      h           = (int) ReadU32 (header + 0x16);   // negative if rows are stored top-down
+  unsigned planes      = ReadU16 (header + 0x1A);
+  unsigned bpp         = ReadU16 (header + 0x1C);
+  unsigned compression = ReadU32 (header + 0x1E);
+  bool top_down = h < 0;
+  if (top_down)
+    h = -h;
+  bool ok = header_size >= INFO_HEADER_SIZE AND planes == 1 AND
+            w > 0 AND w <= MAX_DIMENSION AND h > 0 AND h <= MAX_DIMENSION;
+  if (NOT ok) {
+    printf ("%s: not a correct BMP file\n", filename);
+    Pack_CloseFile (&file);
+    return false;
+  }
+  if (bpp != 24 OR compression != 0) {
+    printf ("%s: only uncompressed 24-bit BMP files are supported\n", filename);
+    Pack_CloseFile (&file);
+    return false;
+  }
+  if (data_pos < FILE_HEADER_SIZE + header_size)
+    data_pos = FILE_HEADER_SIZE + header_size;
+
+  // Each row is padded to a multiple of 4 bytes in the file - make sure they are all there
+  size_t row_size = (size_t)w * 3;
+  size_t stride   = (row_size + 3) & ~(size_t)3;
+  if (file.size < data_pos + stride * h) {
+    printf ("%s: file is too short for a %dx%d image\n", filename, w, h);
+    Pack_CloseFile (&file);
+    return false;
+  }
+
+  // Copy the rows without their padding, bottom row first (the order OpenGL wants)
+  *data = (unsigned char *) Mem_Alloc (MEM_TEXTURE, row_size * h);
+  if (*data == 0) {
+    Pack_CloseFile (&file);
+    return false;
+  }
+  for (int y=0; y<h; y++)
+    memcpy (*data + y * row_size, file.data + data_pos + (top_down ? h - 1 - y : y) * stride, row_size);
+  Pack_CloseFile (&file);
+
+  // Reorder the data from BGR to RGB (which OpenGL likes)
+  SwizzleBGR (*data, w * h);
+
+  *width = w;
+  *height = h;
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: SwizzleBGR
+|
+| Output: Swaps the 1st and 3rd byte of each 3-byte pixel, in place.
+|___________________________________________________________________*/
+
+void SwizzleBGR (unsigned char *pixels, int num_pixels)
+{
+  int n = 0;
+
+#ifdef CPU_X86
+  if (CPU_HasSSSE3()) {
+    n = num_pixels & ~15;
+    SwizzleBGR_SSSE3 (pixels, n);
+  }
+#endif
+
+  unsigned char tmp;
+  for (unsigned char *p = pixels + n * 3; n < num_pixels; n++, p += 3) {
+    tmp = p[0];
+    p[0] = p[2];
+    p[2] = tmp;
+  }
+}
+
+#ifdef CPU_X86
+/*____________________________________________________________________
+|
+| Function: SwizzleBGR_SSSE3
+|
+| Output: Swizzles num_pixels pixels (a multiple of 16), 16 pixels
+|   (3 x 16 bytes) at a time.  Two pixels straddle the 16-byte loads, so
+|   each output vector gathers bytes from its neighbours as well.  The
+|   loads and stores never overlap (overlapping them stalls on store
+|   forwarding and runs slower than the plain loop).
+|___________________________________________________________________*/
+
+TARGET_SSSE3
+static void SwizzleBGR_SSSE3 (unsigned char *pixels, int num_pixels)
+{
+  const char Z = -128;  // pshufb writes 0 for this index
+  const __m128i ma  = _mm_setr_epi8 (2,1,0, 5,4,3, 8,7,6, 11,10,9, 14,13,12, Z);
+  const __m128i mab = _mm_setr_epi8 (Z,Z,Z, Z,Z,Z, Z,Z,Z, Z,Z,Z, Z,Z,Z, 1);
+  const __m128i mba = _mm_setr_epi8 (Z,15,Z, Z,Z,Z, Z,Z,Z, Z,Z,Z, Z,Z,Z, Z);
+  const __m128i mb  = _mm_setr_epi8 (0,Z, 4,3,2, 7,6,5, 10,9,8, 13,12,11, Z,15);
+  const __m128i mbc = _mm_setr_epi8 (Z,Z,Z, Z,Z,Z, Z,Z,Z, Z,Z,Z, Z,Z, 0,Z);
+  const __m128i mcb = _mm_setr_epi8 (14,Z,Z, Z,Z,Z, Z,Z,Z, Z,Z,Z, Z,Z,Z, Z);
+  const __m128i mc  = _mm_setr_epi8 (Z, 3,2,1, 6,5,4, 9,8,7, 12,11,10, 15,14,13);
+
+  for (unsigned char *p = pixels, *end = pixels + num_pixels * 3; p < end; p += 48) {
+    __m128i a = _mm_loadu_si128 ((__m128i *)p);
+    __m128i b = _mm_loadu_si128 ((__m128i *)(p + 16));
+    __m128i c = _mm_loadu_si128 ((__m128i *)(p + 32));
+    _mm_storeu_si128 ((__m128i *)p,
+      _mm_or_si128 (_mm_shuffle_epi8 (a, ma), _mm_shuffle_epi8 (b, mab)));
+    _mm_storeu_si128 ((__m128i *)(p + 16),
+      _mm_or_si128 (_mm_or_si128 (_mm_shuffle_epi8 (a, mba), _mm_shuffle_epi8 (b, mb)), _mm_shuffle_epi8 (c, mbc)));
+    _mm_storeu_si128 ((__m128i *)(p + 32),
+      _mm_or_si128 (_mm_shuffle_epi8 (b, mcb), _mm_shuffle_epi8 (c, mc)));
+  }
+}
+#endif
+
+/*____________________________________________________________________
+|
+| Function: ReadU16, ReadU32
+|
+| Output: Reads a little endian value from a byte array.
+|___________________________________________________________________*/
+
+static unsigned ReadU16 (const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned ReadU32 (const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
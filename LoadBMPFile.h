@@ -0,0 +1,11 @@
+/*____________________________________________________________________
+|
+| File: LoadBMPFile.h
+|___________________________________________________________________*/
+
+// Loads an uncompressed 24-bit BMP file as tightly packed RGB rows, bottom row first
+// (the order OpenGL expects).  Caller should Mem_Free() the buffer when done using it.
+bool loadBMPfile (char *filename, int *width, int *height, unsigned char **data);
+
+// Swaps the 1st and 3rd byte of each 3-byte pixel (BGR <-> RGB) in place
+void SwizzleBGR (unsigned char *pixels, int num_pixels);
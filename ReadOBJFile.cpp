@@ -2,7 +2,19 @@
 |
 | File: ReadOBJFile.cpp
 |
-| Description: Function to read in 3D data from an OBJ file.  Assumes 
+| Description: Function to read in 3D data from an OBJ file (from an
+|   asset pack or from disk, see pack.h).  Each object is allocated as
+|   one block (see arena.h), and the temporary arrays used while
+|   reading come from a scratch arena kept by each thread, so loading a
+|   model makes almost no allocator calls (a block grown past 256 KB by
+|   a large model is freed afterwards, not kept).  Vertices are read straight
+|   into the object when there are no texcoords; with texcoords each
+|   distinct vertex/texcoord pair is found through a list per source
+|   vertex and the polys are renumbered in place.  The distinct
+|   vertices are kept in an array grown as they are found (doubling, so
+|   it is at most twice their number, never sized for the worst case of
+|   every poly vertex being distinct).
+|   Assumes 
 |   the OBJ file data was created for a RHS.  If data is in LHS then 
 |   uncomment the code that performs the conversion as follows:
 |     1) negate all Z coords
@@ -10,8 +22,11 @@
 |
 | Functions: ReadOBJFile
 |             strNumExists
+|             ReadLine
 |             Convert_Data
 |             Convert_Data_With_Texcoords
+|             GrowGxVertices
+|            NewObject
 |            FreeObject
 |___________________________________________________________________*/
 
@@ -29,6 +44,17 @@
 #include <string.h>
 #include "math3d.h"
 #include "ReadOBJFile.h"
+#include "memtrack.h"
+#include "arena.h"
+#include "pack.h"
+#include "trace.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define SCRATCH_KEEP_SIZE (256 << 10)   // a thread's scratch block bigger than this is freed after each file
 
 /*___________________
 |
@@ -44,26 +70,41 @@ struct SrcPoly {
   SrcPolyVertex vdata[3];   // a source poly is a triangle so it has 3 items of vertex data
 };
 
+// A distinct vertex of a model with texcoords (a source vertex and texcoord pair)
+struct GxVertex {
+  int v;      // index into source vertex array
+  int t;      // index into source texcoords array
+  int next;   // next distinct vertex made from the same source vertex, -1 = none
+};
+
+// Data read from the file (local to each call, so several files can be read at once on different threads)
+struct SrcData {
+  int num_vertices;           // # of vertices in the OBJ file
+  int num_texcoords;          // # of texture coords in the OBJ file (if any)
+  int num_polys;              // # of polys in OBJ file
+  Vector3D *vertices;         // array of vertices read from file
+  UVCoordinate *texcoords;    // array of texcoords read from file
+  SrcPoly *polys;             // array of polys read from file
+};
+
 /*___________________
 |
 | Function Prototypes
 |__________________*/
 
 static int strNumExists (char *str, char c);
-static void Convert_Data (Object3D *object, bool smooth_discontinuous_vertices);
-static void Convert_Data_With_Texcoords (Object3D *object, bool smooth_discontinuous_vertices);
+static bool ReadLine (char *line, int size, const unsigned char **next, const unsigned char *end);
+static void Convert_Data (SrcData *src, Object3D *object, bool smooth_discontinuous_vertices);
+static Object3D *Convert_Data_With_Texcoords (SrcData *src, Arena *scratch, bool smooth_discontinuous_vertices);
+static bool GrowGxVertices (GxVertex **gx, int *max_gx_vertices);
 
 /*___________________
 |
 | Global variables
 |__________________*/
 
-static int src_num_vertices;            // # of vertices in the OBJ file
-static int src_num_texcoords;           // # of texture coords in the OBJ file (if any)
-static int src_num_polys;               // # of polys in OBJ file  
-static Vector3D *src_vertices;        // array of vertices read from file
-static UVCoordinate *src_texcoords; // array of texcoords read from file
-static SrcPoly *src_polys;              // array of polys read from file
+// Temporary arrays for reading a file (one per thread, kept for the next file unless it's large)
+static thread_local ScopedArena scratch (MEM_LOADER);
 
 /*____________________________________________________________________
 |
@@ -78,8 +119,10 @@ void ReadOBJFile  (
   bool       load_texcoords,
   bool       smooth_discontinuous_vertices )
 {
-  FILE *fp;
+  PackFile file;
+  const unsigned char *next, *end;
   char line[500];
+  SrcData src;
   bool error = false; // set to true on any processing error
 
 /*____________________________________________________________________
@@ -90,23 +133,23 @@ void ReadOBJFile  (
   // Set object pointer to null in case of error reading file
   *object = 0;
 
-  fp = 0;
-  src_num_vertices = 0;
-  src_num_texcoords = 0;
-  src_num_polys = 0;
-  src_vertices = 0;
-  src_texcoords = 0;
-  src_polys = 0;
+  memset (&file, 0, sizeof(file));
+  src.num_vertices = 0;
+  src.num_texcoords = 0;
+  src.num_polys = 0;
+  src.vertices = 0;
+  src.texcoords = 0;
+  src.polys = 0;
 
 /*____________________________________________________________________
 |
 | Open the file
 |___________________________________________________________________*/
 
-  // Open the fil
-  fp = fopen(filename, "rt");
-  if (NOT fp)
+  // Open the file (it's read from memory, from its pack or mapped from disk)
+  if (NOT Pack_ReadFile(filename, &file))
     error = true;
+  end = file.data + file.size;
 
 /*____________________________________________________________________
 |
@@ -114,61 +157,75 @@ void ReadOBJFile  (
 |___________________________________________________________________*/
 
   if (NOT error) {
+    TraceScope trace("ReadOBJFile count pass");
     // Count # of vertices
-    while (NOT feof(fp)) {
-      line[0] = 0; // set first 2 characters in line array to 0
-      line[1] = 0;
-      fgets (line, 500, fp);      // try to read in a entire line from the file
+    next = file.data;
+    while (ReadLine (line, 500, &next, end)) {      // read in a entire line from the file
       // Is this line a vertex?
       if (line[0] == 'v' AND line[1] == ' ')
-        src_num_vertices++;
+        src.num_vertices++;
       // Is this line a texture coord?
       else if (line[0] == 'v' AND line[1] == 't')
-        src_num_texcoords++;
+        src.num_texcoords++;
       // Is this line a poly?
       else if (line[0] == 'f' AND line[1] == ' ')
-        src_num_polys++;
+        src.num_polys++;
     }
-    // Reset file pointer to start of the file
-    fseek (fp, 0, SEEK_SET);
 
 /*____________________________________________________________________
 |
 | Error checking - Is needed data available in the file?
 |___________________________________________________________________*/
 
-    if (src_num_vertices == 0)  // we require vertices
+    if (src.num_vertices == 0)  // we require vertices
       error = true;
-    if (src_num_polys == 0)     // we require polys
+    if (src.num_polys == 0)     // we require polys
       error = true;
     // Do we require texcoords?
     if (load_texcoords)
       // If so, then there should be some in the file
-      if (src_num_texcoords == 0)
+      if (src.num_texcoords == 0)
         error = true;
   }
 
 /*____________________________________________________________________
 |
-| Allocate temp arrays for source data
+| Allocate temp arrays for source data (and room for the source vertex
+| lists Convert_Data_With_Texcoords needs) in the scratch arena.
+| Without texcoords the vertices are read straight into the object.
 |___________________________________________________________________*/
     
   if (NOT error) {
-    // Allocate array of vertices
-    src_vertices = (Vector3D *) calloc (src_num_vertices, sizeof(Vector3D));
-    if (src_vertices == 0)
+    size_t size = ARENA_SIZE(src.num_polys * sizeof(SrcPoly));
+    if (load_texcoords)
+      size += ARENA_SIZE(src.num_vertices * sizeof(Vector3D)) +
+              ARENA_SIZE(src.num_texcoords * sizeof(UVCoordinate)) +
+              ARENA_SIZE(src.num_vertices * sizeof(int));
+    Arena_Reset (&scratch.arena);
+    if (NOT Arena_Reserve(&scratch.arena, size))
       error = true;
+    else if (NOT load_texcoords) {
+      *object = NewObject (src.num_vertices, src.num_polys, false);
+      if (*object == 0)
+        error = true;
+    }
+  }
+  if (NOT error) {
+    // Allocate array of vertices
+    if (load_texcoords)
+      src.vertices = (Vector3D *) Arena_Alloc (&scratch.arena, src.num_vertices * sizeof(Vector3D));
+    else
+      src.vertices = (*object)->vertex;
+    memset (src.vertices, 0, src.num_vertices * sizeof(Vector3D));
 
     // Allocate array of polys
-    src_polys = (SrcPoly *) calloc (src_num_polys, sizeof(SrcPoly));
-    if (src_polys == 0)
-      error = true;
+    src.polys = (SrcPoly *) Arena_Alloc (&scratch.arena, src.num_polys * sizeof(SrcPoly));
+    memset (src.polys, 0, src.num_polys * sizeof(SrcPoly));
 
     // Allocate array of texcoords, if needed
     if (load_texcoords) {
-      src_texcoords = (UVCoordinate *) calloc (src_num_texcoords, sizeof(UVCoordinate));
-      if (src_texcoords == 0)
-        error = true;
+      src.texcoords = (UVCoordinate *) Arena_Alloc (&scratch.arena, src.num_texcoords * sizeof(UVCoordinate));
+      memset (src.texcoords, 0, src.num_texcoords * sizeof(UVCoordinate));
     }
   }
 
@@ -178,25 +235,25 @@ void ReadOBJFile  (
 |___________________________________________________________________*/
 
   if (NOT error) {
+      TraceScope trace("ReadOBJFile parse pass");
       // Init indeces into arrays
       int v = 0, p = 0, t = 0;
       int tex0, tex1, tex2; 
       int vn0, vn1, vn2;
 
-      while (NOT feof(fp)) {
-        line[0] = 0; // set first 2 characters in line array to 0
-        line[1] = 0;
-        fgets (line, 500, fp);      // try to read in a entire line from the file
+      // Start again at the start of the file
+      next = file.data;
+      while (ReadLine (line, 500, &next, end)) {    // read in a entire line from the file
         // Is this line a vertex?
         if (line[0] == 'v' AND line[1] == ' ') {
-          sscanf_s (line, "v %f %f %f", &(src_vertices[v].x), &(src_vertices[v].y), &(src_vertices[v].z));
+          sscanf_s (line, "v %f %f %f", &(src.vertices[v].x), &(src.vertices[v].y), &(src.vertices[v].z));
           v++;
         }
         // Is this line a texture coord?
         else if (line[0] == 'v' AND line[1] == 't') {
           // Are we reading in texcoords?
           if (load_texcoords) {
-            sscanf_s (line, "vt %f %f", &(src_texcoords[t].u), &(src_texcoords[t].v));
+            sscanf_s (line, "vt %f %f", &(src.texcoords[t].u), &(src.texcoords[t].v));
             t++;
           }
         }
@@ -204,63 +261,65 @@ void ReadOBJFile  (
         else if (line[0] == 'f' AND line[1] == ' ') {
           // Select from 4 different formats
           if (strstr(line,"//")) {
-            sscanf_s (line, "f %d//%d %d//%d %d//%d", &(src_polys[p].vdata[0].v), &vn0,  
-                                                    &(src_polys[p].vdata[1].v), &vn1,
-                                                    &(src_polys[p].vdata[2].v), &vn2);
+            sscanf_s (line, "f %d//%d %d//%d %d//%d", &(src.polys[p].vdata[0].v), &vn0,  
+                                                    &(src.polys[p].vdata[1].v), &vn1,
+                                                    &(src.polys[p].vdata[2].v), &vn2);
           }
           else {
             switch (strNumExists(line, '/')) {
-              case 0: sscanf_s (line, "f %d %d %d", &(src_polys[p].vdata[0].v), 
-                                                  &(src_polys[p].vdata[1].v), 
-                                                  &(src_polys[p].vdata[2].v));
+              case 0: sscanf_s (line, "f %d %d %d", &(src.polys[p].vdata[0].v), 
+                                                  &(src.polys[p].vdata[1].v), 
+                                                  &(src.polys[p].vdata[2].v));
                       break;
-              case 3: sscanf_s (line, "f %d/%d %d/%d %d/%d", &(src_polys[p].vdata[0].v), &tex0,  
-                                                           &(src_polys[p].vdata[1].v), &tex1,
-                                                           &(src_polys[p].vdata[2].v), &tex2);
+              case 3: sscanf_s (line, "f %d/%d %d/%d %d/%d", &(src.polys[p].vdata[0].v), &tex0,  
+                                                           &(src.polys[p].vdata[1].v), &tex1,
+                                                           &(src.polys[p].vdata[2].v), &tex2);
                       if (load_texcoords) {
-                        src_polys[p].vdata[0].t = tex0;
-                        src_polys[p].vdata[1].t = tex1;
-                        src_polys[p].vdata[2].t = tex2;
+                        src.polys[p].vdata[0].t = tex0;
+                        src.polys[p].vdata[1].t = tex1;
+                        src.polys[p].vdata[2].t = tex2;
                       }
                       break;
-              case 6: sscanf_s (line, "f %d/%d/%d %d/%d/%d %d/%d/%d", &(src_polys[p].vdata[0].v), &tex0, &vn0,  
-                                                                    &(src_polys[p].vdata[1].v), &tex1, &vn1,
-                                                                    &(src_polys[p].vdata[2].v), &tex2, &vn2);
+              case 6: sscanf_s (line, "f %d/%d/%d %d/%d/%d %d/%d/%d", &(src.polys[p].vdata[0].v), &tex0, &vn0,  
+                                                                    &(src.polys[p].vdata[1].v), &tex1, &vn1,
+                                                                    &(src.polys[p].vdata[2].v), &tex2, &vn2);
                       if (load_texcoords) {
-                        src_polys[p].vdata[0].t = tex0;
-                        src_polys[p].vdata[1].t = tex1;
-                        src_polys[p].vdata[2].t = tex2;
+                        src.polys[p].vdata[0].t = tex0;
+                        src.polys[p].vdata[1].t = tex1;
+                        src.polys[p].vdata[2].t = tex2;
                       }
                       break;
             }
           }
           // Subtract one from all indeces read from the file since they are +1
-          src_polys[p].vdata[0].v--;
-          src_polys[p].vdata[1].v--;
-          src_polys[p].vdata[2].v--;
+          src.polys[p].vdata[0].v--;
+          src.polys[p].vdata[1].v--;
+          src.polys[p].vdata[2].v--;
           if (load_texcoords) {
-            src_polys[p].vdata[0].t--;
-            src_polys[p].vdata[1].t--;
-            src_polys[p].vdata[2].t--;
+            src.polys[p].vdata[0].t--;
+            src.polys[p].vdata[1].t--;
+            src.polys[p].vdata[2].t--;
           }
           p++;
         }
      }
   }
 
+  // The file isn't needed anymore, so release it before building the object
+  Pack_CloseFile (&file);
+
 /*____________________________________________________________________
 |
 |  Convert the data read from the file into Object3D format
 |___________________________________________________________________*/
 
-  // Create an empty object
-  *object = (Object3D *)calloc(1,sizeof(Object3D));
-
-  // Add data to the object
-  if  (load_texcoords)
-    Convert_Data_With_Texcoords (*object,smooth_discontinuous_vertices);
-  else
-    Convert_Data (*object,smooth_discontinuous_vertices);
+  // Add the data to the object (creating it, with texcoords)
+  if (NOT error) {
+    if (load_texcoords)
+      *object = Convert_Data_With_Texcoords (&src,&scratch.arena,smooth_discontinuous_vertices);
+    else
+      Convert_Data (&src,*object,smooth_discontinuous_vertices);
+  }
 
   /*____________________________________________________________________
   |
@@ -287,16 +346,12 @@ void ReadOBJFile  (
 | Free resources 
 |___________________________________________________________________*/
 
-  // Free temp memory
-  if (src_vertices)
-    free (src_vertices);
-  if (src_texcoords)
-    free (src_texcoords);
-  if (src_polys)
-    free (src_polys);
-  // Close the file
-  if (fp)
-    fclose (fp);
+  // Free temp memory (the scratch arena's block is kept for the next file, unless a large file
+  //  grew it: then every thread that loaded one would hold on to that much)
+  if (scratch.arena.size > SCRATCH_KEEP_SIZE)
+    Arena_Free (&scratch.arena);
+  else
+    Arena_Reset (&scratch.arena);
 }
 
 /*____________________________________________________________________
@@ -319,47 +374,57 @@ static int strNumExists (char *str, char c)
 
 /*____________________________________________________________________
 |
-| Function: Convert_Data
+| Function: ReadLine
 |
 | Input: Called from ReadOBJFile()
-| Output: Adds data to the Object3D.
+| Output: Copies the next line of the file data into line, like fgets()
+|   (keeping the newline, and splitting lines longer than size-1).
+|   Returns false at the end of the data.
 |___________________________________________________________________*/
 
-static void Convert_Data (Object3D *object, bool smooth_discontinuous_vertices)
+static bool ReadLine (char *line, int size, const unsigned char **next, const unsigned char *end)
 {
-  int i, j;
+  const unsigned char *p = *next;
+  int n = 0;
+
+  if (p >= end)
+    return false;
+  while (p < end AND n < size - 1) {
+    line[n++] = *p;
+    if (*p++ == '\n')
+      break;
+  }
+  line[n] = 0;
+  // Keep the first 2 characters valid for the tests on them
+  if (n < 2)
+    line[1] = 0;
+  *next = p;
+  return true;
+}
 
 /*____________________________________________________________________
 |
-| Init variables in the object
-|___________________________________________________________________*/
-
-  object->num_vertices = src_num_vertices;
-  object->num_polygons = src_num_polys;
-
-/*____________________________________________________________________
+| Function: Convert_Data
 |
-| Allocate memory in the object layer
+| Input: Called from ReadOBJFile()
+| Output: Adds data to the Object3D (whose vertices were read into it
+|   directly).
 |___________________________________________________________________*/
-  
-  object->vertex         = (Vector3D *) malloc (object->num_vertices * sizeof(Vector3D));
-  object->vertex_normal  = (Vector3D *) malloc (object->num_vertices * sizeof(Vector3D));
-  object->polygon        = (Polygon3D*) malloc (object->num_polygons * sizeof(Polygon3D));
-  object->polygon_normal = (Vector3D *) malloc (object->num_polygons * sizeof(Vector3D));
+
+static void Convert_Data (SrcData *src, Object3D *object, bool smooth_discontinuous_vertices)
+{
+  int i, j;
+  TraceScope trace("Convert_Data");
 
 /*____________________________________________________________________
 |
 | Copy data
 |___________________________________________________________________*/
 
-  // Copy vertex data
-  for (i=0; i<src_num_vertices; i++) 
-    object->vertex[i] = src_vertices[i];
-
   // Copy polygon data
-  for (i=0; i<src_num_polys; i++) 
+  for (i=0; i<src->num_polys; i++) 
     for (j=0; j<3; j++)
-      object->polygon[i].index[j] = src_polys[i].vdata[j].v;
+      object->polygon[i].index[j] = src->polys[i].vdata[j].v;
 
 /*____________________________________________________________________
 |
@@ -367,7 +432,7 @@ static void Convert_Data (Object3D *object, bool smooth_discontinuous_vertices)
 |___________________________________________________________________*/
 
   // Calculate polygon normals
-  for (i=0; i<src_num_polys; i++) 
+  for (i=0; i<src->num_polys; i++) 
     SurfaceNormal (&(object->vertex[object->polygon[i].index[0]]),
                    &(object->vertex[object->polygon[i].index[1]]),
                    &(object->vertex[object->polygon[i].index[2]]),
@@ -382,95 +447,90 @@ static void Convert_Data (Object3D *object, bool smooth_discontinuous_vertices)
 | Function: Convert_Data_With_Texcoords
 |
 | Input: Called from ReadOBJFile()
-| Output: Adds data to the Object3D.
+| Output: Returns a new Object3D made from the data (0 if out of
+|   memory or if it has too many distinct vertices).  The polys are
+|   renumbered in place to index the distinct vertices.  The source
+|   vertex lists come from the scratch arena (sized for them by
+|   ReadOBJFile()), the distinct vertices from an array grown as needed.
 |___________________________________________________________________*/
 
-static void Convert_Data_With_Texcoords (Object3D *object, bool smooth_discontinuous_vertices)
+static Object3D *Convert_Data_With_Texcoords (SrcData *src, Arena *scratch, bool smooth_discontinuous_vertices)
 {
-   int i, j, k, max_gx_vertices, num_gx_vertices;
-   bool found;
-   Vector3D *tmp_gx_vertices = 0;
-   UVCoordinate *tmp_gx_texcoords = 0;
-   SrcPolyVertex *tmp_gx_vertices_sig = 0; // a vertex signature is the combination of vertex index and texcoord index
-
-/*____________________________________________________________________
-|
-| Init variables in the object
-|___________________________________________________________________*/
-
-  //object->has_texcoords = load_texcoords;
-  object->num_polygons = src_num_polys;
-
-/*____________________________________________________________________
-|
-| Allocate memory in the object layer
-|___________________________________________________________________*/
-  
-  object->polygon        = (Polygon3D*) malloc (object->num_polygons * sizeof(Polygon3D));
-  object->polygon_normal = (Vector3D *) malloc (object->num_polygons * sizeof(Vector3D));
+   int i, j, k, num_gx_vertices, max_gx_vertices;
+   int *first;        // for each source vertex, the last distinct vertex made from it (-1 = none)
+   GxVertex *gx;      // the distinct vertices, in the order they're found
+   TraceScope trace("Convert_Data_With_Texcoords");
 
 /*____________________________________________________________________
 |
-|  Allocate temp array of vertices (not sure yet how many distinct
-|  vertices are in the model)
+|  Allocate temp arrays (the distinct vertices start with room for one
+|  per source vertex, and grow if seams split more of them)
 |___________________________________________________________________*/
 
-  // Calculate the max number of distinct vertices in this model
-  max_gx_vertices = src_num_polys * 3;
-  // Allocate memory for a temp array of vertices
-  tmp_gx_vertices = (Vector3D *) calloc (max_gx_vertices, sizeof(Vector3D));
-  // Allocate memory for a temp array of texcoords
-  tmp_gx_texcoords = (UVCoordinate *) calloc (max_gx_vertices, sizeof(UVCoordinate));
-  // Allocate an equal size temp array of vertex 'signatures'
-  tmp_gx_vertices_sig = (SrcPolyVertex *) calloc (max_gx_vertices, sizeof(SrcPolyVertex *));
+  first = (int *) Arena_Alloc (scratch, src->num_vertices * sizeof(int));
+  memset (first, 0xff, src->num_vertices * sizeof(int));
+  max_gx_vertices = src->num_vertices > 64 ? src->num_vertices : 64;
+  gx = (GxVertex *) Mem_Alloc (MEM_LOADER, max_gx_vertices * sizeof(GxVertex));
+  if (gx == 0)
+    return 0;
 
 /*____________________________________________________________________
 |
-|  Build temp arrays of vertices and texcoords
+|  Find the distinct vertices (each a combination of a vertex index and
+|  a texcoord index), pointing the polys at them
 |___________________________________________________________________*/
 
   num_gx_vertices = 0;  // no distinct vertices identified so far
   // Look at each poly
-  for (i=0; i<src_num_polys; i++) {
+  for (i=0; i<src->num_polys; i++) {
     // Look at the 3 vertices that make up this poly
     for (j=0; j<3; j++) {
-      // See if this vertex has been identified already
-      found = false;
-      for (k=0; k<num_gx_vertices; k++) 
-        if (memcmp((void*)&(src_polys[i].vdata[j]), (void*)&(tmp_gx_vertices_sig[k]), sizeof(SrcPolyVertex)) == 0) {
-          found = true;
+      SrcPolyVertex *vdata = &(src->polys[i].vdata[j]);
+      // See if this vertex has been identified already (among those with the same source vertex)
+      for (k=first[vdata->v]; k != -1; k=gx[k].next)
+        if (gx[k].t == vdata->t)
           break;
+      // If not, create a new gx vertex
+      if (k == -1) {
+        if (num_gx_vertices == max_gx_vertices AND NOT GrowGxVertices(&gx, &max_gx_vertices)) {
+          Mem_Free (gx);
+          return 0;
         }
-      // If found, just instance it - this is not a newly identified distinct vertex
-      if (found)
-        object->polygon[i].index[j] = k;
-      // Otherwise, create a new gx vertex
-      else {
-        // Trying to create too much?  (should never happen)
-        if (num_gx_vertices == max_gx_vertices)
-          exit(0);
-        else  {
-          tmp_gx_vertices    [num_gx_vertices] = src_vertices [src_polys[i].vdata[j].v];
-          tmp_gx_texcoords   [num_gx_vertices] = src_texcoords[src_polys[i].vdata[j].t];
-          tmp_gx_vertices_sig[num_gx_vertices] = src_polys[i].vdata[j];
-          object->polygon[i].index[j] = num_gx_vertices;
-          num_gx_vertices++;
-        }
+        k = num_gx_vertices++;
+        gx[k].v    = vdata->v;
+        gx[k].t    = vdata->t;
+        gx[k].next = first[vdata->v];
+        first[vdata->v] = k;
       }
+      // The poly now refers to the gx vertex
+      vdata->v = k;
     }
   }
+  // Polygon3D indices are 16 bits
+  if (num_gx_vertices > 0x10000) {
+    printf ("OBJ file has %d distinct vertices (max is %d)\n", num_gx_vertices, 0x10000);
+    Mem_Free (gx);
+    return 0;
+  }
 
 /*____________________________________________________________________
 |
-| Copy the temp data into the object layer
+| Copy the data into the object layer
 |___________________________________________________________________*/
   
-  object->num_vertices  = num_gx_vertices;
-  object->vertex        = (Vector3D *)     malloc (num_gx_vertices * sizeof(Vector3D));
-  object->vertex_normal = (Vector3D *)     malloc (num_gx_vertices * sizeof(Vector3D));
-  object->tex_coords    = (UVCoordinate *) malloc (num_gx_vertices * sizeof(UVCoordinate));
-  memcpy ((void *)(object->vertex),     (void *)tmp_gx_vertices,  num_gx_vertices * sizeof(Vector3D));
-  memcpy ((void *)(object->tex_coords), (void *)tmp_gx_texcoords, num_gx_vertices * sizeof(UVCoordinate));
+  Object3D *object = NewObject (num_gx_vertices, src->num_polys, true);
+  if (object == 0) {
+    Mem_Free (gx);
+    return 0;
+  }
+  for (k=0; k<num_gx_vertices; k++) {
+    object->vertex    [k] = src->vertices [gx[k].v];
+    object->tex_coords[k] = src->texcoords[gx[k].t];
+  }
+  Mem_Free (gx);
+  for (i=0; i<src->num_polys; i++)
+    for (j=0; j<3; j++)
+      object->polygon[i].index[j] = src->polys[i].vdata[j].v;
 
 /*____________________________________________________________________
 |
@@ -478,7 +538,7 @@ static void Convert_Data_With_Texcoords (Object3D *object, bool smooth_discontin
 |___________________________________________________________________*/
 
   // Calculate polygon normals
-  for (i=0; i<src_num_polys; i++) 
+  for (i=0; i<src->num_polys; i++) 
     SurfaceNormal (&(object->vertex[object->polygon[i].index[0]]),
                    &(object->vertex[object->polygon[i].index[1]]),
                    &(object->vertex[object->polygon[i].index[2]]),
@@ -486,18 +546,67 @@ static void Convert_Data_With_Texcoords (Object3D *object, bool smooth_discontin
   
   // Calculate vertex normals
   ComputeVertexNormals (object,smooth_discontinuous_vertices);
+  return object;
+}
+
+/*____________________________________________________________________
+|
+| Function: GrowGxVertices
+|
+| Input: Called from Convert_Data_With_Texcoords()
+| Output: Doubles the room in the distinct vertex array.  Returns false
+|   if out of memory (the array is left as it was).
+|___________________________________________________________________*/
+
+static bool GrowGxVertices (GxVertex **gx, int *max_gx_vertices)
+{
+  GxVertex *bigger = (GxVertex *) Mem_Alloc (MEM_LOADER, 2 * (size_t)*max_gx_vertices * sizeof(GxVertex));
+
+  if (bigger == 0)
+    return false;
+  memcpy (bigger, *gx, *max_gx_vertices * sizeof(GxVertex));
+  Mem_Free (*gx);
+  *gx = bigger;
+  *max_gx_vertices *= 2;
+  return true;
+}
 
 /*____________________________________________________________________
 |
-| Free resources
+| Function: NewObject
+|
+| Output: Returns a new Object3D with its arrays carved out of the same
+|   block as it (aligned to ARENA_ALIGNMENT), or 0 if out of memory.
+|   The arrays aren't initialized.
 |___________________________________________________________________*/
 
-  if (tmp_gx_vertices)
-    free (tmp_gx_vertices);
-  if (tmp_gx_texcoords)
-    free (tmp_gx_texcoords);
-  if (tmp_gx_vertices_sig)
-    free (tmp_gx_vertices_sig);
+Object3D *NewObject (int num_vertices, int num_polygons, bool texcoords)
+{
+  Arena arena;
+
+  size_t size = ARENA_SIZE(sizeof(Object3D)) +
+                2 * ARENA_SIZE(num_vertices * sizeof(Vector3D)) +
+                ARENA_SIZE(num_polygons * sizeof(Polygon3D)) +
+                ARENA_SIZE(num_polygons * sizeof(Vector3D));
+  if (texcoords)
+    size += ARENA_SIZE(num_vertices * sizeof(UVCoordinate));
+  if (NOT Arena_Init(&arena, size, MEM_MESH))
+    return 0;
+
+  Object3D *object = (Object3D *) Arena_Alloc (&arena, sizeof(Object3D));
+  object->num_vertices   = num_vertices;
+  object->num_polygons   = num_polygons;
+  object->vertex         = (Vector3D *)  Arena_Alloc (&arena, num_vertices * sizeof(Vector3D));
+  object->vertex_normal  = (Vector3D *)  Arena_Alloc (&arena, num_vertices * sizeof(Vector3D));
+  object->tex_coords     = texcoords ? (UVCoordinate *) Arena_Alloc (&arena, num_vertices * sizeof(UVCoordinate)) : 0;
+  object->polygon        = (Polygon3D *) Arena_Alloc (&arena, num_polygons * sizeof(Polygon3D));
+  object->polygon_normal = (Vector3D *)  Arena_Alloc (&arena, num_polygons * sizeof(Vector3D));
+  object->arena          = arena.base;
+  object->meshlets       = 0;
+  object->num_meshlets   = 0;
+  object->bvh            = 0;
+  object->morph          = 0;
+  return object;
 }
 
 /*____________________________________________________________________
@@ -509,7 +618,17 @@ static void Convert_Data_With_Texcoords (Object3D *object, bool smooth_discontin
 
 void FreeObject (Object3D *object)
 {
-  if (object) {
+  // Meshlets, the BVH and morph targets are allocated on their own
+  if (object AND object->meshlets)
+    Mem_Free (object->meshlets);
+  if (object AND object->bvh)
+    Mem_Free (object->bvh);
+  if (object AND object->morph)
+    Mem_Free (object->morph);
+  // One block holds it all?
+  if (object AND object->arena)
+    Arena_FreeBlock (object->arena);
+  else if (object) {
     if (object->vertex)
       free (object->vertex);
     if (object->vertex_normal)
@@ -10,5 +10,8 @@ void ReadOBJFile  (
   bool       load_texcoords,
   bool       smooth_discontinuous_vertices );
 
+// Creates an Object3D with room for its arrays (left uninitialized), all in one block
+//  (tex_coords is 0 unless texcoords is set).  Returns 0 if out of memory
+Object3D *NewObject(int num_vertices, int num_polygons, bool texcoords);
 // Frees all data in a Object3D
 void FreeObject(Object3D *object);
@@ -0,0 +1,297 @@
+/*____________________________________________________________________
+|
+| File: adjacency.cpp
+|
+| Description: Mesh connectivity.  Vertices are numbered by position
+|   with an open addressing hash of their bits (so equal means what
+|   memcmp() says, as ComputeVertexNormals always has), then the
+|   polygons around each vertex and position are counted and filled in
+|   compressed rows: a count pass, a running sum to the end of each row
+|   and a fill pass backwards (so each row ends up in polygon order and
+|   its end has moved back to its start).  A polygon that meets a
+|   vertex or position at more than one corner is listed once.  Each
+|   half-edge a->b finds its twin among the polygons around b, so the
+|   whole build is linear in the size of the mesh for bounded valence.
+|   An edge shared by more than two polygons pairs the first two that
+|   run opposite ways; the rest are left without a twin.
+|
+| Functions: Adjacency_Build
+|            Adjacency_Free
+|            Adjacency_VertexPolygons
+|            Adjacency_PositionPolygons
+|            Adjacency_EdgePolygon
+|            Adjacency_OneRing
+|            NumberPositions
+|            HashPosition
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "math3d.h"
+#include "memtrack.h"
+#include "arena.h"
+#include "trace.h"
+#include "adjacency.h"
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static bool NumberPositions (Object3D *object, int *position, int *num_positions);
+static unsigned HashPosition (Vector3D *v);
+
+/*____________________________________________________________________
+|
+| Function: Adjacency_Build
+|
+| Output: Builds an object's adjacency in one block counted against
+|   tag.  Returns false if out of memory.
+|___________________________________________________________________*/
+
+bool Adjacency_Build (Object3D *object, Adjacency *adj, MemTag tag)
+{
+  Arena arena;
+  int i, j, k;
+  int nv = object->num_vertices, np = object->num_polygons;
+
+  TraceScope trace("Adjacency_Build");
+
+  memset (adj, 0, sizeof(Adjacency));
+  adj->object = object;
+
+  size_t size = ARENA_SIZE(nv * sizeof(int)) +
+                2 * ARENA_SIZE((nv + 1) * sizeof(int)) +
+                3 * ARENA_SIZE(np * 3 * sizeof(int));
+  if (NOT Arena_Init(&arena, size, tag))
+    return false;
+  adj->block             = arena.base;
+  adj->bytes             = arena.size;
+  adj->position          = (int *) Arena_Alloc (&arena, nv * sizeof(int));
+  adj->vertex_first      = (int *) Arena_Alloc (&arena, (nv + 1) * sizeof(int));
+  adj->position_first    = (int *) Arena_Alloc (&arena, (nv + 1) * sizeof(int));
+  adj->vertex_polygons   = (int *) Arena_Alloc (&arena, np * 3 * sizeof(int));
+  adj->position_polygons = (int *) Arena_Alloc (&arena, np * 3 * sizeof(int));
+  adj->twin              = (int *) Arena_Alloc (&arena, np * 3 * sizeof(int));
+
+  if (NOT NumberPositions(object, adj->position, &adj->num_positions)) {
+    Adjacency_Free (adj);
+    return false;
+  }
+  int *position = adj->position;
+
+  // Count the polygons around each vertex and position, and sum to the end of each row
+  memset (adj->vertex_first, 0, (nv + 1) * sizeof(int));
+  memset (adj->position_first, 0, (adj->num_positions + 1) * sizeof(int));
+  for (i=0; i<np; i++) {
+    unsigned short *index = object->polygon[i].index;
+    for (j=0; j<3; j++) {
+      if ((j < 1 OR index[j] != index[0]) AND (j < 2 OR index[j] != index[1]))
+        adj->vertex_first[index[j]]++;
+      int p = position[index[j]];
+      if ((j < 1 OR p != position[index[0]]) AND (j < 2 OR p != position[index[1]]))
+        adj->position_first[p]++;
+    }
+  }
+  for (k=1; k<=nv; k++)
+    adj->vertex_first[k] += adj->vertex_first[k-1];
+  for (k=1; k<=adj->num_positions; k++)
+    adj->position_first[k] += adj->position_first[k-1];
+
+  // Fill each row from its end
+  for (i=np-1; i>=0; i--) {
+    unsigned short *index = object->polygon[i].index;
+    for (j=0; j<3; j++) {
+      if ((j < 1 OR index[j] != index[0]) AND (j < 2 OR index[j] != index[1]))
+        adj->vertex_polygons[--adj->vertex_first[index[j]]] = i;
+      int p = position[index[j]];
+      if ((j < 1 OR p != position[index[0]]) AND (j < 2 OR p != position[index[1]]))
+        adj->position_polygons[--adj->position_first[p]] = i;
+    }
+  }
+
+  // Pair each half-edge a->b with one b->a around b
+  for (i=0; i<np*3; i++)
+    adj->twin[i] = -1;
+  adj->boundary_edges = 0;
+  for (int e=0; e<np*3; e++) {
+    if (adj->twin[e] >= 0)
+      continue;
+    int a = position[object->polygon[e / 3].index[e % 3]];
+    int b = position[object->polygon[e / 3].index[ADJ_NEXT(e) % 3]];
+    for (k=adj->position_first[b]; k<adj->position_first[b+1] AND adj->twin[e] < 0; k++) {
+      int poly = adj->position_polygons[k];
+      for (j=0; j<3; j++) {
+        int f = ADJ_HALF_EDGE(poly, j);
+        if (f != e AND adj->twin[f] < 0 AND
+            position[object->polygon[poly].index[j]] == b AND
+            position[object->polygon[poly].index[ADJ_NEXT(f) % 3]] == a) {
+          adj->twin[e] = f;
+          adj->twin[f] = e;
+          break;
+        }
+      }
+    }
+  }
+  for (i=0; i<np*3; i++)
+    if (adj->twin[i] < 0)
+      adj->boundary_edges++;
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Adjacency_Free
+|
+| Output: Frees an adjacency's arrays.
+|___________________________________________________________________*/
+
+void Adjacency_Free (Adjacency *adj)
+{
+  if (adj->block)
+    Arena_FreeBlock (adj->block);
+  memset (adj, 0, sizeof(Adjacency));
+}
+
+/*____________________________________________________________________
+|
+| Function: Adjacency_VertexPolygons
+|
+| Output: Points polygons at the polygons around a vertex.  Returns the
+|   # of them.
+|___________________________________________________________________*/
+
+int Adjacency_VertexPolygons (Adjacency *adj, int vertex, int **polygons)
+{
+  *polygons = adj->vertex_polygons + adj->vertex_first[vertex];
+  return adj->vertex_first[vertex+1] - adj->vertex_first[vertex];
+}
+
+/*____________________________________________________________________
+|
+| Function: Adjacency_PositionPolygons
+|
+| Output: Points polygons at the polygons around a position.  Returns
+|   the # of them.
+|___________________________________________________________________*/
+
+int Adjacency_PositionPolygons (Adjacency *adj, int position, int **polygons)
+{
+  *polygons = adj->position_polygons + adj->position_first[position];
+  return adj->position_first[position+1] - adj->position_first[position];
+}
+
+/*____________________________________________________________________
+|
+| Function: Adjacency_EdgePolygon
+|
+| Output: Returns the polygon across a polygon's edge from corner edge
+|   to the next, or -1 if there isn't one.
+|___________________________________________________________________*/
+
+int Adjacency_EdgePolygon (Adjacency *adj, int polygon, int edge)
+{
+  int twin = adj->twin[ADJ_HALF_EDGE(polygon, edge)];
+  return twin < 0 ? -1 : twin / 3;
+}
+
+/*____________________________________________________________________
+|
+| Function: Adjacency_OneRing
+|
+| Output: Gets the positions that share an edge with a position (each
+|   once, up to max of them).  Returns the # of them.
+|___________________________________________________________________*/
+
+int Adjacency_OneRing (Adjacency *adj, int position, int *ring, int max)
+{
+  int i, j, k, n = 0;
+  int *polygons;
+
+  int count = Adjacency_PositionPolygons (adj, position, &polygons);
+  for (i=0; i<count; i++)
+    for (j=0; j<3; j++) {
+      int p = adj->position[adj->object->polygon[polygons[i]].index[j]];
+      if (p == position)
+        continue;
+      // Valence is small, so a scan beats a set
+      for (k=0; k<n AND k<max; k++)
+        if (ring[k] == p)
+          break;
+      if (k < n AND k < max)
+        continue;
+      if (n < max)
+        ring[n] = p;
+      n++;
+    }
+  return n;
+}
+
+/*____________________________________________________________________
+|
+| Function: NumberPositions
+|
+| Output: Numbers an object's distinct vertex positions in order of
+|   first use and sets each vertex's.  Returns false if out of memory.
+|___________________________________________________________________*/
+
+static bool NumberPositions (Object3D *object, int *position, int *num_positions)
+{
+  int i, n = 0;
+
+  // Keep the table at most half full
+  unsigned size = 16;
+  while (size < (unsigned)object->num_vertices * 2)
+    size *= 2;
+  int *table = (int *) Mem_Alloc (MEM_LOADER, size * sizeof(int));
+  if (table == 0)
+    return false;
+  memset (table, -1, size * sizeof(int));
+
+  for (i=0; i<object->num_vertices; i++) {
+    Vector3D *v = &object->vertex[i];
+    unsigned slot = HashPosition (v) & (size - 1);
+    while (table[slot] >= 0 AND memcmp(&object->vertex[table[slot]], v, sizeof(Vector3D)))
+      slot = (slot + 1) & (size - 1);
+    if (table[slot] < 0) {
+      table[slot] = i;
+      position[i] = n++;
+    }
+    else
+      position[i] = position[table[slot]];
+  }
+
+  Mem_Free (table);
+  *num_positions = n;
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: HashPosition
+|
+| Output: Returns a hash of a position's bits.
+|___________________________________________________________________*/
+
+static unsigned HashPosition (Vector3D *v)
+{
+  unsigned h[3];
+
+  memcpy (h, v, sizeof(h));
+  unsigned x = h[0] * 73856093u ^ h[1] * 19349663u ^ h[2] * 83492791u;
+  // Mix the high bits down (the table uses the low ones)
+  x ^= x >> 16;
+  x *= 0x45d9f3bu;
+  x ^= x >> 16;
+  return x;
+}
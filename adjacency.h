@@ -0,0 +1,41 @@
+/*____________________________________________________________________
+|
+| File: adjacency.h
+|
+| Mesh connectivity built in linear time from an object's polygons:
+| the polygons around each vertex and around each position (vertices
+| at the same point, such as either side of a texcoord seam), and the
+| half-edge across each polygon edge.  Half-edge e is polygon e/3's
+| edge from corner e%3 to the next corner.  Include after memtrack.h.
+|___________________________________________________________________*/
+
+// The half-edges of a polygon's edges and the next one around it
+#define ADJ_HALF_EDGE(_polygon_,_corner_) ((_polygon_) * 3 + (_corner_))
+#define ADJ_NEXT(_e_)                     ((_e_) % 3 == 2 ? (_e_) - 2 : (_e_) + 1)
+
+struct Adjacency {
+  Object3D *object;
+  int   num_positions;
+  int  *position;           // position of each vertex (num_vertices)
+  int  *vertex_first;       // polygons around vertex v are vertex_polygons[vertex_first[v]] to
+  int  *vertex_polygons;    //  [vertex_first[v+1]-1], in order (each once)
+  int  *position_first;     // the same for position p
+  int  *position_polygons;
+  int  *twin;               // opposite half-edge of each half-edge (3 per polygon), -1 = none
+  int   boundary_edges;     // # of half-edges with no twin
+  void *block;              // one block holding the arrays
+  size_t bytes;             // its size
+};
+
+// Builds an object's adjacency (its arrays counted against tag).  Returns false if out of memory
+bool Adjacency_Build (Object3D *object, Adjacency *adj, MemTag tag);
+// Frees it
+void Adjacency_Free (Adjacency *adj);
+// Gets the polygons around a vertex or a position.  Returns the # of them
+int  Adjacency_VertexPolygons (Adjacency *adj, int vertex, int **polygons);
+int  Adjacency_PositionPolygons (Adjacency *adj, int position, int **polygons);
+// Returns the polygon across one of a polygon's edges (from corner edge to the next), or -1
+int  Adjacency_EdgePolygon (Adjacency *adj, int polygon, int edge);
+// Gets the positions joined to a position by an edge (up to max of them).  Returns the # of
+//  them, which may be more than max
+int  Adjacency_OneRing (Adjacency *adj, int position, int *ring, int max);
@@ -0,0 +1,141 @@
+/*____________________________________________________________________
+|
+| File: arena.cpp
+|
+| Description: Arena allocator.  An arena is one block from the heap;
+|   allocating from it just rounds the size up to ARENA_ALIGNMENT and
+|   bumps an offset, and everything in it is freed at once, by freeing
+|   the block or by resetting the arena to use the block again.  Blocks
+|   come from Mem_Alloc(), which aligns them to ARENA_ALIGNMENT (malloc
+|   only guarantees 8 bytes on 32-bit Windows) and counts them against
+|   the arena's tag.
+|
+| Functions: Arena_AllocBlock
+|            Arena_FreeBlock
+|            Arena_Init
+|            Arena_Reserve
+|            Arena_Alloc
+|            Arena_Reset
+|            Arena_Free
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "math3d.h"
+#include "memtrack.h"
+#include "arena.h"
+
+/*____________________________________________________________________
+|
+| Function: Arena_AllocBlock
+|
+| Output: Returns a block of size bytes aligned to ARENA_ALIGNMENT
+|   (counted against tag), or 0 if out of memory.
+|___________________________________________________________________*/
+
+void *Arena_AllocBlock (size_t size, MemTag tag)
+{
+  return Mem_Alloc (tag, ARENA_SIZE (size ? size : 1));
+}
+
+/*____________________________________________________________________
+|
+| Function: Arena_FreeBlock
+|
+| Output: Frees a block from Arena_AllocBlock().
+|___________________________________________________________________*/
+
+void Arena_FreeBlock (void *block)
+{
+  Mem_Free (block);
+}
+
+/*____________________________________________________________________
+|
+| Function: Arena_Init
+|
+| Output: Creates an arena with a block of size bytes, counted against
+|   tag.  Returns true on success.
+|___________________________________________________________________*/
+
+bool Arena_Init (Arena *arena, size_t size, MemTag tag)
+{
+  arena->base = (unsigned char *) Arena_AllocBlock (size, tag);
+  arena->size = arena->base ? ARENA_SIZE(size) : 0;
+  arena->used = 0;
+  arena->tag  = tag;
+  return arena->base != 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Arena_Reserve
+|
+| Output: Makes sure an arena with nothing allocated from it holds at
+|   least size bytes.  Returns true on success.
+|___________________________________________________________________*/
+
+bool Arena_Reserve (Arena *arena, size_t size)
+{
+  if (arena->base AND arena->size >= size)
+    return true;
+  Arena_Free (arena);
+  return Arena_Init (arena, size, arena->tag);
+}
+
+/*____________________________________________________________________
+|
+| Function: Arena_Alloc
+|
+| Output: Returns size bytes from an arena, aligned to ARENA_ALIGNMENT,
+|   or 0 if there isn't room.
+|___________________________________________________________________*/
+
+void *Arena_Alloc (Arena *arena, size_t size)
+{
+  size = ARENA_SIZE (size);
+  if (size > arena->size - arena->used)
+    return 0;
+  void *p = arena->base + arena->used;
+  arena->used += size;
+  return p;
+}
+
+/*____________________________________________________________________
+|
+| Function: Arena_Reset
+|
+| Output: Frees everything allocated from an arena, keeping its block
+|   for the next allocations.
+|___________________________________________________________________*/
+
+void Arena_Reset (Arena *arena)
+{
+  arena->used = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Arena_Free
+|
+| Output: Frees an arena's block.
+|___________________________________________________________________*/
+
+void Arena_Free (Arena *arena)
+{
+  if (arena->base)
+    Arena_FreeBlock (arena->base);
+  arena->base = 0;
+  arena->size = 0;
+  arena->used = 0;
+}
@@ -0,0 +1,44 @@
+/*____________________________________________________________________
+|
+| File: arena.h
+|
+| Arena (bump) allocation: one block, carved into aligned pieces and
+| freed all at once.  Include after memtrack.h (blocks are counted
+| against a tag).
+|___________________________________________________________________*/
+
+#define ARENA_ALIGNMENT MEM_ALIGNMENT   // every allocation starts on a multiple of this (SSE loads)
+
+// Size of an allocation of n bytes in an arena, padding included
+#define ARENA_SIZE(_n_) (((size_t)(_n_) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+struct Arena {
+  unsigned char *base;      // the block (ARENA_ALIGNMENT aligned)
+  size_t         size;      // # of bytes in it
+  size_t         used;      // # of bytes allocated from it
+  MemTag         tag;       // what the block is counted as
+};
+
+// Allocates a block of size bytes, aligned to ARENA_ALIGNMENT (free it with Arena_FreeBlock)
+void *Arena_AllocBlock (size_t size, MemTag tag);
+// Frees a block from Arena_AllocBlock()
+void  Arena_FreeBlock (void *block);
+// Creates an arena with a size byte block.  Returns true on success
+bool  Arena_Init (Arena *arena, size_t size, MemTag tag);
+// Makes sure an empty arena holds at least size bytes, replacing its block with a bigger
+//  one if needed.  Returns true on success
+bool  Arena_Reserve (Arena *arena, size_t size);
+// Allocates size bytes from an arena.  Returns 0 if they don't fit
+void *Arena_Alloc (Arena *arena, size_t size);
+// Frees everything allocated from an arena (keeping its block)
+void  Arena_Reset (Arena *arena);
+// Frees an arena's block
+void  Arena_Free (Arena *arena);
+
+// An arena whose block is freed when it goes out of scope (such as a thread_local scratch arena)
+class ScopedArena {
+public:
+  Arena arena;
+  ScopedArena (MemTag tag) { arena.base = 0; arena.size = 0; arena.used = 0; arena.tag = tag; }
+  ~ScopedArena () { Arena_Free (&arena); }
+};
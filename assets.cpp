@@ -0,0 +1,1679 @@
+/*____________________________________________________________________
+|
+| File: assets.cpp
+|
+| Description: Registry of the meshes and textures in use.  Each file
+|   is loaded once and shared through a handle, and freed when its last
+|   reference is released.  Textures keep no CPU copy: the cooked file
+|   is mapped just long enough to upload it.  Several textures can
+|   share one atlas texture; each is then an asset referencing the
+|   atlas, with its rectangle in it.  Each asset's CPU and GPU memory is
+|   tracked for reporting (and GL texture memory is also counted as
+|   MEM_GPU, see memtrack.h).
+|
+|   Assets can also be streamed: the handle is returned at once and the
+|   file is read and decoded on a stream worker (see stream.h), then
+|   installed on the GL thread by Stream_Update().  Until then a mesh is
+|   0 and a texture is -1, so the scene draws without them.
+|
+|   A mesh loaded from its cooked file is kept as it is stored until
+|   Asset_Mesh() first asks for it, and only then decoded (and split
+|   into meshlets, given its BVH and morph targets), so meshes loaded
+|   but not drawn yet take their cooked size.
+|
+|   Files can be watched (see watch.h) and reloaded when they change:
+|   the new data is loaded the same way, on a stream worker, while the
+|   old is still drawn, then swapped in by Stream_Update() between
+|   frames.  Only the asset whose file changed is loaded and uploaded
+|   again (for a texture in an atlas, the atlas).
+|
+|   With a texture budget, mipmapped textures are uploaded with only
+|   their coarse levels and keep their cooked file mapped.  Each frame
+|   the renderer says how big each texture is on screen; the finer
+|   levels that asks for are loaded on a stream worker (which pages them
+|   in) and uploaded by Stream_Update().  When that would go over the
+|   budget, the levels asked for longest ago are dropped again (the
+|   texture's GL_TEXTURE_BASE_LEVEL is raised past them).
+|
+| Functions: Asset_LoadMesh
+|            Asset_LoadTexture
+|            Asset_LoadAtlas
+|            Asset_StreamMesh
+|            Asset_StreamTexture
+|            Asset_StreamAtlas
+|            Asset_Loading
+|            Asset_Watch
+|            Asset_ReloadChanged
+|            Asset_CookMeshes
+|            Asset_SetTextureBudget
+|            Asset_UseTexture
+|            Asset_UpdateResidency
+|            Asset_RemapToAtlas
+|            Asset_AddRef
+|            Asset_Release
+|            Asset_ReleaseAll
+|            Asset_Mesh
+|            Asset_MeshRadius
+|            Asset_Texture
+|            Asset_WriteCSV
+|            Find
+|            NewAsset
+|            FreeAsset
+|            LoadMesh
+|            PrepareMesh
+|            DecodeMesh
+|            ReadMesh
+|            LoadMorphs
+|            MeshBytes
+|            MeshRadius
+|            AtlasLimits
+|            CookAtlas
+|            InstallTexture
+|            UploadLevels
+|            FreeResidency
+|            EvictLevel
+|            LoadLevels
+|            FinishLevels
+|            NewJob
+|            LoadJob
+|            FinishJob
+|            ApplyRemaps
+|            WatchAsset
+|            FileChanged
+|            Reload
+|            InstallReload
+|            MoveTexCoords
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <math.h>
+#include <GL/glut.h>
+#include "math3d.h"
+#include "memtrack.h"
+#include "ReadOBJFile.h"
+#include "mipmap.h"
+#include "texcompress.h"
+#include "pack.h"
+#include "texfile.h"
+#include "meshfile.h"
+#include "meshlet.h"
+#include "bvh.h"
+#include "morph.h"
+#include "LoadBMPFile.h"
+#include "atlas.h"
+#include "glproc.h"
+#include "glcheck.h"
+#include "stream.h"
+#include "watch.h"
+#include "trace.h"
+#include "profiler.h"
+#include "assets.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct AssetJob;
+
+// A texture whose finer mip levels are streamed in as they're needed
+struct Residency {
+  TexFile   tf;             // the cooked file, kept open to load levels from
+  int       coarse;         // first of the levels that are always resident
+  int       resident;       // finest level uploaded (the finer ones are 0x0 in GL)
+  int       wanted;         // finest level asked for this frame
+  bool      loading;        // a level job is loading levels for it
+  size_t    pending;        // bytes of the levels it's loading (held against the budget until uploaded)
+  bool      orphaned;       // its texture let go of it while it was loading (the job frees it)
+  unsigned  used[MIP_MAX_LEVELS];   // frame each level was last asked for
+};
+
+struct Asset {
+  std::string path;
+  AssetKind   kind;
+  int         refs;         // 0 = free slot
+  bool        loading;      // being streamed in
+  AssetJob   *job;          // the stream job loading (or reloading) it
+  bool        watched;      // its file is watched for changes
+  bool        load_texcoords;   // mesh: load options, kept for reloading
+  bool        smooth_discontinuous_vertices;
+  TexFormat   format;       // texture: cook options, kept for reloading
+  int         quality;
+  bool        mipmaps;
+  Object3D   *mesh;
+  unsigned char *encoded;   // mesh: its cooked file, until it's first asked for (see Asset_Mesh)
+  size_t      encoded_size;
+  float       radius;       // mesh: of its bounding sphere about the origin
+  int         remapped_to;  // mesh: texture its texture coordinates were moved into an atlas for
+  GLuint      texture;
+  int         width, height;
+  Residency  *residency;    // texture: its streamed mip levels (0 = all levels are uploaded)
+  int         atlas;        // texture: atlas it's part of (or ASSET_NONE)
+  AtlasRect   rect;         // texture: where it is in the atlas
+  size_t      cpu_bytes;    // memory held on the CPU
+  size_t      gpu_bytes;    // memory uploaded to GL
+};
+
+// A streamed load, from the request until it is installed
+struct AssetJob {
+  AssetKind    kind;
+  int          handle;          // asset being loaded
+  bool         reload;          // replaces the asset's data (which is used until then)
+  long long    start;           // reload: when it was queued (see Profile_Now)
+  std::string  path;
+  bool         load_texcoords;  // mesh: load options
+  bool         smooth_discontinuous_vertices;
+  Object3D    *mesh;            // mesh: loaded mesh
+  TexFormat    format;          // texture: cook options
+  int          quality;
+  bool         mipmaps;
+  bool         ok;              // texture: tf was cooked or mapped
+  TexFile      tf;
+  std::vector<std::string> paths;     // atlas: images to pack
+  std::vector<int>         members;   // atlas: handle for each image
+  std::vector<AtlasRect>   rects;     // atlas: where each image went (0 wide if it didn't load)
+  int          max_size;        // atlas: GL limits, read on the GL thread
+  bool         power_of_two;
+};
+
+// Loads a range of a texture's mip levels for its residency
+struct LevelJob {
+  int          handle;
+  Residency   *r;
+  int          first, last;     // levels to upload
+  unsigned     touched;         // sum of a byte from each page (so reading them isn't optimized away)
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static int    Find (char *path, AssetKind kind);
+static int    NewAsset (char *path, AssetKind kind);
+static void   FreeAsset (Asset *a);
+static Object3D *LoadMesh (char *path, bool load_texcoords, bool smooth_discontinuous_vertices);
+static Object3D *PrepareMesh (char *path, Object3D *mesh, bool load_texcoords, bool smooth_discontinuous_vertices);
+static void   DecodeMesh (Asset *a);
+static Object3D *ReadMesh (char *path, bool load_texcoords, bool smooth_discontinuous_vertices);
+static void   LoadMorphs (char *path, Object3D *mesh, bool load_texcoords, bool smooth_discontinuous_vertices);
+static size_t MeshBytes (Object3D *o);
+static float  MeshRadius (Object3D *o);
+static void   AtlasLimits (int *max_size, bool *power_of_two);
+static bool   CookAtlas (char *name, char **paths, int num, TexFormat format, int quality, bool mipmaps,
+                         int max_size, bool power_of_two, AtlasRect *rects, TexFile *tf);
+static size_t InstallTexture (int handle, TexFile *tf);
+static size_t UploadLevels (TexFile *tf, int first, int last);
+static void   FreeResidency (Residency *r);
+static bool   EvictLevel (size_t *total);
+static void   LoadLevels (void *data);
+static size_t FinishLevels (void *data, bool discard);
+static AssetJob *NewJob (int handle, bool reload);
+static void   LoadJob (void *data);
+static size_t FinishJob (void *data, bool discard);
+static void   ApplyRemaps ();
+static void   WatchAsset (int handle);
+static void   FileChanged (const char *path);
+static bool   Reload (int handle);
+static size_t InstallReload (AssetJob *job);
+static void   MoveTexCoords (Object3D *o, AtlasRect *from, int from_width, int from_height,
+                             AtlasRect *to, int to_width, int to_height);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static std::vector<Asset> assets;                     // indexed by handle
+static std::unordered_map<std::string,int> by_path;   // kind + path -> handle
+static std::vector<std::pair<int,int> > remaps;       // mesh, texture: Asset_RemapToAtlas() calls waiting for a load
+static bool watching = false;                         // watch the files of assets loaded
+static std::vector<std::string> changed;              // watched files that changed, to reload
+static bool cook_meshes = false;                      // load meshes from cooked mesh files
+static size_t texture_budget = 0;                     // GL texture memory to stay within (0 = upload every level)
+static unsigned residency_frame = 1;                  // counts Asset_UpdateResidency() calls
+
+/*____________________________________________________________________
+|
+| Function: Asset_LoadMesh
+|
+| Output: Returns the handle of a mesh, loading it if needed.  If the
+|   mesh is already loaded the load options are ignored.  A cooked mesh
+|   is decoded when Asset_Mesh() first asks for it.
+|___________________________________________________________________*/
+
+int Asset_LoadMesh (char *path, bool load_texcoords, bool smooth_discontinuous_vertices)
+{
+  int handle = Find (path, ASSET_MESH);
+  if (handle != ASSET_NONE) {
+    assets[handle].refs++;
+    return handle;
+  }
+
+  if (cook_meshes) {
+    size_t size;
+    unsigned char *encoded = MeshFile_Read (path, load_texcoords, smooth_discontinuous_vertices, &size);
+    if (encoded == 0)
+      return ASSET_NONE;
+    handle = NewAsset (path, ASSET_MESH);
+    assets[handle].encoded = encoded;
+    assets[handle].encoded_size = size;
+    assets[handle].cpu_bytes = size;
+    assets[handle].radius = MeshFile_Radius (encoded, size);
+  }
+  else {
+    Object3D *mesh = LoadMesh (path, load_texcoords, smooth_discontinuous_vertices);
+    if (mesh == 0)
+      return ASSET_NONE;
+    handle = NewAsset (path, ASSET_MESH);
+    assets[handle].mesh = mesh;
+    assets[handle].cpu_bytes = MeshBytes (mesh);
+    assets[handle].radius = MeshRadius (mesh);
+  }
+  assets[handle].load_texcoords = load_texcoords;
+  assets[handle].smooth_discontinuous_vertices = smooth_discontinuous_vertices;
+  WatchAsset (handle);
+  return handle;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_LoadTexture
+|
+| Output: Returns the handle of a texture, loading and uploading it if
+|   needed.  If the texture is already loaded the options are ignored.
+|___________________________________________________________________*/
+
+int Asset_LoadTexture (char *path, TexFormat format, int quality, bool mipmaps)
+{
+  TexFile tf;
+
+  int handle = Find (path, ASSET_TEXTURE);
+  if (handle != ASSET_NONE) {
+    assets[handle].refs++;
+    return handle;
+  }
+
+  if (NOT TexFile_Open(path, format, quality, mipmaps, &tf))
+    return ASSET_NONE;
+
+  handle = NewAsset (path, ASSET_TEXTURE);
+  assets[handle].format  = format;
+  assets[handle].quality = quality;
+  assets[handle].mipmaps = mipmaps;
+  InstallTexture (handle, &tf);
+  // GL has its own copy now (unless its mip levels are streamed, which keeps the file)
+  TexFile_Close (&tf);
+  WatchAsset (handle);
+  return handle;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_LoadAtlas
+|
+| Output: Packs BMP textures into one atlas texture, named name, and
+|   uploads it.  Sets handles[i] to a handle for paths[i] (ASSET_NONE if
+|   it couldn't be loaded).  Paths that are already loaded keep their
+|   own texture.  Returns the atlas's handle, or ASSET_NONE.
+|___________________________________________________________________*/
+
+int Asset_LoadAtlas (char *name, char **paths, int num, TexFormat format, int quality, bool mipmaps, int *handles)
+{
+  std::vector<char *> load;
+  std::vector<int> index;
+  std::vector<AtlasRect> rects;
+  int i, max_size;
+  bool power_of_two;
+  TexFile tf;
+
+  TraceScope trace("Asset_LoadAtlas");
+
+  // Pack the images not loaded yet
+  for (i=0; i<num; i++) {
+    handles[i] = Find (paths[i], ASSET_TEXTURE);
+    if (handles[i] != ASSET_NONE)
+      assets[handles[i]].refs++;
+    else {
+      load.push_back (paths[i]);
+      index.push_back (i);
+    }
+  }
+  int n = (int)load.size ();
+  if (n == 0)
+    return ASSET_NONE;
+  rects.resize (n);
+  AtlasLimits (&max_size, &power_of_two);
+  if (NOT CookAtlas(name, load.data(), n, format, quality, mipmaps, max_size, power_of_two, rects.data(), &tf))
+    return ASSET_NONE;
+
+  // The atlas holds the GL texture, with a reference from each texture in it
+  int handle = NewAsset (name, ASSET_TEXTURE);
+  assets[handle].format  = format;
+  assets[handle].quality = quality;
+  assets[handle].mipmaps = mipmaps;
+  InstallTexture (handle, &tf);
+  TexFile_Close (&tf);
+
+  assets[handle].refs = 0;
+  for (i=0; i<n; i++)
+    if (rects[i].width)
+      assets[handle].refs++;
+  for (i=0; i<n; i++)
+    if (rects[i].width) {
+      int h = NewAsset (load[i], ASSET_TEXTURE);
+      assets[h].atlas = handle;
+      assets[h].rect = rects[i];
+      assets[h].width = rects[i].width;
+      assets[h].height = rects[i].height;
+      handles[index[i]] = h;
+      WatchAsset (h);
+    }
+  return handle;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_StreamMesh
+|
+| Output: Returns the handle of a mesh, queueing it to be loaded on a
+|   stream worker if needed.  Asset_Mesh() returns 0 until it has been
+|   installed by Stream_Update().
+|___________________________________________________________________*/
+
+int Asset_StreamMesh (char *path, bool load_texcoords, bool smooth_discontinuous_vertices)
+{
+  int handle = Find (path, ASSET_MESH);
+  if (handle != ASSET_NONE) {
+    assets[handle].refs++;
+    return handle;
+  }
+
+  handle = NewAsset (path, ASSET_MESH);
+  assets[handle].load_texcoords = load_texcoords;
+  assets[handle].smooth_discontinuous_vertices = smooth_discontinuous_vertices;
+  Stream_Submit (LoadJob, FinishJob, NewJob(handle, false));
+  WatchAsset (handle);
+  return handle;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_StreamTexture
+|
+| Output: Returns the handle of a texture, queueing it to be cooked (or
+|   mapped) on a stream worker and uploaded by Stream_Update() if
+|   needed.  Asset_Texture() returns -1 until it has been uploaded.
+|___________________________________________________________________*/
+
+int Asset_StreamTexture (char *path, TexFormat format, int quality, bool mipmaps)
+{
+  int handle = Find (path, ASSET_TEXTURE);
+  if (handle != ASSET_NONE) {
+    assets[handle].refs++;
+    return handle;
+  }
+
+  handle = NewAsset (path, ASSET_TEXTURE);
+  assets[handle].format  = format;
+  assets[handle].quality = quality;
+  assets[handle].mipmaps = mipmaps;
+  Stream_Submit (LoadJob, FinishJob, NewJob(handle, false));
+  WatchAsset (handle);
+  return handle;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_StreamAtlas
+|
+| Output: Like Asset_LoadAtlas(), but the images are loaded and packed
+|   on a stream worker.  The handles are returned at once.  An image
+|   that doesn't load is left as an empty texture.
+|___________________________________________________________________*/
+
+int Asset_StreamAtlas (char *name, char **paths, int num, TexFormat format, int quality, bool mipmaps, int *handles)
+{
+  int handle = ASSET_NONE;
+  AssetJob *job = 0;
+
+  for (int i=0; i<num; i++) {
+    handles[i] = Find (paths[i], ASSET_TEXTURE);
+    if (handles[i] != ASSET_NONE) {
+      assets[handles[i]].refs++;
+      continue;
+    }
+    // Each texture in the atlas holds a reference to it
+    if (job == 0) {
+      handle = NewAsset (name, ASSET_TEXTURE);
+      assets[handle].format  = format;
+      assets[handle].quality = quality;
+      assets[handle].mipmaps = mipmaps;
+      job = NewJob (handle, false);
+      AtlasLimits (&job->max_size, &job->power_of_two);
+    }
+    else
+      assets[handle].refs++;
+    int h = NewAsset (paths[i], ASSET_TEXTURE);
+    assets[h].atlas   = handle;
+    assets[h].loading = true;
+    assets[h].job     = job;
+    job->paths.push_back (paths[i]);
+    job->members.push_back (h);
+    handles[i] = h;
+    WatchAsset (h);
+  }
+  if (job == 0)
+    return ASSET_NONE;
+
+  job->rects.resize (job->paths.size());
+  Stream_Submit (LoadJob, FinishJob, job);
+  return handle;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_Loading
+|
+| Output: Returns true while any asset is still being streamed in.
+|___________________________________________________________________*/
+
+bool Asset_Loading ()
+{
+  for (size_t i=0; i<assets.size(); i++)
+    if (assets[i].refs > 0 AND assets[i].loading)
+      return true;
+  return false;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_Watch
+|
+| Output: Starts (or stops) watching the files of the assets loaded
+|   from now on, so Asset_ReloadChanged() reloads them when they change.
+|___________________________________________________________________*/
+
+void Asset_Watch (bool on)
+{
+  watching = on;
+  if (NOT on) {
+    for (size_t i=0; i<assets.size(); i++)
+      if (assets[i].watched) {
+        Watch_Remove (assets[i].path.c_str());
+        assets[i].watched = false;
+      }
+    changed.clear ();
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_ReloadChanged
+|
+| Output: Queues a reload of each watched asset whose file has changed.
+|   An asset still streaming in is reloaded once it's in.  Returns the
+|   # of reloads queued.
+|___________________________________________________________________*/
+
+int Asset_ReloadChanged ()
+{
+  std::vector<std::string> paths;
+  int n = 0;
+
+  Watch_Poll (FileChanged);
+  paths.swap (changed);
+  for (size_t i=0; i<paths.size(); i++) {
+    bool wait = false;
+    int kinds[] = {ASSET_MESH, ASSET_TEXTURE};
+    for (int k=0; k<2; k++) {
+      int handle = Find ((char *)paths[i].c_str(), (AssetKind)kinds[k]);
+      if (handle == ASSET_NONE OR NOT assets[handle].watched)
+        continue;
+      if (Reload (handle))
+        n++;
+      else
+        wait = true;
+    }
+    if (wait)
+      changed.push_back (paths[i]);
+  }
+  return n;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_CookMeshes
+|
+| Output: Sets whether the meshes loaded from now on are read from
+|   cooked mesh files (cooked when missing or out of date) rather than
+|   parsed from their OBJ files, with their BVHs kept in .kbv files.
+|   Asset_LoadMesh() then keeps each one as it is stored until it's
+|   first used.
+|___________________________________________________________________*/
+
+void Asset_CookMeshes (bool on)
+{
+  cook_meshes = on;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_SetTextureBudget
+|
+| Output: Sets how much GL texture memory to stay within by streaming
+|   the mip levels of the textures loaded from now on (0 = upload every
+|   level at once).  Needs GL 1.2 (GL_TEXTURE_BASE_LEVEL).
+|___________________________________________________________________*/
+
+void Asset_SetTextureBudget (size_t budget)
+{
+  texture_budget = GLProc_HasVersion(1,2) ? budget : 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_UseTexture
+|
+| Output: Asks for the mip level of a texture with about one texel per
+|   pixel, when it's drawn pixels across on screen this frame.
+|___________________________________________________________________*/
+
+void Asset_UseTexture (int handle, float pixels)
+{
+  if (handle < 0 OR handle >= (int)assets.size() OR assets[handle].refs == 0 OR assets[handle].residency == 0)
+    return;
+  Asset *a = &assets[handle];
+  Residency *r = a->residency;
+
+  float texels = (float) std::max (a->width, a->height);
+  int level = 0;
+  while (level < r->coarse AND texels >= 2 * pixels) {
+    texels /= 2;
+    level++;
+  }
+  r->wanted = std::min (r->wanted, level);
+  for (int i=level; i<=r->coarse; i++)
+    r->used[i] = residency_frame;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_UpdateResidency
+|
+| Output: Queues loads of the finer mip levels asked for this frame, as
+|   far as the budget goes, dropping levels not asked for this frame
+|   (the least recently asked for first) to make room.  Levels queued
+|   in earlier frames and not uploaded yet count against the budget.
+|___________________________________________________________________*/
+
+void Asset_UpdateResidency ()
+{
+  size_t total = 0;
+  size_t i;
+
+  for (i=0; i<assets.size(); i++)
+    if (assets[i].refs > 0 AND assets[i].kind == ASSET_TEXTURE) {
+      total += assets[i].gpu_bytes;
+      if (assets[i].residency)
+        total += assets[i].residency->pending;
+    }
+
+  for (i=0; i<assets.size(); i++) {
+    Residency *r = assets[i].residency;
+    if (assets[i].refs == 0 OR r == 0)
+      continue;
+    if (NOT r->loading AND r->wanted < r->resident) {
+      // From the coarsest level missing, until one doesn't fit
+      int first = r->resident;
+      while (first > r->wanted) {
+        size_t size = r->tf.header->levels[first-1].size;
+        while (total + size > texture_budget AND EvictLevel(&total))
+          ;
+        if (total + size > texture_budget)
+          break;
+        total += size;
+        first--;
+      }
+      if (first < r->resident) {
+        LevelJob *job = new LevelJob;
+        job->handle  = (int)i;
+        job->r       = r;
+        job->first   = first;
+        job->last    = r->resident - 1;
+        job->touched = 0;
+        r->loading = true;
+        for (int level=job->first; level<=job->last; level++)
+          r->pending += r->tf.header->levels[level].size;
+        Stream_Submit (LoadLevels, FinishLevels, job);
+      }
+    }
+    r->wanted = r->coarse;
+  }
+  residency_frame++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_RemapToAtlas
+|
+| Output: If a texture is in an atlas, moves a mesh's texture
+|   coordinates to the texture's place in it.  Does nothing if the mesh
+|   has already been remapped for this texture.  Returns false if it
+|   was remapped for another texture.  If either is still streaming in,
+|   the remap is done once both are installed.
+|___________________________________________________________________*/
+
+bool Asset_RemapToAtlas (int mesh, int texture)
+{
+  // Wait for the mesh and the atlas if they're being streamed in
+  if (mesh >= 0 AND mesh < (int)assets.size() AND texture >= 0 AND texture < (int)assets.size() AND
+      (assets[mesh].loading OR assets[texture].loading)) {
+    remaps.push_back (std::make_pair (mesh, texture));
+    return true;
+  }
+
+  Object3D *o = Asset_Mesh (mesh);
+  if (o == 0 OR texture < 0 OR texture >= (int)assets.size() OR assets[texture].atlas == ASSET_NONE)
+    return true;
+  if (assets[mesh].remapped_to == texture)
+    return true;
+  if (assets[mesh].remapped_to != ASSET_NONE) {
+    printf ("%s: already using another atlas texture\n", assets[mesh].path.c_str());
+    return false;
+  }
+
+  Asset *atlas = &assets[assets[texture].atlas];
+  Atlas_RemapTexCoords (o, &assets[texture].rect, atlas->width, atlas->height);
+  assets[mesh].remapped_to = texture;
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_AddRef
+|
+| Output: Adds a reference to an asset.
+|___________________________________________________________________*/
+
+void Asset_AddRef (int handle)
+{
+  if (handle >= 0 AND handle < (int)assets.size() AND assets[handle].refs > 0)
+    assets[handle].refs++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_Release
+|
+| Output: Removes a reference, freeing the asset if it was the last.
+|___________________________________________________________________*/
+
+void Asset_Release (int handle)
+{
+  if (handle < 0 OR handle >= (int)assets.size() OR assets[handle].refs == 0)
+    return;
+  if (--assets[handle].refs == 0)
+    FreeAsset (&assets[handle]);
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_ReleaseAll
+|
+| Output: Frees every asset, whatever its reference count.
+|___________________________________________________________________*/
+
+void Asset_ReleaseAll ()
+{
+  for (size_t i=0; i<assets.size(); i++)
+    if (assets[i].refs > 0)
+      FreeAsset (&assets[i]);
+  assets.clear ();
+  by_path.clear ();
+  remaps.clear ();
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_Mesh
+|
+| Output: Returns a mesh, decoding it the first time if it's still as
+|   stored, or 0 if the handle isn't a loaded mesh.
+|___________________________________________________________________*/
+
+Object3D *Asset_Mesh (int handle)
+{
+  if (handle < 0 OR handle >= (int)assets.size())
+    return 0;
+  if (assets[handle].encoded)
+    DecodeMesh (&assets[handle]);
+  return assets[handle].mesh;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_MeshRadius
+|
+| Output: Returns the radius of a mesh's bounding sphere about its
+|   origin, or 0 if the handle isn't a loaded mesh.
+|___________________________________________________________________*/
+
+float Asset_MeshRadius (int handle)
+{
+  // Known without decoding the mesh
+  if (handle < 0 OR handle >= (int)assets.size() OR (assets[handle].mesh == 0 AND assets[handle].encoded == 0))
+    return 0;
+  return assets[handle].radius;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_Texture
+|
+| Output: Returns a texture's GL name, or -1 if the handle isn't a
+|   loaded texture (or is still streaming in).
+|___________________________________________________________________*/
+
+unsigned Asset_Texture (int handle)
+{
+  if (handle < 0 OR handle >= (int)assets.size() OR assets[handle].kind != ASSET_TEXTURE OR assets[handle].refs == 0 OR
+      assets[handle].loading)
+    return (unsigned) -1;
+  if (assets[handle].atlas != ASSET_NONE)
+    return Asset_Texture (assets[handle].atlas);
+  return assets[handle].texture;
+}
+
+/*____________________________________________________________________
+|
+| Function: Asset_WriteCSV
+|
+| Output: Writes a line per loaded asset, and the totals, to a CSV
+|   file.  Returns true on success.
+|___________________________________________________________________*/
+
+bool Asset_WriteCSV (const char *filename)
+{
+  size_t cpu_total = 0, gpu_total = 0;
+
+  FILE *fp = fopen (filename, "wt");
+  if (fp == 0) {
+    printf ("Assets: could not write %s\n", filename);
+    return false;
+  }
+  fprintf (fp, "handle,kind,path,refs,atlas,cpu_bytes,gpu_bytes\n");
+  for (size_t i=0; i<assets.size(); i++) {
+    Asset *a = &assets[i];
+    if (a->refs == 0)
+      continue;
+    char atlas[16] = "";
+    if (a->atlas != ASSET_NONE)
+      snprintf (atlas, sizeof(atlas), "%d", a->atlas);
+    fprintf (fp, "%d,%s,%s,%d,%s,%zu,%zu\n", (int)i, a->kind == ASSET_MESH ? "mesh" : "texture",
+             a->path.c_str(), a->refs, atlas, a->cpu_bytes, a->gpu_bytes);
+    cpu_total += a->cpu_bytes;
+    gpu_total += a->gpu_bytes;
+  }
+  fprintf (fp, ",total,,,,%zu,%zu\n", cpu_total, gpu_total);
+  fclose (fp);
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Find
+|
+| Output: Returns the handle of a loaded asset, or ASSET_NONE.
+|___________________________________________________________________*/
+
+static int Find (char *path, AssetKind kind)
+{
+  auto it = by_path.find (std::to_string(kind) + ":" + path);
+  if (it == by_path.end() OR assets[it->second].refs == 0)
+    return ASSET_NONE;
+  return it->second;
+}
+
+/*____________________________________________________________________
+|
+| Function: NewAsset
+|
+| Output: Returns the handle of a new asset with 1 reference, reusing a
+|   free slot if there is one.
+|___________________________________________________________________*/
+
+static int NewAsset (char *path, AssetKind kind)
+{
+  size_t handle;
+
+  for (handle=0; handle<assets.size(); handle++)
+    if (assets[handle].refs == 0)
+      break;
+  if (handle == assets.size())
+    assets.push_back (Asset());
+
+  Asset *a = &assets[handle];
+  a->path      = path;
+  a->kind      = kind;
+  a->refs      = 1;
+  a->loading   = false;
+  a->job       = 0;
+  a->watched   = false;
+  a->load_texcoords = false;
+  a->smooth_discontinuous_vertices = false;
+  a->format    = TEXFMT_RGB;
+  a->quality   = 0;
+  a->mipmaps   = false;
+  a->mesh      = 0;
+  a->encoded   = 0;
+  a->encoded_size = 0;
+  a->radius    = 0;
+  a->remapped_to = ASSET_NONE;
+  a->texture   = 0;
+  a->width     = 0;
+  a->height    = 0;
+  a->residency = 0;
+  a->atlas     = ASSET_NONE;
+  a->cpu_bytes = 0;
+  a->gpu_bytes = 0;
+  by_path[std::to_string(kind) + ":" + path] = (int)handle;
+  return (int)handle;
+}
+
+/*____________________________________________________________________
+|
+| Function: FreeAsset
+|
+| Output: Frees an asset's data and marks its slot free.
+|___________________________________________________________________*/
+
+static void FreeAsset (Asset *a)
+{
+  // A stream job still loading it frees what it loaded when it finishes
+  a->loading = false;
+  a->job = 0;
+  int handle = (int)(a - assets.data());
+  remaps.erase (std::remove_if (remaps.begin(), remaps.end(), [handle] (const std::pair<int,int> &r) {
+                  return r.first == handle OR r.second == handle; }), remaps.end());
+
+  if (a->watched)
+    Watch_Remove (a->path.c_str());
+  a->watched = false;
+  if (a->mesh)
+    FreeObject (a->mesh);
+  Mem_Free (a->encoded);
+  if (a->kind == ASSET_TEXTURE AND a->atlas == ASSET_NONE)
+    glDeleteTextures (1, &a->texture);
+  FreeResidency (a->residency);
+  a->residency = 0;
+  by_path.erase (std::to_string(a->kind) + ":" + a->path);
+  // Textures in an atlas hold a reference to it
+  if (a->atlas != ASSET_NONE) {
+    int atlas = a->atlas;
+    a->atlas = ASSET_NONE;
+    Asset_Release (atlas);
+  }
+  Mem_Count (MEM_GPU, -(long long)a->gpu_bytes);
+  a->refs = 0;
+  a->mesh = 0;
+  a->encoded = 0;
+  a->encoded_size = 0;
+  a->texture = 0;
+  a->cpu_bytes = 0;
+  a->gpu_bytes = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: LoadMesh
+|
+| Output: Returns a mesh read from its cooked mesh file or its OBJ
+|   file (see Asset_CookMeshes), with any morph targets found next to
+|   it, split into meshlets and with a BVH for picking (read from its
+|   .kbv file when cooking, if it matches), or 0 on failure.  Called
+|   from any thread.
+|___________________________________________________________________*/
+
+static Object3D *LoadMesh (char *path, bool load_texcoords, bool smooth_discontinuous_vertices)
+{
+  Object3D *mesh = ReadMesh (path, load_texcoords, smooth_discontinuous_vertices);
+
+  return PrepareMesh (path, mesh, load_texcoords, smooth_discontinuous_vertices);
+}
+
+/*____________________________________________________________________
+|
+| Function: PrepareMesh
+|
+| Output: Gives a mesh just read or decoded its morph targets, meshlets
+|   and BVH (see LoadMesh).  Returns it (0 if mesh is 0).
+|___________________________________________________________________*/
+
+static Object3D *PrepareMesh (char *path, Object3D *mesh, bool load_texcoords, bool smooth_discontinuous_vertices)
+{
+  // Compared with the targets' polygons before the meshlets reorder them
+  if (mesh)
+    LoadMorphs (path, mesh, load_texcoords, smooth_discontinuous_vertices);
+  // Without meshlets it's still drawn, just not culled
+  if (mesh AND NOT Meshlet_Build(mesh))
+    printf ("%s: out of memory for meshlets\n", path);
+  // Built after the meshlets (which reorder the polygons)
+  if (mesh) {
+    char filename[512];
+    BVH_Name (path, filename, sizeof(filename));
+    if (cook_meshes)
+      mesh->bvh = BVH_Load (filename, mesh);
+    if (mesh->bvh == 0) {
+      mesh->bvh = BVH_Build (mesh);
+      if (mesh->bvh == 0)
+        printf ("%s: out of memory for the BVH\n", path);
+      else if (cook_meshes)
+        BVH_Save (mesh->bvh, filename);
+    }
+  }
+  return mesh;
+}
+
+/*____________________________________________________________________
+|
+| Function: DecodeMesh
+|
+| Output: Decodes a mesh asset kept as it is stored, and frees that.
+|   The asset has no mesh if it can't be decoded.
+|___________________________________________________________________*/
+
+static void DecodeMesh (Asset *a)
+{
+  TraceScope trace("DecodeMesh");
+
+  Object3D *mesh = MeshFile_Decode (a->encoded, a->encoded_size);
+  if (mesh == 0)
+    printf ("%s: not a valid cooked mesh\n", a->path.c_str());
+  a->mesh = PrepareMesh ((char *)a->path.c_str(), mesh, a->load_texcoords, a->smooth_discontinuous_vertices);
+  a->cpu_bytes = a->mesh ? MeshBytes (a->mesh) : 0;
+  Mem_Free (a->encoded);
+  a->encoded = 0;
+  a->encoded_size = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: ReadMesh
+|
+| Output: Returns a mesh read from its cooked mesh file or its OBJ
+|   file, or 0 on failure.
+|___________________________________________________________________*/
+
+static Object3D *ReadMesh (char *path, bool load_texcoords, bool smooth_discontinuous_vertices)
+{
+  Object3D *mesh = 0;
+
+  if (cook_meshes)
+    mesh = MeshFile_Load (path, load_texcoords, smooth_discontinuous_vertices);
+  else
+    ReadOBJFile (path, &mesh, load_texcoords, smooth_discontinuous_vertices);
+  return mesh;
+}
+
+/*____________________________________________________________________
+|
+| Function: LoadMorphs
+|
+| Output: Gives a mesh the morph targets in <name>_morph0.obj,
+|   <name>_morph1.obj, ... (up to the first one missing), read the same
+|   way as the mesh.  A target whose vertices or polygons differ from
+|   the mesh's is left out.
+|___________________________________________________________________*/
+
+static void LoadMorphs (char *path, Object3D *mesh, bool load_texcoords, bool smooth_discontinuous_vertices)
+{
+  Object3D *targets[MORPH_MAX_TARGETS];
+  int i, num_targets = 0;
+
+  for (i=0; i<MORPH_MAX_TARGETS; i++) {
+    char filename[512];
+    Morph_Name (path, i, filename, sizeof(filename));
+    bool found = Pack_Contains (filename);
+    if (NOT found) {
+      FILE *fp = fopen (filename, "rb");
+      found = (fp != 0);
+      if (fp)
+        fclose (fp);
+    }
+    if (NOT found)
+      break;
+    Object3D *target = ReadMesh (filename, load_texcoords, smooth_discontinuous_vertices);
+    if (target AND NOT Morph_Matches(mesh, target)) {
+      printf ("%s: not the same vertices and polygons as %s\n", filename, path);
+      FreeObject (target);
+    }
+    else if (target)
+      targets[num_targets++] = target;
+  }
+
+  if (num_targets AND NOT Morph_Build(mesh, targets, num_targets))
+    printf ("%s: out of memory for morph targets\n", path);
+  for (i=0; i<num_targets; i++)
+    FreeObject (targets[i]);
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshBytes
+|
+| Output: Returns the # of bytes allocated for a mesh's arrays.
+|___________________________________________________________________*/
+
+static size_t MeshBytes (Object3D *o)
+{
+  size_t bytes = sizeof(Object3D);
+
+  if (o->vertex)          bytes += o->num_vertices * sizeof(Vector3D);
+  if (o->vertex_normal)   bytes += o->num_vertices * sizeof(Vector3D);
+  if (o->tex_coords)      bytes += o->num_vertices * sizeof(UVCoordinate);
+  if (o->polygon)         bytes += o->num_polygons * sizeof(Polygon3D);
+  if (o->polygon_normal)  bytes += o->num_polygons * sizeof(Vector3D);
+  if (o->meshlets)        bytes += o->num_meshlets * sizeof(Meshlet);
+  if (o->bvh)             bytes += BVH_Size (o->bvh);
+  if (o->morph)           bytes += o->morph->bytes;
+  return bytes;
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshRadius
+|
+| Output: Returns the distance from a mesh's origin to its farthest
+|   vertex.
+|___________________________________________________________________*/
+
+static float MeshRadius (Object3D *o)
+{
+  float r2 = 0;
+
+  for (int i=0; i<o->num_vertices; i++) {
+    Vector3D *v = &o->vertex[i];
+    r2 = std::max (r2, v->x * v->x + v->y * v->y + v->z * v->z);
+  }
+  return sqrtf (r2);
+}
+
+/*____________________________________________________________________
+|
+| Function: AtlasLimits
+|
+| Output: Gets the largest texture the GL takes, and whether it needs
+|   power of 2 sizes (unless it has full NPOT support).
+|___________________________________________________________________*/
+
+static void AtlasLimits (int *max_size, bool *power_of_two)
+{
+  glGetIntegerv (GL_MAX_TEXTURE_SIZE, max_size);
+  *power_of_two = NOT (GLProc_HasVersion(2,0) OR GLProc_HasExtension("GL_ARB_texture_non_power_of_two"));
+}
+
+/*____________________________________________________________________
+|
+| Function: CookAtlas
+|
+| Output: Loads BMP files, packs the ones that loaded into an atlas
+|   image and cooks it in memory.  Sets rects[i] to where paths[i] went
+|   (0 wide if it didn't load).  Makes no GL calls, so it can run on a
+|   stream worker.  Returns true on success.
+|___________________________________________________________________*/
+
+static bool CookAtlas (char *name, char **paths, int num, TexFormat format, int quality, bool mipmaps,
+                       int max_size, bool power_of_two, AtlasRect *rects, TexFile *tf)
+{
+  std::vector<unsigned char *> images;
+  std::vector<int> widths, heights, index;
+  std::vector<AtlasRect> packed;
+  int i, width, height;
+  unsigned char *rgb;
+
+  TraceScope trace("CookAtlas");
+
+  memset (rects, 0, num * sizeof(AtlasRect));
+  for (i=0; i<num; i++)
+    if (loadBMPfile(paths[i], &width, &height, &rgb)) {
+      images.push_back (rgb);
+      widths.push_back (width);
+      heights.push_back (height);
+      index.push_back (i);
+    }
+  int n = (int)images.size ();
+  if (n == 0)
+    return false;
+
+  // Pack them and build the atlas image
+  packed.resize (n);
+  bool ok = Atlas_Pack (n, widths.data(), heights.data(), ATLAS_PADDING, max_size, power_of_two,
+                        packed.data(), &width, &height);
+  unsigned char *atlas = ok ? Atlas_Build (n, images.data(), packed.data(), ATLAS_PADDING, width, height) : 0;
+  for (i=0; i<n; i++)
+    Mem_Free (images[i]);
+  if (atlas == 0) {
+    printf ("%s: could not build a %d texture atlas\n", name, n);
+    return false;
+  }
+  ok = TexFile_CookImage (name, atlas, width, height, format, quality, mipmaps, tf);
+  Mem_Free (atlas);
+  if (NOT ok)
+    return false;
+
+  for (i=0; i<n; i++)
+    rects[index[i]] = packed[i];
+  printf ("%s: %d textures in a %dx%d atlas\n", name, n, width, height);
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: InstallTexture
+|
+| Output: Creates a texture asset's GL texture from a cooked texture
+|   (replacing the one it had, if any).  If its mip levels are to be
+|   streamed, only the coarse ones are uploaded and the asset takes the
+|   cooked file over (tf is left closed).  Returns the # of bytes
+|   uploaded.
+|___________________________________________________________________*/
+
+static size_t InstallTexture (int handle, TexFile *tf)
+{
+  Asset *a = &assets[handle];
+  TexFileHeader *h = tf->header;
+  GLuint old = a->texture;
+  Residency *r = 0;
+  int first = 0;
+
+  // Stream the finer levels of a mip chain from the file (not one cooked in memory, which
+  // would keep a CPU copy)
+  if (texture_budget AND h->num_levels > 1 AND NOT tf->in_memory) {
+    r = new Residency;
+    r->tf = *tf;
+    memset (tf, 0, sizeof(TexFile));
+    for (r->coarse=0; r->coarse<(int)h->num_levels-1; r->coarse++)
+      if ((int)std::max(h->levels[r->coarse].width, h->levels[r->coarse].height) <= ASSET_COARSE_MIP_SIZE)
+        break;
+    r->resident = r->wanted = first = r->coarse;
+    r->loading  = false;
+    r->pending  = 0;
+    r->orphaned = false;
+    memset (r->used, 0, sizeof(r->used));
+    tf = &r->tf;
+  }
+
+  // Create an OpenGL texture
+  glGenTextures (1, &a->texture);
+  // Bind the newly created texture - all future texture functions will modify this texture
+  glBindTexture (GL_TEXTURE_2D, a->texture);
+  Mem_Count (MEM_GPU, -(long long)a->gpu_bytes);
+  a->gpu_bytes = UploadLevels (tf, first, h->num_levels - 1);
+  a->width  = h->levels[0].width;
+  a->height = h->levels[0].height;
+
+  // Define how the texture will be sampled (trilinear when minified), from the finest level uploaded
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, h->num_levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  if (r) {
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, first);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, h->num_levels - 1);
+  }
+
+  // A reload replaces the texture drawn until now
+  if (old)
+    glDeleteTextures (1, &old);
+  FreeResidency (a->residency);
+  a->residency = r;
+  return a->gpu_bytes;
+}
+
+/*____________________________________________________________________
+|
+| Function: UploadLevels
+|
+| Output: Uploads levels first to last of a cooked texture to the bound
+|   texture, straight from the mapped file.  Returns the # of bytes
+|   uploaded (counted as MEM_GPU).
+|___________________________________________________________________*/
+
+static size_t UploadLevels (TexFile *tf, int first, int last)
+{
+  TexFileHeader *h = tf->header;
+  size_t bytes = 0;
+
+  TraceScope trace("texture upload");
+  // Rows of RGB levels are tightly packed
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+  for (int i=first; i<=last; i++) {
+    TexFileLevel *level = &h->levels[i];
+    if (h->format == TEXFMT_RGB)
+      GL_UPLOAD(glTexImage2D(GL_TEXTURE_2D,i,GL_RGB,level->width,level->height,0,GL_RGB,GL_UNSIGNED_BYTE,TexFile_Level(tf,i)), level->size);
+    else
+      GL_UPLOAD(pglCompressedTexImage2D(GL_TEXTURE_2D,i,h->gl_format,level->width,level->height,0,level->size,TexFile_Level(tf,i)), level->size);
+    bytes += level->size;
+  }
+  Mem_Count (MEM_GPU, (long long)bytes);
+  return bytes;
+}
+
+/*____________________________________________________________________
+|
+| Function: FreeResidency
+|
+| Output: Closes a texture's streamed mip levels' file, or leaves that
+|   to the level job loading from it.
+|___________________________________________________________________*/
+
+static void FreeResidency (Residency *r)
+{
+  if (r == 0)
+    return;
+  if (r->loading)
+    r->orphaned = true;
+  else {
+    TexFile_Close (&r->tf);
+    delete r;
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: EvictLevel
+|
+| Output: Drops the finest level of the streamed texture whose finest
+|   level was asked for longest ago (and not this frame), and takes its
+|   size off total.  Returns false if there was no level to drop.
+|___________________________________________________________________*/
+
+static bool EvictLevel (size_t *total)
+{
+  unsigned oldest = residency_frame;
+  int handle = ASSET_NONE;
+
+  for (size_t i=0; i<assets.size(); i++) {
+    Residency *r = assets[i].residency;
+    if (assets[i].refs > 0 AND r AND NOT r->loading AND r->resident < r->coarse AND r->used[r->resident] < oldest) {
+      oldest = r->used[r->resident];
+      handle = (int)i;
+    }
+  }
+  if (handle == ASSET_NONE)
+    return false;
+
+  // Sample from the next level, then free this one (a 0x0 image)
+  Asset *a = &assets[handle];
+  Residency *r = a->residency;
+  TexFileHeader *h = r->tf.header;
+  glBindTexture (GL_TEXTURE_2D, a->texture);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, r->resident + 1);
+  glTexImage2D (GL_TEXTURE_2D, r->resident, h->gl_format, 0, 0, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+  size_t size = h->levels[r->resident].size;
+  a->gpu_bytes -= size;
+  Mem_Count (MEM_GPU, -(long long)size);
+  *total -= size;
+  r->resident++;
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: LoadLevels
+|
+| Output: Reads a byte from each page of a level job's levels, so they
+|   are paged in from the cooked file before the GL thread uploads
+|   them.  Runs on a stream worker.
+|___________________________________________________________________*/
+
+static void LoadLevels (void *data)
+{
+  LevelJob *job = (LevelJob *)data;
+  TexFile *tf = &job->r->tf;
+  unsigned sum = 0;
+
+  TraceScope trace("LoadLevels");
+  for (int i=job->first; i<=job->last; i++) {
+    const unsigned char *level = TexFile_Level (tf, i);
+    for (unsigned offset=0; offset<tf->header->levels[i].size; offset+=PACK_ALIGNMENT)
+      sum += level[offset];
+  }
+  job->touched = sum;
+}
+
+/*____________________________________________________________________
+|
+| Function: FinishLevels
+|
+| Output: Uploads a level job's levels and makes the finest the base
+|   level (unless discard is set, or the texture is gone).  Frees the
+|   job.  Returns the # of bytes uploaded.
+|___________________________________________________________________*/
+
+static size_t FinishLevels (void *data, bool discard)
+{
+  LevelJob *job = (LevelJob *)data;
+  Residency *r = job->r;
+  size_t bytes = 0;
+
+  r->loading = false;
+  r->pending = 0;
+  if (r->orphaned)
+    FreeResidency (r);
+  else if (NOT discard) {
+    Asset *a = &assets[job->handle];
+    glBindTexture (GL_TEXTURE_2D, a->texture);
+    bytes = UploadLevels (&r->tf, job->first, job->last);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job->first);
+    r->resident = job->first;
+    a->gpu_bytes += bytes;
+  }
+  delete job;
+  return bytes;
+}
+
+/*____________________________________________________________________
+|
+| Function: NewJob
+|
+| Output: Returns a new stream job for an asset, with its load options,
+|   and marks the asset as loading (unless it's a reload, which leaves
+|   the asset as it is until the job is finished).
+|___________________________________________________________________*/
+
+static AssetJob *NewJob (int handle, bool reload)
+{
+  Asset *a = &assets[handle];
+  AssetJob *job = new AssetJob;
+  job->kind     = a->kind;
+  job->handle   = handle;
+  job->reload   = reload;
+  job->start    = Profile_Now ();
+  job->path     = a->path;
+  job->load_texcoords = a->load_texcoords;
+  job->smooth_discontinuous_vertices = a->smooth_discontinuous_vertices;
+  job->mesh     = 0;
+  job->format   = a->format;
+  job->quality  = a->quality;
+  job->mipmaps  = a->mipmaps;
+  job->ok       = false;
+  memset (&job->tf, 0, sizeof(TexFile));
+  job->max_size = 0;
+  job->power_of_two = false;
+  a->loading = a->loading OR NOT reload;
+  a->job = job;
+  return job;
+}
+
+/*____________________________________________________________________
+|
+| Function: LoadJob
+|
+| Output: Loads a job's mesh or texture.  Runs on a stream worker, so it
+|   only touches the job (never the registry or GL).
+|___________________________________________________________________*/
+
+static void LoadJob (void *data)
+{
+  AssetJob *job = (AssetJob *)data;
+  char *path = (char *)job->path.c_str ();
+
+  if (job->kind == ASSET_MESH)
+    job->mesh = LoadMesh (path, job->load_texcoords, job->smooth_discontinuous_vertices);
+  else if (job->paths.empty())
+    job->ok = TexFile_Open (path, job->format, job->quality, job->mipmaps, &job->tf);
+  else {
+    std::vector<char *> paths;
+    for (size_t i=0; i<job->paths.size(); i++)
+      paths.push_back ((char *)job->paths[i].c_str());
+    job->ok = CookAtlas (path, paths.data(), (int)paths.size(), job->format, job->quality, job->mipmaps,
+                         job->max_size, job->power_of_two, job->rects.data(), &job->tf);
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: FinishJob
+|
+| Output: Installs a loaded job's data in its asset (unless the asset
+|   was released or reloaded again meanwhile, or discard is set) and
+|   frees the job.  Returns the # of bytes uploaded to GL.
+|___________________________________________________________________*/
+
+static size_t FinishJob (void *data, bool discard)
+{
+  AssetJob *job = (AssetJob *)data;
+  size_t bytes = 0;
+
+  if (NOT discard AND job->handle < (int)assets.size() AND assets[job->handle].job == job AND job->reload) {
+    bytes = InstallReload (job);
+    ApplyRemaps ();
+  }
+  else if (NOT discard AND job->handle < (int)assets.size() AND assets[job->handle].job == job) {
+    int handle = job->handle;
+    assets[handle].loading = false;
+    assets[handle].job = 0;
+    if (job->mesh) {
+      assets[handle].mesh = job->mesh;
+      assets[handle].cpu_bytes = MeshBytes (job->mesh);
+      assets[handle].radius = MeshRadius (job->mesh);
+      job->mesh = 0;
+    }
+    else if (job->ok)
+      bytes = InstallTexture (handle, &job->tf);
+
+    // Atlas textures (each one left holds a reference to the atlas)
+    for (size_t i=0; i<job->members.size(); i++) {
+      Asset *a = &assets[job->members[i]];
+      if (a->job != job)
+        continue;
+      a->loading = false;
+      a->job = 0;
+      if (job->ok AND job->rects[i].width) {
+        a->rect   = job->rects[i];
+        a->width  = a->rect.width;
+        a->height = a->rect.height;
+      }
+      else {
+        a->atlas = ASSET_NONE;
+        Asset_Release (handle);
+      }
+    }
+    ApplyRemaps ();
+  }
+
+  if (job->mesh)
+    FreeObject (job->mesh);
+  TexFile_Close (&job->tf);
+  delete job;
+  return bytes;
+}
+
+/*____________________________________________________________________
+|
+| Function: ApplyRemaps
+|
+| Output: Retries the Asset_RemapToAtlas() calls that were waiting for
+|   a mesh or texture to stream in.
+|___________________________________________________________________*/
+
+static void ApplyRemaps ()
+{
+  std::vector<std::pair<int,int> > waiting;
+
+  waiting.swap (remaps);
+  for (size_t i=0; i<waiting.size(); i++)
+    Asset_RemapToAtlas (waiting[i].first, waiting[i].second);
+}
+
+/*____________________________________________________________________
+|
+| Function: WatchAsset
+|
+| Output: Starts watching an asset's file, if assets are being watched
+|   and it's a loose file (a file in a pack can't change).
+|___________________________________________________________________*/
+
+static void WatchAsset (int handle)
+{
+  Asset *a = &assets[handle];
+
+  if (watching AND NOT a->watched AND NOT Pack_Contains(a->path.c_str()))
+    a->watched = Watch_Add (a->path.c_str());
+}
+
+/*____________________________________________________________________
+|
+| Function: FileChanged
+|
+| Output: Called by Watch_Poll() for each watched file that changed.
+|___________________________________________________________________*/
+
+static void FileChanged (const char *path)
+{
+  if (std::find(changed.begin(), changed.end(), path) == changed.end())
+    changed.push_back (path);
+}
+
+/*____________________________________________________________________
+|
+| Function: Reload
+|
+| Output: Queues a job to load an asset's file again (for a texture in
+|   an atlas, the whole atlas).  Returns false if the asset is still
+|   streaming in, so it can't be reloaded yet.
+|___________________________________________________________________*/
+
+static bool Reload (int handle)
+{
+  int target = assets[handle].atlas != ASSET_NONE ? assets[handle].atlas : handle;
+  if (assets[handle].loading OR assets[target].loading)
+    return false;
+
+  // A job already reloading it is dropped when it finishes
+  AssetJob *job = NewJob (target, true);
+  if (target != handle) {
+    for (size_t i=0; i<assets.size(); i++)
+      if (assets[i].refs > 0 AND assets[i].atlas == target) {
+        job->paths.push_back (assets[i].path);
+        job->members.push_back ((int)i);
+      }
+    job->rects.resize (job->paths.size());
+    AtlasLimits (&job->max_size, &job->power_of_two);
+  }
+  Stream_Submit (LoadJob, FinishJob, job);
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: InstallReload
+|
+| Output: Swaps a reloaded mesh or texture in for the old one, which is
+|   freed.  If the file didn't load, the old one is kept.  Returns the
+|   # of bytes uploaded to GL.
+|___________________________________________________________________*/
+
+static size_t InstallReload (AssetJob *job)
+{
+  Asset *a = &assets[job->handle];
+  size_t bytes = 0, i;
+
+  a->job = 0;
+  if (job->kind == ASSET_MESH) {
+    if (job->mesh == 0) {
+      printf ("%s: could not reload\n", a->path.c_str());
+      return 0;
+    }
+    // Texture coordinates moved into an atlas are moved again
+    int texture = a->remapped_to;
+    if (a->mesh)
+      FreeObject (a->mesh);
+    Mem_Free (a->encoded);
+    a->encoded = 0;
+    a->encoded_size = 0;
+    a->mesh = job->mesh;
+    a->cpu_bytes = MeshBytes (a->mesh);
+    a->radius = MeshRadius (a->mesh);
+    a->remapped_to = ASSET_NONE;
+    job->mesh = 0;
+    if (texture != ASSET_NONE)
+      Asset_RemapToAtlas (job->handle, texture);
+  }
+  else {
+    // An atlas is only replaced if every texture in it loaded again
+    bool ok = job->ok;
+    for (i=0; i<job->rects.size(); i++)
+      if (job->rects[i].width == 0)
+        ok = false;
+    if (NOT ok) {
+      printf ("%s: could not reload\n", a->path.c_str());
+      return 0;
+    }
+    int old_width = a->width, old_height = a->height;
+    bytes = InstallTexture (job->handle, &job->tf);
+    a = &assets[job->handle];
+
+    // Textures that moved in the atlas take the meshes mapped to them along
+    for (i=0; i<job->members.size(); i++) {
+      int h = job->members[i];
+      Asset *m = &assets[h];
+      if (m->refs == 0 OR m->atlas != job->handle)
+        continue;
+      for (size_t j=0; j<assets.size(); j++)
+        if (assets[j].refs > 0 AND assets[j].remapped_to == h)
+          MoveTexCoords (assets[j].mesh, &m->rect, old_width, old_height, &job->rects[i], a->width, a->height);
+      m->rect   = job->rects[i];
+      m->width  = m->rect.width;
+      m->height = m->rect.height;
+    }
+  }
+  printf ("%s: reloaded in %.1f ms\n", a->path.c_str(), (Profile_Now() - job->start) / 1.0e6);
+  return bytes;
+}
+
+/*____________________________________________________________________
+|
+| Function: MoveTexCoords
+|
+| Output: Moves texture coordinates remapped to one rectangle in an
+|   atlas to another (in an atlas of a different size, maybe).
+|___________________________________________________________________*/
+
+static void MoveTexCoords (Object3D *o, AtlasRect *from, int from_width, int from_height,
+                           AtlasRect *to, int to_width, int to_height)
+{
+  if (o == 0 OR o->tex_coords == 0)
+    return;
+  if (from->x == to->x AND from->y == to->y AND from->width == to->width AND from->height == to->height AND
+      from_width == to_width AND from_height == to_height)
+    return;
+
+  // Back to [0,1] over the image, then into the new rectangle
+  float fu0 = (float)from->x / from_width,  fdu = (float)from->width / from_width;
+  float fv0 = (float)from->y / from_height, fdv = (float)from->height / from_height;
+  float tu0 = (float)to->x / to_width,      tdu = (float)to->width / to_width;
+  float tv0 = (float)to->y / to_height,     tdv = (float)to->height / to_height;
+  for (int i=0; i<o->num_vertices; i++) {
+    o->tex_coords[i].u = tu0 + (o->tex_coords[i].u - fu0) / fdu * tdu;
+    o->tex_coords[i].v = tv0 + (o->tex_coords[i].v - fv0) / fdv * tdv;
+  }
+}
@@ -0,0 +1,77 @@
+/*____________________________________________________________________
+|
+| File: assets.h
+|
+| Shared, reference counted meshes and textures, keyed by file path.
+| Loading a path that is already loaded returns the same handle (and
+| adds a reference).  Include after math3d.h, mipmap.h and
+| texcompress.h.
+|___________________________________________________________________*/
+
+#define ASSET_NONE -1   // invalid handle
+#define ASSET_COARSE_MIP_SIZE 64  // streamed mip levels this size and smaller are always uploaded
+
+enum AssetKind { ASSET_MESH, ASSET_TEXTURE };
+
+// Loads an OBJ file (the first time it's asked for), returns its handle or ASSET_NONE
+int  Asset_LoadMesh (char *path, bool load_texcoords, bool smooth_discontinuous_vertices);
+// Loads a texture from a BMP file (cooked, see texfile.h) and uploads it to GL.  Only the
+//  GL copy is kept.  Returns its handle or ASSET_NONE
+int  Asset_LoadTexture (char *path, TexFormat format, int quality, bool mipmaps);
+// Packs BMP textures into one atlas texture and uploads it.  handles[i] is set to the
+//  handle of paths[i], which draws with the atlas (see Asset_RemapToAtlas).  Returns the
+//  atlas's handle or ASSET_NONE
+int  Asset_LoadAtlas (char *name, char **paths, int num, TexFormat format, int quality, bool mipmaps, int *handles);
+
+// Streamed versions of the loads above: the handle is returned at once and the file is
+//  loaded on a stream worker (see stream.h), then installed by Stream_Update().  Until then
+//  Asset_Mesh() returns 0 and Asset_Texture() returns -1
+int  Asset_StreamMesh (char *path, bool load_texcoords, bool smooth_discontinuous_vertices);
+int  Asset_StreamTexture (char *path, TexFormat format, int quality, bool mipmaps);
+int  Asset_StreamAtlas (char *name, char **paths, int num, TexFormat format, int quality, bool mipmaps, int *handles);
+// Returns true while any asset is still streaming in
+bool Asset_Loading ();
+
+// Starts (or stops) watching the files of the assets loaded from now on (loose files only,
+//  not those in a pack) so they can be reloaded when they change
+void Asset_Watch (bool on);
+// Queues a reload of each watched asset whose file has changed.  The file is loaded on a
+//  stream worker and swapped in by Stream_Update(), between frames; the old data is drawn
+//  until then.  Call once per frame.  Returns the # of reloads queued
+int  Asset_ReloadChanged ();
+
+// Loads the meshes loaded from now on from cooked mesh files (see meshfile.h), cooking them
+//  from their OBJ files when missing or out of date.  Asset_LoadMesh() keeps each one as it is
+//  stored until Asset_Mesh() first asks for it
+void Asset_CookMeshes (bool on);
+// Streams the mip levels of the mipmapped textures loaded from now on: only the levels up to
+//  ASSET_COARSE_MIP_SIZE are uploaded at first, and finer ones as Asset_UseTexture() asks for
+//  them, staying within budget bytes of texture memory (0 = upload every level at once)
+void Asset_SetTextureBudget (size_t budget);
+// Tells the mip streaming that a texture is drawn about pixels across on screen this frame
+void Asset_UseTexture (int handle, float pixels);
+// Queues loads of the mip levels asked for this frame on a stream worker (uploaded by
+//  Stream_Update()), evicting the levels asked for longest ago to stay within the budget.
+//  Call once per frame, after drawing
+void Asset_UpdateResidency ();
+
+// Moves a mesh's texture coordinates into its texture's place in an atlas (only once,
+//  and nothing happens if the texture isn't in an atlas).  Waits for either to stream in.
+//  Returns false if the mesh was already moved for a different texture
+bool Asset_RemapToAtlas (int mesh, int texture);
+// Adds a reference to an asset
+void Asset_AddRef (int handle);
+// Removes a reference to an asset, freeing it when there are none left
+void Asset_Release (int handle);
+// Frees every asset
+void Asset_ReleaseAll ();
+
+// Returns a mesh, decoding it if it's still as stored (0 if the handle isn't a loaded mesh)
+Object3D *Asset_Mesh (int handle);
+// Returns the radius of a mesh's bounding sphere about its origin (0 if not loaded)
+float     Asset_MeshRadius (int handle);
+// Returns a texture's GL name (-1 if the handle isn't a loaded texture)
+unsigned  Asset_Texture (int handle);
+
+// Writes each loaded asset's path, references and CPU/GPU memory to a CSV file
+bool Asset_WriteCSV (const char *filename);
@@ -0,0 +1,256 @@
+/*____________________________________________________________________
+|
+| File: atlas.cpp
+|
+| Description: Packs images into a texture atlas with a skyline packer:
+|   the top edge of the packed area is kept as a list of horizontal
+|   segments, and each image (tallest first) goes where its top would
+|   be lowest.  Images are padded with copies of their edge pixels so
+|   bilinear filtering and the first few mip levels don't pick up their
+|   neighbours.
+|
+| Functions: Atlas_Pack
+|            Atlas_Build
+|            Atlas_RemapTexCoords
+|            PackSkyline
+|            RoundUp
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "math3d.h"
+#include "memtrack.h"
+#include "trace.h"
+#include "atlas.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+// A horizontal piece of the skyline
+struct SkylineSegment {
+  int x, y, width;
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static int  PackSkyline (int num_images, int *widths, int *heights, int *order, int atlas_width, AtlasRect *rects);
+static int  RoundUp (int n, bool power_of_two);
+
+/*____________________________________________________________________
+|
+| Function: Atlas_Pack
+|
+| Output: Packs the images (each grown by padding on every side) into
+|   the smallest atlas found.  Each candidate width is packed and the
+|   height it needs measured.  rects are the images without padding.
+|   Returns true on success.
+|___________________________________________________________________*/
+
+bool Atlas_Pack (int num_images, int *widths, int *heights, int padding, int max_size, bool power_of_two,
+                 AtlasRect *rects, int *atlas_width, int *atlas_height)
+{
+  int i, max_width = 0, sum_width = 0;
+  long long area = 0;
+
+  TraceScope trace("Atlas_Pack");
+
+  // Padded sizes, rounded up to whole 4x4 blocks so compressed blocks never mix images
+  std::vector<int> w(num_images), h(num_images), order(num_images);
+  for (i=0; i<num_images; i++) {
+    w[i] = (widths[i] + 2 * padding + 3) & ~3;
+    h[i] = (heights[i] + 2 * padding + 3) & ~3;
+    max_width = std::max (max_width, w[i]);
+    sum_width += w[i];
+    area += (long long)w[i] * h[i];
+    order[i] = i;
+  }
+  // Tallest first (then widest)
+  std::sort (order.begin(), order.end(), [&](int a, int b) {
+    return h[a] != h[b] ? h[a] > h[b] : w[a] > w[b];
+  });
+
+  // Try widths from the widest image to all the images side by side
+  std::vector<AtlasRect> packed(num_images);
+  long long best_area = -1;
+  int start = RoundUp (std::max (max_width, (int)sqrt((double)area)), power_of_two);
+  for (int width = start; width <= max_size; width = RoundUp (width + 1, power_of_two)) {
+    int height = PackSkyline (num_images, w.data(), h.data(), order.data(), width, packed.data());
+    if (height <= max_size)
+      height = RoundUp (height, power_of_two);
+    if (height <= max_size AND (best_area < 0 OR (long long)width * height < best_area)) {
+      best_area = (long long)width * height;
+      *atlas_width = width;
+      *atlas_height = height;
+      for (i=0; i<num_images; i++) {
+        rects[i].x = packed[i].x + padding;
+        rects[i].y = packed[i].y + padding;
+        rects[i].width = widths[i];
+        rects[i].height = heights[i];
+      }
+    }
+    if (width >= sum_width)
+      break;  // wider can't help
+  }
+  return best_area >= 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Atlas_Build
+|
+| Output: Returns a new RGB atlas image with each image copied to its
+|   rectangle and its edges repeated into the padding around it.
+|___________________________________________________________________*/
+
+unsigned char *Atlas_Build (int num_images, unsigned char **images, AtlasRect *rects, int padding,
+                            int atlas_width, int atlas_height)
+{
+  TraceScope trace("Atlas_Build");
+
+  unsigned char *atlas = (unsigned char *) Mem_Calloc (MEM_TEXTURE, (size_t)atlas_width * atlas_height * 3);
+  if (atlas == 0)
+    return 0;
+
+  for (int i=0; i<num_images; i++) {
+    AtlasRect *r = &rects[i];
+    size_t row_size = (size_t)r->width * 3;
+    // Rows of the padded area, each taken from the nearest row of the image
+    for (int y=-padding; y<r->height+padding; y++) {
+      int ay = r->y + y;
+      if (ay < 0 OR ay >= atlas_height)
+        continue;
+      int sy = std::min (std::max (y, 0), r->height - 1);
+      unsigned char *src = images[i] + sy * row_size;
+      unsigned char *dst = atlas + ((size_t)ay * atlas_width + r->x) * 3;
+      memcpy (dst, src, row_size);
+      // Repeat the first and last pixel into the padding
+      for (int x=1; x<=padding; x++) {
+        if (r->x - x >= 0)
+          memcpy (dst - x * 3, src, 3);
+        if (r->x + r->width - 1 + x < atlas_width)
+          memcpy (dst + row_size + (x - 1) * 3, src + row_size - 3, 3);
+      }
+    }
+  }
+  return atlas;
+}
+
+/*____________________________________________________________________
+|
+| Function: Atlas_RemapTexCoords
+|
+| Output: Moves an object's texture coordinates into an image's place
+|   in the atlas.
+|___________________________________________________________________*/
+
+void Atlas_RemapTexCoords (Object3D *object, AtlasRect *rect, int atlas_width, int atlas_height)
+{
+  if (object == 0 OR object->tex_coords == 0)
+    return;
+
+  float u0 = (float)rect->x / atlas_width,  du = (float)rect->width / atlas_width;
+  float v0 = (float)rect->y / atlas_height, dv = (float)rect->height / atlas_height;
+  for (int i=0; i<object->num_vertices; i++) {
+    object->tex_coords[i].u = u0 + object->tex_coords[i].u * du;
+    object->tex_coords[i].v = v0 + object->tex_coords[i].v * dv;
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: PackSkyline
+|
+| Output: Places images (in the given order) in an atlas of the given
+|   width.  Each goes where its top edge would be lowest, leftmost on a
+|   tie.  Returns the height used, or a huge height if an image is
+|   wider than the atlas.
+|___________________________________________________________________*/
+
+static int PackSkyline (int num_images, int *widths, int *heights, int *order, int atlas_width, AtlasRect *rects)
+{
+  std::vector<SkylineSegment> skyline;
+  int height = 0;
+
+  skyline.push_back ({ 0, 0, atlas_width });
+  for (int n=0; n<num_images; n++) {
+    int i = order[n];
+    int w = widths[i], h = heights[i];
+    int best = -1, best_y = 0, best_top = 0x7FFFFFFF;
+
+    // Find the lowest place starting at the left end of a segment
+    for (size_t s=0; s<skyline.size(); s++) {
+      int x = skyline[s].x;
+      if (x + w > atlas_width)
+        break;
+      int y = 0;
+      for (size_t t=s; t<skyline.size() AND skyline[t].x < x + w; t++)
+        y = std::max (y, skyline[t].y);
+      if (y + h < best_top) {
+        best = (int)s;
+        best_y = y;
+        best_top = y + h;
+      }
+    }
+    if (best < 0)
+      return 0x7FFFFFFF;
+
+    // Place the image and raise the skyline under it
+    int x = skyline[best].x;
+    rects[i].x = x;
+    rects[i].y = best_y;
+    rects[i].width = w;
+    rects[i].height = h;
+    height = std::max (height, best_top);
+
+    SkylineSegment top = { x, best_top, w };
+    size_t s = best;
+    while (s < skyline.size() AND skyline[s].x + skyline[s].width <= x + w)
+      skyline.erase (skyline.begin() + s);   // completely covered
+    if (s < skyline.size() AND skyline[s].x < x + w) {
+      // Partly covered - keep the part to the right
+      skyline[s].width -= x + w - skyline[s].x;
+      skyline[s].x = x + w;
+    }
+    skyline.insert (skyline.begin() + s, top);
+
+    // Merge neighbours at the same height
+    for (size_t t=1; t<skyline.size(); )
+      if (skyline[t].y == skyline[t-1].y) {
+        skyline[t-1].width += skyline[t].width;
+        skyline.erase (skyline.begin() + t);
+      }
+      else
+        t++;
+  }
+  return height;
+}
+
+/*____________________________________________________________________
+|
+| Function: RoundUp
+|
+| Output: Rounds n up to a power of 2, or a multiple of 4.
+|___________________________________________________________________*/
+
+static int RoundUp (int n, bool power_of_two)
+{
+  if (NOT power_of_two)
+    return (n + 3) & ~3;
+  int p = 4;
+  while (p < n)
+    p *= 2;
+  return p;
+}
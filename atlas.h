@@ -0,0 +1,27 @@
+/*____________________________________________________________________
+|
+| File: atlas.h
+|
+| Texture atlas: packs several images into one, so meshes using any of
+| them can be drawn without binding another texture.  Include after
+| math3d.h.
+|___________________________________________________________________*/
+
+#define ATLAS_PADDING 4     // pixels of repeated edge around each image (a whole BC block)
+
+// Where an image is in an atlas (in pixels, y from the first/bottom row)
+struct AtlasRect {
+  int x, y, width, height;
+};
+
+// Picks an atlas size and packs the images into it (skyline, bottom-left).  If
+//  power_of_two, both sides are powers of 2, otherwise multiples of 4.  Returns false
+//  if the images don't fit in max_size x max_size
+bool Atlas_Pack (int num_images, int *widths, int *heights, int padding, int max_size, bool power_of_two,
+                 AtlasRect *rects, int *atlas_width, int *atlas_height);
+// Creates the atlas image (RGB) from images placed by Atlas_Pack, filling each image's
+//  padding with copies of its edge pixels.  Caller should Mem_Free() it
+unsigned char *Atlas_Build (int num_images, unsigned char **images, AtlasRect *rects, int padding,
+                            int atlas_width, int atlas_height);
+// Remaps texture coordinates in [0,1] over a whole image to its rectangle in the atlas
+void Atlas_RemapTexCoords (Object3D *object, AtlasRect *rect, int atlas_width, int atlas_height);
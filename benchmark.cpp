@@ -0,0 +1,369 @@
+/*____________________________________________________________________
+|
+| File: benchmark.cpp
+|
+| Description: Deterministic flythrough benchmark.  A camera path is a
+|   list of segments, each holding the same user input for a number of
+|   frames.  Replaying it through update() moves the camera exactly the
+|   same way on every run, since update() moves a fixed amount per frame.
+|
+|   Camera path files are text, one segment per line:
+|     <frames> <mouse_dx> <mouse_dy> <keys>
+|   where keys is any of w,a,s,d (held down) or - for none.  Blank lines
+|   and lines starting with # are ignored.  Recorded input is written
+|   in the same format.
+|
+| Functions: Benchmark_LoadPath
+|            Benchmark_NextInput
+|            Benchmark_Done
+|            Benchmark_FrameTime
+|            Benchmark_WriteJSON
+|            Benchmark_StartRecording
+|            Benchmark_RecordInput
+|            Benchmark_StopRecording
+|            AddSegment
+|            WriteSegment
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "math3d.h"
+#include "benchmark.h"
+#include "json.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct BenchSegment {
+  int        frames;
+  BenchInput input;
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void AddSegment (int frames, int mouse_dx, int mouse_dy, const char *keys);
+static void WriteSegment ();
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+// Built-in flythrough: look around the starting point, fly in among the shields and back out
+static const struct { int frames, mouse_dx, mouse_dy; const char *keys; } builtin_path[] = {
+  { 120,  0,  0, "-"  },   // hold still
+  { 600,  0,  0, "w"  },   // fly forward
+  { 240,  1,  0, "w"  },   // turn right while flying
+  { 240, -2,  0, "-"  },   // turn back left
+  { 300,  0,  0, "wa" },   // strafe left while flying
+  { 120,  0,  1, "-"  },   // look down
+  { 120,  0, -1, "-"  },   // look back up
+  { 240,  1,  0, "s"  },   // back up while turning right
+  { 300,  0,  0, "sd" }    // back out
+};
+
+static std::vector<BenchSegment> path;
+static std::string path_name;
+static size_t segment = 0;        // current segment
+static int segment_frame = 0;     // frame within the current segment
+static std::vector<double> frame_ms;
+
+static FILE *record_fp = 0;
+static BenchSegment record_segment;
+
+/*____________________________________________________________________
+|
+| Function: Benchmark_LoadPath
+|
+| Output: Loads a camera path and resets the run.  Returns true on
+|   success.
+|___________________________________________________________________*/
+
+bool Benchmark_LoadPath (const char *filename)
+{
+  char line[256], keys[16];
+  int frames, mouse_dx, mouse_dy;
+
+  path.clear ();
+  frame_ms.clear ();
+  segment = 0;
+  segment_frame = 0;
+  path_name = filename;
+
+  if (strcmp(filename, "builtin") == 0) {
+    for (size_t i=0; i<sizeof(builtin_path)/sizeof(builtin_path[0]); i++)
+      AddSegment (builtin_path[i].frames, builtin_path[i].mouse_dx, builtin_path[i].mouse_dy, builtin_path[i].keys);
+    return true;
+  }
+
+  FILE *fp = fopen (filename, "rt");
+  if (fp == 0) {
+    printf ("Benchmark: could not open camera path %s\n", filename);
+    return false;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    if (line[0] == '#')
+      continue;
+    strcpy (keys, "-");
+    if (sscanf(line, "%d %d %d %15s", &frames, &mouse_dx, &mouse_dy, keys) >= 3)
+      AddSegment (frames, mouse_dx, mouse_dy, keys);
+  }
+  fclose (fp);
+
+  if (path.empty()) {
+    printf ("Benchmark: camera path %s is empty\n", filename);
+    return false;
+  }
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Benchmark_NextInput
+|
+| Output: Sets input to the next frame's input.  Returns false (with
+|   no input) once the path is done.
+|___________________________________________________________________*/
+
+bool Benchmark_NextInput (BenchInput *input)
+{
+  memset (input, 0, sizeof(BenchInput));
+  if (Benchmark_Done())
+    return false;
+
+  *input = path[segment].input;
+  if (++segment_frame == path[segment].frames) {
+    segment++;
+    segment_frame = 0;
+  }
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Benchmark_Done
+|
+| Output: Returns true once the whole path has been played.
+|___________________________________________________________________*/
+
+bool Benchmark_Done ()
+{
+  return segment >= path.size();
+}
+
+/*____________________________________________________________________
+|
+| Function: Benchmark_FrameTime
+|
+| Output: Records the time a frame took.
+|___________________________________________________________________*/
+
+void Benchmark_FrameTime (double ms)
+{
+  frame_ms.push_back (ms);
+}
+
+/*____________________________________________________________________
+|
+| Function: Benchmark_WriteJSON
+|
+| Output: Writes the run's settings, frame time statistics (leaving out
+|   the first BENCH_WARMUP_FRAMES frames), a histogram and every frame
+|   time to a JSON file.  Returns true on success.
+|___________________________________________________________________*/
+
+bool Benchmark_WriteJSON (const char *filename, const char *renderer, int instances, double load_ms)
+{
+  const double buckets[] = { 1, 2, 4, 8, 16.7, 33.3, 50, 100 };   // histogram upper bounds (ms)
+  const int num_buckets = sizeof(buckets) / sizeof(buckets[0]);
+  int counts[num_buckets + 1] = { 0 };
+  size_t i, n;
+  double sum = 0, sum_sq = 0;
+  char date[32];
+
+  // Statistics leave out the warmup frames
+  std::vector<double> sorted;
+  if (frame_ms.size() > BENCH_WARMUP_FRAMES)
+    sorted.assign (frame_ms.begin() + BENCH_WARMUP_FRAMES, frame_ms.end());
+  std::sort (sorted.begin(), sorted.end());
+  n = sorted.size();
+  for (i=0; i<n; i++) {
+    sum += sorted[i];
+    sum_sq += sorted[i] * sorted[i];
+    int b = 0;
+    while (b < num_buckets AND sorted[i] > buckets[b])
+      b++;
+    counts[b]++;
+  }
+  double mean = n ? sum / n : 0;
+  double stddev = n ? sqrt(fmax(0.0, sum_sq / n - mean * mean)) : 0;
+  // Nearest-rank percentile
+  #define PERCENTILE(_p_) (n ? sorted[(size_t)ceil((_p_) / 100.0 * n) - 1] : 0)
+  double p99 = PERCENTILE(99);
+
+  FILE *fp = fopen (filename, "wt");
+  if (fp == 0) {
+    printf ("Benchmark: could not write %s\n", filename);
+    return false;
+  }
+
+  time_t now = time (0);
+  strftime (date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+  fprintf (fp, "{\n");
+  fprintf (fp, "  \"path\": ");
+  JSON_WriteString (fp, path_name.c_str());
+  fprintf (fp, ",\n  \"date\": \"%s\",\n", date);
+  fprintf (fp, "  \"renderer\": ");
+  JSON_WriteString (fp, renderer ? renderer : "");
+  fprintf (fp, ",\n");
+  fprintf (fp, "  \"instances\": %d,\n", instances);
+  fprintf (fp, "  \"frames\": %d,\n", (int)frame_ms.size());
+  fprintf (fp, "  \"warmup_frames\": %d,\n", BENCH_WARMUP_FRAMES);
+  fprintf (fp, "  \"load_ms\": %.3f,\n", load_ms);
+  fprintf (fp, "  \"frame_ms\": { \"min\": %.4f, \"mean\": %.4f, \"stddev\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n",
+           n ? sorted[0] : 0, mean, stddev, PERCENTILE(50), PERCENTILE(90), PERCENTILE(95), p99, n ? sorted[n-1] : 0);
+  fprintf (fp, "  \"histogram_ms\": [");
+  for (int b=0; b<=num_buckets; b++) {
+    if (b < num_buckets)
+      fprintf (fp, "%s{ \"le\": %g, \"count\": %d }", b ? ", " : "", buckets[b], counts[b]);
+    else
+      fprintf (fp, ", { \"le\": null, \"count\": %d }", counts[b]);
+  }
+  fprintf (fp, "],\n");
+  fprintf (fp, "  \"frame_times_ms\": [");
+  for (i=0; i<frame_ms.size(); i++)
+    fprintf (fp, "%s%.4f", i ? "," : "", frame_ms[i]);
+  fprintf (fp, "]\n}\n");
+  fclose (fp);
+
+  #undef PERCENTILE
+  printf ("Benchmark: %d frames, mean %.3f ms, p99 %.3f ms - written to %s\n",
+          (int)frame_ms.size(), mean, p99, filename);
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Benchmark_StartRecording
+|
+| Output: Starts recording input to a camera path file.  Returns true
+|   on success.
+|___________________________________________________________________*/
+
+bool Benchmark_StartRecording (const char *filename)
+{
+  record_fp = fopen (filename, "wt");
+  if (record_fp == 0) {
+    printf ("Benchmark: could not write camera path %s\n", filename);
+    return false;
+  }
+  fprintf (record_fp, "# frames mouse_dx mouse_dy keys\n");
+  memset (&record_segment, 0, sizeof(record_segment));
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Benchmark_RecordInput
+|
+| Output: Records one frame of input, merging it into the current
+|   segment if the input hasn't changed.
+|___________________________________________________________________*/
+
+void Benchmark_RecordInput (BenchInput *input)
+{
+  if (record_fp == 0)
+    return;
+
+  if (record_segment.frames AND memcmp(input, &record_segment.input, sizeof(BenchInput)) == 0)
+    record_segment.frames++;
+  else {
+    WriteSegment ();
+    record_segment.frames = 1;
+    record_segment.input = *input;
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: Benchmark_StopRecording
+|
+| Output: Writes any unfinished segment and closes the recording.
+|___________________________________________________________________*/
+
+void Benchmark_StopRecording ()
+{
+  if (record_fp) {
+    WriteSegment ();
+    fclose (record_fp);
+    record_fp = 0;
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: AddSegment
+|
+| Output: Adds a segment to the path.
+|___________________________________________________________________*/
+
+static void AddSegment (int frames, int mouse_dx, int mouse_dy, const char *keys)
+{
+  BenchSegment s;
+
+  if (frames <= 0)
+    return;
+  memset (&s, 0, sizeof(s));
+  s.frames = frames;
+  s.input.mouse_dx = mouse_dx;
+  s.input.mouse_dy = mouse_dy;
+  s.input.forward  = strchr(keys, 'w') != 0;
+  s.input.back     = strchr(keys, 's') != 0;
+  s.input.left     = strchr(keys, 'a') != 0;
+  s.input.right    = strchr(keys, 'd') != 0;
+  path.push_back (s);
+}
+
+/*____________________________________________________________________
+|
+| Function: WriteSegment
+|
+| Output: Writes the segment being recorded, if any, to the recording.
+|___________________________________________________________________*/
+
+static void WriteSegment ()
+{
+  char keys[8], *k = keys;
+  BenchInput *input = &record_segment.input;
+
+  if (record_segment.frames == 0)
+    return;
+  if (input->forward) *k++ = 'w';
+  if (input->left)    *k++ = 'a';
+  if (input->back)    *k++ = 's';
+  if (input->right)   *k++ = 'd';
+  if (k == keys)      *k++ = '-';
+  *k = 0;
+  fprintf (record_fp, "%d %d %d %s\n", record_segment.frames, input->mouse_dx, input->mouse_dy, keys);
+}
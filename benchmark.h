@@ -0,0 +1,28 @@
+/*____________________________________________________________________
+|
+| File: benchmark.h
+|___________________________________________________________________*/
+
+#define BENCH_WARMUP_FRAMES 10  // # of frames at the start of a run left out of the statistics
+
+// User input for one frame (what the mouse and keyboard callbacks would have set)
+struct BenchInput {
+  int  mouse_dx, mouse_dy;              // mouse movement from the window center, in pixels
+  bool forward, back, left, right;      // W, S, A, D held down
+};
+
+// Loads a camera path file (or the built-in flythrough if filename is "builtin")
+bool Benchmark_LoadPath (const char *filename);
+// Gets the input for the next frame of the path, returns false once the path is done
+bool Benchmark_NextInput (BenchInput *input);
+// Returns true once every frame of the path has been played
+bool Benchmark_Done ();
+// Records how long a frame took
+void Benchmark_FrameTime (double ms);
+// Writes the run's settings and frame time distribution as JSON
+bool Benchmark_WriteJSON (const char *filename, const char *renderer, int instances, double load_ms);
+
+// Records live input to a camera path file that Benchmark_LoadPath() can replay
+bool Benchmark_StartRecording (const char *filename);
+void Benchmark_RecordInput (BenchInput *input);
+void Benchmark_StopRecording ();
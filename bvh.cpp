@@ -0,0 +1,1237 @@
+/*____________________________________________________________________
+|
+| File: bvh.cpp
+|
+| Description: Bounding volume hierarchies.  Nodes are split top down
+|   with an explicit stack: the centers of a node's primitives are
+|   dropped into 16 bins along each axis, and the split between two bins
+|   that costs least by the surface area heuristic (the area of each side
+|   times its # of primitives) is taken.  Nodes with up to 4 primitives
+|   become leaves.  Nodes whose centers are all in one spot, or that are
+|   halfway to the deepest a tree may be, are split in half instead.
+|   Children are stored next to each other, so a node only needs the
+|   first one.
+|
+|   A triangle leaf is one packet of 4 triangles with their first
+|   vertex and two edges laid out by lane, tested against a ray at once
+|   with SSE (Moller-Trumbore, both sides hit).  Traversal visits the
+|   nearer child first and skips boxes beyond the closest hit so far.
+|
+|   A sphere sweep is a ray cast with the boxes grown by the radius.
+|   Against a triangle it finds where the sphere first meets the face's
+|   plane inside the triangle, or else the first of its edges and
+|   corners it meets.  A sphere that starts out touching a triangle
+|   (Ericson's closest point on a triangle) is stopped at once if it
+|   moves in, and left to move away otherwise, so a camera pressed
+|   against a wall can still slide along it or back off.
+|
+|   A mesh whose vertices move (a blended morph pose) keeps its tree:
+|   refitting rewrites the packets from the new positions and grows
+|   each box back around its children, children being stored after
+|   their parents.  The splits may fit the new pose less well, but
+|   every query stays exact.
+|
+|   A mesh's BVH is saved with a checksum of the positions and polygons
+|   it was built for, so an old file (or one in a pack) is never used
+|   for a changed mesh: it is built again instead.
+|
+| Functions: BVH_Build
+|            BVH_BuildSpheres
+|            BVH_Refit
+|            BVH_Free
+|            BVH_Size
+|            BVH_Intersect
+|            BVH_SweepSphere
+|            BVH_IntersectSpheres
+|            BVH_IntersectAll
+|            BVH_GetStats
+|            BVH_ResetStats
+|            BVH_Checksum
+|            BVH_Save
+|            BVH_Load
+|            BVH_Name
+|            BuildNodes
+|            NewBVH
+|            ReadBVH
+|            IsValid
+|            SetupRay
+|            Traverse
+|            HitBox
+|            HitPacket
+|            HitTriangle
+|            SweepPacket
+|            SweepTriangle
+|            ClosestPoint
+|            LowestRoot
+|            Dot
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <vector>
+#include <algorithm>
+#include "math3d.h"
+#include "memtrack.h"
+#include "cpu.h"
+#include "pack.h"
+#include "trace.h"
+#include "bvh.h"
+
+#ifdef CPU_X86
+#include <xmmintrin.h>    // SSE
+#endif
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define SAH_BINS   16
+#define EPSILON    1e-12f       // smallest determinant of a triangle that is hit (edge on is missed)
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+// Bounds and center of a primitive being built into a tree
+struct Box {
+  float min[3], max[3];
+  float center[3];
+};
+
+// A ray set up for box tests
+struct Ray {
+  Vector3D origin, dir;
+  float inv_dir[3];
+  float radius;                 // of the sphere swept along it, 0 = a ray
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void BuildNodes (std::vector<Box> &boxes, std::vector<BVHNode> &nodes, std::vector<int> &order);
+static BVH *NewBVH (int num_nodes, int num_packets, int num_spheres);
+static BVH *ReadBVH (char *filename, bool search_packs, Object3D *object, unsigned checksum, bool *stale);
+static bool IsValid (BVH *bvh, int num_polygons);
+static void SetupRay (Ray *ray, Vector3D *origin, Vector3D *dir, float radius);
+static bool Traverse (BVH *bvh, Ray *ray, BVHHit *hit, BVHSphereFn test, void *data);
+static bool HitBox (BVHNode *node, Ray *ray, float max_t, float *t);
+static bool HitPacket (BVHPacket *packet, Ray *ray, BVHHit *hit);
+static bool HitTriangle (Vector3D *v0, Vector3D *e1, Vector3D *e2, Vector3D *origin, Vector3D *dir, float *t, float *u, float *v);
+static bool SweepPacket (BVHPacket *packet, Ray *ray, BVHHit *hit);
+static bool SweepTriangle (Vector3D p[3], Ray *ray, float max_t, float *t, Vector3D *contact);
+static void ClosestPoint (Vector3D p[3], Vector3D *point, Vector3D *closest);
+static bool LowestRoot (float a, float b, float c, float max, float *root);
+static inline float Dot (Vector3D *a, Vector3D *b);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static BVHStats stats;
+
+/*____________________________________________________________________
+|
+| Function: BVH_Build
+|
+| Output: Builds a BVH over an object's triangles.  Returns it, or 0 if
+|   out of memory.
+|___________________________________________________________________*/
+
+BVH *BVH_Build (Object3D *object)
+{
+  int i, j, k;
+  std::vector<Box> boxes (object->num_polygons);
+  std::vector<BVHNode> nodes;
+  std::vector<int> order;
+
+  TraceScope trace("BVH_Build");
+
+  for (i=0; i<object->num_polygons; i++) {
+    Box *b = &boxes[i];
+    for (k=0; k<3; k++) {
+      b->min[k] = FLT_MAX;
+      b->max[k] = -FLT_MAX;
+    }
+    for (j=0; j<3; j++) {
+      float *p = &object->vertex[object->polygon[i].index[j]].x;
+      for (k=0; k<3; k++) {
+        b->min[k] = std::min (b->min[k], p[k]);
+        b->max[k] = std::max (b->max[k], p[k]);
+      }
+    }
+    for (k=0; k<3; k++)
+      b->center[k] = (b->min[k] + b->max[k]) * 0.5f;
+  }
+  BuildNodes (boxes, nodes, order);
+
+  // Each leaf's triangles become a packet
+  int num_packets = 0;
+  for (i=0; i<(int)nodes.size(); i++)
+    if (nodes[i].count)
+      num_packets++;
+  BVH *bvh = NewBVH ((int)nodes.size(), num_packets, 0);
+  if (bvh == 0)
+    return 0;
+  bvh->checksum = BVH_Checksum (object);
+  if (nodes.size())
+    memcpy (BVH_NODES(bvh), &nodes[0], nodes.size() * sizeof(BVHNode));
+
+  BVHPacket *packets = BVH_PACKETS(bvh);
+  memset (packets, 0, num_packets * sizeof(BVHPacket));
+  int n = 0;
+  for (i=0; i<(int)nodes.size(); i++) {
+    BVHNode *node = &BVH_NODES(bvh)[i];
+    if (node->count == 0)
+      continue;
+    BVHPacket *packet = &packets[n];
+    for (j=0; j<4; j++) {
+      packet->polygon[j] = -1;
+      if (j >= node->count)
+        continue;
+      int poly = order[node->first + j];
+      unsigned short *index = object->polygon[poly].index;
+      Vector3D *v0 = &object->vertex[index[0]], *v1 = &object->vertex[index[1]], *v2 = &object->vertex[index[2]];
+      packet->v0[0][j] = v0->x;          packet->v0[1][j] = v0->y;          packet->v0[2][j] = v0->z;
+      packet->e1[0][j] = v1->x - v0->x;  packet->e1[1][j] = v1->y - v0->y;  packet->e1[2][j] = v1->z - v0->z;
+      packet->e2[0][j] = v2->x - v0->x;  packet->e2[1][j] = v2->y - v0->y;  packet->e2[2][j] = v2->z - v0->z;
+      packet->polygon[j] = poly;
+    }
+    node->first = n++;
+  }
+  return bvh;
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_BuildSpheres
+|
+| Output: Builds a BVH over n spheres.  Returns it, or 0 if out of
+|   memory.
+|___________________________________________________________________*/
+
+BVH *BVH_BuildSpheres (Vector3D *centers, float *radii, int n)
+{
+  std::vector<Box> boxes (n);
+  std::vector<BVHNode> nodes;
+  std::vector<int> order;
+
+  for (int i=0; i<n; i++) {
+    float *c = &centers[i].x;
+    for (int k=0; k<3; k++) {
+      boxes[i].min[k] = c[k] - radii[i];
+      boxes[i].max[k] = c[k] + radii[i];
+      boxes[i].center[k] = c[k];
+    }
+  }
+  BuildNodes (boxes, nodes, order);
+
+  BVH *bvh = NewBVH ((int)nodes.size(), 0, n);
+  if (bvh AND n) {
+    memcpy (BVH_NODES(bvh), &nodes[0], nodes.size() * sizeof(BVHNode));
+    memcpy (BVH_SPHERES(bvh), &order[0], n * sizeof(int));
+  }
+  return bvh;
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_Refit
+|
+| Output: Moves a mesh BVH's triangles to other positions of the mesh's
+|   vertices (vertex i's x,y,z at positions[i*stride]), and fits its
+|   boxes to them.
+|___________________________________________________________________*/
+
+void BVH_Refit (BVH *bvh, Object3D *object, float *positions, int stride)
+{
+  int i, j, k;
+  BVHNode *nodes = BVH_NODES(bvh);
+  BVHPacket *packets = BVH_PACKETS(bvh);
+
+  // Children come after their parents, so going backwards reaches them first
+  for (i=(int)bvh->num_nodes-1; i>=0; i--) {
+    BVHNode *node = &nodes[i];
+    for (k=0; k<3; k++) {
+      node->min[k] = FLT_MAX;
+      node->max[k] = -FLT_MAX;
+    }
+    if (node->count == 0) {
+      for (j=0; j<2; j++)
+        for (k=0; k<3; k++) {
+          node->min[k] = std::min (node->min[k], nodes[node->first + j].min[k]);
+          node->max[k] = std::max (node->max[k], nodes[node->first + j].max[k]);
+        }
+      continue;
+    }
+    BVHPacket *packet = &packets[node->first];
+    for (j=0; j<4; j++) {
+      if (packet->polygon[j] < 0)
+        continue;
+      unsigned short *index = object->polygon[packet->polygon[j]].index;
+      float *p[3];
+      for (k=0; k<3; k++)
+        p[k] = positions + (size_t)index[k] * stride;
+      for (k=0; k<3; k++) {
+        packet->v0[k][j] = p[0][k];
+        packet->e1[k][j] = p[1][k] - p[0][k];
+        packet->e2[k][j] = p[2][k] - p[0][k];
+        node->min[k] = std::min (node->min[k], std::min (p[0][k], std::min (p[1][k], p[2][k])));
+        node->max[k] = std::max (node->max[k], std::max (p[0][k], std::max (p[1][k], p[2][k])));
+      }
+    }
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_Free
+|
+| Output: Frees a BVH (0 is ignored).
+|___________________________________________________________________*/
+
+void BVH_Free (BVH *bvh)
+{
+  Mem_Free (bvh);
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_Size
+|
+| Output: Returns the # of bytes in a BVH's block.
+|___________________________________________________________________*/
+
+size_t BVH_Size (BVH *bvh)
+{
+  return sizeof(BVH) + bvh->num_nodes * sizeof(BVHNode) + bvh->num_packets * sizeof(BVHPacket) +
+         bvh->num_spheres * sizeof(int);
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_Intersect
+|
+| Output: Finds the closest triangle a ray hits before hit->t and sets
+|   hit to it.  Returns true if one was found.
+|___________________________________________________________________*/
+
+bool BVH_Intersect (BVH *bvh, Vector3D *origin, Vector3D *dir, BVHHit *hit)
+{
+  Ray ray;
+
+  SetupRay (&ray, origin, dir, 0);
+  return Traverse (bvh, &ray, hit, 0, 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_SweepSphere
+|
+| Output: Finds the first triangle a sphere moving from center to
+|   center+move*hit->t touches and sets hit to it.  Returns true if one
+|   was found.
+|___________________________________________________________________*/
+
+bool BVH_SweepSphere (BVH *bvh, Vector3D *center, Vector3D *move, float radius, BVHHit *hit)
+{
+  Ray ray;
+
+  SetupRay (&ray, center, move, radius);
+  return Traverse (bvh, &ray, hit, 0, 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_IntersectSpheres
+|
+| Output: Calls test() on each sphere of a sphere BVH whose box the ray
+|   hits before hit->t, nearest boxes first.  Returns true if one of
+|   them found a hit.
+|___________________________________________________________________*/
+
+bool BVH_IntersectSpheres (BVH *bvh, Vector3D *origin, Vector3D *dir, float radius, BVHHit *hit,
+                           BVHSphereFn test, void *data)
+{
+  Ray ray;
+
+  SetupRay (&ray, origin, dir, radius);
+  return Traverse (bvh, &ray, hit, test, data);
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_IntersectAll
+|
+| Output: Finds the closest triangle of an object a ray hits before
+|   hit->t by testing every polygon.  Returns true if one was found.
+|___________________________________________________________________*/
+
+bool BVH_IntersectAll (Object3D *object, Vector3D *origin, Vector3D *dir, BVHHit *hit)
+{
+  Vector3D e1, e2;
+  float t, u, v;
+  bool found = false;
+
+  for (int i=0; i<object->num_polygons; i++) {
+    unsigned short *index = object->polygon[i].index;
+    Vector3D *v0 = &object->vertex[index[0]];
+    SubtractVector (&object->vertex[index[1]], v0, &e1);
+    SubtractVector (&object->vertex[index[2]], v0, &e2);
+    if (HitTriangle(v0, &e1, &e2, origin, dir, &t, &u, &v) AND t < hit->t) {
+      hit->t = t;
+      hit->polygon = i;
+      hit->u = u;
+      hit->v = v;
+      found = true;
+    }
+  }
+  return found;
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_GetStats
+|
+| Output: Sets stats to the counts kept since the last reset.
+|___________________________________________________________________*/
+
+void BVH_GetStats (BVHStats *s)
+{
+  *s = stats;
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_ResetStats
+|
+| Output: Starts counting again.
+|___________________________________________________________________*/
+
+void BVH_ResetStats ()
+{
+  memset (&stats, 0, sizeof(stats));
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_Checksum
+|
+| Output: Returns a checksum (32-bit FNV-1a) of an object's vertex
+|   positions and polygons.
+|___________________________________________________________________*/
+
+unsigned BVH_Checksum (Object3D *object)
+{
+  unsigned h = 2166136261u;
+  const unsigned char *p;
+  size_t i, n;
+
+  p = (const unsigned char *) object->vertex;
+  n = object->num_vertices * sizeof(Vector3D);
+  for (i=0; i<n; i++)
+    h = (h ^ p[i]) * 16777619u;
+  p = (const unsigned char *) object->polygon;
+  n = object->num_polygons * sizeof(Polygon3D);
+  for (i=0; i<n; i++)
+    h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_Save
+|
+| Output: Writes a BVH to a file.  Returns true on success.
+|___________________________________________________________________*/
+
+bool BVH_Save (BVH *bvh, char *filename)
+{
+  TraceScope trace("BVH_Save");
+
+  // Write the file under another name and then replace the old one (another thread may be
+  // reading it)
+  char temp[1024];
+  snprintf (temp, sizeof(temp), "%s.tmp", filename);
+  FILE *fp = fopen (temp, "wb");
+  bool ok = fp != 0;
+  if (ok) {
+    size_t size = BVH_Size (bvh);
+    ok = fwrite(bvh, 1, size, fp) == size;
+    ok = (fclose(fp) == 0) AND ok;
+  }
+#ifdef _WIN32
+  if (ok)
+    remove (filename);
+#endif
+  if (ok)
+    ok = rename (temp, filename) == 0;
+  if (NOT ok) {
+    printf ("%s: could not write the BVH\n", filename);
+    remove (temp);
+  }
+  return ok;
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_Load
+|
+| Output: Reads a BVH file (from a pack if there is one in a pack, or
+|   else from disk) if it was built for this object.  Returns the BVH,
+|   or 0.
+|___________________________________________________________________*/
+
+BVH *BVH_Load (char *filename, Object3D *object)
+{
+  bool stale;
+
+  TraceScope trace("BVH_Load");
+
+  // One in a pack may be older than the one on disk
+  unsigned checksum = BVH_Checksum (object);
+  BVH *bvh = ReadBVH (filename, true, object, checksum, &stale);
+  if (bvh == 0 AND stale)
+    bvh = ReadBVH (filename, false, object, checksum, &stale);
+  return bvh;
+}
+
+/*____________________________________________________________________
+|
+| Function: BVH_Name
+|
+| Output: Sets filename to the OBJ name with its extension replaced by
+|   .kbv.
+|___________________________________________________________________*/
+
+void BVH_Name (char *obj_filename, char *filename, int size)
+{
+  const char *dot = strrchr (obj_filename, '.');
+  const char *slash = strpbrk (dot ? dot : obj_filename, "/\\");
+  int len = (dot AND slash == 0) ? (int)(dot - obj_filename) : (int)strlen(obj_filename);
+
+  snprintf (filename, size, "%.*s.kbv", len, obj_filename);
+}
+
+/*____________________________________________________________________
+|
+| Function: BuildNodes
+|
+| Output: Builds the nodes of a tree over boxes (root first).  Sets
+|   order to the box numbers sorted so each leaf's are order[first] to
+|   order[first+count-1].
+|___________________________________________________________________*/
+
+static void BuildNodes (std::vector<Box> &boxes, std::vector<BVHNode> &nodes, std::vector<int> &order)
+{
+  struct Range { int node, begin, end, depth; };
+  struct Bin { float min[3], max[3]; int count; };
+  Range stack[BVH_MAX_DEPTH+1];
+  int i, j, k, n = (int)boxes.size();
+
+  order.resize (n);
+  for (i=0; i<n; i++)
+    order[i] = i;
+  nodes.clear ();
+  if (n == 0)
+    return;
+  nodes.reserve (2 * ((n + BVH_LEAF_SIZE - 1) / BVH_LEAF_SIZE));
+  BVHNode root = {{0,0,0}, 0, {0,0,0}, n};
+  nodes.push_back (root);
+
+  int top = 0;
+  stack[top++] = {0, 0, n, 0};
+  while (top) {
+    Range r = stack[--top];
+    BVHNode *node = &nodes[r.node];
+
+    // Bound the boxes and their centers
+    float cmin[3], cmax[3];
+    for (k=0; k<3; k++) {
+      node->min[k] = cmin[k] = FLT_MAX;
+      node->max[k] = cmax[k] = -FLT_MAX;
+    }
+    for (i=r.begin; i<r.end; i++) {
+      Box *b = &boxes[order[i]];
+      for (k=0; k<3; k++) {
+        node->min[k] = std::min (node->min[k], b->min[k]);
+        node->max[k] = std::max (node->max[k], b->max[k]);
+        cmin[k] = std::min (cmin[k], b->center[k]);
+        cmax[k] = std::max (cmax[k], b->center[k]);
+      }
+    }
+    node->first = r.begin;
+    node->count = r.end - r.begin;
+    if (node->count <= BVH_LEAF_SIZE)
+      continue;
+
+    // Find the cheapest split between bins along any axis
+    int best_axis = -1, best_bin = 0;
+    float best_cost = FLT_MAX;
+    for (int axis=0; axis<3; axis++) {
+      float extent = cmax[axis] - cmin[axis];
+      if (extent <= 0)
+        continue;
+      Bin bins[SAH_BINS];
+      for (j=0; j<SAH_BINS; j++) {
+        for (k=0; k<3; k++) {
+          bins[j].min[k] = FLT_MAX;
+          bins[j].max[k] = -FLT_MAX;
+        }
+        bins[j].count = 0;
+      }
+      float scale = SAH_BINS / extent;
+      for (i=r.begin; i<r.end; i++) {
+        Box *b = &boxes[order[i]];
+        int bin = std::min ((int)((b->center[axis] - cmin[axis]) * scale), SAH_BINS - 1);
+        for (k=0; k<3; k++) {
+          bins[bin].min[k] = std::min (bins[bin].min[k], b->min[k]);
+          bins[bin].max[k] = std::max (bins[bin].max[k], b->max[k]);
+        }
+        bins[bin].count++;
+      }
+      // Sweep from the right for the cost of each right side, then from the left
+      float right_cost[SAH_BINS];
+      Bin side = {{FLT_MAX,FLT_MAX,FLT_MAX}, {-FLT_MAX,-FLT_MAX,-FLT_MAX}, 0};
+      for (j=SAH_BINS-1; j>0; j--) {
+        for (k=0; k<3; k++) {
+          side.min[k] = std::min (side.min[k], bins[j].min[k]);
+          side.max[k] = std::max (side.max[k], bins[j].max[k]);
+        }
+        side.count += bins[j].count;
+        float dx = side.max[0] - side.min[0], dy = side.max[1] - side.min[1], dz = side.max[2] - side.min[2];
+        right_cost[j] = side.count ? (dx*dy + dy*dz + dz*dx) * side.count : 0;
+      }
+      for (k=0; k<3; k++) {
+        side.min[k] = FLT_MAX;
+        side.max[k] = -FLT_MAX;
+      }
+      side.count = 0;
+      for (j=0; j<SAH_BINS-1; j++) {
+        for (k=0; k<3; k++) {
+          side.min[k] = std::min (side.min[k], bins[j].min[k]);
+          side.max[k] = std::max (side.max[k], bins[j].max[k]);
+        }
+        side.count += bins[j].count;
+        if (side.count == 0 OR side.count == node->count)
+          continue;
+        float dx = side.max[0] - side.min[0], dy = side.max[1] - side.min[1], dz = side.max[2] - side.min[2];
+        float cost = (dx*dy + dy*dz + dz*dx) * side.count + right_cost[j+1];
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_bin = j;
+        }
+      }
+    }
+
+    // Move the boxes left of the split to the front (with the same bin math as above)
+    int mid = r.begin;
+    if (best_axis >= 0 AND r.depth < BVH_MAX_DEPTH / 2) {
+      float scale = SAH_BINS / (cmax[best_axis] - cmin[best_axis]);
+      for (i=r.begin; i<r.end; i++) {
+        float c = boxes[order[i]].center[best_axis];
+        if (std::min ((int)((c - cmin[best_axis]) * scale), SAH_BINS - 1) <= best_bin)
+          std::swap (order[i], order[mid++]);
+      }
+    }
+    // The centers are all in one spot, or the SAH has made the tree lopsided: split in half
+    // (which keeps it within BVH_MAX_DEPTH)
+    else
+      mid = r.begin + node->count / 2;
+
+    int left = (int)nodes.size();
+    BVHNode child = {{0,0,0}, 0, {0,0,0}, 0};
+    nodes.push_back (child);
+    nodes.push_back (child);
+    node = &nodes[r.node];
+    node->first = left;
+    node->count = 0;
+    stack[top++] = {left + 1, mid, r.end, r.depth + 1};
+    stack[top++] = {left, r.begin, mid, r.depth + 1};
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: NewBVH
+|
+| Output: Allocates a BVH's block and fills in its header.  Returns it,
+|   or 0 if out of memory.
+|___________________________________________________________________*/
+
+static BVH *NewBVH (int num_nodes, int num_packets, int num_spheres)
+{
+  BVH h;
+
+  memset (&h, 0, sizeof(h));
+  memcpy (h.magic, BVH_MAGIC, 4);
+  h.version     = BVH_VERSION;
+  h.endianness  = BVH_ENDIANNESS;
+  h.num_nodes   = num_nodes;
+  h.num_packets = num_packets;
+  h.num_spheres = num_spheres;
+  BVH *bvh = (BVH *) Mem_Alloc (MEM_MESH, BVH_Size(&h));
+  if (bvh)
+    *bvh = h;
+  return bvh;
+}
+
+/*____________________________________________________________________
+|
+| Function: ReadBVH
+|
+| Output: Reads a BVH file (looking in the packs first if search_packs
+|   is set) if it was built for this object.  Sets stale if it was found
+|   in a pack but couldn't be used.  Returns the BVH, or 0.
+|___________________________________________________________________*/
+
+static BVH *ReadBVH (char *filename, bool search_packs, Object3D *object, unsigned checksum, bool *stale)
+{
+  PackFile file;
+  BVH *bvh = 0;
+
+  *stale = false;
+  bool found = search_packs ? Pack_ReadFile (filename, &file) : Pack_MapFile (filename, &file);
+  if (NOT found)
+    return 0;
+  if (file.size >= sizeof(BVH)) {
+    BVH h;
+    memcpy (&h, file.data, sizeof(h));
+    if (memcmp(h.magic, BVH_MAGIC, 4) == 0 AND h.version == BVH_VERSION AND h.endianness == BVH_ENDIANNESS AND
+        h.checksum == checksum AND h.num_spheres == 0 AND h.num_nodes > 0 AND
+        h.num_nodes <= 2 * (unsigned)object->num_polygons + 1 AND h.num_packets <= (unsigned)object->num_polygons AND
+        BVH_Size(&h) == file.size) {
+      bvh = (BVH *) Mem_Alloc (MEM_MESH, file.size);
+      if (bvh) {
+        memcpy (bvh, file.data, file.size);
+        if (NOT IsValid(bvh, object->num_polygons)) {
+          printf ("%s: not a valid BVH, rebuilding\n", filename);
+          Mem_Free (bvh);
+          bvh = 0;
+        }
+      }
+    }
+  }
+  *stale = bvh == 0 AND file.in_pack;
+  Pack_CloseFile (&file);
+  return bvh;
+}
+
+/*____________________________________________________________________
+|
+| Function: IsValid
+|
+| Output: Returns true if a BVH read from a file can be traversed
+|   safely: children follow their parent, leaves point at packets that
+|   exist, the tree isn't too deep for the traversal stack and the
+|   packets only name polygons the object has.
+|___________________________________________________________________*/
+
+static bool IsValid (BVH *bvh, int num_polygons)
+{
+  int stack[BVH_MAX_DEPTH+1][2];
+  BVHNode *nodes = BVH_NODES(bvh);
+  unsigned i;
+  int j;
+
+  int top = 0;
+  stack[top][0] = 0;
+  stack[top++][1] = 0;
+  while (top) {
+    top--;
+    int n = stack[top][0], depth = stack[top][1];
+    BVHNode *node = &nodes[n];
+    if (node->count) {
+      if (node->count < 0 OR node->count > 4 OR node->first < 0 OR node->first >= (int)bvh->num_packets)
+        return false;
+      continue;
+    }
+    if (node->first <= n OR node->first + 1 >= (int)bvh->num_nodes OR depth >= BVH_MAX_DEPTH - 1)
+      return false;
+    stack[top][0] = node->first;
+    stack[top++][1] = depth + 1;
+    stack[top][0] = node->first + 1;
+    stack[top++][1] = depth + 1;
+  }
+  for (i=0; i<bvh->num_packets; i++)
+    for (j=0; j<4; j++) {
+      int poly = BVH_PACKETS(bvh)[i].polygon[j];
+      if (poly < -1 OR poly >= num_polygons)
+        return false;
+    }
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: SetupRay
+|
+| Output: Sets up a ray (or the path of a sphere) for Traverse().
+|___________________________________________________________________*/
+
+static void SetupRay (Ray *ray, Vector3D *origin, Vector3D *dir, float radius)
+{
+  ray->origin = *origin;
+  ray->dir = *dir;
+  // Division by zero gives an infinity, which the slab test handles
+  ray->inv_dir[0] = 1 / dir->x;
+  ray->inv_dir[1] = 1 / dir->y;
+  ray->inv_dir[2] = 1 / dir->z;
+  ray->radius = radius;
+}
+
+/*____________________________________________________________________
+|
+| Function: Traverse
+|
+| Output: Walks the boxes a ray hits before hit->t, nearer child first,
+|   testing the packets (or calling test() on the spheres) in the leaves.
+|   Returns true if a closer hit was found.
+|___________________________________________________________________*/
+
+static bool Traverse (BVH *bvh, Ray *ray, BVHHit *hit, BVHSphereFn test, void *data)
+{
+  // Each level pushes at most one node (the farther child) and pops its parent
+  int stack[BVH_MAX_DEPTH+1];
+  BVHNode *nodes = BVH_NODES(bvh);
+  float t_near, t_far;
+  bool found = false;
+
+  stats.queries++;
+  if (bvh->num_nodes == 0 OR NOT HitBox(&nodes[0], ray, hit->t, &t_near))
+    return false;
+  int top = 0;
+  stack[top++] = 0;
+  while (top) {
+    BVHNode *node = &nodes[stack[--top]];
+    stats.nodes++;
+    if (node->count) {
+      if (test) {
+        float t = hit->t;
+        for (int i=0; i<node->count; i++)
+          test (data, BVH_SPHERES(bvh)[node->first + i], &ray->origin, &ray->dir, hit);
+        stats.spheres += node->count;
+        found = found OR hit->t < t;
+      }
+      else {
+        stats.triangles += node->count;
+        if (ray->radius > 0 ? SweepPacket(&BVH_PACKETS(bvh)[node->first], ray, hit) :
+                              HitPacket(&BVH_PACKETS(bvh)[node->first], ray, hit))
+          found = true;
+      }
+      continue;
+    }
+    BVHNode *left = &nodes[node->first], *right = left + 1;
+    bool hit_left  = HitBox (left, ray, hit->t, &t_near);
+    bool hit_right = HitBox (right, ray, hit->t, &t_far);
+    if (hit_left AND hit_right) {
+      // Visit the nearer one first (it's popped first)
+      if (t_near <= t_far) {
+        stack[top++] = node->first + 1;
+        stack[top++] = node->first;
+      }
+      else {
+        stack[top++] = node->first;
+        stack[top++] = node->first + 1;
+      }
+    }
+    else if (hit_left)
+      stack[top++] = node->first;
+    else if (hit_right)
+      stack[top++] = node->first + 1;
+  }
+  return found;
+}
+
+/*____________________________________________________________________
+|
+| Function: HitBox
+|
+| Output: Returns true if a ray hits a node's box (grown by the ray's
+|   radius) between 0 and max_t, and sets t to where it enters.
+|___________________________________________________________________*/
+
+static bool HitBox (BVHNode *node, Ray *ray, float max_t, float *t)
+{
+  const float *origin = &ray->origin.x;
+  float t0 = 0, t1 = max_t;
+
+  for (int k=0; k<3; k++) {
+    float a = (node->min[k] - ray->radius - origin[k]) * ray->inv_dir[k];
+    float b = (node->max[k] + ray->radius - origin[k]) * ray->inv_dir[k];
+    // A NaN (ray in the slab's plane, parallel to it) leaves the range as it is
+    if (a > b)
+      std::swap (a, b);
+    if (a > t0) t0 = a;
+    if (b < t1) t1 = b;
+  }
+  *t = t0;
+  return t0 <= t1;
+}
+
+/*____________________________________________________________________
+|
+| Function: HitPacket
+|
+| Output: Tests a ray against a packet's triangles and sets hit to the
+|   closest one before hit->t.  Returns true if one was found.
+|___________________________________________________________________*/
+
+static bool HitPacket (BVHPacket *packet, Ray *ray, BVHHit *hit)
+{
+  float t[4], u[4], v[4];
+  int mask = 0;
+
+#ifdef CPU_X86
+  __m128 dx = _mm_set1_ps (ray->dir.x), dy = _mm_set1_ps (ray->dir.y), dz = _mm_set1_ps (ray->dir.z);
+  __m128 e1x = _mm_loadu_ps (packet->e1[0]), e1y = _mm_loadu_ps (packet->e1[1]), e1z = _mm_loadu_ps (packet->e1[2]);
+  __m128 e2x = _mm_loadu_ps (packet->e2[0]), e2y = _mm_loadu_ps (packet->e2[1]), e2z = _mm_loadu_ps (packet->e2[2]);
+
+  // p = dir x e2, det = e1 . p
+  __m128 px = _mm_sub_ps (_mm_mul_ps (dy, e2z), _mm_mul_ps (dz, e2y));
+  __m128 py = _mm_sub_ps (_mm_mul_ps (dz, e2x), _mm_mul_ps (dx, e2z));
+  __m128 pz = _mm_sub_ps (_mm_mul_ps (dx, e2y), _mm_mul_ps (dy, e2x));
+  __m128 det = _mm_add_ps (_mm_add_ps (_mm_mul_ps (e1x, px), _mm_mul_ps (e1y, py)), _mm_mul_ps (e1z, pz));
+  __m128 abs_det = _mm_andnot_ps (_mm_set1_ps (-0.0f), det);
+  __m128 ok = _mm_cmpgt_ps (abs_det, _mm_set1_ps (EPSILON));
+  __m128 inv = _mm_div_ps (_mm_set1_ps (1), det);
+
+  // s = origin - v0, u = (s . p) / det
+  __m128 sx = _mm_sub_ps (_mm_set1_ps (ray->origin.x), _mm_loadu_ps (packet->v0[0]));
+  __m128 sy = _mm_sub_ps (_mm_set1_ps (ray->origin.y), _mm_loadu_ps (packet->v0[1]));
+  __m128 sz = _mm_sub_ps (_mm_set1_ps (ray->origin.z), _mm_loadu_ps (packet->v0[2]));
+  __m128 uu = _mm_mul_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (sx, px), _mm_mul_ps (sy, py)), _mm_mul_ps (sz, pz)), inv);
+
+  // q = s x e1, v = (dir . q) / det, t = (e2 . q) / det
+  __m128 qx = _mm_sub_ps (_mm_mul_ps (sy, e1z), _mm_mul_ps (sz, e1y));
+  __m128 qy = _mm_sub_ps (_mm_mul_ps (sz, e1x), _mm_mul_ps (sx, e1z));
+  __m128 qz = _mm_sub_ps (_mm_mul_ps (sx, e1y), _mm_mul_ps (sy, e1x));
+  __m128 vv = _mm_mul_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (dx, qx), _mm_mul_ps (dy, qy)), _mm_mul_ps (dz, qz)), inv);
+  __m128 tt = _mm_mul_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (e2x, qx), _mm_mul_ps (e2y, qy)), _mm_mul_ps (e2z, qz)), inv);
+
+  __m128 zero = _mm_setzero_ps ();
+  ok = _mm_and_ps (ok, _mm_cmpge_ps (uu, zero));
+  ok = _mm_and_ps (ok, _mm_cmpge_ps (vv, zero));
+  ok = _mm_and_ps (ok, _mm_cmple_ps (_mm_add_ps (uu, vv), _mm_set1_ps (1)));
+  ok = _mm_and_ps (ok, _mm_cmpgt_ps (tt, zero));
+  ok = _mm_and_ps (ok, _mm_cmplt_ps (tt, _mm_set1_ps (hit->t)));
+  mask = _mm_movemask_ps (ok);
+  if (mask == 0)
+    return false;
+  _mm_storeu_ps (t, tt);
+  _mm_storeu_ps (u, uu);
+  _mm_storeu_ps (v, vv);
+#else
+  for (int j=0; j<4; j++) {
+    Vector3D v0 = {packet->v0[0][j], packet->v0[1][j], packet->v0[2][j]};
+    Vector3D e1 = {packet->e1[0][j], packet->e1[1][j], packet->e1[2][j]};
+    Vector3D e2 = {packet->e2[0][j], packet->e2[1][j], packet->e2[2][j]};
+    if (HitTriangle(&v0, &e1, &e2, &ray->origin, &ray->dir, &t[j], &u[j], &v[j]) AND t[j] < hit->t)
+      mask |= 1 << j;
+  }
+  if (mask == 0)
+    return false;
+#endif
+
+  for (int j=0; j<4; j++)
+    if ((mask & (1 << j)) AND t[j] < hit->t) {
+      hit->t = t[j];
+      hit->polygon = packet->polygon[j];
+      hit->u = u[j];
+      hit->v = v[j];
+    }
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: HitTriangle
+|
+| Output: Returns true if a ray hits a triangle (from either side) in
+|   front of its origin, and sets t, u and v to where.
+|___________________________________________________________________*/
+
+static bool HitTriangle (Vector3D *v0, Vector3D *e1, Vector3D *e2, Vector3D *origin, Vector3D *dir, float *t, float *u, float *v)
+{
+  Vector3D p, s, q;
+
+  // The same steps (and rounding) as the SSE path in HitPacket()
+  p.x = dir->y * e2->z - dir->z * e2->y;
+  p.y = dir->z * e2->x - dir->x * e2->z;
+  p.z = dir->x * e2->y - dir->y * e2->x;
+  float det = e1->x * p.x + e1->y * p.y + e1->z * p.z;
+  if (fabsf(det) <= EPSILON)
+    return false;
+  float inv = 1 / det;
+  s.x = origin->x - v0->x;
+  s.y = origin->y - v0->y;
+  s.z = origin->z - v0->z;
+  *u = (s.x * p.x + s.y * p.y + s.z * p.z) * inv;
+  q.x = s.y * e1->z - s.z * e1->y;
+  q.y = s.z * e1->x - s.x * e1->z;
+  q.z = s.x * e1->y - s.y * e1->x;
+  *v = (dir->x * q.x + dir->y * q.y + dir->z * q.z) * inv;
+  *t = (e2->x * q.x + e2->y * q.y + e2->z * q.z) * inv;
+  return *u >= 0 AND *v >= 0 AND *u + *v <= 1 AND *t > 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: SweepPacket
+|
+| Output: Sweeps a sphere along a ray against a packet's triangles and
+|   sets hit to the first one it touches before hit->t.  Returns true if
+|   one was found.
+|___________________________________________________________________*/
+
+static bool SweepPacket (BVHPacket *packet, Ray *ray, BVHHit *hit)
+{
+  Vector3D p[3], contact, center;
+  float t;
+  bool found = false;
+
+  for (int j=0; j<4; j++) {
+    if (packet->polygon[j] < 0)
+      continue;
+    p[0].x = packet->v0[0][j];
+    p[0].y = packet->v0[1][j];
+    p[0].z = packet->v0[2][j];
+    p[1].x = p[0].x + packet->e1[0][j];
+    p[1].y = p[0].y + packet->e1[1][j];
+    p[1].z = p[0].z + packet->e1[2][j];
+    p[2].x = p[0].x + packet->e2[0][j];
+    p[2].y = p[0].y + packet->e2[1][j];
+    p[2].z = p[0].z + packet->e2[2][j];
+    if (NOT SweepTriangle(p, ray, hit->t, &t, &contact) OR t >= hit->t)
+      continue;
+    hit->t = t;
+    hit->polygon = packet->polygon[j];
+    hit->u = hit->v = 0;
+    // Push back from the contact toward the center (straight back if it's on the triangle)
+    center.x = ray->origin.x + ray->dir.x * t;
+    center.y = ray->origin.y + ray->dir.y * t;
+    center.z = ray->origin.z + ray->dir.z * t;
+    SubtractVector (&center, &contact, &hit->normal);
+    if (Dot(&hit->normal, &hit->normal) > 0)
+      NormalizeVector (&hit->normal, &hit->normal);
+    else {
+      MultiplyScalarVector (-1, &ray->dir, &hit->normal);
+      NormalizeVector (&hit->normal, &hit->normal);
+    }
+    found = true;
+  }
+  return found;
+}
+
+/*____________________________________________________________________
+|
+| Function: SweepTriangle
+|
+| Output: Returns true if a sphere moving from ray->origin along
+|   ray->dir touches a triangle between 0 and max_t, and sets t to when
+|   and contact to the point it touches.
+|___________________________________________________________________*/
+
+static bool SweepTriangle (Vector3D p[3], Ray *ray, float max_t, float *t, Vector3D *contact)
+{
+  Vector3D *c = &ray->origin, *v = &ray->dir;
+  Vector3D e1, e2, face, d, q;
+  float r = ray->radius, root;
+  int k;
+
+  SubtractVector (&p[1], &p[0], &e1);
+  SubtractVector (&p[2], &p[0], &e2);
+  VectorCrossProduct (&e1, &e2, &face);
+  if (Dot(&face, &face) <= 0)
+    return false;
+  NormalizeVector (&face, &face);
+
+  // Already touching: stopped if moving in, free to move away
+  ClosestPoint (p, c, &q);
+  SubtractVector (c, &q, &d);
+  if (Dot(&d, &d) < r * r) {
+    if (Dot(v, &d) >= 0)
+      return false;
+    *t = 0;
+    *contact = q;
+    return true;
+  }
+
+  // Where it meets the plane (from the side it's on), if that is inside the triangle
+  SubtractVector (c, &p[0], &d);
+  float side = Dot(&face, &d) < 0 ? -1.0f : 1.0f;
+  float s0 = side * Dot(&face, &d);
+  float nv = side * Dot(&face, v);
+  if (nv < 0) {
+    float t0 = (r - s0) / nv;
+    if (t0 >= 0 AND t0 <= max_t) {
+      q.x = c->x + v->x * t0 - face.x * side * r;
+      q.y = c->y + v->y * t0 - face.y * side * r;
+      q.z = c->z + v->z * t0 - face.z * side * r;
+      for (k=0; k<3; k++) {
+        Vector3D edge, to_q, cross;
+        SubtractVector (&p[(k + 1) % 3], &p[k], &edge);
+        SubtractVector (&q, &p[k], &to_q);
+        VectorCrossProduct (&edge, &to_q, &cross);
+        if (Dot(&cross, &face) < 0)
+          break;
+      }
+      if (k == 3) {
+        *t = t0;
+        *contact = q;
+        return true;
+      }
+    }
+  }
+
+  // Otherwise the first corner or edge it meets
+  bool found = false;
+  float vv = Dot(v, v);
+  for (k=0; k<3; k++) {
+    SubtractVector (c, &p[k], &d);
+    if (LowestRoot(vv, 2 * Dot(v, &d), Dot(&d, &d) - r * r, max_t, &root)) {
+      max_t = root;
+      *contact = p[k];
+      found = true;
+    }
+  }
+  for (k=0; k<3; k++) {
+    Vector3D edge, base;
+    SubtractVector (&p[(k + 1) % 3], &p[k], &edge);
+    SubtractVector (&p[k], c, &base);
+    float edge_sq = Dot(&edge, &edge), edge_v = Dot(&edge, v), edge_base = Dot(&edge, &base);
+    // When it is r from the edge's line, at a point between the corners
+    float a = edge_sq * -vv + edge_v * edge_v;
+    float b = edge_sq * 2 * Dot(v, &base) - 2 * edge_v * edge_base;
+    float cc = edge_sq * (r * r - Dot(&base, &base)) + edge_base * edge_base;
+    if (LowestRoot(a, b, cc, max_t, &root)) {
+      float f = (edge_v * root - edge_base) / edge_sq;
+      if (f >= 0 AND f <= 1) {
+        max_t = root;
+        contact->x = p[k].x + edge.x * f;
+        contact->y = p[k].y + edge.y * f;
+        contact->z = p[k].z + edge.z * f;
+        found = true;
+      }
+    }
+  }
+  *t = max_t;
+  return found;
+}
+
+/*____________________________________________________________________
+|
+| Function: ClosestPoint
+|
+| Output: Sets closest to the point of a triangle closest to a point.
+|___________________________________________________________________*/
+
+static void ClosestPoint (Vector3D p[3], Vector3D *point, Vector3D *closest)
+{
+  Vector3D ab, ac, ap, bp, cp;
+
+  // Which of the corners, edges or face the point is over
+  SubtractVector (&p[1], &p[0], &ab);
+  SubtractVector (&p[2], &p[0], &ac);
+  SubtractVector (point, &p[0], &ap);
+  float d1 = Dot(&ab, &ap), d2 = Dot(&ac, &ap);
+  if (d1 <= 0 AND d2 <= 0) {
+    *closest = p[0];
+    return;
+  }
+  SubtractVector (point, &p[1], &bp);
+  float d3 = Dot(&ab, &bp), d4 = Dot(&ac, &bp);
+  if (d3 >= 0 AND d4 <= d3) {
+    *closest = p[1];
+    return;
+  }
+  float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 AND d1 >= 0 AND d3 <= 0) {
+    float f = d1 / (d1 - d3);
+    closest->x = p[0].x + ab.x * f;
+    closest->y = p[0].y + ab.y * f;
+    closest->z = p[0].z + ab.z * f;
+    return;
+  }
+  SubtractVector (point, &p[2], &cp);
+  float d5 = Dot(&ab, &cp), d6 = Dot(&ac, &cp);
+  if (d6 >= 0 AND d5 <= d6) {
+    *closest = p[2];
+    return;
+  }
+  float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 AND d2 >= 0 AND d6 <= 0) {
+    float f = d2 / (d2 - d6);
+    closest->x = p[0].x + ac.x * f;
+    closest->y = p[0].y + ac.y * f;
+    closest->z = p[0].z + ac.z * f;
+    return;
+  }
+  float va = d3 * d6 - d5 * d4;
+  if (va <= 0 AND d4 - d3 >= 0 AND d5 - d6 >= 0) {
+    float f = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+    closest->x = p[1].x + (p[2].x - p[1].x) * f;
+    closest->y = p[1].y + (p[2].y - p[1].y) * f;
+    closest->z = p[1].z + (p[2].z - p[1].z) * f;
+    return;
+  }
+  float denom = 1 / (va + vb + vc);
+  float fb = vb * denom, fc = vc * denom;
+  closest->x = p[0].x + ab.x * fb + ac.x * fc;
+  closest->y = p[0].y + ab.y * fb + ac.y * fc;
+  closest->z = p[0].z + ab.z * fb + ac.z * fc;
+}
+
+/*____________________________________________________________________
+|
+| Function: LowestRoot
+|
+| Output: Returns true if the first root of a*x*x + b*x + c is between
+|   0 and max, and sets root to it.
+|___________________________________________________________________*/
+
+static bool LowestRoot (float a, float b, float c, float max, float *root)
+{
+  if (a == 0)
+    return false;
+  float det = b * b - 4 * a * c;
+  if (det < 0)
+    return false;
+  float s = sqrtf (det);
+  float r1 = (-b - s) / (2 * a), r2 = (-b + s) / (2 * a);
+  float first = std::min (r1, r2);
+  // (A first root below 0 means it started inside, which the caller has ruled out)
+  if (first < 0 OR first > max)
+    return false;
+  *root = first;
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Dot
+|
+| Output: Returns the dot product of two vectors.
+|___________________________________________________________________*/
+
+static inline float Dot (Vector3D *a, Vector3D *b)
+{
+  return a->x * b->x + a->y * b->y + a->z * b->z;
+}
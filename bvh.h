@@ -0,0 +1,107 @@
+/*____________________________________________________________________
+|
+| File: bvh.h
+|
+| Bounding volume hierarchies for ray casts and sphere sweeps: one over
+| a mesh's triangles (built with the surface area heuristic, leaves of
+| up to 4 triangles tested at once with SSE), or one over spheres (such
+| as the instances of a mesh in a scene).  A BVH is one block with no pointers
+| in it, so a mesh's can be saved next to its OBJ file (.kbv) and read
+| back as is.
+|___________________________________________________________________*/
+
+#define BVH_MAGIC       "KBV1"
+#define BVH_VERSION     1
+#define BVH_ENDIANNESS  0x04030201
+#define BVH_LEAF_SIZE   4           // most triangles (or spheres) in a leaf
+#define BVH_MAX_DEPTH   64          // deepest a tree can be (a leaf is forced below this)
+
+// A box around a node's children, or a leaf (count > 0: primitives first to first+count-1)
+struct BVHNode {
+  float min[3];
+  int   first;              // inner node: left child (the right child is first+1)
+  float max[3];
+  int   count;              // leaf: # of primitives, 0 = inner node
+};
+
+// A leaf's triangles, one per SSE lane (unused lanes have polygon -1 and no area)
+struct BVHPacket {
+  float v0[3][4];           // first vertex x,y,z
+  float e1[3][4];           // edge to the second vertex
+  float e2[3][4];           // edge to the third vertex
+  int   polygon[4];
+};
+
+// Block header (also the .kbv file header), followed by the nodes (root first) and then
+//  the packets (triangle BVH) or the sphere numbers of the leaves (sphere BVH)
+struct BVH {
+  char     magic[4];        // BVH_MAGIC
+  unsigned version;         // BVH_VERSION
+  unsigned endianness;      // BVH_ENDIANNESS
+  unsigned num_nodes;
+  unsigned num_packets;
+  unsigned num_spheres;
+  unsigned checksum;        // of the mesh it was built for (see BVH_Checksum)
+  unsigned reserved;
+};
+
+#define BVH_NODES(_bvh_)    ((BVHNode *)((_bvh_) + 1))
+#define BVH_PACKETS(_bvh_)  ((BVHPacket *)(BVH_NODES(_bvh_) + (_bvh_)->num_nodes))
+#define BVH_SPHERES(_bvh_)  ((int *)(BVH_NODES(_bvh_) + (_bvh_)->num_nodes))
+
+// The closest hit found so far
+struct BVHHit {
+  float t;                  // distance along the ray (in lengths of its direction), set to the farthest to look
+  int   sphere;             // sphere BVH: which sphere the hit is in, -1 = none
+  int   polygon;            // which polygon was hit, -1 = none
+  float u, v;               // barycentric weights of the polygon's second and third vertices
+  Vector3D normal;          // sweeps: unit normal of the contact, pointing back at the swept sphere
+};
+
+// Counts kept by the queries since the last BVH_ResetStats() (queries from one thread only)
+struct BVHStats {
+  long long queries;        // rays cast and spheres swept (counting each tree they go down)
+  long long nodes;          // nodes visited
+  long long triangles;      // triangles tested
+  long long spheres;        // spheres handed to a BVHSphereFn
+};
+
+// Tests a ray (or a sphere of the radius given to BVH_IntersectSpheres() moving along it) against
+//  sphere (in a sphere BVH), updating hit if it is hit closer
+typedef void (*BVHSphereFn) (void *data, int sphere, Vector3D *origin, Vector3D *dir, BVHHit *hit);
+
+// Builds a BVH over a mesh's triangles.  Returns it (free it with BVH_Free), or 0 if out of memory
+BVH *BVH_Build (Object3D *object);
+// Builds a BVH over spheres.  Returns it, or 0 if out of memory
+BVH *BVH_BuildSpheres (Vector3D *centers, float *radii, int n);
+// Moves a mesh BVH's triangles to other positions of the mesh's vertices (vertex i at
+//  positions[i*stride]) and refits its boxes around them, keeping the tree
+void BVH_Refit (BVH *bvh, Object3D *object, float *positions, int stride);
+// Frees a BVH
+void BVH_Free (BVH *bvh);
+// Returns the # of bytes in a BVH's block
+size_t BVH_Size (BVH *bvh);
+// Finds the closest triangle a ray hits before hit->t.  Returns true if one was found
+bool BVH_Intersect (BVH *bvh, Vector3D *origin, Vector3D *dir, BVHHit *hit);
+// Finds the first triangle a sphere moving from center to center+move*hit->t touches (the
+//  contact is at center+move*t).  A sphere already touching a triangle stops at t = 0 if it
+//  moves toward it, and isn't stopped by it otherwise.  Returns true if one was found
+bool BVH_SweepSphere (BVH *bvh, Vector3D *center, Vector3D *move, float radius, BVHHit *hit);
+// Calls test() on each sphere a ray may hit before hit->t (with the boxes grown by radius, for
+//  a sweep), nearest boxes first.  Returns true if one of them found a hit
+bool BVH_IntersectSpheres (BVH *bvh, Vector3D *origin, Vector3D *dir, float radius, BVHHit *hit,
+                           BVHSphereFn test, void *data);
+// Same as BVH_Intersect() testing every polygon of a mesh (to check and time it against)
+bool BVH_IntersectAll (Object3D *object, Vector3D *origin, Vector3D *dir, BVHHit *hit);
+// Gets and resets the query counts
+void BVH_GetStats (BVHStats *stats);
+void BVH_ResetStats ();
+// Returns a checksum of a mesh's positions and polygons
+unsigned BVH_Checksum (Object3D *object);
+// Writes a mesh's BVH to a file.  Returns true on success
+bool BVH_Save (BVH *bvh, char *filename);
+// Reads a BVH from a file (looking in the packs first) if it was built for this mesh.
+//  Returns it, or 0
+BVH *BVH_Load (char *filename, Object3D *object);
+// Returns the BVH file name for an OBJ file (the OBJ name with a .kbv extension)
+void BVH_Name (char *obj_filename, char *filename, int size);
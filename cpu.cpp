@@ -0,0 +1,69 @@
+/*____________________________________________________________________
+|
+| File: cpu.cpp
+|
+| Description: Queries the CPU for the instruction sets and number of
+|   threads the SIMD and multithreaded code paths can use.
+|
+| Functions: CPU_HasSSSE3
+|            CPU_NumThreads
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <thread>
+#include <algorithm>
+#include "cpu.h"
+
+#ifdef CPU_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+/*____________________________________________________________________
+|
+| Function: CPU_HasSSSE3
+|
+| Output: Returns true if the CPU supports SSSE3.
+|___________________________________________________________________*/
+
+bool CPU_HasSSSE3 ()
+{
+#ifdef CPU_X86
+  static const bool ssse3 = [] {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid (info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid (1, &eax, &ebx, &ecx, &edx) == 0)
+      return false;
+    return (ecx & bit_SSSE3) != 0;
+#endif
+  } ();
+  return ssse3;
+#else
+  return false;
+#endif
+}
+
+/*____________________________________________________________________
+|
+| Function: CPU_NumThreads
+|
+| Output: Returns the number of hardware threads, or 1 if unknown.
+|___________________________________________________________________*/
+
+int CPU_NumThreads ()
+{
+  // Cached (on Linux this reads /proc on every call)
+  static const int n = std::max (1, (int)std::thread::hardware_concurrency());
+  return n;
+}
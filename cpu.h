@@ -0,0 +1,21 @@
+/*____________________________________________________________________
+|
+| File: cpu.h
+|___________________________________________________________________*/
+
+// Defined when compiling for x86/x64 (where the SSE intrinsics are available)
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CPU_X86
+#endif
+
+// GCC and Clang need to be told a function may use SSSE3 instructions (MSVC doesn't)
+#if defined(CPU_X86) && defined(__GNUC__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define TARGET_SSSE3
+#endif
+
+// Returns true if the CPU supports SSSE3 (checked once, then cached)
+bool CPU_HasSSSE3 ();
+// Returns the number of hardware threads (at least 1)
+int  CPU_NumThreads ();
@@ -0,0 +1,198 @@
+/*____________________________________________________________________
+|
+| File: glcheck.cpp
+|
+| Description: Call accounting for the GL_DRAW/GL_STATE/GL_UPLOAD
+|   wrappers in glcheck.h.  Only used when GL_INSTRUMENT is defined;
+|   otherwise the wrappers compile down to the bare GL call.
+|
+| Functions: GLStats_Site
+|            GLStats_Record
+|            GLStats_EndFrame
+|            GLStats_WriteCSV
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glut.h>
+#include "math3d.h"
+#include "glcheck.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define MAX_SITES 256
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct GLCallSite {
+  const char *file;
+  int         line;
+  const char *text;     // the wrapped call, as written in the source
+  GLStatKind  kind;
+  long long   calls;
+  long long   bytes;
+  long long   errors;
+};
+
+struct GLFrameCounts {
+  long long draws;
+  long long state_changes;
+  long long uploads;
+  long long bytes;
+  long long errors;
+};
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static GLCallSite sites[MAX_SITES];
+static int num_sites = 0;
+static GLFrameCounts current_frame;   // counts so far this frame
+#ifdef GL_INSTRUMENT
+static GLFrameCounts last_frame;      // counts for the last complete frame
+static GLFrameCounts max_frame;       // highest per frame counts seen
+static long long num_frames = 0;
+#endif
+
+/*____________________________________________________________________
+|
+| Function: GLStats_Site
+|
+| Output: Registers a call site and returns its id.
+|___________________________________________________________________*/
+
+int GLStats_Site (const char *file, int line, const char *text, GLStatKind kind)
+{
+  // Out of sites?  (should never happen) - share the last one
+  if (num_sites == MAX_SITES)
+    return MAX_SITES-1;
+
+  // Keep only the file name
+  const char *name = file;
+  for (const char *p = file; *p; p++)
+    if (*p == '/' OR *p == '\\')
+      name = p + 1;
+
+  sites[num_sites].file = name;
+  sites[num_sites].line = line;
+  sites[num_sites].text = text;
+  sites[num_sites].kind = kind;
+  return num_sites++;
+}
+
+/*____________________________________________________________________
+|
+| Function: GLStats_Record
+|
+| Output: Counts one call at a call site, and checks whether it raised
+|   a GL error.
+|___________________________________________________________________*/
+
+void GLStats_Record (int site, long long bytes)
+{
+  GLCallSite *s = &sites[site];
+
+  s->calls++;
+  s->bytes += bytes;
+  switch (s->kind) {
+    case GLSTAT_DRAW:   current_frame.draws++;         break;
+    case GLSTAT_STATE:  current_frame.state_changes++; break;
+    case GLSTAT_UPLOAD: current_frame.uploads++;       break;
+  }
+  current_frame.bytes += bytes;
+
+  GLenum code = glGetError ();
+  if (code != GL_NO_ERROR) {
+    // Report the first error at each site
+    if (s->errors == 0)
+      printf ("OpenGL error 0x%04x at %s:%d %s\n", code, s->file, s->line, s->text);
+    s->errors++;
+    current_frame.errors++;
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: GLStats_EndFrame
+|
+| Output: Ends the current frame's counts.
+|___________________________________________________________________*/
+
+void GLStats_EndFrame ()
+{
+#ifdef GL_INSTRUMENT
+  last_frame = current_frame;
+  if (current_frame.draws > max_frame.draws)                 max_frame.draws = current_frame.draws;
+  if (current_frame.state_changes > max_frame.state_changes) max_frame.state_changes = current_frame.state_changes;
+  if (current_frame.uploads > max_frame.uploads)             max_frame.uploads = current_frame.uploads;
+  if (current_frame.bytes > max_frame.bytes)                 max_frame.bytes = current_frame.bytes;
+  if (current_frame.errors > max_frame.errors)               max_frame.errors = current_frame.errors;
+  memset (&current_frame, 0, sizeof(current_frame));
+  num_frames++;
+#endif
+}
+
+/*____________________________________________________________________
+|
+| Function: GLStats_WriteCSV
+|
+| Output: Writes one row per call site:
+|     site,call,kind,calls,calls_per_frame,bytes,bytes_per_frame,errors
+|   and prints the last and worst frame totals.  Returns true on
+|   success.
+|___________________________________________________________________*/
+
+bool GLStats_WriteCSV (const char *filename)
+{
+#ifndef GL_INSTRUMENT
+  (void)filename;
+  printf ("GL call accounting is off (define GL_INSTRUMENT in glcheck.h)\n");
+  return false;
+#else
+  const char *kind_names[] = { "draw", "state", "upload" };
+  double frames = num_frames ? (double)num_frames : 1;
+
+  FILE *fp = fopen (filename, "wt");
+  if (fp == 0)
+    return false;
+
+  fprintf (fp, "site,call,kind,calls,calls_per_frame,bytes,bytes_per_frame,errors\n");
+  for (int i=0; i<num_sites; i++) {
+    GLCallSite *s = &sites[i];
+    fprintf (fp, "%s:%d,\"", s->file, s->line);
+    // Double any quotes in the call text
+    for (const char *p = s->text; *p; p++) {
+      if (*p == '"')
+        fputc ('"', fp);
+      fputc (*p, fp);
+    }
+    fprintf (fp, "\",%s,%lld,%.2f,%lld,%.0f,%lld\n", kind_names[s->kind],
+             s->calls, s->calls / frames, s->bytes, s->bytes / frames, s->errors);
+  }
+  fclose (fp);
+
+  printf ("GL calls over %lld frames - last frame: %lld draws, %lld state changes, %lld uploads, %lld bytes, %lld errors\n",
+          num_frames, last_frame.draws, last_frame.state_changes, last_frame.uploads, last_frame.bytes, last_frame.errors);
+  printf ("                          worst frame: %lld draws, %lld state changes, %lld uploads, %lld bytes, %lld errors\n",
+          max_frame.draws, max_frame.state_changes, max_frame.uploads, max_frame.bytes, max_frame.errors);
+  return true;
+#endif
+}
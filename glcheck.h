@@ -0,0 +1,37 @@
+/*____________________________________________________________________
+|
+| File: glcheck.h
+|
+| Wrappers for OpenGL calls.  In a normal build they are just the call.
+| Define GL_INSTRUMENT to also count draw calls, state changes, bytes
+| submitted and errors (glGetError() after every wrapped call) per
+| frame and per call site.
+|___________________________________________________________________*/
+
+//#define GL_INSTRUMENT     // Define to count GL calls (slower - checks for errors after each call)
+
+enum GLStatKind { GLSTAT_DRAW, GLSTAT_STATE, GLSTAT_UPLOAD };
+
+#ifdef GL_INSTRUMENT
+#define GL_ACCOUNT(_kind_,_bytes_,_text_)                                       \
+  {                                                                             \
+    static int _site_ = GLStats_Site (__FILE__, __LINE__, _text_, _kind_);      \
+    GLStats_Record (_site_, (long long)(_bytes_));                              \
+  }
+#else
+#define GL_ACCOUNT(_kind_,_bytes_,_text_)
+#endif
+
+// Wrap a GL call that draws, changes state, or uploads data (_bytes_ = # of bytes sent to GL)
+#define GL_DRAW(_call_,_bytes_)   do { _call_; GL_ACCOUNT(GLSTAT_DRAW,_bytes_,#_call_)   } while (0)
+#define GL_STATE(_call_)          do { _call_; GL_ACCOUNT(GLSTAT_STATE,0,#_call_)        } while (0)
+#define GL_UPLOAD(_call_,_bytes_) do { _call_; GL_ACCOUNT(GLSTAT_UPLOAD,_bytes_,#_call_) } while (0)
+
+// Registers a call site, returns its id (used by the macros above)
+int  GLStats_Site (const char *file, int line, const char *text, GLStatKind kind);
+// Counts one call at a call site (and any GL error it raised)
+void GLStats_Record (int site, long long bytes);
+// Ends the current frame's counts (call once per frame)
+void GLStats_EndFrame ();
+// Writes per call site totals and per frame averages to a CSV file
+bool GLStats_WriteCSV (const char *filename);
@@ -0,0 +1,205 @@
+/*____________________________________________________________________
+|
+| File: glproc.cpp
+|
+| Description: Loads OpenGL entry points newer than 1.1 at runtime and
+|   records which optional features the current context supports.
+|
+| Functions: GLProc_SetLoader
+|            GLProc_Init
+|            GLProc_HasExtension
+|            GLProc_HasVersion
+|            GetProc
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glut.h>
+#ifndef _WIN32
+#include <GL/glx.h>
+#endif
+#include "math3d.h"
+#include "glproc.h"
+
+/*___________________
+|
+| Macros
+|__________________*/
+
+#define LOAD_PROC(_type_,_var_,_name_) (_var_ = (_type_) GetProc(_name_))
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static GLProcAddress GetProc (const char *name);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static GLProcLoader proc_loader = 0;  // set for contexts the window system didn't create (see GLProc_SetLoader)
+
+bool glproc_timer_query = false;
+bool glproc_s3tc = false;
+bool glproc_vbo = false;
+bool glproc_map_range = false;
+
+PFNGLGENQUERIESPROC          pglGenQueries = 0;
+PFNGLDELETEQUERIESPROC       pglDeleteQueries = 0;
+PFNGLBEGINQUERYPROC          pglBeginQuery = 0;
+PFNGLENDQUERYPROC            pglEndQuery = 0;
+PFNGLGETQUERYOBJECTIVPROC    pglGetQueryObjectiv = 0;
+PFNGLGETQUERYOBJECTUI64VPROC pglGetQueryObjectui64v = 0;
+
+PFNGLCOMPRESSEDTEXIMAGE2DPROC pglCompressedTexImage2D = 0;
+
+PFNGLGENBUFFERSPROC          pglGenBuffers = 0;
+PFNGLDELETEBUFFERSPROC       pglDeleteBuffers = 0;
+PFNGLBINDBUFFERPROC          pglBindBuffer = 0;
+PFNGLBUFFERDATAPROC          pglBufferData = 0;
+PFNGLBUFFERSUBDATAPROC       pglBufferSubData = 0;
+PFNGLMAPBUFFERRANGEPROC      pglMapBufferRange = 0;
+PFNGLUNMAPBUFFERPROC         pglUnmapBuffer = 0;
+
+/*____________________________________________________________________
+|
+| Function: GLProc_SetLoader
+|
+| Output: Sets the function GLProc_Init() looks entry points up with
+|   (0 = the window system's).
+|___________________________________________________________________*/
+
+void GLProc_SetLoader (GLProcLoader loader)
+{
+  proc_loader = loader;
+}
+
+/*____________________________________________________________________
+|
+| Function: GLProc_Init
+|
+| Output: Loads entry points for the current context and sets the
+|   glproc_* feature flags.  Features whose entry points are missing
+|   are reported as unsupported.
+|___________________________________________________________________*/
+
+void GLProc_Init ()
+{
+  // Query objects
+  if (GLProc_HasVersion(1,5)) {
+    LOAD_PROC (PFNGLGENQUERIESPROC,       pglGenQueries,       "glGenQueries");
+    LOAD_PROC (PFNGLDELETEQUERIESPROC,    pglDeleteQueries,    "glDeleteQueries");
+    LOAD_PROC (PFNGLBEGINQUERYPROC,       pglBeginQuery,       "glBeginQuery");
+    LOAD_PROC (PFNGLENDQUERYPROC,         pglEndQuery,         "glEndQuery");
+    LOAD_PROC (PFNGLGETQUERYOBJECTIVPROC, pglGetQueryObjectiv, "glGetQueryObjectiv");
+  }
+
+  // GPU timer queries
+  if (GLProc_HasVersion(3,3) OR GLProc_HasExtension("GL_ARB_timer_query"))
+    LOAD_PROC (PFNGLGETQUERYOBJECTUI64VPROC, pglGetQueryObjectui64v, "glGetQueryObjectui64v");
+  else if (GLProc_HasExtension("GL_EXT_timer_query"))
+    LOAD_PROC (PFNGLGETQUERYOBJECTUI64VPROC, pglGetQueryObjectui64v, "glGetQueryObjectui64vEXT");
+  glproc_timer_query = pglGenQueries AND pglDeleteQueries AND pglBeginQuery AND pglEndQuery AND
+                       pglGetQueryObjectiv AND pglGetQueryObjectui64v;
+
+  // Compressed textures
+  if (GLProc_HasVersion(1,3))
+    LOAD_PROC (PFNGLCOMPRESSEDTEXIMAGE2DPROC, pglCompressedTexImage2D, "glCompressedTexImage2D");
+  else if (GLProc_HasExtension("GL_ARB_texture_compression"))
+    LOAD_PROC (PFNGLCOMPRESSEDTEXIMAGE2DPROC, pglCompressedTexImage2D, "glCompressedTexImage2DARB");
+  glproc_s3tc = pglCompressedTexImage2D AND GLProc_HasExtension("GL_EXT_texture_compression_s3tc");
+
+  // Vertex buffer objects
+  if (GLProc_HasVersion(1,5)) {
+    LOAD_PROC (PFNGLGENBUFFERSPROC,    pglGenBuffers,    "glGenBuffers");
+    LOAD_PROC (PFNGLDELETEBUFFERSPROC, pglDeleteBuffers, "glDeleteBuffers");
+    LOAD_PROC (PFNGLBINDBUFFERPROC,    pglBindBuffer,    "glBindBuffer");
+    LOAD_PROC (PFNGLBUFFERDATAPROC,    pglBufferData,    "glBufferData");
+    LOAD_PROC (PFNGLBUFFERSUBDATAPROC, pglBufferSubData, "glBufferSubData");
+    LOAD_PROC (PFNGLUNMAPBUFFERPROC,   pglUnmapBuffer,   "glUnmapBuffer");
+  }
+  else if (GLProc_HasExtension("GL_ARB_vertex_buffer_object")) {
+    LOAD_PROC (PFNGLGENBUFFERSPROC,    pglGenBuffers,    "glGenBuffersARB");
+    LOAD_PROC (PFNGLDELETEBUFFERSPROC, pglDeleteBuffers, "glDeleteBuffersARB");
+    LOAD_PROC (PFNGLBINDBUFFERPROC,    pglBindBuffer,    "glBindBufferARB");
+    LOAD_PROC (PFNGLBUFFERDATAPROC,    pglBufferData,    "glBufferDataARB");
+    LOAD_PROC (PFNGLBUFFERSUBDATAPROC, pglBufferSubData, "glBufferSubDataARB");
+    LOAD_PROC (PFNGLUNMAPBUFFERPROC,   pglUnmapBuffer,   "glUnmapBufferARB");
+  }
+  glproc_vbo = pglGenBuffers AND pglDeleteBuffers AND pglBindBuffer AND pglBufferData AND pglBufferSubData;
+
+  // Mapping buffer ranges (the ARB extension has no suffix)
+  if (glproc_vbo AND (GLProc_HasVersion(3,0) OR GLProc_HasExtension("GL_ARB_map_buffer_range")))
+    LOAD_PROC (PFNGLMAPBUFFERRANGEPROC, pglMapBufferRange, "glMapBufferRange");
+  glproc_map_range = pglMapBufferRange AND pglUnmapBuffer;
+}
+
+/*____________________________________________________________________
+|
+| Function: GLProc_HasExtension
+|
+| Output: Returns true if the extension string of the current context
+|   contains name as a whole word.
+|___________________________________________________________________*/
+
+bool GLProc_HasExtension (const char *name)
+{
+  const char *extensions = (const char *) glGetString (GL_EXTENSIONS);
+  size_t len = strlen(name);
+
+  if (extensions == 0)
+    return false;
+  for (const char *p = strstr(extensions, name); p; p = strstr(p + len, name))
+    if ((p == extensions OR p[-1] == ' ') AND (p[len] == ' ' OR p[len] == 0))
+      return true;
+  return false;
+}
+
+/*____________________________________________________________________
+|
+| Function: GLProc_HasVersion
+|
+| Output: Returns true if the current context is at least version
+|   major.minor.
+|___________________________________________________________________*/
+
+bool GLProc_HasVersion (int major, int minor)
+{
+  const char *version = (const char *) glGetString (GL_VERSION);
+  int ctx_major = 0, ctx_minor = 0;
+
+  if (version == 0 OR sscanf(version, "%d.%d", &ctx_major, &ctx_minor) != 2)
+    return false;
+  return (ctx_major > major) OR (ctx_major == major AND ctx_minor >= minor);
+}
+
+/*____________________________________________________________________
+|
+| Function: GetProc
+|
+| Output: Returns the address of an entry point of the current context,
+|   or 0 if it has none by that name.
+|___________________________________________________________________*/
+
+static GLProcAddress GetProc (const char *name)
+{
+  if (proc_loader)
+    return proc_loader (name);
+#ifdef _WIN32
+  return (GLProcAddress) wglGetProcAddress (name);
+#else
+  return (GLProcAddress) glXGetProcAddressARB ((const GLubyte *)name);
+#endif
+}
@@ -0,0 +1,51 @@
+/*____________________________________________________________________
+|
+| File: glproc.h
+|
+| OpenGL entry points newer than 1.1 (opengl32.dll only exports 1.1,
+| so everything else is loaded at runtime).  Include after GL/glut.h.
+|___________________________________________________________________*/
+
+#include <GL/glext.h>
+
+// An entry point's address, as the platform's lookup returns it
+typedef void (*GLProcAddress) ();
+// Looks up an entry point by name for the current context
+typedef GLProcAddress (*GLProcLoader) (const char *name);
+
+// Makes GLProc_Init() look entry points up with loader (such as eglGetProcAddress() for an EGL
+//  context) instead of wglGetProcAddress()/glXGetProcAddressARB() (0 = those again)
+void GLProc_SetLoader (GLProcLoader loader);
+// Loads all entry points for the current context (call once a context is current)
+void GLProc_Init ();
+// Returns true if the current context supports the named extension
+bool GLProc_HasExtension (const char *name);
+// Returns true if the current context's version is at least major.minor
+bool GLProc_HasVersion (int major, int minor);
+
+// Which optional features the current context supports (set by GLProc_Init)
+extern bool glproc_timer_query;   // GL_TIME_ELAPSED queries
+extern bool glproc_s3tc;          // S3TC (BC1/BC3) compressed textures
+extern bool glproc_vbo;           // vertex buffer objects
+extern bool glproc_map_range;     // mapping part of a buffer without waiting for the GPU
+
+// Query objects (GL 1.5) and 64-bit results (GL 3.3 / ARB_timer_query)
+extern PFNGLGENQUERIESPROC          pglGenQueries;
+extern PFNGLDELETEQUERIESPROC       pglDeleteQueries;
+extern PFNGLBEGINQUERYPROC          pglBeginQuery;
+extern PFNGLENDQUERYPROC            pglEndQuery;
+extern PFNGLGETQUERYOBJECTIVPROC    pglGetQueryObjectiv;
+extern PFNGLGETQUERYOBJECTUI64VPROC pglGetQueryObjectui64v;
+
+// Compressed textures (GL 1.3 / ARB_texture_compression)
+extern PFNGLCOMPRESSEDTEXIMAGE2DPROC pglCompressedTexImage2D;
+
+// Vertex buffer objects (GL 1.5 / ARB_vertex_buffer_object) and mapping ranges of them
+//  (GL 3.0 / ARB_map_buffer_range)
+extern PFNGLGENBUFFERSPROC          pglGenBuffers;
+extern PFNGLDELETEBUFFERSPROC       pglDeleteBuffers;
+extern PFNGLBINDBUFFERPROC          pglBindBuffer;
+extern PFNGLBUFFERDATAPROC          pglBufferData;
+extern PFNGLBUFFERSUBDATAPROC       pglBufferSubData;
+extern PFNGLMAPBUFFERRANGEPROC      pglMapBufferRange;
+extern PFNGLUNMAPBUFFERPROC         pglUnmapBuffer;
@@ -0,0 +1,209 @@
+/*____________________________________________________________________
+|
+| File: headless.cpp
+|
+| Description: Offscreen OpenGL context for running the scene with no
+|   window, display or GPU (for example on a CI machine).  Uses EGL
+|   with a pbuffer surface, preferring Mesa's surfaceless platform so
+|   no X server is needed.  With Mesa's software driver (llvmpipe or
+|   swrast) this works on machines with no GPU at all.
+|
+|   Not supported on Windows (no EGL), where Headless_CreateContext()
+|   just returns false.
+|
+| Functions: Headless_CreateContext
+|            Headless_DestroyContext
+|            Headless_WriteFrame
+|            EGLProc
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glut.h>
+#ifndef _WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#include "math3d.h"
+#include "glproc.h"
+#include "headless.h"
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+#ifndef _WIN32
+static GLProcAddress EGLProc (const char *name);
+#endif
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+#ifndef _WIN32
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLSurface surface = EGL_NO_SURFACE;
+static EGLContext context = EGL_NO_CONTEXT;
+#endif
+
+/*____________________________________________________________________
+|
+| Function: Headless_CreateContext
+|
+| Output: Creates an offscreen compatibility-profile OpenGL context
+|   with a width x height RGB + depth framebuffer and makes it current.
+|   Returns true on success.
+|___________________________________________________________________*/
+
+bool Headless_CreateContext (int width, int height)
+{
+#ifdef _WIN32
+  printf ("Headless mode is not supported on this platform\n");
+  return false;
+#else
+  EGLint major, minor, num_configs;
+  EGLConfig config;
+
+  const EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE,        8,
+    EGL_GREEN_SIZE,      8,
+    EGL_BLUE_SIZE,       8,
+    EGL_DEPTH_SIZE,      24,
+    EGL_NONE
+  };
+  const EGLint pbuffer_attribs[] = {
+    EGL_WIDTH,  width,
+    EGL_HEIGHT, height,
+    EGL_NONE
+  };
+
+  // Prefer the surfaceless platform (no X server or DRM device needed)
+  const char *extensions = eglQueryString (EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+    (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress ("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay AND extensions AND strstr(extensions, "EGL_MESA_platform_surfaceless"))
+    display = getPlatformDisplay (EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+  // Otherwise use whatever the default display is
+  if (display == EGL_NO_DISPLAY)
+    display = eglGetDisplay (EGL_DEFAULT_DISPLAY);
+  if (display == EGL_NO_DISPLAY OR NOT eglInitialize(display, &major, &minor)) {
+    printf ("Headless: could not initialize EGL\n");
+    return false;
+  }
+
+  if (NOT eglChooseConfig(display, config_attribs, &config, 1, &num_configs) OR num_configs == 0) {
+    printf ("Headless: no suitable EGL config\n");
+    Headless_DestroyContext ();
+    return false;
+  }
+
+  surface = eglCreatePbufferSurface (display, config, pbuffer_attribs);
+  if (surface == EGL_NO_SURFACE) {
+    printf ("Headless: could not create a %dx%d pbuffer\n", width, height);
+    Headless_DestroyContext ();
+    return false;
+  }
+
+  // Desktop OpenGL (not GLES) so the fixed function pipeline is available
+  eglBindAPI (EGL_OPENGL_API);
+  context = eglCreateContext (display, config, EGL_NO_CONTEXT, NULL);
+  if (context == EGL_NO_CONTEXT OR NOT eglMakeCurrent(display, surface, surface, context)) {
+    printf ("Headless: could not create an OpenGL context\n");
+    Headless_DestroyContext ();
+    return false;
+  }
+
+  // Entry points of an EGL context come from EGL, not GLX
+  GLProc_SetLoader (EGLProc);
+  printf ("Headless: EGL %d.%d, %s\n", major, minor, (const char *)glGetString(GL_RENDERER));
+  return true;
+#endif
+}
+
+/*____________________________________________________________________
+|
+| Function: Headless_DestroyContext
+|
+| Output: Releases the offscreen context, if any.
+|___________________________________________________________________*/
+
+void Headless_DestroyContext ()
+{
+#ifndef _WIN32
+  if (display != EGL_NO_DISPLAY) {
+    eglMakeCurrent (display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (context != EGL_NO_CONTEXT)
+      eglDestroyContext (display, context);
+    if (surface != EGL_NO_SURFACE)
+      eglDestroySurface (display, surface);
+    eglTerminate (display);
+  }
+  display = EGL_NO_DISPLAY;
+  surface = EGL_NO_SURFACE;
+  context = EGL_NO_CONTEXT;
+  GLProc_SetLoader (0);
+#endif
+}
+
+/*____________________________________________________________________
+|
+| Function: Headless_WriteFrame
+|
+| Output: Reads back the color buffer and writes it to a binary PPM
+|   (P6) file.  OpenGL returns rows bottom-up so they are written in
+|   reverse order.  Returns true on success.
+|___________________________________________________________________*/
+
+bool Headless_WriteFrame (char *filename, int width, int height)
+{
+  int row_size = width * 3;
+  unsigned char *pixels = (unsigned char *) malloc (row_size * height);
+  if (pixels == 0)
+    return false;
+
+  glPixelStorei (GL_PACK_ALIGNMENT, 1);
+  glReadPixels (0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+
+  FILE *fp = fopen (filename, "wb");
+  if (fp == 0) {
+    printf ("Headless: could not write %s\n", filename);
+    free (pixels);
+    return false;
+  }
+  fprintf (fp, "P6\n%d %d\n255\n", width, height);
+  for (int y=height-1; y>=0; y--)
+    fwrite (pixels + y * row_size, 1, row_size, fp);
+  fclose (fp);
+
+  free (pixels);
+  return true;
+}
+
+#ifndef _WIN32
+/*____________________________________________________________________
+|
+| Function: EGLProc
+|
+| Output: Returns the address of an entry point of the current EGL
+|   context, or 0 if it has none by that name.
+|___________________________________________________________________*/
+
+static GLProcAddress EGLProc (const char *name)
+{
+  return (GLProcAddress) eglGetProcAddress (name);
+}
+#endif
@@ -0,0 +1,13 @@
+/*____________________________________________________________________
+|
+| File: headless.h
+|___________________________________________________________________*/
+
+// Creates an offscreen OpenGL context (no window or display needed) and makes it current
+bool Headless_CreateContext (int width, int height);
+
+// Destroys the offscreen context
+void Headless_DestroyContext ();
+
+// Reads back the current frame and saves it as a binary PPM file
+bool Headless_WriteFrame (char *filename, int width, int height);
@@ -0,0 +1,574 @@
+/*____________________________________________________________________
+|
+| File: job.cpp
+|
+| Description: Work-stealing job scheduler.  Each worker has its own
+|   queue (a Chase-Lev deque): it pushes and pops jobs at the bottom
+|   with no locking, while idle workers steal the oldest jobs from the
+|   top with one compare-and-swap, so a worker mostly runs the jobs it
+|   made itself (whose data is still in its cache) and large pieces of
+|   work move between threads only when someone runs out.  Threads
+|   that aren't workers (the GL thread, stream workers) submit through
+|   one locked queue.  Workers that find nothing sleep on a condition
+|   variable; a counter bumped on every submit keeps a worker from
+|   sleeping through a submit made while it was looking.
+|
+|   A job starts once its count of unfinished dependencies (plus one
+|   until it is submitted) reaches zero; the job finishing last pushes
+|   it.  A parallel for pushes all its ranges at once and the caller
+|   runs jobs until they are all done.
+|
+| Functions: Job_Init
+|            Job_NumThreads
+|            Job_Create
+|            Job_DependsOn
+|            Job_Submit
+|            Job_Wait
+|            Job_Release
+|            Job_ParallelFor
+|            Job_Shutdown
+|            Worker
+|            Push
+|            Wake
+|            FindJob
+|            Run
+|            DequePush
+|            DequePop
+|            DequeSteal
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "math3d.h"
+#include "cpu.h"
+#include "trace.h"
+#include "job.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct Job {
+  JobFn               fn;
+  JobRangeFn          range_fn;       // set instead of fn for a parallel for's range
+  void               *data;
+  int                 begin, end;
+  std::atomic<int>    waiting;        // unfinished dependencies, plus one until submitted
+  std::atomic<int>    refs;           // the creator's, the scheduler's and each dependency's
+  std::atomic<bool>   done;
+  std::mutex          mutex;          // guards done (when set) and dependents
+  std::vector<Job *>  dependents;     // jobs waiting for this one
+  std::atomic<int>   *counter;        // decremented when finished (a parallel for's ranges left)
+};
+
+// Owner pushes and pops at the bottom, thieves take from the top
+struct JobDeque {
+  std::atomic<long long> top, bottom;
+  std::atomic<Job *>     jobs[JOB_DEQUE_SIZE];
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Worker (int index);
+static void Push (Job *job);
+static void Wake (bool all);
+static Job *FindJob ();
+static void Run (Job *job);
+static bool DequePush (JobDeque *deque, Job *job);
+static Job *DequePop (JobDeque *deque);
+static Job *DequeSteal (JobDeque *deque);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static std::mutex init_mutex;
+static std::atomic<bool> running (false);
+static int num_threads = 1;
+static std::vector<std::thread> workers;
+static std::vector<JobDeque *> deques;            // one per worker
+static thread_local int worker_index = -1;        // this thread's deque, -1 = not a worker
+
+static std::mutex inject_mutex;
+static std::deque<Job *> inject;                  // jobs from threads that aren't workers (guarded by inject_mutex)
+static std::atomic<int> num_injected (0);
+
+static std::mutex sleep_mutex;
+static std::condition_variable sleep_cv;
+static std::atomic<unsigned> submits (0);         // bumped on every push, to catch one made while a worker looked
+static std::atomic<int> sleeping (0);
+static bool stopping = false;                     // guarded by sleep_mutex
+
+/*____________________________________________________________________
+|
+| Function: Job_Init
+|
+| Output: Starts num_threads-1 worker threads, if that many aren't
+|   already running.
+|___________________________________________________________________*/
+
+void Job_Init (int num)
+{
+  std::lock_guard<std::mutex> lock (init_mutex);
+
+  if (num <= 0)
+    num = CPU_NumThreads ();
+  num = std::min (num, JOB_MAX_THREADS);
+  if (running.load(std::memory_order_acquire) AND num == num_threads)
+    return;
+  if (running.load(std::memory_order_acquire)) {
+    // Stop the old pool first
+    {
+      std::lock_guard<std::mutex> sleep_lock (sleep_mutex);
+      stopping = true;
+    }
+    sleep_cv.notify_all ();
+    for (size_t i=0; i<workers.size(); i++)
+      workers[i].join ();
+    workers.clear ();
+    for (size_t i=0; i<deques.size(); i++)
+      delete deques[i];
+    deques.clear ();
+  }
+
+  stopping = false;
+  num_threads = num;
+  for (int i=0; i<num-1; i++) {
+    JobDeque *deque = new JobDeque;
+    deque->top.store (0);
+    deque->bottom.store (0);
+    deques.push_back (deque);
+  }
+  for (int i=0; i<num-1; i++)
+    workers.push_back (std::thread (Worker, i));
+  running.store (true, std::memory_order_release);
+}
+
+/*____________________________________________________________________
+|
+| Function: Job_NumThreads
+|
+| Output: Returns the # of threads that run jobs.
+|___________________________________________________________________*/
+
+int Job_NumThreads ()
+{
+  if (NOT running.load(std::memory_order_acquire))
+    Job_Init (0);
+  return num_threads;
+}
+
+/*____________________________________________________________________
+|
+| Function: Job_Create
+|
+| Output: Returns a new job (not submitted yet) that runs fn(data).
+|___________________________________________________________________*/
+
+Job *Job_Create (JobFn fn, void *data)
+{
+  Job *job = new Job;
+  job->fn       = fn;
+  job->range_fn = 0;
+  job->data     = data;
+  job->begin    = job->end = 0;
+  job->waiting.store (1, std::memory_order_relaxed);
+  job->refs.store (1, std::memory_order_relaxed);
+  job->done.store (false, std::memory_order_relaxed);
+  job->counter  = 0;
+  return job;
+}
+
+/*____________________________________________________________________
+|
+| Function: Job_DependsOn
+|
+| Output: Makes a job that hasn't been submitted wait for another to
+|   finish (if it hasn't yet) before starting.
+|___________________________________________________________________*/
+
+void Job_DependsOn (Job *job, Job *dependency)
+{
+  std::lock_guard<std::mutex> lock (dependency->mutex);
+  if (dependency->done.load(std::memory_order_relaxed))
+    return;
+  job->waiting.fetch_add (1, std::memory_order_relaxed);
+  job->refs.fetch_add (1, std::memory_order_relaxed);
+  dependency->dependents.push_back (job);
+}
+
+/*____________________________________________________________________
+|
+| Function: Job_Submit
+|
+| Output: Lets a job run, now if its dependencies are finished or else
+|   once the last of them is.
+|___________________________________________________________________*/
+
+void Job_Submit (Job *job)
+{
+  if (NOT running.load(std::memory_order_acquire))
+    Job_Init (0);
+  // The scheduler's reference, until it has run
+  job->refs.fetch_add (1, std::memory_order_relaxed);
+  if (job->waiting.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    Push (job);
+    Wake (false);
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: Job_Wait
+|
+| Output: Runs jobs until a job has finished.
+|___________________________________________________________________*/
+
+void Job_Wait (Job *job)
+{
+  while (NOT job->done.load(std::memory_order_acquire)) {
+    Job *other = FindJob ();
+    if (other)
+      Run (other);
+    else
+      std::this_thread::yield ();
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: Job_Release
+|
+| Output: Drops a reference to a job, freeing it if it was the last.
+|___________________________________________________________________*/
+
+void Job_Release (Job *job)
+{
+  if (job->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    delete job;
+}
+
+/*____________________________________________________________________
+|
+| Function: Job_ParallelFor
+|
+| Output: Runs fn on ranges of grain indices covering 0 up to count,
+|   on any threads running jobs, and returns once every one is done.
+|___________________________________________________________________*/
+
+void Job_ParallelFor (int count, int grain, JobRangeFn fn, void *data)
+{
+  if (count <= 0)
+    return;
+  grain = std::max (grain, 1);
+  int n = (count - 1) / grain + 1;
+  if (n == 1 OR Job_NumThreads() == 1) {
+    fn (data, 0, count);
+    return;
+  }
+
+  TraceScope trace("Job_ParallelFor");
+
+  // The ranges are one array, owned here (the scheduler's reference never frees them)
+  Job *ranges = new Job[n];
+  std::atomic<int> left (n);
+  for (int i=0; i<n; i++) {
+    Job *job = &ranges[i];
+    job->fn       = 0;
+    job->range_fn = fn;
+    job->data     = data;
+    job->begin    = i * grain;
+    job->end      = std::min (count, (i + 1) * grain);
+    job->waiting.store (0, std::memory_order_relaxed);
+    job->refs.store (2, std::memory_order_relaxed);
+    job->done.store (false, std::memory_order_relaxed);
+    job->counter  = &left;
+  }
+  // Pushed last first, so this thread pops the first range and thieves take the last
+  if (worker_index >= 0)
+    for (int i=n-1; i>=0; i--)
+      Push (&ranges[i]);
+  else {
+    std::lock_guard<std::mutex> lock (inject_mutex);
+    for (int i=0; i<n; i++)
+      inject.push_back (&ranges[i]);
+    num_injected.fetch_add (n, std::memory_order_release);
+  }
+  Wake (true);
+
+  while (left.load(std::memory_order_acquire) > 0) {
+    Job *job = FindJob ();
+    if (job)
+      Run (job);
+    else
+      std::this_thread::yield ();
+  }
+  delete[] ranges;
+}
+
+/*____________________________________________________________________
+|
+| Function: Job_Shutdown
+|
+| Output: Stops the worker threads.
+|___________________________________________________________________*/
+
+void Job_Shutdown ()
+{
+  std::lock_guard<std::mutex> lock (init_mutex);
+
+  {
+    std::lock_guard<std::mutex> sleep_lock (sleep_mutex);
+    stopping = true;
+  }
+  sleep_cv.notify_all ();
+  for (size_t i=0; i<workers.size(); i++)
+    workers[i].join ();
+  workers.clear ();
+  for (size_t i=0; i<deques.size(); i++)
+    delete deques[i];
+  deques.clear ();
+  num_threads = 1;
+  running.store (false, std::memory_order_release);
+}
+
+/*____________________________________________________________________
+|
+| Function: Worker
+|
+| Output: Runs jobs until the pool is stopped, sleeping when there are
+|   none.
+|___________________________________________________________________*/
+
+static void Worker (int index)
+{
+  worker_index = index;
+  for (;;) {
+    // Note the submits before looking, so one made while looking isn't slept through
+    unsigned seen = submits.load ();
+    Job *job = FindJob ();
+    if (job) {
+      Run (job);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock (sleep_mutex);
+    if (stopping)
+      break;
+    sleeping.fetch_add (1);
+    sleep_cv.wait (lock, [seen] { return stopping OR submits.load() != seen; });
+    sleeping.fetch_sub (1);
+    if (stopping)
+      break;
+  }
+  worker_index = -1;
+}
+
+/*____________________________________________________________________
+|
+| Function: Push
+|
+| Output: Queues a job that is ready to run: on the calling worker's
+|   deque, or the shared queue if it isn't a worker or its deque is
+|   full.
+|___________________________________________________________________*/
+
+static void Push (Job *job)
+{
+  if (worker_index < 0 OR NOT DequePush(deques[worker_index], job)) {
+    std::lock_guard<std::mutex> lock (inject_mutex);
+    inject.push_back (job);
+    num_injected.fetch_add (1, std::memory_order_release);
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: Wake
+|
+| Output: Counts a submit and wakes a sleeping worker (or all of them).
+|___________________________________________________________________*/
+
+static void Wake (bool all)
+{
+  submits.fetch_add (1);
+  if (sleeping.load() == 0)
+    return;
+  // Taking the lock makes sure a worker about to sleep is waiting before it is notified
+  { std::lock_guard<std::mutex> lock (sleep_mutex); }
+  if (all)
+    sleep_cv.notify_all ();
+  else
+    sleep_cv.notify_one ();
+}
+
+/*____________________________________________________________________
+|
+| Function: FindJob
+|
+| Output: Returns a job to run: the newest from the calling worker's
+|   deque, else the oldest from the shared queue, else one stolen from
+|   another worker, or 0 if there are none.
+|___________________________________________________________________*/
+
+static Job *FindJob ()
+{
+  static thread_local unsigned seed = 0;
+  Job *job;
+
+  if (worker_index >= 0 AND (job = DequePop(deques[worker_index])) != 0)
+    return job;
+
+  if (num_injected.load(std::memory_order_acquire) > 0) {
+    std::lock_guard<std::mutex> lock (inject_mutex);
+    if (NOT inject.empty()) {
+      job = inject.front ();
+      inject.pop_front ();
+      num_injected.fetch_sub (1, std::memory_order_relaxed);
+      return job;
+    }
+  }
+
+  // Start at a random victim so thieves spread out
+  int n = (int)deques.size ();
+  if (n == 0)
+    return 0;
+  seed = seed * 1664525u + 1013904223u + (unsigned)worker_index;
+  int first = (int)((seed >> 16) % (unsigned)n);
+  for (int i=0; i<n; i++) {
+    int victim = (first + i) % n;
+    if (victim != worker_index AND (job = DequeSteal(deques[victim])) != 0)
+      return job;
+  }
+  return 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Run
+|
+| Output: Runs a job, then lets the jobs waiting for it go.
+|___________________________________________________________________*/
+
+static void Run (Job *job)
+{
+  std::vector<Job *> dependents;
+
+  {
+    TraceScope trace("job");
+    if (job->range_fn)
+      job->range_fn (job->data, job->begin, job->end);
+    else
+      job->fn (job->data);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock (job->mutex);
+    dependents.swap (job->dependents);
+    job->done.store (true, std::memory_order_release);
+  }
+  for (size_t i=0; i<dependents.size(); i++) {
+    if (dependents[i]->waiting.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      Push (dependents[i]);
+      Wake (false);
+    }
+    Job_Release (dependents[i]);
+  }
+
+  // The counter's owner may free the job once it reaches zero
+  std::atomic<int> *counter = job->counter;
+  Job_Release (job);
+  if (counter)
+    counter->fetch_sub (1, std::memory_order_release);
+}
+
+/*____________________________________________________________________
+|
+| Function: DequePush
+|
+| Output: Pushes a job on the bottom of a worker's own deque.  Returns
+|   false if it's full.
+|___________________________________________________________________*/
+
+static bool DequePush (JobDeque *deque, Job *job)
+{
+  long long b = deque->bottom.load (std::memory_order_relaxed);
+  long long t = deque->top.load (std::memory_order_acquire);
+  if (b - t >= JOB_DEQUE_SIZE)
+    return false;
+  deque->jobs[b & (JOB_DEQUE_SIZE - 1)].store (job, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_release);
+  deque->bottom.store (b + 1, std::memory_order_relaxed);
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: DequePop
+|
+| Output: Pops the newest job off the bottom of a worker's own deque,
+|   or returns 0 if it's empty (or a thief took the last one).
+|___________________________________________________________________*/
+
+static Job *DequePop (JobDeque *deque)
+{
+  long long b = deque->bottom.load (std::memory_order_relaxed) - 1;
+  deque->bottom.store (b, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+  long long t = deque->top.load (std::memory_order_relaxed);
+
+  if (t > b) {
+    deque->bottom.store (b + 1, std::memory_order_relaxed);
+    return 0;
+  }
+  Job *job = deque->jobs[b & (JOB_DEQUE_SIZE - 1)].load (std::memory_order_relaxed);
+  if (t == b) {
+    // The last one: race any thief for it
+    if (NOT deque->top.compare_exchange_strong (t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      job = 0;
+    deque->bottom.store (b + 1, std::memory_order_relaxed);
+  }
+  return job;
+}
+
+/*____________________________________________________________________
+|
+| Function: DequeSteal
+|
+| Output: Takes the oldest job off the top of another worker's deque,
+|   or returns 0 if it's empty or another thread got there first.
+|___________________________________________________________________*/
+
+static Job *DequeSteal (JobDeque *deque)
+{
+  long long t = deque->top.load (std::memory_order_acquire);
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+  long long b = deque->bottom.load (std::memory_order_acquire);
+
+  if (t >= b)
+    return 0;
+  Job *job = deque->jobs[t & (JOB_DEQUE_SIZE - 1)].load (std::memory_order_relaxed);
+  if (NOT deque->top.compare_exchange_strong (t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    return 0;
+  return job;
+}
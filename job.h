@@ -0,0 +1,43 @@
+/*____________________________________________________________________
+|
+| File: job.h
+|
+| Job system: short jobs run on a pool of worker threads that steal
+| from each other's queues.  A job can wait for other jobs to finish
+| before it starts, and a parallel for splits a range of indices into
+| jobs.  Waiting for a job runs other jobs meanwhile, so any thread
+| (the GL thread, a stream worker, a job) can wait without idling a
+| core.
+|___________________________________________________________________*/
+
+#define JOB_MAX_THREADS  32         // max # of threads running jobs (the caller's included)
+#define JOB_DEQUE_SIZE   4096       // # of jobs a worker's queue holds (must be a power of 2)
+
+struct Job;
+
+// Runs a job
+typedef void (*JobFn) (void *data);
+// Runs indices begin up to (not including) end of a parallel for
+typedef void (*JobRangeFn) (void *data, int begin, int end);
+
+// Starts num_threads-1 worker threads (0 = one per core, less the caller), stopping any
+//  running with a different count.  Called when the first job is run if needed.  With no
+//  workers, jobs only run when a thread waits
+void Job_Init (int num_threads);
+// Returns the # of threads that run jobs (the workers and a waiting thread)
+int  Job_NumThreads ();
+// Creates a job that runs fn(data) once submitted and its dependencies are finished
+Job *Job_Create (JobFn fn, void *data);
+// Makes a job (not submitted yet) wait for another to finish before it starts
+void Job_DependsOn (Job *job, Job *dependency);
+// Lets a job run (once its dependencies are finished)
+void Job_Submit (Job *job);
+// Waits for a job to finish, running other jobs meanwhile
+void Job_Wait (Job *job);
+// Lets go of a job from Job_Create() (it is freed once finished)
+void Job_Release (Job *job);
+// Runs fn over indices 0 up to count in ranges of grain indices, spread over the workers and
+//  the calling thread, and returns when they are all done
+void Job_ParallelFor (int count, int grain, JobRangeFn fn, void *data);
+// Stops the worker threads (no jobs may be pending)
+void Job_Shutdown ();
@@ -0,0 +1,41 @@
+/*____________________________________________________________________
+|
+| File: json.cpp
+|
+| Description: Helpers shared by the JSON writers (the event trace and
+|   the benchmark results).
+|
+| Functions: JSON_WriteString
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include "math3d.h"
+#include "json.h"
+
+/*____________________________________________________________________
+|
+| Function: JSON_WriteString
+|
+| Output: Writes str as a quoted JSON string.
+|___________________________________________________________________*/
+
+void JSON_WriteString (FILE *fp, const char *str)
+{
+  fputc ('"', fp);
+  for (; *str; str++) {
+    if (*str == '"' OR *str == '\\')
+      fputc ('\\', fp);
+    if ((unsigned char)*str >= ' ')
+      fputc (*str, fp);
+  }
+  fputc ('"', fp);
+}
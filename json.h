@@ -0,0 +1,7 @@
+/*____________________________________________________________________
+|
+| File: json.h
+|___________________________________________________________________*/
+
+// Writes str as a quoted JSON string, escaping quotes and backslashes (control characters are dropped)
+void JSON_WriteString (FILE *fp, const char *str);
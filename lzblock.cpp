@@ -0,0 +1,257 @@
+/*____________________________________________________________________
+|
+| File: lzblock.cpp
+|
+| Description: LZ4 block format compressor and decompressor.  A block
+|   is a list of sequences, each a run of literal bytes followed by a
+|   match: a copy of earlier output given by its offset (up to 64K back)
+|   and length (at least 4).  The compressor finds matches with a hash
+|   table of 4-byte sequences, greedily, trading some ratio for speed:
+|   decompression is little more than memcpy.  The decompressor checks
+|   every length and offset so a corrupt block can't overrun a buffer.
+|
+| Functions: LZ_Compress
+|            LZ_Decompress
+|            Read32
+|            Hash
+|            WriteLength
+|            ReadLength
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "math3d.h"
+#include "lzblock.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define MIN_MATCH       4
+#define LAST_LITERALS   5       // a block always ends with at least this many literals
+#define MF_LIMIT        12      // and no match starts closer than this to its end
+#define MAX_OFFSET      65535
+#define HASH_LOG        12      // # of bits in the hash table index
+#define SKIP_TRIGGER    6       // after 2^this misses in a row, step through the input faster
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static inline unsigned Read32 (const unsigned char *p);
+static inline unsigned Hash (unsigned v);
+static unsigned char *WriteLength (unsigned char *op, size_t length);
+static bool ReadLength (const unsigned char **ip, const unsigned char *iend, size_t *length);
+
+/*____________________________________________________________________
+|
+| Function: LZ_Compress
+|
+| Output: Compresses n bytes into dst.  Returns the size of the block,
+|   or 0 if it is bigger than capacity (LZ_BOUND(n) is always enough).
+|___________________________________________________________________*/
+
+size_t LZ_Compress (const unsigned char *src, size_t n, unsigned char *dst, size_t capacity)
+{
+  unsigned table[1 << HASH_LOG];  // position of the last 4 bytes with each hash
+  const unsigned char *ip = src, *anchor = src, *end = src + n;
+  unsigned char *op = dst, *oend = dst + capacity;
+  size_t literals, length;
+
+  if (n > MF_LIMIT) {
+    const unsigned char *mflimit = end - MF_LIMIT;
+    const unsigned char *matchlimit = end - LAST_LITERALS;
+    unsigned misses = 0;
+
+    memset (table, 0, sizeof(table));
+    for (ip++; ip < mflimit; ) {
+      // Look for an earlier occurrence of the next 4 bytes
+      unsigned seq = Read32 (ip);
+      unsigned h = Hash (seq);
+      const unsigned char *match = src + table[h];
+      table[h] = (unsigned)(ip - src);
+      if (ip - match > MAX_OFFSET OR Read32(match) != seq) {
+        ip += 1 + (misses++ >> SKIP_TRIGGER);
+        continue;
+      }
+      misses = 0;
+
+      // Extend the match back over the literals, then forward as far as it goes
+      while (ip > anchor AND match > src AND ip[-1] == match[-1]) {
+        ip--;
+        match--;
+      }
+      const unsigned char *p = ip + MIN_MATCH, *m = match + MIN_MATCH;
+      while (p < matchlimit AND *p == *m) {
+        p++;
+        m++;
+      }
+
+      // Write the sequence, leaving room for the last literals' token
+      literals = ip - anchor;
+      length = p - ip - MIN_MATCH;
+      if ((size_t)(oend - op) < 1 + literals / 255 + 1 + literals + 2 + length / 255 + 1 + 1 + LAST_LITERALS)
+        return 0;
+      unsigned char *token = op++;
+      *token = (unsigned char)((literals < 15 ? literals : 15) << 4);
+      if (literals >= 15)
+        op = WriteLength (op, literals);
+      memcpy (op, anchor, literals);
+      op += literals;
+      size_t offset = ip - match;
+      *op++ = (unsigned char) offset;
+      *op++ = (unsigned char) (offset >> 8);
+      *token |= (unsigned char)(length < 15 ? length : 15);
+      if (length >= 15)
+        op = WriteLength (op, length);
+      ip = anchor = p;
+
+      // The bytes just before often start the next match
+      if (ip < mflimit)
+        table[Hash(Read32(ip - 2))] = (unsigned)(ip - 2 - src);
+    }
+  }
+
+  // The rest are literals
+  literals = end - anchor;
+  if ((size_t)(oend - op) < 1 + literals / 255 + 1 + literals)
+    return 0;
+  *op++ = (unsigned char)((literals < 15 ? literals : 15) << 4);
+  if (literals >= 15)
+    op = WriteLength (op, literals);
+  memcpy (op, anchor, literals);
+  op += literals;
+  return op - dst;
+}
+
+/*____________________________________________________________________
+|
+| Function: LZ_Decompress
+|
+| Output: Decompresses a block into dst.  Returns true if it was valid
+|   and decoded to exactly size bytes.
+|___________________________________________________________________*/
+
+bool LZ_Decompress (const unsigned char *src, size_t n, unsigned char *dst, size_t size)
+{
+  const unsigned char *ip = src, *iend = src + n;
+  unsigned char *op = dst, *oend = dst + size;
+
+  while (ip < iend) {
+    unsigned token = *ip++;
+
+    // Literals
+    size_t literals = token >> 4;
+    if (literals == 15 AND NOT ReadLength(&ip, iend, &literals))
+      return false;
+    if (literals > (size_t)(iend - ip) OR literals > (size_t)(oend - op))
+      return false;
+    memcpy (op, ip, literals);
+    ip += literals;
+    op += literals;
+    // The last sequence has no match
+    if (ip == iend)
+      break;
+
+    // Match
+    if (iend - ip < 2)
+      return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 OR offset > (size_t)(op - dst))
+      return false;
+    size_t length = token & 15;
+    if (length == 15 AND NOT ReadLength(&ip, iend, &length))
+      return false;
+    length += MIN_MATCH;
+    if (length > (size_t)(oend - op))
+      return false;
+    const unsigned char *match = op - offset;
+    if (offset >= length) {
+      memcpy (op, match, length);
+      op += length;
+    }
+    else {
+      // Overlapping copy: repeats the last offset bytes
+      while (length--)
+        *op++ = *match++;
+    }
+  }
+  return op == oend;
+}
+
+/*____________________________________________________________________
+|
+| Function: Read32
+|
+| Output: Reads 4 bytes from any address.
+|___________________________________________________________________*/
+
+static inline unsigned Read32 (const unsigned char *p)
+{
+  unsigned v;
+  memcpy (&v, p, 4);
+  return v;
+}
+
+/*____________________________________________________________________
+|
+| Function: Hash
+|
+| Output: Returns a HASH_LOG bit hash of 4 bytes.
+|___________________________________________________________________*/
+
+static inline unsigned Hash (unsigned v)
+{
+  return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+/*____________________________________________________________________
+|
+| Function: WriteLength
+|
+| Output: Writes the bytes that follow a token for a length of 15 or
+|   more (255 for each full 255, then the remainder).  Returns the next
+|   output position.
+|___________________________________________________________________*/
+
+static unsigned char *WriteLength (unsigned char *op, size_t length)
+{
+  for (length -= 15; length >= 255; length -= 255)
+    *op++ = 255;
+  *op++ = (unsigned char) length;
+  return op;
+}
+
+/*____________________________________________________________________
+|
+| Function: ReadLength
+|
+| Output: Adds the bytes after a token to a length.  Returns false if
+|   the block ends first.
+|___________________________________________________________________*/
+
+static bool ReadLength (const unsigned char **ip, const unsigned char *iend, size_t *length)
+{
+  unsigned b;
+
+  do {
+    if (*ip >= iend)
+      return false;
+    b = *(*ip)++;
+    *length += b;
+  } while (b == 255);
+  return true;
+}
@@ -0,0 +1,17 @@
+/*____________________________________________________________________
+|
+| File: lzblock.h
+|
+| Fast block compression in the LZ4 block format (so the blocks can also
+| be read by the lz4 library).
+|___________________________________________________________________*/
+
+// Largest compressed size of n bytes (when nothing in them repeats)
+#define LZ_BOUND(_n_) ((_n_) + (_n_) / 255 + 16)
+
+// Compresses n bytes into dst, which holds capacity bytes.  Returns the compressed size,
+//  or 0 if it doesn't fit
+size_t LZ_Compress (const unsigned char *src, size_t n, unsigned char *dst, size_t capacity);
+// Decompresses a block of n bytes that must decode to exactly size bytes.  Returns false if
+//  the block is corrupt (it never reads or writes outside the buffers)
+bool   LZ_Decompress (const unsigned char *src, size_t n, unsigned char *dst, size_t size);
@@ -16,27 +16,91 @@
 #include <string>					// String handling
 #include <stdio.h>	  		// C Standard Library
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <float.h>
+#include <vector>
+#include <algorithm>
 #include "math3d.h"
+#include "memtrack.h"
 #include "ReadOBJFile.h"
+#include "mipmap.h"
+#include "texcompress.h"
+#include "atlas.h"
+#include "assets.h"
+#include "stream.h"
+#include "pack.h"
+#include "lzblock.h"
+#include "meshfile.h"
+#include "meshlet.h"
+#include "adjacency.h"
+#include "bvh.h"
+#include "morph.h"
+#include "job.h"
+#include "cpu.h"
+#include "watch.h"
+#include "glproc.h"
+#include "streambuf.h"
+#include "glcheck.h"
+#include "headless.h"
+#include "benchmark.h"
+#include "trace.h"
+#include "profiler.h"
+#include <chrono>
 using namespace std;
 
 // Function prototypes
-GLenum errorCheck(string function);
+#if defined(DEBUG_CODE) || defined(GL_INSTRUMENT)
+GLenum errorCheck(const char *function);
+#else
+#define errorCheck(_function_) GL_NO_ERROR  // glGetError() can force a sync with the GPU, so only check in debug/instrumented builds
+#endif
 void keyboard(unsigned char,int,int);
 void keyboard_up(unsigned char, int,int);
 void keyboardSpecial(int,int,int);
 void mouseMove(int x,int y);
 void init();
+int  runHeadless();
 void loadModels();
+void placeShields(int n);
+void finishBenchmark();
 void cleanup();
+void writeProfile();
+void writeTrace();
+void writeGLStats();
 void render();
 void update();
 void model3D_draw(Object3D *o);
 void model3D_drawFast(Object3D *o);
-void modelTex3D_drawFast(Object3D *o, GLuint texture_id, unsigned char *texture_data);
-
-bool loadBMPfile(char *filename,int *width,int *height,unsigned char **data);
+void modelTex3D_drawFast(Object3D *o, GLuint texture_id, StreamBuffer *blended, size_t offset);
+void shieldWeights(int i, int num_targets, float *weights);
+void phaseWeights(float phase, int num_targets, float *weights);
+int  poseStep(int i);
+bool blendShields(Object3D *mesh, size_t *offset);
+float screenSize(Vector3D *center, float radius);
+void writeAssets();
+void writeMemory();
+void exitMemory();
+void printClusterStats();
+int  loadMeshReport(char *path);
+int  meshCodecReport(char *path);
+int  adjacencyReport(char *path);
+int  jobBenchmark(int max_threads);
+void cameraRay(int x, int y, Vector3D *dir);
+void rotateShield(Vector3D *v, float degrees, Vector3D *out);
+void shieldRay(int i, Vector3D *origin, Vector3D *dir, Vector3D *shield_origin, Vector3D *shield_dir);
+BVH *shieldTree();
+BVH *shieldPose(Object3D *mesh, int i);
+void freePoses();
+bool pickShields(Vector3D *origin, Vector3D *dir, BVHHit *hit);
+bool sweepShields(Vector3D *center, Vector3D *move, float radius, BVHHit *hit);
+void queryShield(void *data, int i, Vector3D *origin, Vector3D *dir, BVHHit *hit);
+void moveCamera(Vector3D *move);
+void printBVHStats();
+void printPick(int x, int y);
+int  pickBenchmark(int num_rays);
+void jobBenchArithmetic(void *data, int begin, int end);
+void jobBenchNode(void *data);
 
 // List the static OpenGL libraries to link into this application
 #pragma comment (lib, "glut32.lib")
@@ -51,20 +115,84 @@ bool loadBMPfile(char *filename,int *width,int *height,unsigned char **data);
 #define VIEW_WIDTH  700
 #define VIEW_HEIGHT 700
 
+// Steps of the morph cycle the shields' poses are refit at for picking and collisions
+#define POSE_STEPS 32
+
 // Global variables (can be used by all functions in this file)
 int wireframe = 0;    // 0=off, 1=on
 int polygonshade = 1; // 0=flat shading, 1=smooth shading
 int lighton = 1;      // 0=off, 1=on
 
-// 3D models
-Object3D *obj_teapot = 0;
-GLuint texture_id = -1;           // -1 means not loaded
-unsigned char *texture_data = 0;  // 0 means not loaded
+// Headless mode (set from the command line)
+int headless_frames = 0;                          // 0=normal window, >0=render this many frames offscreen then exit
+char *headless_dump = 0;                          // if set, save each frame as <headless_dump>NNNN.ppm
+char *headless_times = "frame_times.csv";         // per-frame timings are written here
+
+// Profiling
+char *profile_csv = "profile.csv";  // 'p' key (or exit, if given with -profile) writes timer statistics here
+int prof_frame, prof_render, prof_update, prof_collide, prof_morph, prof_draw_shields, prof_draw_overlay, prof_flush, prof_stream;
+char *trace_json = "trace.json";    // 't' key (or exit, if given with -trace) writes the event trace here
+char *glstats_csv = "glstats.csv";  // 'g' key (or exit, if given with -glstats) writes GL call counts here (GL_INSTRUMENT builds)
+char *assets_csv = "assets.csv";    // 'm' key (or loading, if given with -assets) writes memory per asset here
+bool assets_after_load = false;
+char *memory_csv = "memory.csv";    // 'r' key (or exit, if given with -memory) writes memory per tag here
+bool memory_at_exit = false;        // -memory: the exit report is still to be written (see exitMemory)
+
+// Benchmark mode (set from the command line)
+char *benchmark_path = 0;                   // camera path to replay (or "builtin"), 0=off
+char *benchmark_json = "benchmark.json";    // results are written here
+double load_ms = 0;                         // time taken by loadModels() (until the last asset streamed in)
+
+// Asset streaming (set from the command line)
+bool stream_assets = true;                  // load assets on worker threads while rendering, false=load them all in init()
+size_t upload_budget = STREAM_UPLOAD_BUDGET; // bytes of streamed assets uploaded per frame
+bool streaming = false;                     // assets are still streaming in
+long long load_start;                       // when loadModels() started
+bool pack_compress = true;                  // -mkpack compresses the assets that shrink
+bool watch_assets = false;                  // reload meshes and textures when their files change
+
+// Texture compression (set from the command line)
+TexFormat texture_format = TEXFMT_BC1;  // used for the shield texture if the GL supports S3TC
+int texture_quality = TEXQ_NORMAL;
+bool use_atlas = false;                 // pack the shield and overlay textures into one atlas
+bool cook_meshes = false;                 // load meshes from cooked .kmc files
+size_t texture_budget = 0;              // stream mip levels by screen size within this many bytes, 0=load them all
+GLuint bound_texture = -1;              // texture last bound by modelTex3D_drawFast() this frame
+bool cull_clusters = true;              // skip the meshlets outside the view or facing away ('c' key prints the counts)
+bool collide_camera = true;             // stop the camera at the shields and slide it along them ('b' key prints the BVH counts)
+bool animate_morphs = true;             // blend the shield mesh's morph targets (if it has any) into each shield's pose
+
+// Shield instances
+Vector3D default_shield_position[] = {{0,-5,-10}, {10,-5,-25}, {20,-5,-35}};
+Vector3D *shield_position = default_shield_position;
+int num_shields = 3;
+float shield_rotate = 0;                // degrees the shields are turned about (10,1,0)
+float morph_phase = 0;                  // radians the shields' morph weights have cycled through
+StreamBuffer morph_buffer;              // the shields' blended poses, written anew every frame
+BVH *shield_bvh = 0;                    // tree over the shields' bounding spheres for picking, 0 = build it on the next pick
+float shield_bvh_radius = 0;            // shield radius it was built with
+
+// A shield mesh BVH refit to the pose at one step of the morph cycle (see shieldPose)
+struct ShieldPose {
+  BVH          *bvh;
+  unsigned      checksum;               // of the mesh it was refit from
+  MorphTargets *morph;
+};
+ShieldPose pose_cache[POSE_STEPS];
+
+// What queryShield() tests the shields with
+struct ShieldQuery {
+  Object3D *mesh;
+  float     radius;                     // of a sphere swept along the ray, 0 = just the ray
+};
+
+// 3D models and textures (asset handles, ASSET_NONE means not loaded)
+int shield_mesh = ASSET_NONE;
+int shield_texture = ASSET_NONE;
 
 //overlay
-Object3D *obj_overlay = 0;
-GLuint texture_overlay_id = -1;           // -1 means not loaded
-unsigned char *texture_overlay_data = 0;  // 0 means not loaded
+int overlay_mesh = ASSET_NONE;
+int overlay_texture = ASSET_NONE;
 
 // Current mouse position
 int mouse_x,mouse_y;
@@ -97,6 +225,129 @@ Vector3D camera_up;
 *************************************************************************************/
 int main(int argc, char **argv) {
 
+  // Command line options:
+  //   -headless <n>     render n frames into an offscreen context (no window) then exit
+  //   -dump <prefix>    in headless mode, save each frame as <prefix>NNNN.ppm
+  //   -times <file>     in headless mode, where to write per-frame timings (CSV)
+  //   -profile <file>   write frame-phase timer statistics (CSV) to this file on exit
+  //   -trace <file>     write a Chrome trace of loading and rendering (JSON) to this file on exit
+  //   -glstats <file>   write GL call counts per call site (CSV) to this file on exit (GL_INSTRUMENT builds)
+  //   -bench <path>     replay a camera path file (or "builtin") and report frame times, then exit
+  //                     (with -headless the whole path is rendered offscreen, ignoring the frame count)
+  //   -bench-out <file> where to write the benchmark results (JSON)
+  //   -instances <n>    draw n shields instead of the default 3
+  //   -record <file>    record the camera input to a path file that -bench can replay
+  //   -assets <file>    write the memory used by each asset (CSV) to this file after loading
+  //   -memory <file>    write the current and peak memory of the loader, meshes, textures and GL (CSV)
+  //                     to this file on exit
+  //   -texformat <fmt>  shield texture format: bc1 (default), bc3 or rgb (compressed needs S3TC)
+  //   -texquality <n>   compression quality: 0=fast, 1=normal (default), 2=high
+  //   -atlas            pack the shield and overlay textures into one atlas texture
+  //   -syncload         load every asset before the first frame instead of streaming them in
+  //   -uploadbudget <n> upload at most n KB of streamed assets per frame (default 4096)
+  //   -pack <file>      read assets from this asset pack before loose files (can be given more than once)
+  //   -mkpack <file> <asset>...  write the assets listed after it to a new asset pack, then exit
+  //   -nocompress       store every asset uncompressed in -mkpack (give it before -mkpack)
+  //   -watch            reload meshes and textures while running when their files change
+  //   -texbudget <n>    stream texture mip levels as their objects need them, within n MB of textures
+  //   -loadmesh <file>  load an OBJ file and report its size, load time and the peak memory used, then exit
+  //   -cookmeshes       load meshes from cooked mesh files (.kmc, made from the OBJ files when missing or
+  //                     out of date) instead of parsing the OBJ files, and their BVHs from .kbv files
+  //   -meshcodec <file> encode an OBJ file as a cooked mesh and report its size, error and decode time, then exit
+  //   -noclusters       draw every polygon of each mesh instead of culling its meshlets
+  //   -nocollide        let the camera fly through the shields
+  //   -nomorph          draw (and pick and collide with) the shields in their base pose instead of blending
+  //                     their morph targets
+  //   -adjacency <file> build an OBJ file's adjacency and report its size, build time and query times, then exit
+  //   -jobbench <n>     time parallel work with the job system on 1 to n threads (0 = one per core), then exit
+  //   -pickbench <n>    time picking the shields with n rays through random pixels, with the BVHs and testing
+  //                     every polygon, then exit
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-headless") && i+1 < argc)
+      headless_frames = atoi(argv[++i]);
+    else if (!strcmp(argv[i],"-dump") && i+1 < argc)
+      headless_dump = argv[++i];
+    else if (!strcmp(argv[i],"-times") && i+1 < argc)
+      headless_times = argv[++i];
+    else if (!strcmp(argv[i],"-profile") && i+1 < argc) {
+      profile_csv = argv[++i];
+      atexit(writeProfile);                                   // 'q' calls exit() so this is the only sure way
+    }
+    else if (!strcmp(argv[i],"-trace") && i+1 < argc) {
+      trace_json = argv[++i];
+      atexit(writeTrace);
+    }
+    else if (!strcmp(argv[i],"-glstats") && i+1 < argc) {
+      glstats_csv = argv[++i];
+      atexit(writeGLStats);
+    }
+    else if (!strcmp(argv[i],"-assets") && i+1 < argc) {
+      assets_csv = argv[++i];
+      assets_after_load = true;
+    }
+    else if (!strcmp(argv[i],"-memory") && i+1 < argc) {
+      memory_csv = argv[++i];
+      memory_at_exit = true;
+      atexit(exitMemory);
+    }
+    else if (!strcmp(argv[i],"-bench") && i+1 < argc)
+      benchmark_path = argv[++i];
+    else if (!strcmp(argv[i],"-bench-out") && i+1 < argc)
+      benchmark_json = argv[++i];
+    else if (!strcmp(argv[i],"-instances") && i+1 < argc)
+      placeShields(atoi(argv[++i]));
+    else if (!strcmp(argv[i],"-texformat") && i+1 < argc) {
+      i++;
+      texture_format = !strcmp(argv[i],"bc3") ? TEXFMT_BC3 : !strcmp(argv[i],"bc1") ? TEXFMT_BC1 : TEXFMT_RGB;
+    }
+    else if (!strcmp(argv[i],"-texquality") && i+1 < argc)
+      texture_quality = atoi(argv[++i]);
+    else if (!strcmp(argv[i],"-atlas"))
+      use_atlas = true;
+    else if (!strcmp(argv[i],"-syncload"))
+      stream_assets = false;
+    else if (!strcmp(argv[i],"-uploadbudget") && i+1 < argc)
+      upload_budget = (size_t)atoi(argv[++i]) << 10;
+    else if (!strcmp(argv[i],"-record") && i+1 < argc) {
+      if (Benchmark_StartRecording(argv[++i]))
+        atexit(Benchmark_StopRecording);
+    }
+    else if (!strcmp(argv[i],"-pack") && i+1 < argc) {
+      if (!Pack_Mount(argv[++i]))
+        return 1;
+    }
+    else if (!strcmp(argv[i],"-nocompress"))
+      pack_compress = false;
+    else if (!strcmp(argv[i],"-watch"))
+      watch_assets = true;
+    else if (!strcmp(argv[i],"-texbudget") && i+1 < argc)
+      texture_budget = (size_t)(atof(argv[++i]) * (1 << 20));
+    else if (!strcmp(argv[i],"-mkpack") && i+1 < argc)
+      return Pack_Write(argv[i+1],argv+i+2,argc-i-2,pack_compress) ? 0 : 1;
+    else if (!strcmp(argv[i],"-loadmesh") && i+1 < argc)
+      return loadMeshReport(argv[i+1]);
+    else if (!strcmp(argv[i],"-cookmeshes"))
+      cook_meshes = true;
+    else if (!strcmp(argv[i],"-meshcodec") && i+1 < argc)
+      return meshCodecReport(argv[i+1]);
+    else if (!strcmp(argv[i],"-noclusters"))
+      cull_clusters = false;
+    else if (!strcmp(argv[i],"-nocollide"))
+      collide_camera = false;
+    else if (!strcmp(argv[i],"-nomorph"))
+      animate_morphs = false;
+    else if (!strcmp(argv[i],"-adjacency") && i+1 < argc)
+      return adjacencyReport(argv[i+1]);
+    else if (!strcmp(argv[i],"-jobbench") && i+1 < argc)
+      return jobBenchmark(atoi(argv[i+1]));
+    else if (!strcmp(argv[i],"-pickbench") && i+1 < argc)
+      return pickBenchmark(atoi(argv[i+1]));
+  }
+  if (benchmark_path && !Benchmark_LoadPath(benchmark_path))
+    return 1;
+  if (headless_frames > 0)
+    return runHeadless();
+
 	glutInit(&argc, argv);										                  // Initialize GLUT  
 	glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_SINGLE);	  // Set up display buffer (single buffer and z-buffer (depth buffer) with RGB color mode)  
 	glutInitWindowSize(VIEW_WIDTH,VIEW_WIDTH);								  // Set the width and height of the window  
@@ -116,6 +367,60 @@ int main(int argc, char **argv) {
   cleanup();
 }
 
+/*************************************************************************************
+| Function: runHeadless
+|
+| Description: Renders headless_frames frames of the scene into an offscreen context
+| instead of a window, so the program can run on machines with no display or GPU.
+| The time for each frame (render() plus glFinish()) is written to headless_times and
+| each frame is optionally saved as a PPM image.
+| Output: The process exit code.
+*************************************************************************************/
+int runHeadless() {
+
+  if (!Headless_CreateContext(VIEW_WIDTH,VIEW_HEIGHT))
+    return 1;
+
+  init();
+
+  // No mouse - keep it centered so the camera doesn't turn
+  mouse_x = VIEW_WIDTH/2;
+  mouse_y = VIEW_HEIGHT/2;
+
+  FILE *fp = fopen(headless_times,"wt");
+  if (fp)
+    fprintf(fp,"frame,ms\n");
+
+  double total_ms = 0;
+  int frame;
+  for (frame = 0; benchmark_path ? !Benchmark_Done() : frame < headless_frames; frame++) {
+    chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+    render();
+    glFinish();                                               // Wait for the frame to actually finish
+    chrono::duration<double,milli> elapsed = chrono::high_resolution_clock::now() - start;
+    total_ms += elapsed.count();
+    if (fp)
+      fprintf(fp,"%d,%.3f\n",frame,elapsed.count());
+
+    if (headless_dump) {
+      char filename[512];
+      snprintf(filename,sizeof(filename),"%s%04d.ppm",headless_dump,frame);
+      Headless_WriteFrame(filename,VIEW_WIDTH,VIEW_HEIGHT);
+    }
+  }
+  if (fp)
+    fclose(fp);
+  cout << "Rendered " << frame << " frames, average " << total_ms / frame << " ms" << endl;
+  printClusterStats();
+  printBVHStats();
+  if (benchmark_path)
+    finishBenchmark();
+
+  cleanup();
+  Headless_DestroyContext();
+  return 0;
+}
+
 /*************************************************************************************
 | Function: errorCheck
 |
@@ -125,15 +430,19 @@ int main(int argc, char **argv) {
 | functions.
 | Input: The name of the function that calls errorCheck.
 | Output: The GLenum containing the error code.
+|
+| Note: Only compiled in debug or GL_INSTRUMENT builds, otherwise errorCheck() is a
+| macro that does nothing.
 *************************************************************************************/
-GLenum errorCheck(string function) {
+#if defined(DEBUG_CODE) || defined(GL_INSTRUMENT)
+GLenum errorCheck(const char *function) {
 
   GLenum code;												        // Stores the error code
-  const GLubyte *errorString;									// Stores error string
 
   code = glGetError();										    // Check for stored error codes
 
 #ifdef DEBUG_CODE											
+  const GLubyte *errorString;									// Stores error string
   if(code != GL_NO_ERROR) {									  // Error detected
     errorString = gluErrorString(code);				// Store error string and print it
     cout << "OpenGL error in function '" << function
@@ -145,10 +454,13 @@ GLenum errorCheck(string function) {
   }
   else
     cout << "Function '" << function << "' execution successful." << endl;
+#else
+  (void)function;												// Only named in the debug messages
 #endif
 
   return code;
 }
+#endif
 
 /*************************************************************************************
 | Function: keyboard
@@ -170,6 +482,22 @@ void keyboard(unsigned char key,int x,int y) {
     move_left = true;
   else if(key == 'd' || key == 'D')
     move_right = true;
+  else if(key == 'p' || key == 'P')
+    writeProfile();
+  else if(key == 't' || key == 'T')
+    writeTrace();
+  else if(key == 'g' || key == 'G')
+    writeGLStats();
+  else if(key == 'm' || key == 'M')
+    writeAssets();
+  else if(key == 'r' || key == 'R')
+    writeMemory();
+  else if(key == 'c' || key == 'C')
+    printClusterStats();
+  else if(key == 'e' || key == 'E')
+    printPick(x, y);
+  else if(key == 'b' || key == 'B')
+    printBVHStats();
 
   errorCheck("keyboard");
 }
@@ -234,6 +562,20 @@ void mouseMove(int x,int y)
 *************************************************************************************/
 void init() {
 
+  GLProc_Init();                  // Load OpenGL entry points beyond 1.1
+  StreamBuf_Init(&morph_buffer);  // Where the shields' blended poses are written each frame
+
+  // Frame-phase timers
+  prof_frame          = Profile_Register("frame");
+  prof_render         = Profile_Register("render");
+  prof_update         = Profile_Register("update");
+  prof_collide        = Profile_Register("camera collision");
+  prof_morph          = Profile_Register("morph blend");
+  prof_draw_shields   = Profile_Register("draw shields");
+  prof_draw_overlay   = Profile_Register("draw overlay");
+  prof_flush          = Profile_Register("flush");
+  prof_stream         = Profile_Register("stream uploads");
+
   glClearColor(0.0,0.0,0.0,1.0);  // Assign the background color of our window (with color black)  
 
   glMatrixMode(GL_PROJECTION);		// Set the display mode as projection
@@ -244,8 +586,18 @@ void init() {
   glCullFace(GL_BACK);
   //glFrontFace(GL_CCW);          // shouldn't be necessary to set since CCW is the default
 
-  // Load 3D models
-  loadModels ();             
+  // Load 3D models (if streamed, this only queues them and they pop in as they finish)
+  {
+    TraceScope trace("loadModels");
+    load_start = Profile_Now();
+    Asset_Watch(watch_assets);
+    Asset_CookMeshes(cook_meshes);
+    Asset_SetTextureBudget(texture_budget);
+    loadModels ();
+    streaming = stream_assets;
+    if (!streaming)
+      load_ms = (Profile_Now() - load_start) / 1.0e6;
+  }
 
   errorCheck("init");
 }
@@ -257,42 +609,70 @@ void init() {
 *************************************************************************************/
 void loadModels() {
 
+  // Load now, or queue the loads for the stream workers
+  int (*loadMesh)(char *,bool,bool) = stream_assets ? Asset_StreamMesh : Asset_LoadMesh;
+  int (*loadTexture)(char *,TexFormat,int,bool) = stream_assets ? Asset_StreamTexture : Asset_LoadTexture;
+  int (*loadAtlas)(char *,char **,int,TexFormat,int,bool,int *) = stream_assets ? Asset_StreamAtlas : Asset_LoadAtlas;
+
   // Load a model
   bool load_texcoords = true;
   bool smooth_discontinuous_vertices = true;
-  ReadOBJFile ("romanshield.obj",&obj_teapot,load_texcoords,smooth_discontinuous_vertices);
-
-  // Load a texture
-  int width,height;
-  if (loadBMPfile("romantexture.bmp",&width,&height,&texture_data)) {
-    // Create an OpenGL texture
-    glGenTextures(1,&texture_id);
-    // Bind the newly created texture - all future texture functions will modify this texture
-    glBindTexture(GL_TEXTURE_2D,texture_id);
-    // Pass the image data to OpenGL
-    //glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,width,height,0,GL_BGR,GL_UNSIGNED_BYTE,data);
-    glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,width,height,0,GL_RGB,GL_UNSIGNED_BYTE,texture_data);
-    // Define how the texture will be sampled
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+  shield_mesh = loadMesh("romanshield.obj",load_texcoords,smooth_discontinuous_vertices);
+  // Load a model
+  overlay_mesh = loadMesh("overlay.obj", load_texcoords, false);
+
+  // Load the textures (cooked from the BMP files on first use, compressed if the GL supports it)
+  TexFormat format = glproc_s3tc ? texture_format : TEXFMT_RGB;
+  if (use_atlas) {
+    // One texture for both, so drawing them doesn't need another bind
+    char *paths[] = {"romantexture.bmp", "overlay.bmp"};
+    int handles[2];
+    loadAtlas("atlas", paths, 2, format, texture_quality, true, handles);
+    shield_texture = handles[0];
+    overlay_texture = handles[1];
+    Asset_RemapToAtlas(shield_mesh, shield_texture);
+    Asset_RemapToAtlas(overlay_mesh, overlay_texture);
+  }
+  else {
+    shield_texture = loadTexture("romantexture.bmp",format,texture_quality,true);
+    overlay_texture = loadTexture("overlay.bmp", TEXFMT_RGB, 0, false);
   }
 
-  // Load a model
-  ReadOBJFile("overlay.obj", &obj_overlay, load_texcoords, false);
-  // Load a texture
-  if (loadBMPfile("overlay.bmp", &width, &height, &texture_overlay_data)) {
-	  // Create an OpenGL texture
-	  glGenTextures(1, &texture_overlay_id);
-	  // Bind the newly created texture - all future texture functions will modify this texture
-	  glBindTexture(GL_TEXTURE_2D, texture_overlay_id);
-	  // Pass the image data to OpenGL
-	  //glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,width,height,0,GL_BGR,GL_UNSIGNED_BYTE,data);
-	  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, texture_overlay_data);
-	  // Define how the texture will be sampled
-	  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  if (assets_after_load && !stream_assets)
+    writeAssets();
+}
+
+/*************************************************************************************
+| Function: placeShields
+|
+| Description: Places n shield instances in rows of up to 10, starting in front of the
+| camera and going back into the scene.
+*************************************************************************************/
+void placeShields(int n) {
+
+  if (n < 1)
+    return;
+  if (shield_position != default_shield_position)
+    free(shield_position);
+  shield_position = (Vector3D *) malloc(n * sizeof(Vector3D));
+  for (int i = 0; i < n; i++) {
+    shield_position[i].x = (float)(10 * (i % 10) - 45);
+    shield_position[i].y = -5;
+    shield_position[i].z = (float)(-10 - 15 * (i / 10));
   }
+  num_shields = n;
+  BVH_Free(shield_bvh);
+  shield_bvh = 0;
+}
 
+/*************************************************************************************
+| Function: finishBenchmark
+|
+| Description: Writes the benchmark results to benchmark_json.
+*************************************************************************************/
+void finishBenchmark() {
+
+  Benchmark_WriteJSON(benchmark_json,(const char *)glGetString(GL_RENDERER),num_shields,load_ms);
 }
 
 /*************************************************************************************
@@ -302,14 +682,474 @@ void loadModels() {
 *************************************************************************************/
 void cleanup() {
 
-  FreeObject (obj_teapot);
-  obj_teapot = 0;
-  // Free the data buffer created by loadBMPfile()
-  free(texture_data);
+  // Report what is still held before freeing it
+  exitMemory();
+  Profile_Shutdown();
+
+  // Stop loading (anything still loading is thrown away)
+  Stream_Shutdown();
+
+  // Free the meshes and textures
+  Asset_ReleaseAll();
+  BVH_Free(shield_bvh);
+  shield_bvh = 0;
+  freePoses();
+  StreamBuf_Free(&morph_buffer);
+  Watch_Shutdown();
+  Pack_UnmountAll();
+  Job_Shutdown();
+}
+
+/*************************************************************************************
+| Function: writeProfile
+|
+| Description: Writes the frame-phase timer statistics to profile_csv.
+*************************************************************************************/
+void writeProfile() {
+
+  if (Profile_WriteCSV(profile_csv))
+    cout << "Profile written to " << profile_csv << endl;
+}
+
+/*************************************************************************************
+| Function: writeTrace
+|
+| Description: Writes the recorded trace events to trace_json.
+*************************************************************************************/
+void writeTrace() {
+
+  if (Trace_WriteJSON(trace_json))
+    cout << "Trace written to " << trace_json << endl;
+}
+
+/*************************************************************************************
+| Function: writeGLStats
+|
+| Description: Writes the GL call counts per call site to glstats_csv.
+*************************************************************************************/
+void writeGLStats() {
+
+  if (GLStats_WriteCSV(glstats_csv))
+    cout << "GL call counts written to " << glstats_csv << endl;
+}
+
+/*************************************************************************************
+| Function: writeAssets
+|
+| Description: Writes the memory used by each loaded asset to assets_csv.
+*************************************************************************************/
+void writeAssets() {
+
+  if (Asset_WriteCSV(assets_csv))
+    cout << "Asset memory written to " << assets_csv << endl;
+}
+
+/*************************************************************************************
+| Function: writeMemory
+|
+| Description: Prints the memory counted against each tag and writes it to memory_csv.
+*************************************************************************************/
+void writeMemory() {
+
+  Mem_Print();
+  if (Mem_WriteCSV(memory_csv))
+    cout << "Memory report written to " << memory_csv << endl;
+}
+
+/*************************************************************************************
+| Function: exitMemory
+|
+| Description: Writes the memory report -memory asks for at exit, once: from cleanup()
+| (while the assets are still loaded) or, for an exit() that skips cleanup(), at exit.
+*************************************************************************************/
+void exitMemory() {
 
-  FreeObject(obj_overlay);
-  obj_overlay = 0;
-  free(texture_overlay_data);
+  if (!memory_at_exit)
+    return;
+  memory_at_exit = false;
+  writeMemory();
+}
+
+/*************************************************************************************
+| Function: printClusterStats
+|
+| Description: Prints how many meshlets were culled, and how many polygons and draw
+| calls were left, since the last time, then starts counting again.
+*************************************************************************************/
+void printClusterStats() {
+
+  MeshletStats s;
+  Meshlet_GetStats(&s);
+  Meshlet_ResetStats();
+  if (s.objects == 0)
+    return;
+  printf("Meshlets: %lld tested, %lld outside the view (%.1f%%), %lld facing away (%.1f%%)\n",
+         s.meshlets,s.outside,s.meshlets ? 100.0 * s.outside / s.meshlets : 0.0,
+         s.backfacing,s.meshlets ? 100.0 * s.backfacing / s.meshlets : 0.0);
+  printf("Polygons: %lld of %lld drawn (%.1f%%) in %.2f draw calls per object\n",
+         s.drawn,s.polygons,s.polygons ? 100.0 * s.drawn / s.polygons : 0.0,(double)s.runs / s.objects);
+}
+
+/*************************************************************************************
+| Function: printBVHStats
+|
+| Description: Prints how many BVH queries (camera collision and picking, counting the
+| tree over the shields and each shield's) were made, and the nodes, shields and
+| triangles each took, since the last time, then starts counting again.  The time taken
+| by camera collision is in the profile ("camera collision").
+*************************************************************************************/
+void printBVHStats() {
+
+  BVHStats s;
+  BVH_GetStats(&s);
+  BVH_ResetStats();
+  if (s.queries == 0)
+    return;
+  printf("BVH: %lld queries, %.1f nodes, %.2f shields and %.1f triangles tested per query\n",
+         s.queries,(double)s.nodes / s.queries,(double)s.spheres / s.queries,(double)s.triangles / s.queries);
+}
+
+/*************************************************************************************
+| Function: loadMeshReport
+|
+| Description: Loads an OBJ file the way the shield is loaded (with texcoords if it has
+| any) and reports its size, how long it took and the process' peak memory before and
+| after, to measure the loader on large meshes.
+| Output: The process exit code.
+*************************************************************************************/
+int loadMeshReport(char *path) {
+  Object3D *mesh;
+
+  size_t peak_before = Profile_PeakMemory();
+  long long start = Profile_Now();
+  bool texcoords = true;
+  ReadOBJFile(path, &mesh, texcoords, false);
+  if (mesh == 0) {
+    texcoords = false;
+    ReadOBJFile(path, &mesh, texcoords, false);
+  }
+  double ms = (Profile_Now() - start) / 1.0e6;
+  if (mesh == 0) {
+    cout << path << ": could not be loaded" << endl;
+    return 1;
+  }
+
+  printf("%s: %d vertices, %d polygons%s, loaded in %.1f ms\n", path, mesh->num_vertices, mesh->num_polygons,
+         texcoords ? " (with texcoords)" : "", ms);
+  printf("Peak memory: %.2f MB before loading, %.2f MB after\n", peak_before / 1048576.0, Profile_PeakMemory() / 1048576.0);
+  Mem_Print();
+  FreeObject(mesh);
+  return 0;
+}
+
+/*************************************************************************************
+| Function: adjacencyReport
+|
+| Description: Builds the adjacency of an OBJ file (see adjacency.h) and reports how
+| much memory it takes, how long building it takes, how long walking every one-ring
+| takes and how long ComputeVertexNormals() takes with it.
+| Output: The process exit code.
+*************************************************************************************/
+int adjacencyReport(char *path) {
+  const int runs = 50;
+  Object3D *mesh;
+  Adjacency adj;
+  int i, k, ring[64];
+
+  ReadOBJFile(path, &mesh, true, false);
+  if (mesh == 0)
+    ReadOBJFile(path, &mesh, false, false);
+  if (mesh == 0) {
+    cout << path << ": could not be loaded" << endl;
+    return 1;
+  }
+
+  long long start = Profile_Now();
+  for (i = 0; i < runs; i++) {
+    if (i > 0)
+      Adjacency_Free(&adj);
+    if (!Adjacency_Build(mesh, &adj, MEM_LOADER)) {
+      cout << path << ": out of memory" << endl;
+      return 1;
+    }
+  }
+  double build_ms = (Profile_Now() - start) / 1.0e6 / runs;
+
+  // Every one-ring, and the polygons across every edge
+  int max_valence = 0;
+  long long ring_total = 0, across = 0;
+  start = Profile_Now();
+  for (i = 0; i < runs; i++)
+    for (k = 0; k < adj.num_positions; k++) {
+      int n = Adjacency_OneRing(&adj, k, ring, 64);
+      max_valence = max(max_valence, n);
+      ring_total += n;
+    }
+  double ring_ms = (Profile_Now() - start) / 1.0e6 / runs;
+  start = Profile_Now();
+  for (i = 0; i < runs; i++)
+    for (k = 0; k < mesh->num_polygons * 3; k++)
+      across += Adjacency_EdgePolygon(&adj, k / 3, k % 3) >= 0;
+  double edge_ms = (Profile_Now() - start) / 1.0e6 / runs;
+
+  double normals_ms[2];
+  for (k = 0; k < 2; k++) {
+    start = Profile_Now();
+    for (i = 0; i < runs; i++)
+      ComputeVertexNormals(mesh, k == 1);
+    normals_ms[k] = (Profile_Now() - start) / 1.0e6 / runs;
+  }
+
+  printf("%s: %d vertices (%d positions), %d polygons, %d boundary edges\n", path, mesh->num_vertices,
+         adj.num_positions, mesh->num_polygons, adj.boundary_edges);
+  printf("  adjacency %zu bytes (%.1f per polygon), built in %.3f ms (%.1f ns per polygon)\n", adj.bytes,
+         (double)adj.bytes / mesh->num_polygons, build_ms, build_ms * 1.0e6 / mesh->num_polygons);
+  printf("  one-rings: average valence %.2f, max %d, all walked in %.3f ms; edges crossed in %.3f ms (%lld)\n",
+         adj.num_positions ? (double)ring_total / runs / adj.num_positions : 0.0, max_valence, ring_ms, edge_ms,
+         across / runs);
+  printf("  ComputeVertexNormals %.3f ms, %.3f ms smoothing discontinuous vertices\n", normals_ms[0], normals_ms[1]);
+  Adjacency_Free(&adj);
+  FreeObject(mesh);
+  return 0;
+}
+
+/*************************************************************************************
+| Function: jobBenchArithmetic
+|
+| Description: A -jobbench parallel for range: iterates a square root on each index.
+*************************************************************************************/
+void jobBenchArithmetic(void *data, int begin, int end) {
+
+  float *out = (float *)data;
+  for (int i = begin; i < end; i++) {
+    float x = (float)i;
+    for (int k = 0; k < 64; k++)
+      x = sqrtf(x * 0.5f + 1.0f);
+    out[i] = x;
+  }
+}
+
+/*************************************************************************************
+| Function: jobBenchNode
+|
+| Description: A -jobbench job graph node: iterates a square root on its value.
+*************************************************************************************/
+struct JobBenchNode {
+  Job   *job;
+  float  value;
+};
+
+void jobBenchNode(void *data) {
+
+  JobBenchNode *node = (JobBenchNode *)data;
+  float x = node->value;
+  for (int k = 0; k < 256; k++)
+    x = sqrtf(x + 1.0f);
+  node->value = x;
+}
+
+/*************************************************************************************
+| Function: jobBenchmark
+|
+| Description: Times the same work on the job system with 1 thread up to max_threads
+| (0 = one per core) and prints the speedup of each: a parallel for over pure arithmetic,
+| vertex normals of a 255x255 grid, the first mip level and BC1 encoding of a 1024x1024
+| image, and a graph of small jobs each waiting for two others.
+| Output: The process exit code.
+*************************************************************************************/
+int jobBenchmark(int max_threads) {
+  const int runs = 5, grid = 255, image = 1024, arithmetic = 1 << 18, graph_width = 64, graph_depth = 64;
+  const char *names[] = { "parallel for", "vertex normals", "mipmap", "BC1 encode", "job graph" };
+  double ms[JOB_MAX_THREADS+1][5];
+  int i, k, t;
+
+  if (max_threads <= 0)
+    max_threads = CPU_NumThreads();
+  max_threads = min(max_threads, (int)JOB_MAX_THREADS);
+
+  // A wavy grid, so the normals vary
+  Object3D *mesh = NewObject(grid * grid, (grid - 1) * (grid - 1) * 2, false);
+  for (i = 0; i < grid * grid; i++) {
+    float x = (float)(i % grid), z = (float)(i / grid);
+    mesh->vertex[i].x = x;
+    mesh->vertex[i].y = sinf(x * 0.1f) * cosf(z * 0.13f) * 4;
+    mesh->vertex[i].z = z;
+  }
+  for (i = 0, k = 0; i < grid * grid; i++) {
+    if (i % grid == grid - 1 || i / grid == grid - 1)
+      continue;
+    unsigned short q[4] = { (unsigned short)i, (unsigned short)(i + grid), (unsigned short)(i + grid + 1), (unsigned short)(i + 1) };
+    for (int tri = 0; tri < 2; tri++, k++) {
+      Polygon3D *p = &mesh->polygon[k];
+      p->index[0] = q[0];
+      p->index[1] = q[tri + 1];
+      p->index[2] = q[tri + 2];
+      Vector3D a = mesh->vertex[p->index[0]], b = mesh->vertex[p->index[1]], c = mesh->vertex[p->index[2]];
+      Vector3D e1 = { b.x - a.x, b.y - a.y, b.z - a.z }, e2 = { c.x - a.x, c.y - a.y, c.z - a.z };
+      Vector3D n = { e1.y*e2.z - e1.z*e2.y, e1.z*e2.x - e1.x*e2.z, e1.x*e2.y - e1.y*e2.x };
+      float length = sqrtf(n.x*n.x + n.y*n.y + n.z*n.z);
+      mesh->polygon_normal[k].x = n.x / length;
+      mesh->polygon_normal[k].y = n.y / length;
+      mesh->polygon_normal[k].z = n.z / length;
+    }
+  }
+
+  // A noisy image
+  unsigned char *pixels = (unsigned char *)Mem_Alloc(MEM_TEXTURE, image * image * 3);
+  unsigned char *half = (unsigned char *)Mem_Alloc(MEM_TEXTURE, (image / 2) * (image / 2) * 3);
+  unsigned char *blocks = (unsigned char *)Mem_Alloc(MEM_TEXTURE, TexCompress_Size(image, image, TEXFMT_BC1));
+  float *values = (float *)Mem_Alloc(MEM_LOADER, arithmetic * sizeof(float));
+  unsigned seed = 1;
+  for (i = 0; i < image * image * 3; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    pixels[i] = (unsigned char)((i / 3 % image) / 4 + (seed >> 28));
+  }
+  std::vector<JobBenchNode> nodes(graph_width * graph_depth);
+
+  for (t = 1; t <= max_threads; t++) {
+    Job_Init(t);
+    for (int w = 0; w < 5; w++) {
+      double best = 1e30;
+      for (int r = 0; r < runs; r++) {
+        long long start = Profile_Now();
+        if (w == 0)
+          Job_ParallelFor(arithmetic, 4096, jobBenchArithmetic, values);
+        else if (w == 1)
+          ComputeVertexNormals(mesh, false);
+        else if (w == 2)
+          Mipmap_Downsample(pixels, image, image, half);
+        else if (w == 3)
+          TexCompress_Encode(pixels, image, image, 3, TEXFMT_BC1, TEXQ_NORMAL, blocks);
+        else {
+          // Each node waits for two in the row before it
+          for (i = 0; i < graph_width * graph_depth; i++) {
+            nodes[i].value = (float)i;
+            nodes[i].job = Job_Create(jobBenchNode, &nodes[i]);
+            if (i >= graph_width) {
+              Job_DependsOn(nodes[i].job, nodes[i - graph_width].job);
+              Job_DependsOn(nodes[i].job, nodes[i - graph_width + (i + 1) % graph_width - i % graph_width].job);
+            }
+          }
+          for (i = 0; i < graph_width * graph_depth; i++)
+            Job_Submit(nodes[i].job);
+          for (i = graph_width * (graph_depth - 1); i < graph_width * graph_depth; i++)
+            Job_Wait(nodes[i].job);
+          for (i = 0; i < graph_width * graph_depth; i++)
+            Job_Release(nodes[i].job);
+        }
+        best = min(best, (Profile_Now() - start) / 1.0e6);
+      }
+      ms[t][w] = best;
+    }
+  }
+
+  printf("Job system on %d hardware threads (best of %d runs, ms and speedup over 1 thread)\n", CPU_NumThreads(), runs);
+  printf("%-16s", "threads");
+  for (t = 1; t <= max_threads; t++)
+    printf("%16d", t);
+  printf("\n");
+  for (int w = 0; w < 5; w++) {
+    printf("%-16s", names[w]);
+    for (t = 1; t <= max_threads; t++)
+      printf("%9.3f %5.2fx", ms[t][w], ms[1][w] / ms[t][w]);
+    printf("\n");
+  }
+
+  Job_Shutdown();
+  Mem_Free(values);
+  Mem_Free(blocks);
+  Mem_Free(half);
+  Mem_Free(pixels);
+  FreeObject(mesh);
+  return 0;
+}
+
+/*************************************************************************************
+| Function: meshCodecReport
+|
+| Description: Encodes an OBJ file as a cooked mesh (see meshfile.h) and reports how
+| much smaller it is than the OBJ text and the Object3D (and once LZ4 compressed, as
+| in an asset pack), the largest errors the encoding introduces, and how long decoding
+| takes compared to parsing the OBJ file.
+| Output: The process exit code.
+*************************************************************************************/
+int meshCodecReport(char *path) {
+  const int parse_runs = 5, decode_runs = 200;
+  Object3D *mesh, *decoded;
+  PackFile file;
+  size_t size;
+  int i, k;
+
+  // Parse the OBJ file (as the overlay is loaded: texcoords, normals averaged over connected polygons)
+  long long start = Profile_Now();
+  for (i = 0; i < parse_runs; i++) {
+    ReadOBJFile(path, &mesh, true, false);
+    if (mesh == 0) {
+      cout << path << ": could not be loaded" << endl;
+      return 1;
+    }
+    if (i < parse_runs-1)
+      FreeObject(mesh);
+  }
+  double parse_ms = (Profile_Now() - start) / 1.0e6 / parse_runs;
+
+  unsigned char *data = MeshFile_Encode(mesh, MESHFILE_TEXCOORDS, &size);
+  unsigned char *lz = (unsigned char *) Mem_Alloc(MEM_LOADER, LZ_BOUND(size));
+  size_t lz_size = data && lz ? LZ_Compress(data, size, lz, LZ_BOUND(size)) : 0;
+  Mem_Free(lz);
+
+  start = Profile_Now();
+  for (i = 0; data && i < decode_runs; i++) {
+    decoded = MeshFile_Decode(data, size);
+    if (decoded == 0)
+      break;
+    if (i < decode_runs-1)
+      FreeObject(decoded);
+  }
+  double decode_ms = (Profile_Now() - start) / 1.0e6 / decode_runs;
+  if (data == 0 || decoded == 0) {
+    cout << path << ": could not be encoded" << endl;
+    return 1;
+  }
+
+  // Largest errors (position relative to the bounding box size)
+  float extent = 0, position_error = 0, uv_error = 0, normal_dot = 1;
+  const MeshFileHeader *h = (const MeshFileHeader *) data;
+  for (k = 0; k < 3; k++)
+    extent = max(extent, h->bounds_max[k] - h->bounds_min[k]);
+  for (i = 0; i < mesh->num_vertices; i++) {
+    Vector3D *a = &mesh->vertex[i], *b = &decoded->vertex[i];
+    Vector3D *na = &mesh->vertex_normal[i], *nb = &decoded->vertex_normal[i];
+    position_error = max(position_error, max(fabsf(a->x - b->x), max(fabsf(a->y - b->y), fabsf(a->z - b->z))));
+    uv_error = max(uv_error, max(fabsf(mesh->tex_coords[i].u - decoded->tex_coords[i].u),
+                                 fabsf(mesh->tex_coords[i].v - decoded->tex_coords[i].v)));
+    normal_dot = min(normal_dot, na->x*nb->x + na->y*nb->y + na->z*nb->z);
+  }
+  for (i = 0; i < mesh->num_polygons; i++) {
+    Vector3D *na = &mesh->polygon_normal[i], *nb = &decoded->polygon_normal[i];
+    normal_dot = min(normal_dot, na->x*nb->x + na->y*nb->y + na->z*nb->z);
+  }
+
+  size_t obj_size = Pack_ReadFile(path, &file) ? file.size : 0;
+  Pack_CloseFile(&file);
+  size_t object_size = sizeof(Object3D) + mesh->num_vertices * (2*sizeof(Vector3D) + sizeof(UVCoordinate)) +
+                       mesh->num_polygons * (sizeof(Polygon3D) + sizeof(Vector3D));
+  const double rad_to_deg = 57.29578;
+  printf("%s: %d vertices, %d polygons\n", path, mesh->num_vertices, mesh->num_polygons);
+  printf("  OBJ file %zu bytes, Object3D %zu bytes, encoded %zu bytes (indices %u), %zu with LZ4\n",
+         obj_size, object_size, size, h->indices_size, lz_size);
+  printf("  ratio %.1fx to the OBJ file, %.2fx to the Object3D (%.2fx with LZ4)\n",
+         (double)obj_size / size, (double)object_size / size, lz_size ? (double)object_size / lz_size : 0.0);
+  printf("  max error: position %.2g (%.2g of the bounds), normal %.3f degrees, texcoord %.2g\n",
+         position_error, extent > 0 ? position_error / extent : 0.0f,
+         acos(min(1.0f, normal_dot)) * rad_to_deg, uv_error);
+  printf("  parse OBJ %.3f ms, decode %.3f ms (%.0fx faster, %.0f MB/s of Object3D)\n",
+         parse_ms, decode_ms, parse_ms / decode_ms, object_size / decode_ms / 1000.0);
+
+  FreeObject(decoded);
+  FreeObject(mesh);
+  Mem_Free(data);
+  return 0;
 }
 
 /*************************************************************************************
@@ -324,46 +1164,107 @@ void render() {
   GLfloat light0_diffuse[]  = {1.0, 1.0, 1.0, 1.0};		    // Array with diffuse values for light0
   GLfloat light0_specular[] = {0.0, 0.0, 0.0, 0.0};		    // Array with specular values for light0
 
-  update();   // Process user input
+  // Time from the start of one frame to the start of the next
+  static long long last_frame_start = 0;
+  long long frame_start = Profile_Now();
+  if (last_frame_start)
+    Profile_AddSample(prof_frame,(frame_start - last_frame_start) / 1.0e6);
+  last_frame_start = frame_start;
+
+  ProfileScope render_scope(prof_render);
+
+  // Install the assets the stream workers have loaded, up to the upload budget (and start
+  // reloading any whose files have changed, to be swapped in by a later frame)
+  {
+    ProfileScope scope(prof_stream);
+    if (watch_assets)
+      Asset_ReloadChanged();
+    Stream_Update(upload_budget);
+  }
+  if (streaming && !Asset_Loading()) {
+    streaming = false;
+    load_ms = (Profile_Now() - load_start) / 1.0e6;
+    cout << "Assets streamed in after " << load_ms << " ms" << endl;
+    if (assets_after_load)
+      writeAssets();
+  }
+  bound_texture = -1;   // anything may have been bound since the last frame
+
+  // Benchmark replay: feed update() the recorded input instead of the live mouse and keyboard.
+  // It waits (with the camera and shields held still, and no frame times taken) until the assets
+  // have streamed in, so every run replays the same path over the same scene
+  bool bench_waiting = benchmark_path && streaming;
+  if (benchmark_path && !bench_waiting) {
+    BenchInput input;
+    Benchmark_NextInput(&input);
+    mouse_x = VIEW_WIDTH/2 + input.mouse_dx;
+    mouse_y = VIEW_HEIGHT/2 + input.mouse_dy;
+    move_forward = input.forward;
+    move_back = input.back;
+    move_left = input.left;
+    move_right = input.right;
+  }
+  // Record the live input?  (the mouse is warped back to the center every frame)
+  else if (!benchmark_path) {
+    static bool first_frame = true;
+    BenchInput input;
+    input.mouse_dx = first_frame ? 0 : mouse_x - VIEW_WIDTH/2;
+    input.mouse_dy = first_frame ? 0 : mouse_y - VIEW_HEIGHT/2;
+    input.forward = move_forward;
+    input.back = move_back;
+    input.left = move_left;
+    input.right = move_right;
+    Benchmark_RecordInput(&input);
+    first_frame = false;
+  }
+
+  if (!bench_waiting) {
+    ProfileScope scope(prof_update);
+    update();   // Process user input
+  }
 
   if (lighton) {
     // Enable lighting
-    glEnable(GL_LIGHTING);										            // Enable lighting for the scene
+    GL_STATE(glEnable(GL_LIGHTING));										            // Enable lighting for the scene
                                                           // Enable one light (light0) as a point light source
-    glEnable(GL_LIGHT0);										              // Enable point light source, light0
-    glLightfv(GL_LIGHT0,GL_POSITION,light0_position);			// Set position values for light0
-    glLightfv(GL_LIGHT0,GL_AMBIENT,light0_ambient);			  // Set ambient values for light0
-    glLightfv(GL_LIGHT0,GL_DIFFUSE,light0_diffuse);			  // Set diffuse values for light0
-    glLightfv(GL_LIGHT0,GL_SPECULAR,light0_specular);			// Set specular values for light0
+    GL_STATE(glEnable(GL_LIGHT0));										              // Enable point light source, light0
+    GL_STATE(glLightfv(GL_LIGHT0,GL_POSITION,light0_position));			// Set position values for light0
+    GL_STATE(glLightfv(GL_LIGHT0,GL_AMBIENT,light0_ambient));			  // Set ambient values for light0
+    GL_STATE(glLightfv(GL_LIGHT0,GL_DIFFUSE,light0_diffuse));			  // Set diffuse values for light0
+    GL_STATE(glLightfv(GL_LIGHT0,GL_SPECULAR,light0_specular));			// Set specular values for light0
 
-    glEnable(GL_COLOR_MATERIAL);								          // Enable colors for the pyramid
+    GL_STATE(glEnable(GL_COLOR_MATERIAL));								          // Enable colors for the pyramid
   }
   else
-    glDisable(GL_LIGHTING);
+    GL_STATE(glDisable(GL_LIGHTING));
 
-  static float rotate = 0;							  // Defines the degree of rotation for the pyramid
   static float rotate_incr = 0.005;
-  rotate += rotate_incr;									// Increment rotate every time through display
-  while(rotate >= 360)										// Reset rotate once it passes 360 degrees
-    rotate -= 360;
+  if (!bench_waiting) {
+    shield_rotate += rotate_incr;						// Increment the rotation every time through display
+    while(shield_rotate >= 360)							// Reset it once it passes 360 degrees
+      shield_rotate -= 360;
+    morph_phase += 0.02f;                 // The morph weights cycle about every 5 seconds at 60 fps
+    while(morph_phase >= 2 * 3.14159265f)
+      morph_phase -= 2 * 3.14159265f;
+  }
 
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);   // Clear display window with set color and clear depth buffer
 
   // Enable wireframe rendering?
   if(wireframe)
-    glPolygonMode(GL_FRONT_AND_BACK,GL_LINE);					  // Switches to wireframe mode (usually not desirable but can be good for debugging)
+    GL_STATE(glPolygonMode(GL_FRONT_AND_BACK,GL_LINE));					  // Switches to wireframe mode (usually not desirable but can be good for debugging)
   else
-    glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
+    GL_STATE(glPolygonMode(GL_FRONT_AND_BACK,GL_FILL));
 
   // Set flat or smooth shading
   if(polygonshade == 0)
-    glShadeModel(GL_FLAT);
+    GL_STATE(glShadeModel(GL_FLAT));
   else
-    glShadeModel(GL_SMOOTH);      // Smooth discontinuous vertices when loading model for this to appear correctly
+    GL_STATE(glShadeModel(GL_SMOOTH));      // Smooth discontinuous vertices when loading model for this to appear correctly
 
   glMatrixMode(GL_MODELVIEW);     // Switch matrix mode back to model-view (usually done when about to draw object geometry)
   glLoadIdentity();							  // Load the identity matrix		
-  glEnable(GL_NORMALIZE);         // Only needed if any of the vertex normals are scaled
+  GL_STATE(glEnable(GL_NORMALIZE));         // Only needed if any of the vertex normals are scaled
 
   // Compute a point the camera is looking at
   Vector3D offset, camera_to;
@@ -377,47 +1278,74 @@ void render() {
             camera_to.x, camera_to.y, camera_to.z, 
             camera_up.x, camera_up.y, camera_up.z);
 
-  // Draw a model
-  glColor3f(1,1,1); 
-  glPushMatrix();
-  glTranslatef(0,-5,-10);
-  glRotatef(rotate,10,1,0);
-  glScalef(40,40,40);
-  modelTex3D_drawFast(obj_teapot,texture_id,texture_data);
-  glPopMatrix();
-
-    // Draw a model
-  glColor3f(1,1,1); 
-  glPushMatrix();
-  glTranslatef(10,-5,-25);
-  glRotatef(rotate,10,1,0);
-  glScalef(40,40,40);
-  modelTex3D_drawFast(obj_teapot, texture_id, texture_data);
-  glPopMatrix();
-
-  // Draw a model
-  glColor3f(1, 1, 1);
-  glPushMatrix();
-  glTranslatef(20, -5, -35);
-  glRotatef(rotate, 10, 1, 0);
-  glScalef(40, 40, 40);
-  modelTex3D_drawFast(obj_teapot, texture_id, texture_data);
-  glPopMatrix();
+  // Draw the shields
+  {
+    ProfileScope scope(prof_draw_shields);
+    ProfileGPUScope gpu_scope(prof_draw_shields);
+    float shield_radius = 40 * Asset_MeshRadius(shield_mesh);
+    // Blend every shield's pose at once (in jobs), into this frame's range of the streaming buffer
+    Object3D *mesh = Asset_Mesh(shield_mesh);
+    size_t morph_offset = 0;
+    bool morphed = false;
+    if (animate_morphs && mesh && mesh->morph) {
+      ProfileScope morph_scope(prof_morph);
+      morphed = blendShields(mesh, &morph_offset);
+    }
+    for (int i = 0; i < num_shields; i++) {
+      if (texture_budget)
+        Asset_UseTexture(shield_texture, screenSize(&shield_position[i], shield_radius));
+      glColor3f(1,1,1);
+      glPushMatrix();
+      glTranslatef(shield_position[i].x,shield_position[i].y,shield_position[i].z);
+      glRotatef(shield_rotate,10,1,0);
+      glScalef(40,40,40);
+      if (morphed)
+        modelTex3D_drawFast(mesh,Asset_Texture(shield_texture),&morph_buffer,morph_offset + i * Morph_InstanceBytes(mesh));
+      else
+        modelTex3D_drawFast(mesh,Asset_Texture(shield_texture),0,0);
+      glPopMatrix();
+    }
+  }
 
   glPopMatrix();
 
-  glDisable(GL_LIGHTING);
-  glDisable(GL_DEPTH_TEST);
+  GL_STATE(glDisable(GL_LIGHTING));
+  GL_STATE(glDisable(GL_DEPTH_TEST));
   glColor3f(1, 1, 1);
   glPushMatrix();
   glTranslatef(-3, 3, -0.88);
-  modelTex3D_drawFast(obj_overlay, texture_overlay_id, texture_overlay_data);
+  {
+    ProfileScope scope(prof_draw_overlay);
+    ProfileGPUScope gpu_scope(prof_draw_overlay);
+    modelTex3D_drawFast(Asset_Mesh(overlay_mesh), Asset_Texture(overlay_texture), 0, 0);
+  }
   glPopMatrix();
-  glEnable(GL_CULL_FACE);
-  glEnable(GL_DEPTH_TEST);
+  GL_STATE(glEnable(GL_CULL_FACE));
+  GL_STATE(glEnable(GL_DEPTH_TEST));
+
+  // Stream in the mip levels the shields need at their size on screen this frame
+  if (texture_budget)
+    Asset_UpdateResidency();
 
-  glFlush();																	// Flush the OpenGL buffers to the window 
-  glutPostRedisplay();												// This function sets a flag in GLUT's main loop which
+  {
+    ProfileScope scope(prof_flush);
+    glFlush();																// Flush the OpenGL buffers to the window
+  }
+  Profile_EndFrame();                         // Collect any finished GPU timings
+  GLStats_EndFrame();
+
+  if (benchmark_path && !bench_waiting) {
+    glFinish();                               // Include the time for the GPU to finish the frame
+    Benchmark_FrameTime((Profile_Now() - frame_start) / 1.0e6);
+    if (!headless_frames && Benchmark_Done()) {
+      printClusterStats();
+      printBVHStats();
+      finishBenchmark();
+      exit(0);
+    }
+  }
+  if (!headless_frames)
+    glutPostRedisplay();											// This function sets a flag in GLUT's main loop which
                                               // indicates that the display needs to be redrawn
   errorCheck("render");
 }
@@ -429,6 +1357,9 @@ void render() {
 *************************************************************************************/
 #define MOVE_AMOUNT 0.005f    // the amount of movement per frame
 #define ROTATE_AMOUNT 0.25f   // the amount of rotation per frame, in degrees
+#define CAMERA_RADIUS 0.25f   // the camera collides as a sphere this big (well outside the near plane)
+#define CAMERA_SKIN   0.001f  // distance it stops short of what it runs into
+#define CAMERA_SLIDES 3       // most surfaces it slides along in one move
 
 void update() {
 
@@ -493,36 +1424,76 @@ void update() {
   |___________________________________________________________________*/
 
   if(move_forward || move_back || move_left || move_right) {
-    Vector3D offset, v_left;
+    Vector3D offset, v_left, move = {0, 0, 0};
     if(move_forward && !move_back) {
       MultiplyScalarVector(MOVE_AMOUNT,&camera_heading,&offset);
-      AddVector(&camera_position,&offset,&camera_position);
+      AddVector(&move,&offset,&move);
     }
     if(move_back && !move_forward) {
       MultiplyScalarVector(-MOVE_AMOUNT,&camera_heading,&offset);
-      AddVector(&camera_position,&offset,&camera_position);
+      AddVector(&move,&offset,&move);
     }
     if(move_left && !move_right) {
       VectorCrossProduct(&camera_up,&camera_heading,&v_left);
       NormalizeVector(&v_left,&v_left);
       MultiplyScalarVector(MOVE_AMOUNT,&v_left,&offset);
-      AddVector(&camera_position,&offset,&camera_position);
+      AddVector(&move,&offset,&move);
     }
 	if (move_right && !move_left) {
 		VectorCrossProduct(&camera_up, &camera_heading, &v_left);
 		NormalizeVector(&v_left, &v_left);
 		MultiplyScalarVector(-MOVE_AMOUNT, &v_left, &offset);
-		AddVector(&camera_position, &offset, &camera_position);
+		AddVector(&move, &offset, &move);
 	}
-    // ADD CODE TO MOVE RIGHT
+    // Move all at once, so it slides along what it runs into
+    moveCamera(&move);
   }
 
 
-  glutWarpPointer(VIEW_WIDTH/2,VIEW_HEIGHT/2);
+  // Keep the mouse centered in the window (there is no window in headless mode)
+  if (!headless_frames)
+    glutWarpPointer(VIEW_WIDTH/2,VIEW_HEIGHT/2);
   mouse_x_last = VIEW_WIDTH/2;
   mouse_y_last = VIEW_HEIGHT/2;
 }
 
+/*************************************************************************************
+| Function: moveCamera
+|
+| Description: Moves the camera, sweeping its sphere against the shields: it stops
+| where it touches one and slides the rest of the way along it.
+*************************************************************************************/
+void moveCamera(Vector3D *move) {
+
+  if (!collide_camera) {
+    AddVector(&camera_position,move,&camera_position);
+    return;
+  }
+  ProfileScope scope(prof_collide);
+  Vector3D remaining = *move, step;
+  for (int i = 0; i < CAMERA_SLIDES; i++) {
+    float length = VectorMagnitude(&remaining);
+    if (length <= 0)
+      break;
+    BVHHit hit;
+    if (!sweepShields(&camera_position,&remaining,CAMERA_RADIUS,&hit)) {
+      AddVector(&camera_position,&remaining,&camera_position);
+      break;
+    }
+    // Up to the contact, less the skin
+    float travel = max(0.0f, hit.t * length - CAMERA_SKIN);
+    MultiplyScalarVector(travel / length,&remaining,&step);
+    AddVector(&camera_position,&step,&camera_position);
+    // The rest of the move (what the skin held back included), less the part going into the surface
+    MultiplyScalarVector((length - travel) / length,&remaining,&remaining);
+    float into = remaining.x*hit.normal.x + remaining.y*hit.normal.y + remaining.z*hit.normal.z;
+    if (into < 0) {
+      MultiplyScalarVector(-into,&hit.normal,&step);
+      AddVector(&remaining,&step,&remaining);
+    }
+  }
+}
+
 /*************************************************************************************
 | Function: model3D_draw
 |
@@ -552,7 +1523,7 @@ void model3D_draw(Object3D *o) {
       glVertex3f(o->vertex[o->polygon[i].index[2]].x,
                  o->vertex[o->polygon[i].index[2]].y,
                  o->vertex[o->polygon[i].index[2]].z);
-    glEnd();
+    GL_DRAW(glEnd(), 3 * 2 * sizeof(Vector3D));
   }
 
   errorCheck("model3D");
@@ -566,112 +1537,483 @@ void model3D_draw(Object3D *o) {
 void model3D_drawFast(Object3D *o) {
 
   // Use the vertex buffer for rendering
-  glEnableClientState(GL_VERTEX_ARRAY);
-  glVertexPointer(3,GL_FLOAT,0,o->vertex);
+  GL_STATE(glEnableClientState(GL_VERTEX_ARRAY));
+  GL_STATE(glVertexPointer(3,GL_FLOAT,0,o->vertex));
 
   // Use the vertex normal buffer for rendering
-  glEnableClientState(GL_NORMAL_ARRAY);
-  glNormalPointer(GL_FLOAT,0,o->vertex_normal);
+  GL_STATE(glEnableClientState(GL_NORMAL_ARRAY));
+  GL_STATE(glNormalPointer(GL_FLOAT,0,o->vertex_normal));
 
-  // Draw the model
-  glDrawElements(GL_TRIANGLES,o->num_polygons * 3,GL_UNSIGNED_SHORT,o->polygon);
+  // Draw the model (the arrays are in client memory so they are sent on every draw)
+  GL_DRAW(glDrawElements(GL_TRIANGLES,o->num_polygons * 3,GL_UNSIGNED_SHORT,o->polygon),
+          o->num_polygons * sizeof(Polygon3D) + o->num_vertices * 2 * sizeof(Vector3D));
 
   // Disable the buffers
-  glDisableClientState(GL_VERTEX_ARRAY);
-  glDisableClientState(GL_NORMAL_ARRAY);
+  GL_STATE(glDisableClientState(GL_VERTEX_ARRAY));
+  GL_STATE(glDisableClientState(GL_NORMAL_ARRAY));
 }
 
 /*************************************************************************************
-| Function: modelTex3D_drawFast
+| Function: shieldWeights
 |
-| Description: Renders a textured 3D model using the fast method.
+| Description: Sets shield i's morph target weights for this frame, each rising and
+| falling out of step with the others'.
 *************************************************************************************/
-void modelTex3D_drawFast(Object3D *o,  GLuint texture_id, unsigned char *texture_data) {
+void shieldWeights(int i, int num_targets, float *weights) {
 
-  // Use the vertex buffer for rendering
-  glEnableClientState(GL_VERTEX_ARRAY);
-  glVertexPointer(3,GL_FLOAT,0,o->vertex);
+  phaseWeights(morph_phase + i * 0.7f, num_targets, weights);
+}
 
-  // Use the vertex normal buffer for rendering
-  glEnableClientState(GL_NORMAL_ARRAY);
-  glNormalPointer(GL_FLOAT,0,o->vertex_normal);
+/*************************************************************************************
+| Function: phaseWeights
+|
+| Description: Sets the morph target weights at a phase (radians) of their cycle.
+*************************************************************************************/
+void phaseWeights(float phase, int num_targets, float *weights) {
+
+  for (int k = 0; k < num_targets; k++)
+    weights[k] = 0.5f - 0.5f * cosf(phase + k * 2 * 3.14159265f / num_targets);
+}
+
+/*************************************************************************************
+| Function: poseStep
+|
+| Description: Returns the step of the morph cycle (0 to POSE_STEPS-1) nearest shield
+| i's phase this frame, the pose it is picked and collided with.
+*************************************************************************************/
+int poseStep(int i) {
+
+  float cycles = (morph_phase + i * 0.7f) / (2 * 3.14159265f);
+  return (int)floorf((cycles - floorf(cycles)) * POSE_STEPS + 0.5f) % POSE_STEPS;
+}
+
+/*************************************************************************************
+| Function: blendShields
+|
+| Description: Blends every shield's pose from the shield mesh's morph targets into the
+| next range of morph_buffer (which starts at offset), with the weights of
+| shieldWeights(). Returns false if out of memory.
+*************************************************************************************/
+bool blendShields(Object3D *mesh, size_t *offset) {
+
+  int num_targets = mesh->morph->num_targets;
+  static vector<float> weights;
+  weights.resize(num_shields * num_targets);
+  for (int i = 0; i < num_shields; i++)
+    shieldWeights(i, num_targets, &weights[i * num_targets]);
 
-  if (texture_id != -1 && texture_data != 0) {
-    glEnable(GL_TEXTURE_2D);
+  float *out = (float *)StreamBuf_Map(&morph_buffer, num_shields * Morph_InstanceBytes(mesh), offset);
+  if (out == 0)
+    return false;
+  Morph_Blend(mesh, num_shields, &weights[0], out);
+  StreamBuf_Unmap(&morph_buffer);
+  return true;
+}
+
+/*************************************************************************************
+| Function: modelTex3D_drawFast
+|
+| Description: Renders a textured 3D model using the fast method, with its own positions
+| and normals, or a blended pose at offset in a streaming buffer (see blendShields).
+*************************************************************************************/
+void modelTex3D_drawFast(Object3D *o,  GLuint texture_id, StreamBuffer *blended, size_t offset) {
+
+  if (o == 0)
+    return;
+
+  GL_STATE(glEnableClientState(GL_VERTEX_ARRAY));
+  GL_STATE(glEnableClientState(GL_NORMAL_ARRAY));
+  if (blended) {
+    // Use the blended positions and normals (interleaved) for rendering
+    StreamBuf_Bind(blended);
+    GL_STATE(glVertexPointer(3,GL_FLOAT,(GLsizei)MORPH_STRIDE,StreamBuf_Pointer(blended,offset)));
+    GL_STATE(glNormalPointer(GL_FLOAT,(GLsizei)MORPH_STRIDE,StreamBuf_Pointer(blended,offset + 3 * sizeof(float))));
+    StreamBuf_Unbind(blended);              // The texture coordinates are in client memory
+  }
+  else {
+    // Use the vertex buffer for rendering
+    GL_STATE(glVertexPointer(3,GL_FLOAT,0,o->vertex));
+    // Use the vertex normal buffer for rendering
+    GL_STATE(glNormalPointer(GL_FLOAT,0,o->vertex_normal));
+  }
+
+  if (texture_id != -1) {
+    GL_STATE(glEnable(GL_TEXTURE_2D));
     // Enable the texture state
-    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    GL_STATE(glEnableClientState(GL_TEXTURE_COORD_ARRAY));
     // Point to our buffer
-    glTexCoordPointer(2,GL_FLOAT,0,o->tex_coords);
-    glBindTexture(GL_TEXTURE_2D,texture_id);
+    GL_STATE(glTexCoordPointer(2,GL_FLOAT,0,o->tex_coords));
+    if (texture_id != bound_texture) {
+      GL_STATE(glBindTexture(GL_TEXTURE_2D,texture_id));
+      bound_texture = texture_id;
+    }
+  }
+  else
+    GL_STATE(glDisable(GL_TEXTURE_2D));    // e.g. the texture hasn't streamed in yet
+
+  // Find the polygons that may be visible, one run per group of neighboring meshlets (a blended
+  // pose is tested against the meshlets' bounds grown to hold any blend)
+  static vector<MeshletRun> runs;
+  int num_runs = 1;
+  runs.resize(max(o->num_meshlets,1));
+  if (cull_clusters) {
+    MeshletView view;
+    Meshlet_GetView(&view);
+    view.morphed = blended != 0;
+    num_runs = Meshlet_Cull(o,&view,runs.data());
+  }
+  else {
+    runs[0].first = 0;
+    runs[0].count = o->num_polygons;
   }
 
-  // Draw the model
-  glDrawElements(GL_TRIANGLES,o->num_polygons * 3,GL_UNSIGNED_SHORT,o->polygon);
+  // Draw them (the arrays in client memory are sent on every draw, a blended pose was uploaded once)
+  for (int i = 0; i < num_runs; i++)
+    GL_DRAW(glDrawElements(GL_TRIANGLES,runs[i].count * 3,GL_UNSIGNED_SHORT,o->polygon + runs[i].first),
+            runs[i].count * sizeof(Polygon3D) +
+            o->num_vertices * (sizeof(UVCoordinate) + (blended ? 0 : 2 * sizeof(Vector3D))));
 
   // Disable the buffers
-  glDisableClientState(GL_VERTEX_ARRAY);
-  glDisableClientState(GL_NORMAL_ARRAY);
-  if (texture_id != -1 && texture_data != 0)
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  GL_STATE(glDisableClientState(GL_VERTEX_ARRAY));
+  GL_STATE(glDisableClientState(GL_NORMAL_ARRAY));
+  if (texture_id != -1)
+    GL_STATE(glDisableClientState(GL_TEXTURE_COORD_ARRAY));
 }
 
 /*************************************************************************************
-| Function: loadBMPfile
+| Function: screenSize
 |
-| Description: loads the data from a BMP file.  Returns true on success, false on any
-|   error.  Caller should free() the buffer when done using it.
+| Description: Returns about how many pixels across a sphere is drawn from the camera
+| (with the 100 degree field of view set in init()).
 *************************************************************************************/
-bool loadBMPfile (char *filename, int *width, int *height, unsigned char **data)
-{
-  // Data read from the header of the BMP file
-  unsigned char header[54]; // Each BMP file begins by a 54-bytes header
-  unsigned int dataPos;     // Position in the file where the actual data begins
-  unsigned int imageSize;   // = width*height*3
-
-  // Init variables
-  *data = 0;  // buffer is not created yet
-
-  // Open the file
-  FILE *file = fopen (filename,"rb");
-  // If file not opened, return with an error
-  if (file == 0) {
-    cout << "File not opened" << endl;
-    return false;
+float screenSize(Vector3D *center, float radius) {
+
+  float dx = center->x - camera_position.x;
+  float dy = center->y - camera_position.y;
+  float dz = center->z - camera_position.z;
+  float distance = sqrtf(dx*dx + dy*dy + dz*dz);
+  if (distance <= radius)
+    return (float)VIEW_HEIGHT;
+  return radius / (distance * tanf(50 * 3.14159265f / 180)) * VIEW_HEIGHT;
+}
+
+/*************************************************************************************
+| Function: cameraRay
+|
+| Description: Sets dir to the direction from the camera through a window pixel (one
+| unit along the heading, with the 100 degree field of view set in init()).
+*************************************************************************************/
+void cameraRay(int x, int y, Vector3D *dir) {
+
+  Vector3D right, up, offset;
+  float tan_half = tanf(50 * 3.14159265f / 180);
+  float px = (2.0f * x / VIEW_WIDTH - 1) * tan_half;     // the aspect ratio is 1
+  float py = (1 - 2.0f * y / VIEW_HEIGHT) * tan_half;
+
+  VectorCrossProduct(&camera_heading,&camera_up,&right);
+  NormalizeVector(&right,&right);
+  VectorCrossProduct(&right,&camera_heading,&up);
+  MultiplyScalarVector(px,&right,&offset);
+  AddVector(&camera_heading,&offset,dir);
+  MultiplyScalarVector(py,&up,&offset);
+  AddVector(dir,&offset,dir);
+}
+
+/*************************************************************************************
+| Function: rotateShield
+|
+| Description: Turns a vector about the axis render() turns the shields about.
+*************************************************************************************/
+void rotateShield(Vector3D *v, float degrees, Vector3D *out) {
+
+  Vector3D axis = {10, 1, 0}, cross;
+  NormalizeVector(&axis,&axis);
+  float angle = degrees * 3.14159265f / 180;
+  float c = cosf(angle), s = sinf(angle);
+
+  // Rodrigues' formula
+  VectorCrossProduct(&axis,v,&cross);
+  float d = (axis.x*v->x + axis.y*v->y + axis.z*v->z) * (1 - c);
+  Vector3D r;
+  r.x = v->x*c + cross.x*s + axis.x*d;
+  r.y = v->y*c + cross.y*s + axis.y*d;
+  r.z = v->z*c + cross.z*s + axis.z*d;
+  *out = r;
+}
+
+/*************************************************************************************
+| Function: shieldRay
+|
+| Description: Moves a ray into shield i's model space (undoing the translate, rotate
+| and scale render() draws it with).  Distances along the ray are the same in both.
+*************************************************************************************/
+void shieldRay(int i, Vector3D *origin, Vector3D *dir, Vector3D *shield_origin, Vector3D *shield_dir) {
+
+  Vector3D p;
+
+  SubtractVector(origin,&shield_position[i],&p);
+  rotateShield(&p, -shield_rotate, shield_origin);
+  MultiplyScalarVector(1.0f / 40,shield_origin,shield_origin);
+  rotateShield(dir, -shield_rotate, shield_dir);
+  MultiplyScalarVector(1.0f / 40,shield_dir,shield_dir);
+}
+
+/*************************************************************************************
+| Function: shieldTree
+|
+| Description: Returns the tree over the shields' bounding spheres (grown to hold any
+| blend of their morph targets), (re)building it if the shields have changed size (a
+| reload) or place, or 0 if the shield mesh (or its BVH) isn't loaded.
+*************************************************************************************/
+BVH *shieldTree() {
+
+  Object3D *mesh = Asset_Mesh(shield_mesh);
+  if (mesh == 0 || mesh->bvh == 0)
+    return 0;
+  float radius = 40 * Asset_MeshRadius(shield_mesh);
+  if (animate_morphs && mesh->morph)
+    radius += 40 * mesh->morph->reach;
+  if (shield_bvh == 0 || radius != shield_bvh_radius) {
+    BVH_Free(shield_bvh);
+    vector<float> radii(num_shields, radius);
+    shield_bvh = BVH_BuildSpheres(shield_position, &radii[0], num_shields);
+    shield_bvh_radius = radius;
   }
-  // Read the 54-byte header
-  if (fread(header,1,54,file) != 54) { // If 54 bytes not read, then error
-    cout << "Not a correct BMP file" << endl;
-    fclose(file);
+  return shield_bvh;
+}
+
+/*************************************************************************************
+| Function: pickShields
+|
+| Description: Finds the closest shield polygon a ray hits, going through the tree
+| over the shields to the BVH of the shield mesh.  Returns true if one was hit.
+*************************************************************************************/
+bool pickShields(Vector3D *origin, Vector3D *dir, BVHHit *hit) {
+
+  hit->t = FLT_MAX;
+  hit->sphere = -1;
+  hit->polygon = -1;
+  BVH *tree = shieldTree();
+  if (tree == 0)
     return false;
-  }
-  // Make sure first 2 bytes are BM
-  if (header[0] != 'B' || header[1] != 'M') {
-    cout << "Not a correct BMP file" << endl;
+  ShieldQuery query = {Asset_Mesh(shield_mesh), 0};
+  return BVH_IntersectSpheres(tree, origin, dir, 0, hit, queryShield, &query);
+}
+
+/*************************************************************************************
+| Function: sweepShields
+|
+| Description: Finds the first shield polygon a sphere moving from center to
+| center+move touches (at center+move*hit->t).  Returns true if one was touched.
+*************************************************************************************/
+bool sweepShields(Vector3D *center, Vector3D *move, float radius, BVHHit *hit) {
+
+  hit->t = 1;
+  hit->sphere = -1;
+  hit->polygon = -1;
+  BVH *tree = shieldTree();
+  if (tree == 0)
     return false;
+  ShieldQuery query = {Asset_Mesh(shield_mesh), radius};
+  return BVH_IntersectSpheres(tree, center, move, radius, hit, queryShield, &query);
+}
+
+/*************************************************************************************
+| Function: shieldPose
+|
+| Description: Returns the shield mesh's BVH refit to shield i's blended pose (the one
+| render() draws this frame, at the nearest of POSE_STEPS steps of the morph cycle), or
+| the mesh's own BVH if out of memory. Every shield at the same step shares one pose,
+| kept in pose_cache until the mesh changes, so picks and camera moves refit at most
+| POSE_STEPS poses however many shields there are and however the phase moves.
+*************************************************************************************/
+BVH *shieldPose(Object3D *mesh, int i) {
+
+  int step = poseStep(i);
+  ShieldPose *p = &pose_cache[step];
+  if (p->bvh && p->checksum == mesh->bvh->checksum && p->morph == mesh->morph)
+    return p->bvh;
+
+  static vector<float> weights, pose;
+  weights.resize(mesh->morph->num_targets);
+  phaseWeights(step * 2 * 3.14159265f / POSE_STEPS, mesh->morph->num_targets, &weights[0]);
+  pose.resize(mesh->num_vertices * MORPH_FLOATS);
+  Morph_Blend(mesh, 1, &weights[0], &pose[0]);
+
+  size_t size = BVH_Size(mesh->bvh);
+  if (p->bvh == 0 || BVH_Size(p->bvh) != size) {
+    BVH_Free(p->bvh);
+    p->bvh = (BVH *) Mem_Alloc(MEM_MESH, size);
+    if (p->bvh == 0)
+      return mesh->bvh;
   }
-  // Read values from the byte array
-  dataPos   = *(int*)&(header[0x0A]);         
-  imageSize = *(int*)&(header[0x22]);
-  *width    = *(int*)&(header[0x12]);
-  *height   = *(int*)&(header[0x16]);
-  // Fill in any missing information
-  if (imageSize == 0)    
-    imageSize = (*width) * (*height) * 3; // 3 since 1 byte for each red, green and blue component
-  if (dataPos == 0)      
-    dataPos = 54; 
-  // Create a buffer (caller should free this buffer when done using it)
-  *data = (unsigned char *) malloc(imageSize);
-  // Read the image data from the file into the buffer
-  fread((void*)*data,1,imageSize,file);
-  // Reorder the data from RBG to GBR (which OpenGL likes)
-  unsigned char red;
-  for (unsigned n=0; n<imageSize; n+=3) {
-    red = (*data)[n];           // save red
-    (*data)[n] = (*data)[n+2];  // move green into reds old place
-    (*data)[n+2] = red;         // move red into greens old place
-  }
-
-  // close the file
-  fclose(file);
-  return true;
+  memcpy(p->bvh, mesh->bvh, size);
+  BVH_Refit(p->bvh, mesh, &pose[0], MORPH_FLOATS);
+  p->checksum = mesh->bvh->checksum;
+  p->morph = mesh->morph;
+  return p->bvh;
+}
+
+/*************************************************************************************
+| Function: freePoses
+|
+| Description: Frees the shield poses kept for picking.
+*************************************************************************************/
+void freePoses() {
+
+  for (int n = 0; n < POSE_STEPS; n++)
+    BVH_Free(pose_cache[n].bvh);
+  memset(pose_cache, 0, sizeof(pose_cache));
+}
+
+/*************************************************************************************
+| Function: queryShield
+|
+| Description: Tests a ray (or a sphere swept along it) against shield i's mesh, in
+| the pose it is drawn in, updating hit if it hits closer.
+*************************************************************************************/
+void queryShield(void *data, int i, Vector3D *origin, Vector3D *dir, BVHHit *hit) {
+
+  ShieldQuery *query = (ShieldQuery *) data;
+  Vector3D shield_origin, shield_dir;
+
+  BVH *bvh = query->mesh->bvh;
+  if (animate_morphs && query->mesh->morph)
+    bvh = shieldPose(query->mesh, i);
+  shieldRay(i, origin, dir, &shield_origin, &shield_dir);
+  if (query->radius == 0) {
+    if (BVH_Intersect(bvh, &shield_origin, &shield_dir, hit))
+      hit->sphere = i;
+  }
+  else if (BVH_SweepSphere(bvh, &shield_origin, &shield_dir, query->radius / 40, hit)) {
+    hit->sphere = i;
+    rotateShield(&hit->normal, shield_rotate, &hit->normal);    // back to world space
+  }
+}
+
+/*************************************************************************************
+| Function: printPick
+|
+| Description: Prints the shield, polygon and texture coordinates under a window pixel
+| ('e' key, at the mouse).
+*************************************************************************************/
+void printPick(int x, int y) {
+
+  Vector3D dir;
+  BVHHit hit;
+
+  cameraRay(x, y, &dir);
+  long long start = Profile_Now();
+  bool found = pickShields(&camera_position, &dir, &hit);
+  double pick_us = (Profile_Now() - start) / 1.0e3;
+  if (!found) {
+    printf("Pick (%d,%d): nothing (%.1f us)\n", x, y, pick_us);
+    return;
+  }
+
+  // Texture coordinates from the barycentric weights of the hit
+  Object3D *mesh = Asset_Mesh(shield_mesh);
+  UVCoordinate uv = {0, 0};
+  if (mesh->tex_coords) {
+    unsigned short *index = mesh->polygon[hit.polygon].index;
+    float w = 1 - hit.u - hit.v;
+    uv.u = w * mesh->tex_coords[index[0]].u + hit.u * mesh->tex_coords[index[1]].u + hit.v * mesh->tex_coords[index[2]].u;
+    uv.v = w * mesh->tex_coords[index[0]].v + hit.u * mesh->tex_coords[index[1]].v + hit.v * mesh->tex_coords[index[2]].v;
+  }
+  printf("Pick (%d,%d): shield %d, polygon %d, distance %.3f, uv (%.4f, %.4f) (%.1f us)\n", x, y, hit.sphere,
+         hit.polygon, hit.t * VectorMagnitude(&dir), uv.u, uv.v, pick_us);
+}
+
+/*************************************************************************************
+| Function: pickBenchmark
+|
+| Description: Loads the shield mesh and times picking the shields (placed by
+| -instances, turned 30 degrees, in their blended poses) from the starting camera
+| through random pixels: with the BVHs, then testing every polygon of every shield.  Reports how many rays hit, the
+| time per ray, and any rays where the two disagree.
+*************************************************************************************/
+int pickBenchmark(int num_rays) {
+
+  int i, k;
+
+  if (num_rays < 1)
+    num_rays = 1;
+  Asset_CookMeshes(cook_meshes);
+  long long start = Profile_Now();
+  shield_mesh = Asset_LoadMesh("romanshield.obj", true, true);
+  double load_ms = (Profile_Now() - start) / 1.0e6;
+  Object3D *mesh = Asset_Mesh(shield_mesh);
+  if (mesh == 0 || mesh->bvh == 0) {
+    cout << "romanshield.obj: could not be loaded" << endl;
+    return 1;
+  }
+  start = Profile_Now();
+  BVH *bvh = BVH_Build(mesh);
+  double build_ms = (Profile_Now() - start) / 1.0e6;
+  BVH_Free(bvh);
+
+  camera_heading = start_heading;
+  camera_up = start_up;
+  shield_rotate = 30;
+  vector<Vector3D> dirs(num_rays);
+  srand(1);
+  for (i = 0; i < num_rays; i++)
+    cameraRay(rand() % VIEW_WIDTH, rand() % VIEW_HEIGHT, &dirs[i]);
+
+  vector<BVHHit> hits(num_rays), all_hits(num_rays);
+  int num_hits = 0;
+  pickShields(&camera_position, &dirs[0], &hits[0]);    // build the tree over the shields first
+  start = Profile_Now();
+  for (i = 0; i < num_rays; i++)
+    num_hits += pickShields(&camera_position, &dirs[i], &hits[i]);
+  double bvh_us = (Profile_Now() - start) / 1.0e3 / num_rays;
+
+  // Each shield's pose, blended the same way as for picking
+  vector<Object3D> poses(num_shields, *mesh);
+  vector<Vector3D> pose_vertices;
+  if (animate_morphs && mesh->morph) {
+    vector<float> weights(mesh->morph->num_targets), pose(mesh->num_vertices * MORPH_FLOATS);
+    pose_vertices.resize(num_shields * mesh->num_vertices);
+    for (k = 0; k < num_shields; k++) {
+      phaseWeights(poseStep(k) * 2 * 3.14159265f / POSE_STEPS, mesh->morph->num_targets, &weights[0]);
+      Morph_Blend(mesh, 1, &weights[0], &pose[0]);
+      for (i = 0; i < mesh->num_vertices; i++)
+        memcpy(&pose_vertices[k * mesh->num_vertices + i], &pose[i * MORPH_FLOATS], sizeof(Vector3D));
+      poses[k].vertex = &pose_vertices[k * mesh->num_vertices];
+    }
+  }
+
+  start = Profile_Now();
+  for (i = 0; i < num_rays; i++) {
+    BVHHit *hit = &all_hits[i];
+    hit->t = FLT_MAX;
+    hit->sphere = -1;
+    hit->polygon = -1;
+    for (k = 0; k < num_shields; k++) {
+      Vector3D shield_origin, shield_dir;
+      shieldRay(k, &camera_position, &dirs[i], &shield_origin, &shield_dir);
+      if (BVH_IntersectAll(&poses[k], &shield_origin, &shield_dir, hit))
+        hit->sphere = k;
+    }
+  }
+  double all_us = (Profile_Now() - start) / 1.0e3 / num_rays;
+
+  // Rays through a shared edge may hit either polygon at the same distance
+  int differ = 0;
+  for (i = 0; i < num_rays; i++)
+    if ((hits[i].sphere != all_hits[i].sphere || hits[i].polygon != all_hits[i].polygon) &&
+        !(hits[i].sphere >= 0 && all_hits[i].sphere >= 0 && fabsf(hits[i].t - all_hits[i].t) <= 1e-5f * all_hits[i].t))
+      differ++;
+
+  printf("romanshield.obj: %d polygons, loaded in %.3f ms; BVH %d nodes, %d packets, %zu bytes, built in %.3f ms\n",
+         mesh->num_polygons, load_ms, (int)mesh->bvh->num_nodes, (int)mesh->bvh->num_packets, BVH_Size(mesh->bvh),
+         build_ms);
+  printf("%d rays at %d shields: %d hit; BVH %.2f us per ray, every polygon %.2f us per ray (%.1fx); %d differ\n",
+         num_rays, num_shields, num_hits, bvh_us, all_us, bvh_us > 0 ? all_us / bvh_us : 0.0, differ);
+
+  Asset_ReleaseAll();
+  BVH_Free(shield_bvh);
+  shield_bvh = 0;
+  freePoses();
+  return differ ? 1 : 0;
 }
@@ -10,6 +10,10 @@
 #include <assert.h>
 
 #include "math3d.h"
+#include "memtrack.h"
+#include "adjacency.h"
+#include "job.h"
+#include "trace.h"
 
 /*___________________
 |
@@ -46,6 +50,26 @@
     _m_->_33 = 1;                       \
   }      
 
+#define VERTICES_PER_JOB 4096     // vertex normals computed per job
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct VertexNormalsWork {
+  Object3D  *object;
+  Adjacency *adj;
+  bool       smooth_discontinuous_vertices;
+};
+
+/*___________________
+|
+| Function prototypes
+|__________________*/
+
+static void ComputeVertexNormalsJob (void *data,int begin,int end);
+
 /*************************************************************************************
 | Function: MultiplyMatrix
 |
@@ -398,14 +422,19 @@ inline void VectorCrossProduct(Vector3D *v1,Vector3D *v2,Vector3D *vresult)
 |       at the same coordinate so the polygon is counted for smoothing
 |       purposes.
 |
+|   The polygons around each vertex (or position) come from the
+|   object's adjacency (see adjacency.h), built in linear time.  The
+|   vertices are then split into jobs (see job.h).
+|
 | Notes: Allocates memory for the vertex_normal array if needed.
 |
 *************************************************************************************/
 bool ComputeVertexNormals (Object3D *object,bool smooth_discontinuous_vertices)
 {
-  int i,j,k,poly_count;
-  float f;
   bool error = false;
+  Adjacency adj;
+
+  TraceScope trace("ComputeVertexNormals");
 
   // Verify input params
   DEBUG_ASSERT(object);
@@ -416,40 +445,53 @@ bool ComputeVertexNormals (Object3D *object,bool smooth_discontinuous_vertices)
     if(object->vertex_normal == NULL)
       error = true;
   }
+  if(NOT error)
+    error = NOT Adjacency_Build(object,&adj,MEM_LOADER);
 
   // Compute a vertex normal for each vertex
-  for(i = 0; (i<object->num_vertices) AND(NOT error); i++) {
+  if(NOT error) {
+    VertexNormalsWork work = { object, &adj, smooth_discontinuous_vertices };
+    Job_ParallelFor(object->num_vertices,VERTICES_PER_JOB,ComputeVertexNormalsJob,&work);
+    Adjacency_Free(&adj);
+  }
+
+  // Verify output params
+  DEBUG_ASSERT(NOT error);
+
+  return (NOT error);
+}
+
+/*************************************************************************************
+| Function: ComputeVertexNormalsJob
+|
+| Output: Computes the vertex normals of vertices begin up to (not including) end for
+|   ComputeVertexNormals().
+*************************************************************************************/
+static void ComputeVertexNormalsJob (void *data,int begin,int end)
+{
+  VertexNormalsWork *work = (VertexNormalsWork *)data;
+  Object3D *object = work->object;
+  Adjacency &adj = *work->adj;
+  int i,j,poly_count;
+  int *polygons;
+  float f;
+
+  for(i = begin; i<end; i++) {
     // Init variables;
     object->vertex_normal[i].x = 0;
     object->vertex_normal[i].y = 0;
     object->vertex_normal[i].z = 0;
-    poly_count = 0;
-
-    if(smooth_discontinuous_vertices) {
-      // Search each polygon to see if adjacent to this vertex (has a vertex with the same value as the vertex)
-      for(j = 0; j<object->num_polygons; j++)
-        for(k = 0; k<3; k++)
-          if((!memcmp(&(object->vertex[object->polygon[j].index[k]]),&(object->vertex[i]),sizeof(Vector3D))) OR
-             (!memcmp(&(object->vertex[object->polygon[j].index[k]]),&(object->vertex[i]),sizeof(Vector3D))) OR
-             (!memcmp(&(object->vertex[object->polygon[j].index[k]]),&(object->vertex[i]),sizeof(Vector3D)))) {
-            object->vertex_normal[i].x += object->polygon_normal[j].x;
-            object->vertex_normal[i].y += object->polygon_normal[j].y;
-            object->vertex_normal[i].z += object->polygon_normal[j].z;
-            poly_count++;
-            break;
-          }
-    }
-    else {
-      // Search each polygon to see if directly connected to this vertex (search each polygon for vertex i)
-      for(j = 0; j<object->num_polygons; j++)
-        for(k = 0; k<3; k++)
-          if(object->polygon[j].index[k] == i) {
-            object->vertex_normal[i].x += object->polygon_normal[j].x;
-            object->vertex_normal[i].y += object->polygon_normal[j].y;
-            object->vertex_normal[i].z += object->polygon_normal[j].z;
-            poly_count++;
-            break;
-          }
+
+    // Polygons adjacent to this vertex (having a vertex with the same value as the vertex), or
+    //  directly connected to it
+    if(work->smooth_discontinuous_vertices)
+      poly_count = Adjacency_PositionPolygons(&adj,adj.position[i],&polygons);
+    else
+      poly_count = Adjacency_VertexPolygons(&adj,i,&polygons);
+    for(j = 0; j<poly_count; j++) {
+      object->vertex_normal[i].x += object->polygon_normal[polygons[j]].x;
+      object->vertex_normal[i].y += object->polygon_normal[polygons[j]].y;
+      object->vertex_normal[i].z += object->polygon_normal[polygons[j]].z;
     }
     // Compute the normal   
     if(poly_count) {
@@ -461,9 +503,4 @@ bool ComputeVertexNormals (Object3D *object,bool smooth_discontinuous_vertices)
     // Normalize to get the vertex normal
     NormalizeVector(&(object->vertex_normal[i]),&(object->vertex_normal[i]));
   }
-
-  // Verify output params
-  DEBUG_ASSERT(NOT error);
-
-  return (NOT error);
 }
@@ -55,6 +55,15 @@ struct Object3D {
   
   Polygon3D *polygon;
   Vector3D  *polygon_normal;
+
+  void      *arena;   // one block holding the object and its arrays (see NewObject), 0 = each allocated on its own
+
+  struct Meshlet *meshlets;     // clusters of its polygons (see meshlet.h), 0 = none
+  int             num_meshlets;
+
+  struct BVH     *bvh;          // tree over its polygons for ray casts (see bvh.h), 0 = none
+
+  struct MorphTargets *morph;   // other poses to blend it with (see morph.h), 0 = none
 };
 
 /*___________________
@@ -0,0 +1,251 @@
+/*____________________________________________________________________
+|
+| File: memtrack.cpp
+|
+| Description: Tagged memory accounting.  Each allocation has a
+|   MEM_ALIGNMENT byte header in front of it holding its size and tag,
+|   so it can be freed (and uncounted) without the caller knowing
+|   either.  The counters are atomic since assets are loaded on worker
+|   threads.  The peak of each tag is tracked on its own, so the peaks
+|   of different tags may not have happened at the same time.
+|
+| Functions: Mem_Alloc
+|            Mem_Calloc
+|            Mem_Free
+|            Mem_Count
+|            Mem_Current
+|            Mem_Print
+|            Mem_WriteCSV
+|            Account
+|            WriteReport
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "math3d.h"
+#include "memtrack.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+// In front of each allocation (padded to MEM_ALIGNMENT bytes)
+struct MemHeader {
+  size_t size;
+  int    tag;
+};
+
+struct MemCounters {
+  std::atomic<long long> current;   // bytes
+  std::atomic<long long> peak;
+  std::atomic<long long> allocs;    // # of allocations (or Mem_Count calls taking memory)
+  std::atomic<long long> frees;
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Account (MemTag tag, long long bytes, bool alloc);
+static void WriteReport (FILE *fp, const char *format);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static const char *tag_names[MEM_NUM_TAGS] = { "loader", "mesh", "texture", "gpu" };
+static MemCounters counters[MEM_NUM_TAGS];
+
+/*____________________________________________________________________
+|
+| Function: Mem_Alloc
+|
+| Output: Returns size bytes aligned to MEM_ALIGNMENT, counted against
+|   tag, or 0 if out of memory.
+|___________________________________________________________________*/
+
+void *Mem_Alloc (MemTag tag, size_t size)
+{
+  unsigned char *block;
+
+  size_t total = MEM_ALIGNMENT + ((size + MEM_ALIGNMENT - 1) & ~(size_t)(MEM_ALIGNMENT - 1));
+#ifdef _WIN32
+  block = (unsigned char *) _aligned_malloc (total, MEM_ALIGNMENT);
+#else
+  if (posix_memalign((void **)&block, MEM_ALIGNMENT, total) != 0)
+    block = 0;
+#endif
+  if (block == 0)
+    return 0;
+
+  MemHeader *header = (MemHeader *) block;
+  header->size = size;
+  header->tag  = tag;
+  Account (tag, (long long)size, true);
+  return block + MEM_ALIGNMENT;
+}
+
+/*____________________________________________________________________
+|
+| Function: Mem_Calloc
+|
+| Output: Returns size cleared bytes (see Mem_Alloc), or 0 if out of
+|   memory.
+|___________________________________________________________________*/
+
+void *Mem_Calloc (MemTag tag, size_t size)
+{
+  void *p = Mem_Alloc (tag, size);
+  if (p)
+    memset (p, 0, size);
+  return p;
+}
+
+/*____________________________________________________________________
+|
+| Function: Mem_Free
+|
+| Output: Frees memory from Mem_Alloc() and takes it off its tag.
+|___________________________________________________________________*/
+
+void Mem_Free (void *p)
+{
+  if (p == 0)
+    return;
+  unsigned char *block = (unsigned char *)p - MEM_ALIGNMENT;
+  MemHeader *header = (MemHeader *) block;
+  Account ((MemTag)header->tag, -(long long)header->size, false);
+#ifdef _WIN32
+  _aligned_free (block);
+#else
+  free (block);
+#endif
+}
+
+/*____________________________________________________________________
+|
+| Function: Mem_Count
+|
+| Output: Counts bytes held outside this allocator against a tag.
+|___________________________________________________________________*/
+
+void Mem_Count (MemTag tag, long long bytes)
+{
+  if (bytes)
+    Account (tag, bytes, bytes > 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Mem_Current
+|
+| Output: Returns the bytes currently counted against a tag.
+|___________________________________________________________________*/
+
+long long Mem_Current (MemTag tag)
+{
+  return counters[tag].current.load (std::memory_order_relaxed);
+}
+
+/*____________________________________________________________________
+|
+| Function: Mem_Print
+|
+| Output: Prints the memory report to the console.
+|___________________________________________________________________*/
+
+void Mem_Print ()
+{
+  printf ("%-8s %12s %12s %10s %10s\n", "tag", "current", "peak", "allocs", "frees");
+  WriteReport (stdout, "%-8s %12lld %12lld %10lld %10lld\n");
+}
+
+/*____________________________________________________________________
+|
+| Function: Mem_WriteCSV
+|
+| Output: Writes the memory report to a CSV file.  Returns true on
+|   success.
+|___________________________________________________________________*/
+
+bool Mem_WriteCSV (const char *filename)
+{
+  FILE *fp = fopen (filename, "wt");
+  if (fp == 0) {
+    printf ("Could not write %s\n", filename);
+    return false;
+  }
+  fprintf (fp, "tag,current_bytes,peak_bytes,allocs,frees\n");
+  WriteReport (fp, "%s,%lld,%lld,%lld,%lld\n");
+  fclose (fp);
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Account
+|
+| Output: Adds bytes (taken if positive, given back if negative) to a
+|   tag's counters as an allocation (even of 0 bytes) if alloc is set,
+|   else as a free, raising its peak if needed.
+|___________________________________________________________________*/
+
+static void Account (MemTag tag, long long bytes, bool alloc)
+{
+  MemCounters *c = &counters[tag];
+
+  long long current = c->current.fetch_add (bytes, std::memory_order_relaxed) + bytes;
+  if (alloc) {
+    c->allocs.fetch_add (1, std::memory_order_relaxed);
+    long long peak = c->peak.load (std::memory_order_relaxed);
+    while (current > peak AND NOT c->peak.compare_exchange_weak (peak, current, std::memory_order_relaxed));
+  }
+  else
+    c->frees.fetch_add (1, std::memory_order_relaxed);
+}
+
+/*____________________________________________________________________
+|
+| Function: WriteReport
+|
+| Output: Writes a line per tag, and one for all the CPU tags together
+|   (its peak is the sum of their peaks), with a printf format taking
+|   the name, current, peak, allocs and frees.
+|___________________________________________________________________*/
+
+static void WriteReport (FILE *fp, const char *format)
+{
+  long long total[4] = { 0, 0, 0, 0 };
+
+  for (int i=0; i<MEM_NUM_TAGS; i++) {
+    long long current = counters[i].current.load (std::memory_order_relaxed);
+    long long peak    = counters[i].peak.load (std::memory_order_relaxed);
+    long long allocs  = counters[i].allocs.load (std::memory_order_relaxed);
+    long long frees   = counters[i].frees.load (std::memory_order_relaxed);
+    fprintf (fp, format, tag_names[i], current, peak, allocs, frees);
+    if (i != MEM_GPU) {
+      total[0] += current;
+      total[1] += peak;
+      total[2] += allocs;
+      total[3] += frees;
+    }
+  }
+  fprintf (fp, format, "cpu", total[0], total[1], total[2], total[3]);
+}
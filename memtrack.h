@@ -0,0 +1,34 @@
+/*____________________________________________________________________
+|
+| File: memtrack.h
+|
+| Tagged memory accounting: allocations made through Mem_Alloc() are
+| counted against a tag, so the memory held by the loader, meshes and
+| textures (and uploaded to GL, see Mem_Count) can be reported.
+|___________________________________________________________________*/
+
+#define MEM_ALIGNMENT 16    // every allocation starts on a multiple of this (SSE loads)
+
+enum MemTag {
+  MEM_LOADER,               // temporary memory while reading files (OBJ parsing, decompressed pack files)
+  MEM_MESH,                 // Object3D arrays
+  MEM_TEXTURE,              // images and cooked textures on the CPU
+  MEM_GPU,                  // texture levels uploaded to GL (counted, not allocated here)
+  MEM_NUM_TAGS
+};
+
+// Allocates size bytes aligned to MEM_ALIGNMENT, counted against a tag.  Returns 0 if out of memory
+void *Mem_Alloc (MemTag tag, size_t size);
+// Same as Mem_Alloc() with the memory cleared
+void *Mem_Calloc (MemTag tag, size_t size);
+// Frees memory from Mem_Alloc() or Mem_Calloc() (0 is ignored)
+void  Mem_Free (void *p);
+// Counts bytes held somewhere else (such as by GL) against a tag: positive when taken,
+//  negative when given back
+void  Mem_Count (MemTag tag, long long bytes);
+// Returns the bytes currently counted against a tag
+long long Mem_Current (MemTag tag);
+// Prints the current and peak bytes and allocation counts of each tag
+void  Mem_Print ();
+// Writes the same to a CSV file.  Returns true on success
+bool  Mem_WriteCSV (const char *filename);
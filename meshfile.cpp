@@ -0,0 +1,608 @@
+/*____________________________________________________________________
+|
+| File: meshfile.cpp
+|
+| Description: Cooked mesh files.  The first time an OBJ file is used
+|   (or after it changes) it is read and converted once, normals
+|   included, and written in a compact encoding: 14 bytes per vertex
+|   and about 8 per polygon instead of 32 and 18 for an Object3D (and a
+|   lot less than the OBJ text).  The indices follow the order vertices
+|   were first used in, so most deltas fit in 1 byte, and the varint
+|   bytes compress further with LZ4 in an asset pack.  Loading is one
+|   pass over each section into a new Object3D, with no parsing and no
+|   normal computation.  The quantization error is at most half a step:
+|   1/131070 of the bounding box in each axis.
+|
+|   A mesh can also be kept in memory as it is stored (MeshFile_Read),
+|   at well under half the size of its Object3D, and only decoded when
+|   it's needed: a large catalog of meshes of which a few are drawn at a
+|   time costs little more RAM than its cooked files.
+|
+| Functions: MeshFile_Load
+|            MeshFile_Read
+|            MeshFile_Cook
+|            MeshFile_Encode
+|            MeshFile_Decode
+|            MeshFile_Radius
+|            MeshFile_Name
+|            LoadCooked
+|            ReadCooked
+|            IsValid
+|            IsUpToDate
+|            SourceInfo
+|            OctEncode
+|            OctDecode
+|            Quantize
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "math3d.h"
+#include "memtrack.h"
+#include "ReadOBJFile.h"
+#include "pack.h"
+#include "trace.h"
+#include "meshfile.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+// A cooked mesh, decoded (for MeshFile_Load) or as it is stored (for MeshFile_Read)
+struct Cooked {
+  bool           decode;
+  Object3D      *object;
+  unsigned char *data;
+  size_t         size;
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static bool LoadCooked (char *obj_filename, bool load_texcoords, bool smooth_discontinuous_vertices, Cooked *cooked);
+static bool ReadCooked (char *filename, bool search_packs, char *obj_filename, unsigned flags, Cooked *cooked, bool *stale);
+static bool IsValid (MeshFileHeader *h, size_t size);
+static bool IsUpToDate (MeshFileHeader *h, char *obj_filename, unsigned flags);
+static bool SourceInfo (char *obj_filename, unsigned *size, unsigned long long *time);
+static void OctEncode (Vector3D *n, short *out);
+static void OctDecode (const short *in, Vector3D *n);
+static unsigned short Quantize (float value, float min, float max);
+
+/*____________________________________________________________________
+|
+| Function: MeshFile_Load
+|
+| Output: Decodes the cooked mesh for an OBJ file, cooking it if
+|   needed.  Returns the mesh, or 0 on failure.
+|___________________________________________________________________*/
+
+Object3D *MeshFile_Load (char *obj_filename, bool load_texcoords, bool smooth_discontinuous_vertices)
+{
+  Cooked cooked = {true, 0, 0, 0};
+
+  TraceScope trace("MeshFile_Load");
+
+  LoadCooked (obj_filename, load_texcoords, smooth_discontinuous_vertices, &cooked);
+  return cooked.object;
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshFile_Read
+|
+| Output: Returns a copy of the cooked mesh for an OBJ file as it is
+|   stored, cooking it if needed, and sets size.  Returns 0 on failure.
+|___________________________________________________________________*/
+
+unsigned char *MeshFile_Read (char *obj_filename, bool load_texcoords, bool smooth_discontinuous_vertices, size_t *size)
+{
+  Cooked cooked = {false, 0, 0, 0};
+
+  TraceScope trace("MeshFile_Read");
+
+  LoadCooked (obj_filename, load_texcoords, smooth_discontinuous_vertices, &cooked);
+  *size = cooked.size;
+  return cooked.data;
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshFile_Cook
+|
+| Output: Reads an OBJ file, encodes it and writes the result to a
+|   cooked mesh file.  Returns true on success.
+|___________________________________________________________________*/
+
+bool MeshFile_Cook (char *obj_filename, char *filename, bool load_texcoords, bool smooth_discontinuous_vertices)
+{
+  Object3D *object;
+  size_t size;
+  unsigned long long source_time;
+
+  TraceScope trace("MeshFile_Cook");
+
+  ReadOBJFile (obj_filename, &object, load_texcoords, smooth_discontinuous_vertices);
+  if (object == 0)
+    return false;
+  unsigned flags = (load_texcoords ? MESHFILE_TEXCOORDS : 0) | (smooth_discontinuous_vertices ? MESHFILE_SMOOTH : 0);
+  unsigned char *data = MeshFile_Encode (object, flags, &size);
+  FreeObject (object);
+  if (data == 0)
+    return false;
+
+  // Remember which version of the OBJ file it was cooked from
+  MeshFileHeader *h = (MeshFileHeader *) data;
+  SourceInfo (obj_filename, &h->source_size, &source_time);
+  h->source_time_lo = (unsigned) source_time;
+  h->source_time_hi = (unsigned) (source_time >> 32);
+
+  // Write the file under another name and then replace the old one (another thread may be
+  // reading it)
+  char temp[1024];
+  snprintf (temp, sizeof(temp), "%s.tmp", filename);
+  FILE *fp = fopen (temp, "wb");
+  bool ok = fp != 0;
+  if (ok) {
+    ok = fwrite(data, 1, size, fp) == size;
+    ok = (fclose(fp) == 0) AND ok;
+  }
+#ifdef _WIN32
+  if (ok)
+    remove (filename);
+#endif
+  if (ok)
+    ok = rename (temp, filename) == 0;
+  if (NOT ok) {
+    printf ("%s: could not write the cooked mesh\n", filename);
+    remove (temp);
+  }
+  Mem_Free (data);
+  return ok;
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshFile_Encode
+|
+| Output: Returns a mesh encoded as a cooked mesh file (with no source
+|   info) and sets size, or returns 0 if out of memory.
+|___________________________________________________________________*/
+
+unsigned char *MeshFile_Encode (Object3D *object, unsigned flags, size_t *size)
+{
+  MeshFileHeader header;
+  int i, j, k;
+
+  TraceScope trace("MeshFile_Encode");
+
+  memset (&header, 0, sizeof(header));
+  memcpy (header.magic, MESHFILE_MAGIC, 4);
+  header.version      = MESHFILE_VERSION;
+  header.endianness   = MESHFILE_ENDIANNESS;
+  header.flags        = flags & (object->tex_coords ? ~0u : ~(unsigned)MESHFILE_TEXCOORDS);
+  header.num_vertices = object->num_vertices;
+  header.num_polygons = object->num_polygons;
+
+  // Bounds of the positions and texcoords
+  for (k=0; k<3; k++) {
+    header.bounds_min[k] = object->num_vertices ? (&object->vertex[0].x)[k] : 0;
+    header.bounds_max[k] = header.bounds_min[k];
+  }
+  for (i=0; i<object->num_vertices; i++)
+    for (k=0; k<3; k++) {
+      float value = (&object->vertex[i].x)[k];
+      header.bounds_min[k] = std::min (header.bounds_min[k], value);
+      header.bounds_max[k] = std::max (header.bounds_max[k], value);
+    }
+  if (header.flags & MESHFILE_TEXCOORDS) {
+    header.uv_min[0] = header.uv_max[0] = object->num_vertices ? object->tex_coords[0].u : 0;
+    header.uv_min[1] = header.uv_max[1] = object->num_vertices ? object->tex_coords[0].v : 0;
+    for (i=0; i<object->num_vertices; i++) {
+      header.uv_min[0] = std::min (header.uv_min[0], object->tex_coords[i].u);
+      header.uv_max[0] = std::max (header.uv_max[0], object->tex_coords[i].u);
+      header.uv_min[1] = std::min (header.uv_min[1], object->tex_coords[i].v);
+      header.uv_max[1] = std::max (header.uv_max[1], object->tex_coords[i].v);
+    }
+  }
+
+  // Lay out the file (each section starts on a multiple of 4 bytes, the indices take at most 3
+  // bytes each since they are 16 bits)
+  size_t offset = sizeof(header);
+  header.positions_offset = (unsigned) offset;
+  offset += ((size_t)object->num_vertices * 6 + 3) & ~(size_t)3;
+  header.normals_offset = (unsigned) offset;
+  offset += (size_t)object->num_vertices * 4;
+  header.texcoords_offset = (unsigned) offset;
+  if (header.flags & MESHFILE_TEXCOORDS)
+    offset += (size_t)object->num_vertices * 4;
+  header.polygon_normals_offset = (unsigned) offset;
+  offset += (size_t)object->num_polygons * 4;
+  header.indices_offset = (unsigned) offset;
+  offset += (size_t)object->num_polygons * 3 * 3;
+
+  unsigned char *data = (unsigned char *) Mem_Calloc (MEM_LOADER, offset);
+  if (data == 0)
+    return 0;
+
+  // Vertices
+  unsigned short *positions = (unsigned short *)(data + header.positions_offset);
+  short *normals = (short *)(data + header.normals_offset);
+  unsigned short *texcoords = (unsigned short *)(data + header.texcoords_offset);
+  for (i=0; i<object->num_vertices; i++) {
+    for (k=0; k<3; k++)
+      positions[i*3+k] = Quantize ((&object->vertex[i].x)[k], header.bounds_min[k], header.bounds_max[k]);
+    OctEncode (&object->vertex_normal[i], normals + i*2);
+    if (header.flags & MESHFILE_TEXCOORDS) {
+      texcoords[i*2]   = Quantize (object->tex_coords[i].u, header.uv_min[0], header.uv_max[0]);
+      texcoords[i*2+1] = Quantize (object->tex_coords[i].v, header.uv_min[1], header.uv_max[1]);
+    }
+  }
+
+  // Polygons
+  short *polygon_normals = (short *)(data + header.polygon_normals_offset);
+  for (i=0; i<object->num_polygons; i++)
+    OctEncode (&object->polygon_normal[i], polygon_normals + i*2);
+
+  unsigned char *p = data + header.indices_offset;
+  int prev = 0;
+  for (i=0; i<object->num_polygons; i++)
+    for (j=0; j<3; j++) {
+      int index = object->polygon[i].index[j];
+      int delta = index - prev;
+      unsigned zigzag = ((unsigned)delta << 1) ^ (unsigned)(delta >> 31);
+      prev = index;
+      while (zigzag >= 0x80) {
+        *p++ = (unsigned char)(zigzag | 0x80);
+        zigzag >>= 7;
+      }
+      *p++ = (unsigned char)zigzag;
+    }
+  header.indices_size = (unsigned)(p - (data + header.indices_offset));
+
+  memcpy (data, &header, sizeof(header));
+  *size = header.indices_offset + header.indices_size;
+  return data;
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshFile_Decode
+|
+| Output: Returns a new Object3D decoded from a cooked mesh, or 0 if
+|   the data isn't one (or is damaged) or out of memory.
+|___________________________________________________________________*/
+
+Object3D *MeshFile_Decode (const unsigned char *data, size_t size)
+{
+  MeshFileHeader h;
+  int i, j, k;
+
+  TraceScope trace("MeshFile_Decode");
+
+  if (size < sizeof(h))
+    return 0;
+  memcpy (&h, data, sizeof(h));
+  if (NOT IsValid(&h, size))
+    return 0;
+  bool texcoords = (h.flags & MESHFILE_TEXCOORDS) != 0;
+
+  Object3D *object = NewObject (h.num_vertices, h.num_polygons, texcoords);
+  if (object == 0)
+    return 0;
+
+  // Vertices
+  float scale[3], uv_scale[2];
+  for (k=0; k<3; k++)
+    scale[k] = (h.bounds_max[k] - h.bounds_min[k]) / 65535.0f;
+  for (k=0; k<2; k++)
+    uv_scale[k] = (h.uv_max[k] - h.uv_min[k]) / 65535.0f;
+  const unsigned short *positions = (const unsigned short *)(data + h.positions_offset);
+  const short *normals = (const short *)(data + h.normals_offset);
+  const unsigned short *uvs = (const unsigned short *)(data + h.texcoords_offset);
+  for (i=0; i<(int)h.num_vertices; i++) {
+    object->vertex[i].x = h.bounds_min[0] + positions[i*3]   * scale[0];
+    object->vertex[i].y = h.bounds_min[1] + positions[i*3+1] * scale[1];
+    object->vertex[i].z = h.bounds_min[2] + positions[i*3+2] * scale[2];
+    OctDecode (normals + i*2, &object->vertex_normal[i]);
+    if (texcoords) {
+      object->tex_coords[i].u = h.uv_min[0] + uvs[i*2]   * uv_scale[0];
+      object->tex_coords[i].v = h.uv_min[1] + uvs[i*2+1] * uv_scale[1];
+    }
+  }
+
+  // Polygons
+  const short *polygon_normals = (const short *)(data + h.polygon_normals_offset);
+  for (i=0; i<(int)h.num_polygons; i++)
+    OctDecode (polygon_normals + i*2, &object->polygon_normal[i]);
+
+  const unsigned char *p = data + h.indices_offset, *end = p + h.indices_size;
+  int prev = 0;
+  for (i=0; i<(int)h.num_polygons; i++)
+    for (j=0; j<3; j++) {
+      unsigned zigzag = 0;
+      for (int shift=0; ; shift+=7) {
+        if (p == end OR shift > 28) {
+          FreeObject (object);
+          return 0;
+        }
+        unsigned char byte = *p++;
+        zigzag |= (unsigned)(byte & 0x7F) << shift;
+        if (byte < 0x80)
+          break;
+      }
+      int index = prev + (int)((zigzag >> 1) ^ (0u - (zigzag & 1)));
+      if (index < 0 OR index >= (int)h.num_vertices) {
+        FreeObject (object);
+        return 0;
+      }
+      object->polygon[i].index[j] = (unsigned short) index;
+      prev = index;
+    }
+
+  return object;
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshFile_Radius
+|
+| Output: Returns the distance from a cooked mesh's origin to its
+|   farthest vertex, as decoded (without decoding the rest), or 0 if
+|   the data isn't a valid cooked mesh.
+|___________________________________________________________________*/
+
+float MeshFile_Radius (const unsigned char *data, size_t size)
+{
+  MeshFileHeader h;
+  float scale[3], r2 = 0;
+  int k;
+
+  if (size < sizeof(h))
+    return 0;
+  memcpy (&h, data, sizeof(h));
+  if (NOT IsValid(&h, size))
+    return 0;
+  for (k=0; k<3; k++)
+    scale[k] = (h.bounds_max[k] - h.bounds_min[k]) / 65535.0f;
+  const unsigned short *positions = (const unsigned short *)(data + h.positions_offset);
+  for (int i=0; i<(int)h.num_vertices; i++) {
+    Vector3D v;
+    v.x = h.bounds_min[0] + positions[i*3]   * scale[0];
+    v.y = h.bounds_min[1] + positions[i*3+1] * scale[1];
+    v.z = h.bounds_min[2] + positions[i*3+2] * scale[2];
+    r2 = std::max (r2, v.x * v.x + v.y * v.y + v.z * v.z);
+  }
+  return sqrtf (r2);
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshFile_Name
+|
+| Output: Sets filename to the OBJ name with its extension replaced by
+|   .kmc.
+|___________________________________________________________________*/
+
+void MeshFile_Name (char *obj_filename, char *filename, int size)
+{
+  const char *dot = strrchr (obj_filename, '.');
+  const char *slash = strpbrk (dot ? dot : obj_filename, "/\\");
+  int len = (dot AND slash == 0) ? (int)(dot - obj_filename) : (int)strlen(obj_filename);
+
+  snprintf (filename, size, "%.*s.kmc", len, obj_filename);
+}
+
+/*____________________________________________________________________
+|
+| Function: LoadCooked
+|
+| Output: Reads the cooked mesh for an OBJ file into cooked, cooking it
+|   if needed.  Returns true on success.
+|___________________________________________________________________*/
+
+static bool LoadCooked (char *obj_filename, bool load_texcoords, bool smooth_discontinuous_vertices, Cooked *cooked)
+{
+  char filename[512];
+  bool stale;
+
+  unsigned flags = (load_texcoords ? MESHFILE_TEXCOORDS : 0) | (smooth_discontinuous_vertices ? MESHFILE_SMOOTH : 0);
+  MeshFile_Name (obj_filename, filename, sizeof(filename));
+
+  // Use the cooked file if it matches the OBJ file and the options (one in a pack may be
+  // older than the one on disk)
+  if (ReadCooked(filename, true, obj_filename, flags, cooked, &stale))
+    return true;
+  if (stale AND ReadCooked(filename, false, obj_filename, flags, cooked, &stale))
+    return true;
+
+  // Otherwise (re)cook it
+  if (NOT MeshFile_Cook(obj_filename, filename, load_texcoords, smooth_discontinuous_vertices))
+    return false;
+  return ReadCooked (filename, false, obj_filename, flags, cooked, &stale);
+}
+
+/*____________________________________________________________________
+|
+| Function: ReadCooked
+|
+| Output: Reads a cooked mesh file (looking in the packs first if
+|   search_packs is set) if it was cooked from the current OBJ file
+|   with the same options, and decodes it or copies it into cooked.
+|   Sets stale if it was found in a pack but couldn't be used.  Returns
+|   true on success.
+|___________________________________________________________________*/
+
+static bool ReadCooked (char *filename, bool search_packs, char *obj_filename, unsigned flags, Cooked *cooked, bool *stale)
+{
+  PackFile file;
+  bool ok = false;
+
+  *stale = false;
+  bool found = search_packs ? Pack_ReadFile (filename, &file) : Pack_MapFile (filename, &file);
+  if (NOT found)
+    return false;
+  if (file.size >= sizeof(MeshFileHeader)) {
+    MeshFileHeader h;
+    memcpy (&h, file.data, sizeof(h));
+    if (IsUpToDate(&h, obj_filename, flags)) {
+      if (cooked->decode) {
+        cooked->object = MeshFile_Decode (file.data, file.size);
+        ok = cooked->object != 0;
+      }
+      else if (IsValid(&h, file.size)) {
+        cooked->data = (unsigned char *) Mem_Alloc (MEM_MESH, file.size);
+        if (cooked->data) {
+          memcpy (cooked->data, file.data, file.size);
+          cooked->size = file.size;
+          ok = true;
+        }
+      }
+      if (NOT ok)
+        printf ("%s: not a valid cooked mesh, recooking\n", filename);
+    }
+  }
+  *stale = NOT ok AND file.in_pack;
+  Pack_CloseFile (&file);
+  return ok;
+}
+
+/*____________________________________________________________________
+|
+| Function: IsValid
+|
+| Output: Returns true if a cooked mesh header is one this code can
+|   read, with every section inside the size bytes of the file.
+|___________________________________________________________________*/
+
+static bool IsValid (MeshFileHeader *h, size_t size)
+{
+  if (memcmp(h->magic, MESHFILE_MAGIC, 4) != 0 OR h->version != MESHFILE_VERSION OR
+      h->endianness != MESHFILE_ENDIANNESS OR h->num_vertices > 0x10000 OR h->num_polygons > 0x1000000)
+    return false;
+  bool texcoords = (h->flags & MESHFILE_TEXCOORDS) != 0;
+  return (size_t)h->positions_offset + (size_t)h->num_vertices * 6 <= size AND
+         (size_t)h->normals_offset + (size_t)h->num_vertices * 4 <= size AND
+         (NOT texcoords OR (size_t)h->texcoords_offset + (size_t)h->num_vertices * 4 <= size) AND
+         (size_t)h->polygon_normals_offset + (size_t)h->num_polygons * 4 <= size AND
+         (size_t)h->indices_offset + h->indices_size <= size AND
+         ((h->positions_offset | h->normals_offset | h->texcoords_offset | h->polygon_normals_offset) & 3) == 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: IsUpToDate
+|
+| Output: Returns true if a cooked mesh was cooked from the current
+|   version of the OBJ file with the same options.
+|___________________________________________________________________*/
+
+static bool IsUpToDate (MeshFileHeader *h, char *obj_filename, unsigned flags)
+{
+  unsigned size;
+  unsigned long long time;
+
+  if (memcmp(h->magic, MESHFILE_MAGIC, 4) != 0 OR h->version != MESHFILE_VERSION OR h->flags != flags)
+    return false;
+  // If the OBJ file is missing, use the cooked file as it is
+  if (NOT SourceInfo(obj_filename, &size, &time))
+    return true;
+  return h->source_size == size AND h->source_time_lo == (unsigned)time AND h->source_time_hi == (unsigned)(time >> 32);
+}
+
+/*____________________________________________________________________
+|
+| Function: SourceInfo
+|
+| Output: Gets the size and modification time of a file (see
+|   Pack_FileInfo).  Returns true on success.
+|___________________________________________________________________*/
+
+static bool SourceInfo (char *obj_filename, unsigned *size, unsigned long long *time)
+{
+  unsigned long long bytes;
+
+  bool ok = Pack_FileInfo (obj_filename, &bytes, time);
+  *size = (unsigned) bytes;
+  return ok;
+}
+
+/*____________________________________________________________________
+|
+| Function: OctEncode
+|
+| Output: Encodes a unit vector as 2 signed 16-bit words: it's projected
+|   onto the octahedron |x|+|y|+|z| = 1, whose lower half is folded
+|   over the upper one, and the result flattened onto the x/y square.
+|___________________________________________________________________*/
+
+static void OctEncode (Vector3D *n, short *out)
+{
+  float l1 = fabsf(n->x) + fabsf(n->y) + fabsf(n->z);
+  float u = l1 > 0 ? n->x / l1 : 0;
+  float v = l1 > 0 ? n->y / l1 : 0;
+
+  if (n->z < 0) {
+    float fu = (1 - fabsf(v)) * (u >= 0 ? 1 : -1);
+    float fv = (1 - fabsf(u)) * (v >= 0 ? 1 : -1);
+    u = fu;
+    v = fv;
+  }
+  out[0] = (short) floorf (std::max(-1.0f, std::min(1.0f, u)) * 32767 + 0.5f);
+  out[1] = (short) floorf (std::max(-1.0f, std::min(1.0f, v)) * 32767 + 0.5f);
+}
+
+/*____________________________________________________________________
+|
+| Function: OctDecode
+|
+| Output: Decodes a unit vector encoded by OctEncode().
+|___________________________________________________________________*/
+
+static void OctDecode (const short *in, Vector3D *n)
+{
+  float u = in[0] * (1.0f / 32767);
+  float v = in[1] * (1.0f / 32767);
+  float z = 1 - fabsf(u) - fabsf(v);
+
+  if (z < 0) {
+    float fu = (1 - fabsf(v)) * (u >= 0 ? 1 : -1);
+    float fv = (1 - fabsf(u)) * (v >= 0 ? 1 : -1);
+    u = fu;
+    v = fv;
+  }
+  float f = 1 / sqrtf (u*u + v*v + z*z);
+  n->x = u * f;
+  n->y = v * f;
+  n->z = z * f;
+}
+
+/*____________________________________________________________________
+|
+| Function: Quantize
+|
+| Output: Returns value's position between min and max as a 16-bit
+|   fraction (rounded to the nearest step).
+|___________________________________________________________________*/
+
+static unsigned short Quantize (float value, float min, float max)
+{
+  if (max <= min)
+    return 0;
+  float f = (value - min) / (max - min) * 65535 + 0.5f;
+  return (unsigned short) std::max (0.0f, std::min(65535.0f, f));
+}
@@ -0,0 +1,63 @@
+/*____________________________________________________________________
+|
+| File: meshfile.h
+|
+| Cooked mesh files (.kmc): an Object3D with its positions quantized to
+| 16 bits within its bounding box, its normals octahedral encoded in 2
+| 16-bit words, its texcoords quantized within their range and its
+| indices delta encoded as variable length integers.  The vertex normals
+| are stored, so loading one is a decode with no normal computation.  A
+| mesh can also be held as it is stored and decoded when it's needed.
+| Include after pack.h.
+|___________________________________________________________________*/
+
+#define MESHFILE_MAGIC       "KMC1"
+#define MESHFILE_VERSION     1
+#define MESHFILE_ENDIANNESS  0x04030201
+
+// Load options a mesh was cooked with
+#define MESHFILE_TEXCOORDS   0x1
+#define MESHFILE_SMOOTH      0x2      // smooth_discontinuous_vertices
+
+// File header (all fields are little endian 32-bit words or floats), followed by the sections
+struct MeshFileHeader {
+  char     magic[4];              // MESHFILE_MAGIC
+  unsigned version;               // MESHFILE_VERSION
+  unsigned endianness;            // MESHFILE_ENDIANNESS
+  unsigned flags;                 // MESHFILE_*
+  unsigned num_vertices;
+  unsigned num_polygons;
+  float    bounds_min[3];         // positions are quantized within these
+  float    bounds_max[3];
+  float    uv_min[2];             // and texcoords within these
+  float    uv_max[2];
+  unsigned positions_offset;      // unsigned short[3] per vertex
+  unsigned normals_offset;        // short[2] per vertex (octahedral)
+  unsigned texcoords_offset;      // unsigned short[2] per vertex (with MESHFILE_TEXCOORDS)
+  unsigned polygon_normals_offset;// short[2] per polygon (octahedral)
+  unsigned indices_offset;        // each index minus the one before it, zigzag and varint encoded
+  unsigned indices_size;
+  unsigned source_size;           // size and modification time of the OBJ file it was cooked from (see Pack_FileInfo)
+  unsigned source_time_lo, source_time_hi;
+  unsigned reserved[5];
+};
+
+// Loads the cooked mesh for obj_filename (from a pack or from disk), cooking it first if it's
+//  missing or out of date.  Returns the decoded mesh, or 0 on failure
+Object3D *MeshFile_Load (char *obj_filename, bool load_texcoords, bool smooth_discontinuous_vertices);
+// Reads the cooked mesh for obj_filename as it is stored (decode it with MeshFile_Decode), cooking
+//  it first if it's missing or out of date.  Returns it (Mem_Free() it, it's MEM_MESH) and sets
+//  size, or returns 0 on failure
+unsigned char *MeshFile_Read (char *obj_filename, bool load_texcoords, bool smooth_discontinuous_vertices, size_t *size);
+// Converts an OBJ file to a cooked mesh file.  Returns true on success
+bool MeshFile_Cook (char *obj_filename, char *filename, bool load_texcoords, bool smooth_discontinuous_vertices);
+// Encodes a mesh (flags = MESHFILE_*).  Returns the file contents (Mem_Free() them) and sets
+//  size, or returns 0 if out of memory
+unsigned char *MeshFile_Encode (Object3D *object, unsigned flags, size_t *size);
+// Decodes a cooked mesh.  Returns a new Object3D, or 0 if the data isn't a valid cooked mesh
+Object3D *MeshFile_Decode (const unsigned char *data, size_t size);
+// Returns the distance from a cooked mesh's origin to its farthest vertex (as decoded), or 0 if
+//  it isn't valid
+float MeshFile_Radius (const unsigned char *data, size_t size);
+// Returns the cooked file name for an OBJ file (the OBJ name with a .kmc extension)
+void MeshFile_Name (char *obj_filename, char *filename, int size);
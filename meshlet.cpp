@@ -0,0 +1,625 @@
+/*____________________________________________________________________
+|
+| File: meshlet.cpp
+|
+| Description: Meshlet clustering and culling.  Clusters are grown one
+|   at a time from the first free triangle in Morton order of their
+|   centers (so each new cluster starts next to the last), by adding the
+|   free neighbor whose normal is closest to the cluster's and that is
+|   closest to its seed.  Triangles are neighbors when they share a
+|   vertex position, so seams (split texcoords or normals) don't stop a
+|   cluster.  The polygons are then reordered cluster by cluster, so
+|   each cluster is one range of indices and visible clusters next to
+|   each other draw with one call.
+|
+|   A cluster is back-facing when the angle from its cone axis to the
+|   camera's view of any point of its sphere is at most 90 degrees less
+|   the cone's angle: then every triangle in it faces away.  A mesh
+|   with morph targets also gets a sphere grown by the farthest any of
+|   the cluster's vertices can move, and a cone widened by the farthest
+|   that can turn each triangle, for drawing blended poses.  An object
+|   with many meshlets has them tested in jobs (see job.h), then merged
+|   into runs in order.
+|
+| Functions: Meshlet_Build
+|            Meshlet_GetView
+|            Meshlet_Cull
+|            Meshlet_GetStats
+|            Meshlet_ResetStats
+|            Classify
+|            ClassifyJob
+|            Bounds
+|            MorphBounds
+|            Turn
+|            MortonCode
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <GL/glut.h>
+#include "math3d.h"
+#include "memtrack.h"
+#include "adjacency.h"
+#include "job.h"
+#include "trace.h"
+#include "morph.h"
+#include "meshlet.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define MESHLETS_PER_JOB 256      // objects with fewer meshlets are culled by the calling thread
+
+// What culling found for a meshlet
+#define MESHLET_VISIBLE     0
+#define MESHLET_OUTSIDE     1
+#define MESHLET_BACKFACING  2
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct ClassifyWork {
+  Meshlet       *meshlets;
+  MeshletView   *view;
+  unsigned char *result;          // MESHLET_* for each meshlet
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static int  Classify (Meshlet *m, MeshletView *view);
+static void ClassifyJob (void *data, int begin, int end);
+static void Bounds (Object3D *object, int first, int count, Meshlet *m);
+static void MorphBounds (Object3D *object, Meshlet *m);
+static float Turn (MorphTargets *morph, Polygon3D *polygon, Vector3D *e1, Vector3D *e2);
+static unsigned MortonCode (Vector3D *p, Vector3D *min, float scale);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static MeshletStats stats;
+
+/*____________________________________________________________________
+|
+| Function: Meshlet_Build
+|
+| Output: Clusters an object's polygons (reordering them) and creates
+|   its meshlets.  Returns false if out of memory.
+|___________________________________________________________________*/
+
+bool Meshlet_Build (Object3D *object)
+{
+  int i, j, k;
+  int n = object->num_polygons;
+  Adjacency adj;
+
+  TraceScope trace("Meshlet_Build");
+
+  if (n <= MESHLET_MAX_TRIANGLES)
+    return true;
+
+  // Triangles around each position
+  if (NOT Adjacency_Build(object, &adj, MEM_LOADER))
+    return false;
+
+  // Triangle centers, and the order to seed clusters in
+  std::vector<Vector3D> centers (n);
+  Vector3D min = object->vertex[0], max = object->vertex[0];
+  for (i=0; i<object->num_vertices; i++) {
+    Vector3D *v = &object->vertex[i];
+    min.x = std::min (min.x, v->x);  max.x = std::max (max.x, v->x);
+    min.y = std::min (min.y, v->y);  max.y = std::max (max.y, v->y);
+    min.z = std::min (min.z, v->z);  max.z = std::max (max.z, v->z);
+  }
+  float extent = std::max (max.x - min.x, std::max (max.y - min.y, max.z - min.z));
+  float scale = extent > 0 ? 1023 / extent : 0;
+  std::vector<std::pair<unsigned,int> > order (n);
+  for (i=0; i<n; i++) {
+    Vector3D *a = &object->vertex[object->polygon[i].index[0]];
+    Vector3D *b = &object->vertex[object->polygon[i].index[1]];
+    Vector3D *c = &object->vertex[object->polygon[i].index[2]];
+    centers[i].x = (a->x + b->x + c->x) / 3;
+    centers[i].y = (a->y + b->y + c->y) / 3;
+    centers[i].z = (a->z + b->z + c->z) / 3;
+    order[i] = std::make_pair (MortonCode (&centers[i], &min, scale), i);
+  }
+  std::sort (order.begin(), order.end());
+
+  // A cluster as wide as MESHLET_MAX_TRIANGLES triangles of average size, used to weigh
+  // distance against normal agreement
+  float area = 0;
+  for (i=0; i<n; i++) {
+    Vector3D *a = &object->vertex[object->polygon[i].index[0]];
+    Vector3D *b = &object->vertex[object->polygon[i].index[1]];
+    Vector3D *c = &object->vertex[object->polygon[i].index[2]];
+    Vector3D e1 = { b->x - a->x, b->y - a->y, b->z - a->z };
+    Vector3D e2 = { c->x - a->x, c->y - a->y, c->z - a->z };
+    Vector3D x = { e1.y*e2.z - e1.z*e2.y, e1.z*e2.x - e1.x*e2.z, e1.x*e2.y - e1.y*e2.x };
+    area += sqrtf (x.x*x.x + x.y*x.y + x.z*x.z) / 2;
+  }
+  float width = sqrtf (area / n * MESHLET_MAX_TRIANGLES);
+  if (NOT (width > 0))
+    width = 1;
+
+  // Grow the clusters
+  std::vector<int> cluster (n, -1), frontier, sorted;
+  std::vector<int> first_of;
+  std::vector<int> queued (n, -1);
+  int num_clusters = 0;
+  sorted.reserve (n);
+  for (int s=0; s<n; s++) {
+    int seed = order[s].second;
+    if (cluster[seed] >= 0)
+      continue;
+    int id = num_clusters++;
+    first_of.push_back ((int)sorted.size());
+    Vector3D axis = { 0, 0, 0 };
+    frontier.clear ();
+    int t = seed;
+    for (int count=0; ; ) {
+      // Add t to the cluster
+      cluster[t] = id;
+      sorted.push_back (t);
+      Vector3D *pn = &object->polygon_normal[t];
+      if (pn->x == pn->x AND pn->y == pn->y AND pn->z == pn->z) {
+        axis.x += pn->x;
+        axis.y += pn->y;
+        axis.z += pn->z;
+      }
+      if (++count == MESHLET_MAX_TRIANGLES)
+        break;
+      // Queue its free neighbors
+      for (j=0; j<3; j++) {
+        int *around;
+        int num = Adjacency_PositionPolygons (&adj, adj.position[object->polygon[t].index[j]], &around);
+        for (k=0; k<num; k++) {
+          int u = around[k];
+          if (cluster[u] < 0 AND queued[u] != id) {
+            queued[u] = id;
+            frontier.push_back (u);
+          }
+        }
+      }
+      // Take the best one next
+      float length = sqrtf (axis.x*axis.x + axis.y*axis.y + axis.z*axis.z);
+      float inv = length > 0 ? 1 / length : 0;
+      int best = -1;
+      float best_score = -1e30f;
+      for (k=0; k<(int)frontier.size(); k++) {
+        int u = frontier[k];
+        if (cluster[u] >= 0)
+          continue;
+        Vector3D *un = &object->polygon_normal[u];
+        float dx = centers[u].x - centers[seed].x;
+        float dy = centers[u].y - centers[seed].y;
+        float dz = centers[u].z - centers[seed].z;
+        float score = (un->x*axis.x + un->y*axis.y + un->z*axis.z) * inv - sqrtf(dx*dx + dy*dy + dz*dz) / width;
+        if (score > best_score) {
+          best_score = score;
+          best = k;
+        }
+      }
+      if (best < 0)
+        break;
+      t = frontier[best];
+      frontier[best] = frontier.back ();
+      frontier.pop_back ();
+    }
+  }
+
+  Adjacency_Free (&adj);
+
+  // Reorder the polygons cluster by cluster
+  Meshlet *meshlets = (Meshlet *) Mem_Alloc (MEM_MESH, num_clusters * sizeof(Meshlet));
+  std::vector<Polygon3D> polygons (object->polygon, object->polygon + n);
+  std::vector<Vector3D> normals (object->polygon_normal, object->polygon_normal + n);
+  if (meshlets == 0)
+    return false;
+  for (i=0; i<n; i++) {
+    object->polygon[i]        = polygons[sorted[i]];
+    object->polygon_normal[i] = normals[sorted[i]];
+  }
+  for (k=0; k<num_clusters; k++) {
+    int first = first_of[k];
+    int count = (k+1 < num_clusters ? first_of[k+1] : n) - first;
+    Bounds (object, first, count, &meshlets[k]);
+    MorphBounds (object, &meshlets[k]);
+  }
+
+  if (object->meshlets)
+    Mem_Free (object->meshlets);
+  object->meshlets = meshlets;
+  object->num_meshlets = num_clusters;
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Meshlet_GetView
+|
+| Output: Gets the frustum planes and the camera position in the
+|   coordinates of the object about to be drawn, from the current GL
+|   matrices.
+|___________________________________________________________________*/
+
+void Meshlet_GetView (MeshletView *view)
+{
+  float mv[16], p[16], m[16];
+  int i, j;
+
+  glGetFloatv (GL_MODELVIEW_MATRIX, mv);
+  glGetFloatv (GL_PROJECTION_MATRIX, p);
+
+  // Clip matrix (projection * modelview, column major)
+  for (i=0; i<4; i++)
+    for (j=0; j<4; j++)
+      m[j*4+i] = p[i]*mv[j*4] + p[4+i]*mv[j*4+1] + p[8+i]*mv[j*4+2] + p[12+i]*mv[j*4+3];
+
+  // Each plane is the last row of the clip matrix plus or minus another
+  for (i=0; i<6; i++) {
+    int row = i / 2;
+    float sign = (i & 1) ? -1.0f : 1.0f;
+    float *plane = view->planes[i];
+    for (j=0; j<4; j++)
+      plane[j] = m[j*4+3] + sign * m[j*4+row];
+    float length = sqrtf (plane[0]*plane[0] + plane[1]*plane[1] + plane[2]*plane[2]);
+    if (length > 0)
+      for (j=0; j<4; j++)
+        plane[j] /= length;
+  }
+
+  // The camera is at the origin of eye space: -R^T t / s^2 for a modelview of s*R and t
+  float s2 = mv[0]*mv[0] + mv[1]*mv[1] + mv[2]*mv[2];
+  if (s2 <= 0)
+    s2 = 1;
+  view->camera.x = -(mv[0]*mv[12] + mv[1]*mv[13] + mv[2]*mv[14]) / s2;
+  view->camera.y = -(mv[4]*mv[12] + mv[5]*mv[13] + mv[6]*mv[14]) / s2;
+  view->camera.z = -(mv[8]*mv[12] + mv[9]*mv[13] + mv[10]*mv[14]) / s2;
+  view->morphed = false;
+}
+
+/*____________________________________________________________________
+|
+| Function: Meshlet_Cull
+|
+| Output: Sets runs to the ranges of polygons in the meshlets that
+|   aren't outside the frustum or back-facing (consecutive ones merged).
+|   An object with no meshlets is one run.  Returns the # of runs.
+|___________________________________________________________________*/
+
+int Meshlet_Cull (Object3D *object, MeshletView *view, MeshletRun *runs)
+{
+  int num_runs = 0;
+
+  stats.objects++;
+  stats.polygons += object->num_polygons;
+  if (object->num_meshlets == 0) {
+    runs[0].first = 0;
+    runs[0].count = object->num_polygons;
+    stats.drawn += object->num_polygons;
+    stats.runs++;
+    return 1;
+  }
+
+  // Test them all first if there are enough to share out
+  static std::vector<unsigned char> result;
+  bool classified = object->num_meshlets >= 2 * MESHLETS_PER_JOB;
+  if (classified) {
+    result.resize (object->num_meshlets);
+    ClassifyWork work = { object->meshlets, view, result.data() };
+    Job_ParallelFor (object->num_meshlets, MESHLETS_PER_JOB, ClassifyJob, &work);
+  }
+
+  for (int i=0; i<object->num_meshlets; i++) {
+    Meshlet *m = &object->meshlets[i];
+    stats.meshlets++;
+
+    int found = classified ? result[i] : Classify (m, view);
+    if (found == MESHLET_OUTSIDE) {
+      stats.outside++;
+      continue;
+    }
+    if (found == MESHLET_BACKFACING) {
+      stats.backfacing++;
+      continue;
+    }
+
+    // Draw it, with the one before if that's also drawn
+    if (num_runs > 0 AND runs[num_runs-1].first + runs[num_runs-1].count == m->first)
+      runs[num_runs-1].count += m->count;
+    else {
+      runs[num_runs].first = m->first;
+      runs[num_runs].count = m->count;
+      num_runs++;
+    }
+    stats.drawn += m->count;
+  }
+  stats.runs += num_runs;
+  return num_runs;
+}
+
+/*____________________________________________________________________
+|
+| Function: Meshlet_GetStats
+|
+| Output: Gets the culling counts.
+|___________________________________________________________________*/
+
+void Meshlet_GetStats (MeshletStats *s)
+{
+  *s = stats;
+}
+
+/*____________________________________________________________________
+|
+| Function: Meshlet_ResetStats
+|
+| Output: Resets the culling counts.
+|___________________________________________________________________*/
+
+void Meshlet_ResetStats ()
+{
+  memset (&stats, 0, sizeof(stats));
+}
+
+/*____________________________________________________________________
+|
+| Function: Classify
+|
+| Output: Returns MESHLET_OUTSIDE if a meshlet is outside the frustum,
+|   MESHLET_BACKFACING if it faces away from the camera, else
+|   MESHLET_VISIBLE.
+|___________________________________________________________________*/
+
+static int Classify (Meshlet *m, MeshletView *view)
+{
+  float radius   = view->morphed ? m->morph_radius   : m->radius;
+  float cone_sin = view->morphed ? m->morph_cone_sin : m->cone_sin;
+  float cone_cos = view->morphed ? m->morph_cone_cos : m->cone_cos;
+
+  // Outside a frustum plane?
+  for (int j=0; j<6; j++) {
+    float *plane = view->planes[j];
+    if (plane[0]*m->center.x + plane[1]*m->center.y + plane[2]*m->center.z + plane[3] < -radius)
+      return MESHLET_OUTSIDE;
+  }
+
+  // Back-facing? (the cone's angle plus the sphere's angle as seen from the camera must
+  // leave the view direction within 90 degrees of the axis)
+  if (cone_cos > 0) {
+    float vx = m->center.x - view->camera.x;
+    float vy = m->center.y - view->camera.y;
+    float vz = m->center.z - view->camera.z;
+    float d = sqrtf (vx*vx + vy*vy + vz*vz);
+    if (d > radius) {
+      float sin_a = radius / d;
+      float cos_a = sqrtf (1 - sin_a*sin_a);
+      if (cone_cos*cos_a - cone_sin*sin_a > 0 AND
+          m->cone_axis.x*vx + m->cone_axis.y*vy + m->cone_axis.z*vz >= d * (cone_sin*cos_a + cone_cos*sin_a))
+        return MESHLET_BACKFACING;
+    }
+  }
+  return MESHLET_VISIBLE;
+}
+
+/*____________________________________________________________________
+|
+| Function: ClassifyJob
+|
+| Output: Classifies meshlets begin up to (not including) end for
+|   Meshlet_Cull().
+|___________________________________________________________________*/
+
+static void ClassifyJob (void *data, int begin, int end)
+{
+  ClassifyWork *work = (ClassifyWork *) data;
+  for (int i=begin; i<end; i++)
+    work->result[i] = (unsigned char) Classify (&work->meshlets[i], work->view);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bounds
+|
+| Output: Sets a meshlet's polygon range, bounding sphere (around the
+|   center of its box) and normal cone (around its average normal,
+|   ignoring degenerate polygons).
+|___________________________________________________________________*/
+
+static void Bounds (Object3D *object, int first, int count, Meshlet *m)
+{
+  int i, j;
+
+  m->first = first;
+  m->count = count;
+
+  Vector3D min = object->vertex[object->polygon[first].index[0]], max = min;
+  for (i=first; i<first+count; i++)
+    for (j=0; j<3; j++) {
+      Vector3D *v = &object->vertex[object->polygon[i].index[j]];
+      min.x = std::min (min.x, v->x);  max.x = std::max (max.x, v->x);
+      min.y = std::min (min.y, v->y);  max.y = std::max (max.y, v->y);
+      min.z = std::min (min.z, v->z);  max.z = std::max (max.z, v->z);
+    }
+  m->center.x = (min.x + max.x) / 2;
+  m->center.y = (min.y + max.y) / 2;
+  m->center.z = (min.z + max.z) / 2;
+  float r2 = 0;
+  for (i=first; i<first+count; i++)
+    for (j=0; j<3; j++) {
+      Vector3D *v = &object->vertex[object->polygon[i].index[j]];
+      float dx = v->x - m->center.x, dy = v->y - m->center.y, dz = v->z - m->center.z;
+      r2 = std::max (r2, dx*dx + dy*dy + dz*dz);
+    }
+  m->radius = sqrtf (r2) * 1.0001f;
+
+  Vector3D axis = { 0, 0, 0 };
+  for (i=first; i<first+count; i++) {
+    Vector3D *n = &object->polygon_normal[i];
+    float length = n->x*n->x + n->y*n->y + n->z*n->z;
+    if (length > 0.5f AND length < 1.5f) {
+      axis.x += n->x;
+      axis.y += n->y;
+      axis.z += n->z;
+    }
+  }
+  float length = sqrtf (axis.x*axis.x + axis.y*axis.y + axis.z*axis.z);
+  m->cone_cos = 0;
+  m->cone_sin = 1;
+  m->cone_axis = axis;
+  if (NOT (length > 0))
+    return;
+  m->cone_axis.x /= length;
+  m->cone_axis.y /= length;
+  m->cone_axis.z /= length;
+  float cos_min = 1;
+  for (i=first; i<first+count; i++) {
+    Vector3D *n = &object->polygon_normal[i];
+    float nl = n->x*n->x + n->y*n->y + n->z*n->z;
+    if (nl > 0.5f AND nl < 1.5f)
+      cos_min = std::min (cos_min, (n->x*m->cone_axis.x + n->y*m->cone_axis.y + n->z*m->cone_axis.z) / sqrtf(nl));
+  }
+  // A little slack for rounding
+  cos_min -= 0.001f;
+  if (cos_min <= 0)
+    return;
+  m->cone_cos = cos_min;
+  m->cone_sin = sqrtf (1 - cos_min*cos_min);
+}
+
+/*____________________________________________________________________
+|
+| Function: MorphBounds
+|
+| Output: Sets a meshlet's sphere and cone for blended poses of its
+|   object (see morph.h): the sphere grown by the farthest a vertex in
+|   it can move, and the cone widened by the most each polygon can turn:
+|   a blend moves its edges' cross product e1 x e2 by the weighted sum
+|   of each target's d1 x e2 + e1 x d2 (d1, d2 the target's changes to
+|   the edges) plus products of the d's, so by at most the sum of their
+|   lengths, an angle of asin of that over |e1 x e2|.
+|___________________________________________________________________*/
+
+static void MorphBounds (Object3D *object, Meshlet *m)
+{
+  int i, j, k;
+  MorphTargets *morph = object->morph;
+
+  m->morph_radius   = m->radius;
+  m->morph_cone_sin = m->cone_sin;
+  m->morph_cone_cos = m->cone_cos;
+  if (morph == 0)
+    return;
+
+  // Farthest a vertex can move, with every target at full weight
+  float reach = 0;
+  for (i=m->first; i<m->first+m->count; i++)
+    for (j=0; j<3; j++) {
+      int v = object->polygon[i].index[j];
+      float r = 0;
+      for (k=0; k<morph->num_targets; k++) {
+        float *d = morph->delta[k] + v * MORPH_FLOATS;
+        r += sqrtf (d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+      }
+      reach = std::max (reach, r);
+    }
+  if (reach == 0)
+    return;
+  m->morph_radius = m->radius + reach * 1.0001f;
+
+  m->morph_cone_cos = 0;
+  m->morph_cone_sin = 1;
+  if (m->cone_cos <= 0)
+    return;
+  float angle = 0;
+  for (i=m->first; i<m->first+m->count; i++) {
+    Vector3D *a = &object->vertex[object->polygon[i].index[0]];
+    Vector3D *b = &object->vertex[object->polygon[i].index[1]];
+    Vector3D *c = &object->vertex[object->polygon[i].index[2]];
+    Vector3D e1 = { b->x - a->x, b->y - a->y, b->z - a->z };
+    Vector3D e2 = { c->x - a->x, c->y - a->y, c->z - a->z };
+    Vector3D x = { e1.y*e2.z - e1.z*e2.y, e1.z*e2.x - e1.x*e2.z, e1.x*e2.y - e1.y*e2.x };
+    float length = sqrtf (x.x*x.x + x.y*x.y + x.z*x.z);
+    float turn = Turn (morph, &object->polygon[i], &e1, &e2);
+    // A polygon that may turn over (or degenerate, which the base cone skips) leaves no cone
+    if (NOT (turn < length))
+      return;
+    float cos_axis = (x.x*m->cone_axis.x + x.y*m->cone_axis.y + x.z*m->cone_axis.z) / length;
+    angle = std::max (angle, acosf (std::max (-1.0f, std::min (1.0f, cos_axis))) + asinf (turn / length));
+  }
+  // A little slack for rounding
+  float cos_max = cosf (angle) - 0.001f;
+  if (cos_max <= 0)
+    return;
+  m->morph_cone_cos = cos_max;
+  m->morph_cone_sin = sqrtf (1 - cos_max*cos_max);
+}
+
+/*____________________________________________________________________
+|
+| Function: Turn
+|
+| Output: Returns the most a blend of the morph targets (weights from 0
+|   to 1) can move the cross product of a polygon's edges e1 (first to
+|   second vertex) and e2 (first to third).
+|___________________________________________________________________*/
+
+static float Turn (MorphTargets *morph, Polygon3D *polygon, Vector3D *e1, Vector3D *e2)
+{
+  float turn = 0, s1 = 0, s2 = 0;
+  for (int k=0; k<morph->num_targets; k++) {
+    float *a = morph->delta[k] + polygon->index[0] * MORPH_FLOATS;
+    float *b = morph->delta[k] + polygon->index[1] * MORPH_FLOATS;
+    float *c = morph->delta[k] + polygon->index[2] * MORPH_FLOATS;
+    Vector3D d1 = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+    Vector3D d2 = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+    Vector3D x = { d1.y*e2->z - d1.z*e2->y + e1->y*d2.z - e1->z*d2.y,
+                   d1.z*e2->x - d1.x*e2->z + e1->z*d2.x - e1->x*d2.z,
+                   d1.x*e2->y - d1.y*e2->x + e1->x*d2.y - e1->y*d2.x };
+    turn += sqrtf (x.x*x.x + x.y*x.y + x.z*x.z);
+    s1 += sqrtf (d1.x*d1.x + d1.y*d1.y + d1.z*d1.z);
+    s2 += sqrtf (d2.x*d2.x + d2.y*d2.y + d2.z*d2.z);
+  }
+  return turn + s1 * s2;
+}
+
+/*____________________________________________________________________
+|
+| Function: MortonCode
+|
+| Output: Returns a point's 30-bit Morton code (10 bits per axis, from
+|   min, scale steps per unit).
+|___________________________________________________________________*/
+
+static unsigned MortonCode (Vector3D *p, Vector3D *min, float scale)
+{
+  unsigned code = 0;
+  unsigned x = (unsigned) std::min (1023.0f, std::max (0.0f, (p->x - min->x) * scale));
+  unsigned y = (unsigned) std::min (1023.0f, std::max (0.0f, (p->y - min->y) * scale));
+  unsigned z = (unsigned) std::min (1023.0f, std::max (0.0f, (p->z - min->z) * scale));
+
+  for (int bit=9; bit>=0; bit--)
+    code = (code << 3) | (((x >> bit) & 1) << 2) | (((y >> bit) & 1) << 1) | ((z >> bit) & 1);
+  return code;
+}
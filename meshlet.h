@@ -0,0 +1,60 @@
+/*____________________________________________________________________
+|
+| File: meshlet.h
+|
+| Meshlets: a mesh's polygons split into small clusters of neighboring
+| triangles that face about the same way, each with a bounding sphere
+| and a cone holding its polygon normals.  A cluster entirely outside
+| the view frustum, or whose every triangle faces away from the camera,
+| can be skipped before its indices are submitted.
+|___________________________________________________________________*/
+
+#define MESHLET_MAX_TRIANGLES 64    // most triangles in a cluster
+
+// A cluster of polygons (polygon[first] to polygon[first+count-1] of its object)
+struct Meshlet {
+  int      first, count;
+  Vector3D center;            // bounding sphere
+  float    radius;
+  Vector3D cone_axis;         // every polygon normal is within the cone's angle of its axis
+  float    cone_sin, cone_cos;// sine and cosine of that angle (cone_cos <= 0: the cone can't cull)
+  float    morph_radius;      // the same, holding any blend of the object's morph targets (weights
+  float    morph_cone_sin;    //  from 0 to 1, see morph.h); the base ones if it has none
+  float    morph_cone_cos;
+};
+
+// A run of consecutive polygons to draw
+struct MeshletRun {
+  int first, count;
+};
+
+// The view an object is drawn with, in the object's own coordinates
+struct MeshletView {
+  float    planes[6][4];      // frustum planes, normalized, pointing in (ax+by+cz+d >= 0 inside)
+  Vector3D camera;            // eye position
+  bool     morphed;           // the object is drawn in a blended pose (use the morph bounds)
+};
+
+// Counts kept by Meshlet_Cull() since the last Meshlet_ResetStats()
+struct MeshletStats {
+  long long objects;          // objects culled
+  long long meshlets;         // meshlets tested
+  long long backfacing;       // rejected by their normal cone
+  long long outside;          // rejected by the frustum
+  long long polygons;         // polygons in the objects tested
+  long long drawn;            // polygons in the meshlets kept
+  long long runs;             // draw calls they took
+};
+
+// Reorders an object's polygons into clusters and creates its meshlets (objects with no more
+//  than MESHLET_MAX_TRIANGLES polygons are left alone).  Returns false if out of memory
+bool Meshlet_Build (Object3D *object);
+// Gets the view from the current GL modelview and projection matrices (set up to draw an
+//  object, with any scale uniform), for the object's own pose
+void Meshlet_GetView (MeshletView *view);
+// Finds an object's meshlets that may be visible, merged into runs of consecutive polygons
+//  (runs must hold num_meshlets).  Returns the # of runs
+int  Meshlet_Cull (Object3D *object, MeshletView *view, MeshletRun *runs);
+// Gets and resets the culling counts
+void Meshlet_GetStats (MeshletStats *stats);
+void Meshlet_ResetStats ();
@@ -0,0 +1,253 @@
+/*____________________________________________________________________
+|
+| File: mipmap.cpp
+|
+| Description: Builds the mip chain of an RGB texture on the CPU, so
+|   every level can be uploaded with glTexImage2D() and the texture
+|   sampled with trilinear filtering.  Each level is a 2x2 box filter of
+|   the level above.  Rows are split into jobs (see job.h), and each row
+|   is filtered 16 source pixels at a time with SSSE3 when the CPU has
+|   it.
+|
+| Functions: Mipmap_Build
+|            Mipmap_Free
+|            Mipmap_Downsample
+|            DownsampleJob
+|            DownsampleRows
+|            DownsampleRow
+|            DownsampleRow_SSSE3
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "math3d.h"
+#include "memtrack.h"
+#include "cpu.h"
+#include "job.h"
+#include "trace.h"
+#include "mipmap.h"
+
+#ifdef CPU_X86
+#include <tmmintrin.h>    // SSSE3
+#endif
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define ROWS_PER_JOB 64   // smaller levels are filtered by the calling thread
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct DownsampleWork {
+  unsigned char *src;
+  int            width, height;
+  unsigned char *dst;
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void DownsampleJob (void *data, int y0, int y1);
+static void DownsampleRows (unsigned char *src, int width, int height, unsigned char *dst, int y0, int y1);
+static void DownsampleRow (unsigned char *row0, unsigned char *row1, int width, unsigned char *dst, int x0, int x1);
+#ifdef CPU_X86
+static void DownsampleRow_SSSE3 (unsigned char *row0, unsigned char *row1, unsigned char *dst, int num_blocks);
+#endif
+
+/*____________________________________________________________________
+|
+| Function: Mipmap_Build
+|
+| Output: Fills in levels[] with the mip chain of an RGB image, down to
+|   1x1.  Returns the number of levels (including level 0).
+|___________________________________________________________________*/
+
+int Mipmap_Build (unsigned char *rgb, int width, int height, MipLevel levels[MIP_MAX_LEVELS])
+{
+  int i, num_levels;
+  size_t total = 0;
+
+  TraceScope trace("Mipmap_Build");
+
+  // Work out the size of each level
+  memset (levels, 0, MIP_MAX_LEVELS * sizeof(MipLevel));
+  levels[0].width  = width;
+  levels[0].height = height;
+  levels[0].data   = rgb;
+  for (num_levels=1; num_levels<MIP_MAX_LEVELS; num_levels++) {
+    MipLevel *prev = &levels[num_levels-1];
+    if (prev->width == 1 AND prev->height == 1)
+      break;
+    levels[num_levels].width  = std::max (1, prev->width / 2);
+    levels[num_levels].height = std::max (1, prev->height / 2);
+    total += (size_t)levels[num_levels].width * levels[num_levels].height * 3;
+  }
+
+  // All the created levels share one buffer (owned by level 1)
+  if (num_levels > 1) {
+    unsigned char *buffer = (unsigned char *) Mem_Alloc (MEM_TEXTURE, total);
+    if (buffer == 0)
+      return 1;
+    for (i=1; i<num_levels; i++) {
+      levels[i].data = buffer;
+      buffer += (size_t)levels[i].width * levels[i].height * 3;
+    }
+  }
+
+  // Each level is filtered from the one above it
+  for (i=1; i<num_levels; i++)
+    Mipmap_Downsample (levels[i-1].data, levels[i-1].width, levels[i-1].height, levels[i].data);
+
+  return num_levels;
+}
+
+/*____________________________________________________________________
+|
+| Function: Mipmap_Free
+|
+| Output: Frees the levels created by Mipmap_Build().
+|___________________________________________________________________*/
+
+void Mipmap_Free (MipLevel levels[MIP_MAX_LEVELS])
+{
+  Mem_Free (levels[1].data);
+  memset (levels + 1, 0, (MIP_MAX_LEVELS - 1) * sizeof(MipLevel));
+}
+
+/*____________________________________________________________________
+|
+| Function: Mipmap_Downsample
+|
+| Output: Halves an RGB image with a 2x2 box filter.  An odd last row or
+|   column is left out, except that a 1 pixel wide (or high) image
+|   stays 1 pixel wide.  Large images are split into jobs.
+|___________________________________________________________________*/
+
+void Mipmap_Downsample (unsigned char *src, int width, int height, unsigned char *dst)
+{
+  DownsampleWork work = { src, width, height, dst };
+
+  Job_ParallelFor (std::max (1, height / 2), ROWS_PER_JOB, DownsampleJob, &work);
+}
+
+/*____________________________________________________________________
+|
+| Function: DownsampleJob
+|
+| Output: Filters destination rows y0 up to (not including) y1 of a
+|   Mipmap_Downsample() job.
+|___________________________________________________________________*/
+
+static void DownsampleJob (void *data, int y0, int y1)
+{
+  DownsampleWork *work = (DownsampleWork *) data;
+  DownsampleRows (work->src, work->width, work->height, work->dst, y0, y1);
+}
+
+/*____________________________________________________________________
+|
+| Function: DownsampleRows
+|
+| Output: Filters destination rows y0 up to (not including) y1.
+|___________________________________________________________________*/
+
+static void DownsampleRows (unsigned char *src, int width, int height, unsigned char *dst, int y0, int y1)
+{
+  int dst_width = std::max (1, width / 2);
+  size_t src_stride = (size_t)width * 3;
+  size_t dst_stride = (size_t)dst_width * 3;
+
+  for (int y=y0; y<y1; y++) {
+    unsigned char *row0 = src + (2 * y) * src_stride;
+    unsigned char *row1 = src + std::min (2 * y + 1, height - 1) * src_stride;
+    unsigned char *out  = dst + y * dst_stride;
+    int x = 0;
+#ifdef CPU_X86
+    if (CPU_HasSSSE3()) {
+      int num_blocks = width / 16;    // blocks of 16 source pixels (8 destination pixels)
+      DownsampleRow_SSSE3 (row0, row1, out, num_blocks);
+      x = num_blocks * 8;
+    }
+#endif
+    DownsampleRow (row0, row1, width, out, x, dst_width);
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: DownsampleRow
+|
+| Output: Filters destination pixels x0 up to (not including) x1 of a
+|   row, from 2 source rows.
+|___________________________________________________________________*/
+
+static void DownsampleRow (unsigned char *row0, unsigned char *row1, int width, unsigned char *dst, int x0, int x1)
+{
+  for (int x=x0; x<x1; x++) {
+    int a = (2 * x) * 3;
+    int b = std::min (2 * x + 1, width - 1) * 3;
+    for (int c=0; c<3; c++)
+      dst[x*3+c] = (unsigned char) ((row0[a+c] + row0[b+c] + row1[a+c] + row1[b+c] + 2) >> 2);
+  }
+}
+
+#ifdef CPU_X86
+/*____________________________________________________________________
+|
+| Function: DownsampleRow_SSSE3
+|
+| Output: Filters num_blocks blocks of 16 source pixels (48 bytes) into
+|   8 destination pixels (24 bytes).  The two rows are added as 16-bit
+|   values, each value is added to the one 3 lanes (1 pixel) on, and
+|   every other pixel of the sums is gathered into the output.
+|___________________________________________________________________*/
+
+TARGET_SSSE3
+static void DownsampleRow_SSSE3 (unsigned char *row0, unsigned char *row1, unsigned char *dst, int num_blocks)
+{
+  const char Z = -128;  // pshufb writes 0 for this index
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i two  = _mm_set1_epi16 (2);
+  // Pick the bytes of the even pixels out of 48 bytes of sums (in 3 registers)
+  const __m128i m0 = _mm_setr_epi8 (0,1,2, 6,7,8, 12,13,14, Z,Z,Z, Z,Z,Z, Z);
+  const __m128i m1 = _mm_setr_epi8 (Z,Z,Z, Z,Z,Z, Z,Z,Z, 2,3,4, 8,9,10, 14);
+  const __m128i m2 = _mm_setr_epi8 (15,Z,Z, Z,Z,Z, Z,Z,Z, Z,Z,Z, Z,Z,Z, Z);
+  const __m128i m3 = _mm_setr_epi8 (Z,0, 4,5,6, 10,11,12, Z,Z,Z, Z,Z,Z, Z,Z);
+  __m128i s[7], t[6];
+
+  for (int i=0; i<num_blocks; i++, row0+=48, row1+=48, dst+=24) {
+    // Vertical sums
+    for (int j=0; j<3; j++) {
+      __m128i a = _mm_loadu_si128 ((__m128i *)(row0 + 16 * j));
+      __m128i b = _mm_loadu_si128 ((__m128i *)(row1 + 16 * j));
+      s[2*j]   = _mm_add_epi16 (_mm_unpacklo_epi8 (a, zero), _mm_unpacklo_epi8 (b, zero));
+      s[2*j+1] = _mm_add_epi16 (_mm_unpackhi_epi8 (a, zero), _mm_unpackhi_epi8 (b, zero));
+    }
+    s[6] = zero;
+    // Add the next pixel's sums and divide by 4 (rounded)
+    for (int j=0; j<6; j++) {
+      t[j] = _mm_add_epi16 (s[j], _mm_alignr_epi8 (s[j+1], s[j], 6));
+      t[j] = _mm_srli_epi16 (_mm_add_epi16 (t[j], two), 2);
+    }
+    __m128i p0 = _mm_packus_epi16 (t[0], t[1]);
+    __m128i p1 = _mm_packus_epi16 (t[2], t[3]);
+    __m128i p2 = _mm_packus_epi16 (t[4], t[5]);
+    // Keep the even pixels
+    _mm_storeu_si128 ((__m128i *)dst, _mm_or_si128 (_mm_shuffle_epi8 (p0, m0), _mm_shuffle_epi8 (p1, m1)));
+    _mm_storel_epi64 ((__m128i *)(dst + 16), _mm_or_si128 (_mm_shuffle_epi8 (p1, m2), _mm_shuffle_epi8 (p2, m3)));
+  }
+}
+#endif
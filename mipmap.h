@@ -0,0 +1,20 @@
+/*____________________________________________________________________
+|
+| File: mipmap.h
+|___________________________________________________________________*/
+
+#define MIP_MAX_LEVELS 16   // enough for a 32768 x 32768 image
+
+// One level of a mip chain (tightly packed RGB rows)
+struct MipLevel {
+  int            width, height;
+  unsigned char *data;
+};
+
+// Builds the mip chain of an RGB image down to 1x1, returns the # of levels.
+//  levels[0] is the image itself, the others are created (free them with Mipmap_Free)
+int  Mipmap_Build (unsigned char *rgb, int width, int height, MipLevel levels[MIP_MAX_LEVELS]);
+// Frees the levels created by Mipmap_Build() (not levels[0])
+void Mipmap_Free (MipLevel levels[MIP_MAX_LEVELS]);
+// Halves an RGB image with a 2x2 box filter.  dst is max(1,width/2) x max(1,height/2)
+void Mipmap_Downsample (unsigned char *src, int width, int height, unsigned char *dst);
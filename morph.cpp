@@ -0,0 +1,270 @@
+/*____________________________________________________________________
+|
+| File: morph.cpp
+|
+| Description: Morph target blending.  The base pose and each target's
+|   differences from it are stored as interleaved positions and
+|   normals, so blending an instance is one pass down a few parallel
+|   arrays: out = base + w1*delta1 + w2*delta2 + ..., 4 floats at a
+|   time with SSE.  Targets an instance gives no weight are skipped.
+|   The normals are blended the same way and left unnormalized (they
+|   are drawn with GL_NORMALIZE).
+|
+|   Each instance is split into chunks of MORPH_FLOATS_PER_JOB floats,
+|   and the chunks of all the instances are spread over the job system
+|   (see job.h), several small instances to a job.
+|
+| Functions: Morph_Matches
+|            Morph_Build
+|            Morph_InstanceBytes
+|            Morph_Blend
+|            Morph_Name
+|            BlendJob
+|            BlendRange
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "math3d.h"
+#include "memtrack.h"
+#include "cpu.h"
+#include "job.h"
+#include "trace.h"
+#include "morph.h"
+
+#ifdef CPU_X86
+#include <xmmintrin.h>    // SSE
+#endif
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define MORPH_FLOATS_PER_JOB 16384    // floats blended by one job (a multiple of 4)
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct BlendWork {
+  MorphTargets *morph;
+  float        *weights;
+  float        *out;
+  int           floats;           // per instance
+  int           chunks;           // per instance
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void BlendJob (void *data, int begin, int end);
+static void BlendRange (float *base, float **delta, float *weight, int n, float *out, int first, int last);
+
+/*____________________________________________________________________
+|
+| Function: Morph_Matches
+|
+| Output: Returns true if target has the same # of vertices and the
+|   same polygons as object.
+|___________________________________________________________________*/
+
+bool Morph_Matches (Object3D *object, Object3D *target)
+{
+  return target->num_vertices == object->num_vertices AND
+         target->num_polygons == object->num_polygons AND
+         memcmp (target->polygon, object->polygon, object->num_polygons * sizeof(Polygon3D)) == 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Morph_Build
+|
+| Output: Creates an object's morph targets from other poses of it, in
+|   one block.  Returns false if out of memory.
+|___________________________________________________________________*/
+
+bool Morph_Build (Object3D *object, Object3D **targets, int num_targets)
+{
+  int i, k;
+  float longest[MORPH_MAX_TARGETS] = {0};
+  size_t header = (sizeof(MorphTargets) + MEM_ALIGNMENT - 1) & ~(size_t)(MEM_ALIGNMENT - 1);
+  size_t floats = ((size_t)object->num_vertices * MORPH_FLOATS + 3) & ~(size_t)3;
+  size_t bytes;
+
+  TraceScope trace("Morph_Build");
+
+  num_targets = std::min (num_targets, MORPH_MAX_TARGETS);
+  bytes = header + (num_targets + 1) * floats * sizeof(float);
+  MorphTargets *morph = (MorphTargets *) Mem_Calloc (MEM_MESH, bytes);
+  if (morph == 0)
+    return false;
+  morph->num_targets  = num_targets;
+  morph->num_vertices = object->num_vertices;
+  morph->bytes        = bytes;
+  morph->base         = (float *)((char *)morph + header);
+  for (k=0; k<num_targets; k++)
+    morph->delta[k] = morph->base + (k + 1) * floats;
+
+  for (i=0; i<object->num_vertices; i++) {
+    float *b = morph->base + i * MORPH_FLOATS;
+    b[0] = object->vertex[i].x;
+    b[1] = object->vertex[i].y;
+    b[2] = object->vertex[i].z;
+    b[3] = object->vertex_normal[i].x;
+    b[4] = object->vertex_normal[i].y;
+    b[5] = object->vertex_normal[i].z;
+    for (k=0; k<num_targets; k++) {
+      float *d = morph->delta[k] + i * MORPH_FLOATS;
+      d[0] = targets[k]->vertex[i].x - b[0];
+      d[1] = targets[k]->vertex[i].y - b[1];
+      d[2] = targets[k]->vertex[i].z - b[2];
+      d[3] = targets[k]->vertex_normal[i].x - b[3];
+      d[4] = targets[k]->vertex_normal[i].y - b[4];
+      d[5] = targets[k]->vertex_normal[i].z - b[5];
+      longest[k] = std::max (longest[k], d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+    }
+  }
+  // Each target at full weight moves a vertex at most its longest difference
+  for (k=0; k<num_targets; k++)
+    morph->reach += sqrtf (longest[k]);
+
+  Mem_Free (object->morph);
+  object->morph = morph;
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Morph_InstanceBytes
+|
+| Output: Returns the # of bytes one blended instance of an object
+|   takes.
+|___________________________________________________________________*/
+
+size_t Morph_InstanceBytes (Object3D *object)
+{
+  return object->num_vertices * MORPH_STRIDE;
+}
+
+/*____________________________________________________________________
+|
+| Function: Morph_Blend
+|
+| Output: Blends num_instances poses of an object into out, each with
+|   its own num_targets weights.
+|___________________________________________________________________*/
+
+void Morph_Blend (Object3D *object, int num_instances, float *weights, float *out)
+{
+  BlendWork work;
+
+  if (object->morph == 0 OR num_instances <= 0)
+    return;
+
+  TraceScope trace("Morph_Blend");
+
+  work.morph   = object->morph;
+  work.weights = weights;
+  work.out     = out;
+  work.floats  = object->num_vertices * MORPH_FLOATS;
+  work.chunks  = (work.floats + MORPH_FLOATS_PER_JOB - 1) / MORPH_FLOATS_PER_JOB;
+  // A job takes whole small instances, or one chunk of a large one
+  int grain = work.chunks > 1 ? 1 : std::max (1, MORPH_FLOATS_PER_JOB / std::max (work.floats, 1));
+  Job_ParallelFor (num_instances * work.chunks, grain, BlendJob, &work);
+}
+
+/*____________________________________________________________________
+|
+| Function: Morph_Name
+|
+| Output: Sets filename to the OBJ name with _morph<target> added
+|   before its extension.
+|___________________________________________________________________*/
+
+void Morph_Name (char *obj_filename, int target, char *filename, int size)
+{
+  const char *dot = strrchr (obj_filename, '.');
+  const char *slash = strpbrk (dot ? dot : obj_filename, "/\\");
+  int len = (dot AND slash == 0) ? (int)(dot - obj_filename) : (int)strlen(obj_filename);
+
+  snprintf (filename, size, "%.*s_morph%d%s", len, obj_filename, target, obj_filename + len);
+}
+
+/*____________________________________________________________________
+|
+| Function: BlendJob
+|
+| Output: Blends chunks begin up to (not including) end of a
+|   Morph_Blend() job.
+|___________________________________________________________________*/
+
+static void BlendJob (void *data, int begin, int end)
+{
+  BlendWork *work = (BlendWork *) data;
+  MorphTargets *morph = work->morph;
+  float *delta[MORPH_MAX_TARGETS], weight[MORPH_MAX_TARGETS];
+
+  for (int j=begin; j<end; j++) {
+    int instance = j / work->chunks;
+    int first = (j % work->chunks) * MORPH_FLOATS_PER_JOB;
+    int last = std::min (work->floats, first + MORPH_FLOATS_PER_JOB);
+    // Only the targets this instance uses
+    float *w = work->weights + instance * morph->num_targets;
+    int n = 0;
+    for (int k=0; k<morph->num_targets; k++)
+      if (w[k] != 0) {
+        delta[n]  = morph->delta[k];
+        weight[n] = w[k];
+        n++;
+      }
+    BlendRange (morph->base, delta, weight, n, work->out + (size_t)instance * work->floats, first, last);
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: BlendRange
+|
+| Output: Sets out[first] up to (not including) out[last] to the base
+|   plus the weighted differences of n targets.  first is a multiple
+|   of 4 (so the base and differences are read aligned).
+|___________________________________________________________________*/
+
+static void BlendRange (float *base, float **delta, float *weight, int n, float *out, int first, int last)
+{
+  int i = first, k;
+
+#ifdef CPU_X86
+  __m128 w[MORPH_MAX_TARGETS];
+  for (k=0; k<n; k++)
+    w[k] = _mm_set1_ps (weight[k]);
+  for (; i+4<=last; i+=4) {
+    __m128 v = _mm_load_ps (base + i);
+    for (k=0; k<n; k++)
+      v = _mm_add_ps (v, _mm_mul_ps (w[k], _mm_load_ps (delta[k] + i)));
+    _mm_storeu_ps (out + i, v);     // an instance may start on any 8 bytes
+  }
+#endif
+  for (; i<last; i++) {
+    float v = base[i];
+    for (k=0; k<n; k++)
+      v += weight[k] * delta[k][i];
+    out[i] = v;
+  }
+}
@@ -0,0 +1,40 @@
+/*____________________________________________________________________
+|
+| File: morph.h
+|
+| Morph targets: other poses of a mesh (read from OBJ files with the
+| same vertices and polygons, <name>_morph0.obj, <name>_morph1.obj,
+| ...) kept as differences from its own pose.  Each instance drawn
+| blends them with its own weights into interleaved positions and
+| normals, written straight into a vertex buffer (see streambuf.h).
+|___________________________________________________________________*/
+
+#define MORPH_MAX_TARGETS 8         // most targets a mesh can have
+#define MORPH_FLOATS      6         // floats per blended vertex (position, then normal)
+#define MORPH_STRIDE      (MORPH_FLOATS * sizeof(float))
+
+// Block header, followed by the base pose and each target's differences from it (each
+//  num_vertices*MORPH_FLOATS floats, padded to a multiple of 4)
+struct MorphTargets {
+  int    num_targets;
+  int    num_vertices;
+  size_t bytes;                       // size of the block
+  float  reach;                       // farthest a vertex can get from the base pose with weights from 0 to 1
+  float *base;                        // position and normal of each vertex, interleaved
+  float *delta[MORPH_MAX_TARGETS];    // a target's positions and normals less the base's
+};
+
+// Returns true if target has the same vertex count and polygons as object
+bool   Morph_Matches (Object3D *object, Object3D *target);
+// Creates an object's morph targets from other poses of it (which must match it, see
+//  Morph_Matches).  Call before Meshlet_Build (which reorders the polygons).  Returns false if
+//  out of memory
+bool   Morph_Build (Object3D *object, Object3D **targets, int num_targets);
+// Returns the # of bytes an instance blends to (num_vertices*MORPH_STRIDE)
+size_t Morph_InstanceBytes (Object3D *object);
+// Blends num_instances poses of an object: instance i's vertices are its base pose plus each
+//  target's differences times weights[i*num_targets+target], written to out+i*num_vertices*
+//  MORPH_FLOATS.  Large batches are split into jobs
+void   Morph_Blend (Object3D *object, int num_instances, float *weights, float *out);
+// Returns the file name of an OBJ file's morph target (0 and up)
+void   Morph_Name (char *obj_filename, int target, char *filename, int size);
@@ -0,0 +1,595 @@
+/*____________________________________________________________________
+|
+| File: pack.cpp
+|
+| Description: Asset packs.  A pack is mapped once when mounted; after
+|   that opening a file in it is a hash table lookup, with no file
+|   system calls at all.  A file stored as is comes straight from the
+|   mapping (the OS pages it in when it's first touched), a compressed
+|   one is decompressed into a buffer.  Files not in any pack are
+|   mapped from disk, so callers read both the same way.
+|
+|   Layout: header, entries, hash table, names, then each file's data
+|   on a PACK_ALIGNMENT boundary.
+|
+| Functions: Pack_Mount
+|            Pack_UnmountAll
+|            Pack_Find
+|            Pack_Contains
+|            Pack_MapFile
+|            Pack_FileInfo
+|            Pack_ReadFile
+|            Pack_CloseFile
+|            Pack_Write
+|            Pack_Hash
+|            FindEntry
+|            MapFile
+|            UnmapFile
+|            CheckPack
+|            SameName
+|            IsCookedTexture
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "math3d.h"
+#include "memtrack.h"
+#include "lzblock.h"
+#include "trace.h"
+#include "pack.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+// A mounted pack
+struct Pack {
+  std::string    filename;
+  unsigned char *base;
+  size_t         size;
+  PackHeader    *header;
+  PackEntry     *entries;
+  unsigned      *buckets;
+  char          *names;
+  void          *handles[2];    // Windows file and mapping
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static PackEntry *FindEntry (const char *name, Pack **pack);
+static unsigned char *MapFile (const char *filename, size_t *size, void *handles[2]);
+static void UnmapFile (unsigned char *base, size_t size, void *handles[2]);
+static bool CheckPack (Pack *p);
+static bool SameName (const char *name, const char *packed, unsigned length);
+static bool IsCookedTexture (const char *name);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static std::vector<Pack> packs;   // searched from the last mounted
+
+/*____________________________________________________________________
+|
+| Function: Pack_Mount
+|
+| Output: Maps a pack and checks its table of contents.  Returns true
+|   on success.
+|___________________________________________________________________*/
+
+bool Pack_Mount (const char *filename)
+{
+  Pack p;
+
+  p.filename = filename;
+  p.base = MapFile (filename, &p.size, p.handles);
+  if (p.base == 0) {
+    printf ("%s: could not open the pack\n", filename);
+    return false;
+  }
+  if (NOT CheckPack(&p)) {
+    printf ("%s: not a valid pack\n", filename);
+    UnmapFile (p.base, p.size, p.handles);
+    return false;
+  }
+  packs.push_back (p);
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Pack_UnmountAll
+|
+| Output: Unmaps every mounted pack.
+|___________________________________________________________________*/
+
+void Pack_UnmountAll ()
+{
+  for (size_t i=0; i<packs.size(); i++)
+    UnmapFile (packs[i].base, packs[i].size, packs[i].handles);
+  packs.clear ();
+}
+
+/*____________________________________________________________________
+|
+| Function: Pack_Find
+|
+| Output: Looks a file up in the mounted packs, the last mounted first.
+|   Sets f to its data (decompressing it if needed).  Returns true if
+|   found (and, if compressed, it decompressed correctly).
+|___________________________________________________________________*/
+
+bool Pack_Find (const char *name, PackFile *f)
+{
+  Pack *p;
+
+  memset (f, 0, sizeof(PackFile));
+  PackEntry *e = FindEntry (name, &p);
+  if (e == 0)
+    return false;
+
+  if (e->compression == PACK_STORED) {
+    f->data = p->base + e->offset;
+    f->size = e->size;
+    f->in_pack = true;
+    return true;
+  }
+  TraceScope trace("Pack decompress");
+  f->buffer = (unsigned char *) Mem_Alloc (MEM_LOADER, e->original_size ? e->original_size : 1);
+  if (f->buffer AND LZ_Decompress(p->base + e->offset, e->size, f->buffer, e->original_size)) {
+    f->data = f->buffer;
+    f->size = e->original_size;
+    return true;
+  }
+  printf ("%s: corrupt in pack %s\n", name, p->filename.c_str());
+  Pack_CloseFile (f);
+  return false;
+}
+
+/*____________________________________________________________________
+|
+| Function: Pack_Contains
+|
+| Output: Returns true if a file is in a mounted pack (without reading
+|   it).
+|___________________________________________________________________*/
+
+bool Pack_Contains (const char *name)
+{
+  Pack *p;
+
+  return FindEntry (name, &p) != 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Pack_MapFile
+|
+| Output: Maps a loose file.  Returns true on success.
+|___________________________________________________________________*/
+
+bool Pack_MapFile (const char *filename, PackFile *f)
+{
+  void *handles[2];
+
+  memset (f, 0, sizeof(PackFile));
+  f->mapping = MapFile (filename, &f->size, handles);
+  if (f->mapping == 0)
+    return false;
+  f->data = f->mapping;
+#ifdef _WIN32
+  f->file = handles[0];
+  f->map  = handles[1];
+#endif
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Pack_FileInfo
+|
+| Output: Gets a loose file's size and modification time, to the
+|   finest the file system keeps it: nanoseconds since 1970, or 100 ns
+|   ticks since 1601 on Windows (a file saved twice in a second has two
+|   times).  Returns true on success.
+|___________________________________________________________________*/
+
+bool Pack_FileInfo (const char *filename, unsigned long long *size, unsigned long long *time)
+{
+  *size = 0;
+  *time = 0;
+#ifdef _WIN32
+  WIN32_FILE_ATTRIBUTE_DATA info;
+  if (NOT GetFileAttributesExA (filename, GetFileExInfoStandard, &info))
+    return false;
+  *size = ((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+  *time = ((unsigned long long)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+#else
+  struct stat st;
+  if (stat(filename, &st) != 0)
+    return false;
+  *size = (unsigned long long) st.st_size;
+#ifdef __APPLE__
+  *time = (unsigned long long) st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+  *time = (unsigned long long) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Pack_ReadFile
+|
+| Output: Gets a file from the mounted packs, or from disk.  Returns
+|   true on success.
+|___________________________________________________________________*/
+
+bool Pack_ReadFile (const char *name, PackFile *f)
+{
+  TraceScope trace("Pack_ReadFile");
+
+  return Pack_Find(name, f) OR Pack_MapFile(name, f);
+}
+
+/*____________________________________________________________________
+|
+| Function: Pack_CloseFile
+|
+| Output: Frees or unmaps a file's data, if it has its own.
+|___________________________________________________________________*/
+
+void Pack_CloseFile (PackFile *f)
+{
+  void *handles[2] = { 0, 0 };
+
+  if (f->buffer)
+    Mem_Free (f->buffer);
+  if (f->mapping) {
+#ifdef _WIN32
+    handles[0] = f->file;
+    handles[1] = f->map;
+#endif
+    UnmapFile (f->mapping, f->size, handles);
+  }
+  memset (f, 0, sizeof(PackFile));
+}
+
+/*____________________________________________________________________
+|
+| Function: Pack_Write
+|
+| Output: Writes a pack holding the files in paths (read with
+|   Pack_ReadFile, so they can come from other packs), each named by its
+|   path.  Returns true on success.
+|___________________________________________________________________*/
+
+bool Pack_Write (const char *filename, char **paths, int num, bool compress)
+{
+  static const unsigned char zeros[PACK_ALIGNMENT] = { 0 };
+  PackHeader header;
+  std::vector<PackEntry> entries (num);
+  std::vector<unsigned> buckets;
+  std::string names;
+  size_t total_size = 0, packed_size = 0;
+  int i, num_compressed = 0;
+
+  // Lay out the table of contents, with a hash table at most half full
+  unsigned num_buckets = 1;
+  while (num_buckets < 2 * (unsigned)num)
+    num_buckets *= 2;
+  buckets.assign (num_buckets, 0);
+  for (i=0; i<num; i++) {
+    std::string name = paths[i];
+    for (size_t c=0; c<name.size(); c++)
+      if (name[c] == '\\')
+        name[c] = '/';
+    PackEntry *e = &entries[i];
+    memset (e, 0, sizeof(PackEntry));
+    e->hash = Pack_Hash (name.c_str(), name.size());
+    e->name_offset = (unsigned) names.size ();
+    e->name_length = (unsigned) name.size ();
+    names += name;
+    unsigned b = e->hash & (num_buckets - 1);
+    while (buckets[b])
+      b = (b + 1) & (num_buckets - 1);
+    buckets[b] = i + 1;
+  }
+  memset (&header, 0, sizeof(header));
+  memcpy (header.magic, PACK_MAGIC, 4);
+  header.version        = PACK_VERSION;
+  header.endianness     = PACK_ENDIANNESS;
+  header.num_entries    = num;
+  header.num_buckets    = num_buckets;
+  header.entries_offset = sizeof(PackHeader);
+  header.buckets_offset = header.entries_offset + num * sizeof(PackEntry);
+  header.names_offset   = header.buckets_offset + num_buckets * sizeof(unsigned);
+  header.names_size     = (unsigned) names.size ();
+  unsigned long long offset = header.names_offset + header.names_size;
+
+  FILE *fp = fopen (filename, "wb");
+  if (fp == 0) {
+    printf ("%s: could not write the pack\n", filename);
+    return false;
+  }
+
+  // The files, each on an aligned offset after the table of contents
+  bool ok = true;
+  fseek (fp, (long) offset, SEEK_SET);
+  for (i=0; ok AND i<num; i++) {
+    PackEntry *e = &entries[i];
+    PackFile f;
+    if (NOT Pack_ReadFile(paths[i], &f)) {
+      printf ("%s: could not read\n", paths[i]);
+      ok = false;
+      break;
+    }
+
+    // Compress it if that saves at least 1/8
+    const unsigned char *data = f.data;
+    size_t size = f.size;
+    unsigned char *lz = 0;
+    if (compress AND NOT IsCookedTexture(paths[i]) AND size >= 64) {
+      size_t capacity = size - size / 8;
+      lz = (unsigned char *) Mem_Alloc (MEM_LOADER, capacity);
+      size_t n = lz ? LZ_Compress (f.data, f.size, lz, capacity) : 0;
+      if (n) {
+        data = lz;
+        size = n;
+        e->compression = PACK_LZ4;
+        num_compressed++;
+      }
+    }
+
+    unsigned long long padding = (PACK_ALIGNMENT - offset % PACK_ALIGNMENT) % PACK_ALIGNMENT;
+    offset += padding;
+    e->offset = (unsigned) offset;
+    e->size = (unsigned) size;
+    e->original_size = (unsigned) f.size;
+    if (offset + size > 0xFFFFFFFFull OR f.size > 0xFFFFFFFFull) {
+      printf ("%s: a pack can't be larger than 4 GB\n", filename);
+      ok = false;
+    }
+    else
+      ok = fwrite(zeros, 1, (size_t)padding, fp) == padding AND fwrite(data, 1, size, fp) == size;
+    offset += size;
+    total_size += f.size;
+    packed_size += size;
+    if (lz)
+      Mem_Free (lz);
+    Pack_CloseFile (&f);
+  }
+
+  // Then go back and write the table of contents
+  if (ok) {
+    fseek (fp, 0, SEEK_SET);
+    ok = fwrite(&header, sizeof(header), 1, fp) == 1 AND
+         (num == 0 OR fwrite(entries.data(), sizeof(PackEntry), num, fp) == (size_t)num) AND
+         fwrite(buckets.data(), sizeof(unsigned), num_buckets, fp) == num_buckets AND
+         fwrite(names.data(), 1, names.size(), fp) == names.size();
+  }
+  ok = (fclose(fp) == 0) AND ok;
+  if (NOT ok) {
+    printf ("%s: could not write the pack\n", filename);
+    remove (filename);
+    return false;
+  }
+  printf ("%s: %d files (%d compressed), %zu bytes packed to %zu, %llu byte pack\n",
+          filename, num, num_compressed, total_size, packed_size, offset);
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Pack_Hash
+|
+| Output: Returns the 32-bit FNV-1a hash of a name, reading \ as / so
+|   either separator finds the same file.
+|___________________________________________________________________*/
+
+unsigned Pack_Hash (const char *name, size_t length)
+{
+  unsigned hash = 2166136261u;
+
+  for (size_t i=0; i<length; i++) {
+    unsigned char c = name[i] == '\\' ? '/' : name[i];
+    hash = (hash ^ c) * 16777619u;
+  }
+  return hash;
+}
+
+/*____________________________________________________________________
+|
+| Function: FindEntry
+|
+| Output: Looks a file up in the mounted packs, the last mounted first.
+|   Returns its entry and sets pack to the pack it's in, or returns 0.
+|___________________________________________________________________*/
+
+static PackEntry *FindEntry (const char *name, Pack **pack)
+{
+  unsigned hash = Pack_Hash (name, strlen(name));
+
+  for (size_t i=packs.size(); i-- > 0; ) {
+    Pack *p = &packs[i];
+    unsigned mask = p->header->num_buckets - 1;
+    // Linear probing, up to the first empty bucket
+    for (unsigned b=hash & mask, probes=0; probes<=mask AND p->buckets[b]; b=(b+1) & mask, probes++) {
+      PackEntry *e = &p->entries[p->buckets[b] - 1];
+      if (e->hash == hash AND SameName(name, p->names + e->name_offset, e->name_length)) {
+        *pack = p;
+        return e;
+      }
+    }
+  }
+  return 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: MapFile
+|
+| Output: Maps a whole file read-only.  Returns its data, or 0 if it
+|   can't be mapped (or is empty).
+|___________________________________________________________________*/
+
+static unsigned char *MapFile (const char *filename, size_t *size, void *handles[2])
+{
+  *size = 0;
+  handles[0] = handles[1] = 0;
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA (filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+  if (file == INVALID_HANDLE_VALUE)
+    return 0;
+  LARGE_INTEGER file_size;
+  HANDLE mapping = 0;
+  void *base = 0;
+  if (GetFileSizeEx(file, &file_size) AND file_size.QuadPart > 0)
+    mapping = CreateFileMappingA (file, 0, PAGE_READONLY, 0, 0, 0);
+  if (mapping)
+    base = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+  if (base == 0) {
+    if (mapping)
+      CloseHandle (mapping);
+    CloseHandle (file);
+    return 0;
+  }
+  handles[0] = file;
+  handles[1] = mapping;
+  *size = (size_t) file_size.QuadPart;
+#else
+  int fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  struct stat st;
+  void *base = MAP_FAILED;
+  if (fstat(fd, &st) == 0 AND st.st_size > 0)
+    base = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);   // the mapping keeps the file open
+  if (base == MAP_FAILED)
+    return 0;
+  *size = st.st_size;
+#endif
+  return (unsigned char *) base;
+}
+
+/*____________________________________________________________________
+|
+| Function: UnmapFile
+|
+| Output: Unmaps a file mapped by MapFile().
+|___________________________________________________________________*/
+
+static void UnmapFile (unsigned char *base, size_t size, void *handles[2])
+{
+#ifdef _WIN32
+  (void)size;
+  UnmapViewOfFile (base);
+  CloseHandle ((HANDLE)handles[1]);
+  CloseHandle ((HANDLE)handles[0]);
+#else
+  (void)handles;
+  munmap (base, size);
+#endif
+}
+
+/*____________________________________________________________________
+|
+| Function: CheckPack
+|
+| Output: Checks a mapped pack's header and that its table of contents
+|   and every file are inside it, and sets the pointers to its tables.
+|   Returns true if it's valid.
+|___________________________________________________________________*/
+
+static bool CheckPack (Pack *p)
+{
+  PackHeader *h = (PackHeader *) p->base;
+
+  if (p->size < sizeof(PackHeader) OR memcmp(h->magic, PACK_MAGIC, 4) != 0 OR
+      h->version != PACK_VERSION OR h->endianness != PACK_ENDIANNESS)
+    return false;
+  if (h->num_buckets == 0 OR (h->num_buckets & (h->num_buckets - 1)) OR h->num_buckets < h->num_entries OR
+      h->entries_offset + (unsigned long long)h->num_entries * sizeof(PackEntry) > p->size OR
+      h->buckets_offset + (unsigned long long)h->num_buckets * sizeof(unsigned) > p->size OR
+      (unsigned long long)h->names_offset + h->names_size > p->size OR
+      h->entries_offset % 4 OR h->buckets_offset % 4)
+    return false;
+
+  p->header  = h;
+  p->entries = (PackEntry *) (p->base + h->entries_offset);
+  p->buckets = (unsigned *) (p->base + h->buckets_offset);
+  p->names   = (char *) (p->base + h->names_offset);
+  for (unsigned i=0; i<h->num_entries; i++) {
+    PackEntry *e = &p->entries[i];
+    if ((unsigned long long)e->name_offset + e->name_length > h->names_size OR
+        (unsigned long long)e->offset + e->size > p->size OR
+        (e->compression != PACK_STORED AND e->compression != PACK_LZ4) OR
+        (e->compression == PACK_STORED AND e->size != e->original_size))
+      return false;
+  }
+  for (unsigned b=0; b<h->num_buckets; b++)
+    if (p->buckets[b] > h->num_entries)
+      return false;
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: SameName
+|
+| Output: Returns true if a name matches a name in a pack (reading \ as
+|   /).
+|___________________________________________________________________*/
+
+static bool SameName (const char *name, const char *packed, unsigned length)
+{
+  unsigned i;
+
+  for (i=0; i<length AND name[i]; i++)
+    if (name[i] != packed[i] AND NOT (name[i] == '\\' AND packed[i] == '/'))
+      return false;
+  return i == length AND name[i] == 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: IsCookedTexture
+|
+| Output: Returns true if a file is a cooked texture (see texfile.h),
+|   which is used in place and so shouldn't be compressed.
+|___________________________________________________________________*/
+
+static bool IsCookedTexture (const char *name)
+{
+  size_t length = strlen (name);
+  return length >= 4 AND strcmp(name + length - 4, ".ktc") == 0;
+}
@@ -0,0 +1,79 @@
+/*____________________________________________________________________
+|
+| File: pack.h
+|
+| Asset packs (.kpk): many files in one, found by name through a hash
+| table.  Each file starts on a page boundary, so a file stored as is
+| can be used straight from the mapped pack.  Files can also be stored
+| LZ4 compressed (see lzblock.h).
+|___________________________________________________________________*/
+
+#define PACK_MAGIC          "KPK1"
+#define PACK_VERSION        1
+#define PACK_ENDIANNESS     0x04030201
+#define PACK_ALIGNMENT      4096          // each file starts on a multiple of this (a page)
+
+enum PackCompression { PACK_STORED, PACK_LZ4 };
+
+// File header (all fields are little endian 32-bit words), followed by the table of contents
+struct PackHeader {
+  char     magic[4];          // PACK_MAGIC
+  unsigned version;           // PACK_VERSION
+  unsigned endianness;        // PACK_ENDIANNESS
+  unsigned num_entries;
+  unsigned num_buckets;       // size of the hash table (a power of 2)
+  unsigned entries_offset;    // PackEntry[num_entries]
+  unsigned buckets_offset;    // unsigned[num_buckets]: entry index + 1, 0 = empty
+  unsigned names_offset;      // the names, one after the other (not 0 terminated)
+  unsigned names_size;
+  unsigned reserved[7];
+};
+
+// One file in the pack
+struct PackEntry {
+  unsigned hash;              // of the name (see Pack_Hash)
+  unsigned name_offset;       // from names_offset
+  unsigned name_length;
+  unsigned compression;       // PackCompression
+  unsigned offset;            // from the start of the pack
+  unsigned size;              // in the pack
+  unsigned original_size;     // once decompressed
+  unsigned reserved;
+};
+
+// A file's contents, from a pack or from disk
+struct PackFile {
+  const unsigned char *data;
+  size_t         size;
+  bool           in_pack;     // data is in a mounted pack (nothing to free)
+  unsigned char *buffer;      // decompressed copy
+  unsigned char *mapping;     // mapped loose file
+#ifdef _WIN32
+  void          *file, *map;
+#endif
+};
+
+// Maps a pack so its files are found by Pack_Find() and Pack_ReadFile(), ahead of packs
+//  mounted before it.  Mount packs before any thread starts reading.  Returns true on success
+bool Pack_Mount (const char *filename);
+// Unmounts every pack (no file from them may be in use)
+void Pack_UnmountAll ();
+// Finds a file in the mounted packs.  Returns true if found
+bool Pack_Find (const char *name, PackFile *f);
+// Returns true if a file is in a mounted pack
+bool Pack_Contains (const char *name);
+// Maps a file on disk (ignoring the packs).  Returns true on success
+bool Pack_MapFile (const char *filename, PackFile *f);
+// Gets the size and modification time of a file on disk, in the file system's finest units
+//  (nanoseconds, or 100 ns ticks on Windows).  Returns true on success
+bool Pack_FileInfo (const char *filename, unsigned long long *size, unsigned long long *time);
+// Reads a file from the mounted packs or, if none has it, from disk.  Stored files are used in
+//  place; compressed ones are decompressed.  Safe to call from several threads.  Returns true on success
+bool Pack_ReadFile (const char *name, PackFile *f);
+// Releases a file read by Pack_Find() or Pack_ReadFile()
+void Pack_CloseFile (PackFile *f);
+// Writes the files to a new pack, LZ4 compressing those that shrink enough if compress is
+//  set (cooked textures are always stored, to be used in place).  Returns true on success
+bool Pack_Write (const char *filename, char **paths, int num, bool compress);
+// Hashes a file name (32-bit FNV-1a, with \ read as /)
+unsigned Pack_Hash (const char *name, size_t length);
@@ -0,0 +1,350 @@
+/*____________________________________________________________________
+|
+| File: profiler.cpp
+|
+| Description: Named CPU and GPU timers with rolling statistics.  Each
+|   timer keeps its last PROFILE_WINDOW samples, from which min, avg,
+|   99th percentile and max are computed when exporting.  GPU times use
+|   GL_TIME_ELAPSED queries, read back a few frames later so the CPU
+|   never waits on the GPU.
+|
+| Functions: Profile_Register
+|            Profile_Name
+|            Profile_Now
+|            Profile_PeakMemory
+|            Profile_AddSample
+|            Profile_GPUBegin
+|            Profile_GPUEnd
+|            Profile_EndFrame
+|            Profile_WriteCSV
+|            Profile_Shutdown
+|            Stats_Add
+|            Stats_Write
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+#include <GL/glut.h>
+#include "math3d.h"
+#include "glproc.h"
+#include "trace.h"
+#include "profiler.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define GPU_QUERIES_IN_FLIGHT 4   // per timer
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct ProfileStats {
+  double samples[PROFILE_WINDOW];   // ring buffer of the most recent samples (ms)
+  int    num_samples;               // # valid samples in the ring buffer
+  int    next;                      // where the next sample goes
+  long long count;                  // total # of samples ever added
+};
+
+struct ProfileTimer {
+  const char   *name;
+  ProfileStats  cpu;
+  ProfileStats  gpu;
+  GLuint        queries[GPU_QUERIES_IN_FLIGHT];
+  bool          pending[GPU_QUERIES_IN_FLIGHT];   // query issued, result not collected yet
+  int           next_query;
+  int           active_query;                     // query currently running, or -1
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Stats_Add (ProfileStats *stats, double ms);
+static void Stats_Write (FILE *fp, const char *name, const char *type, ProfileStats *stats);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static ProfileTimer timers[PROFILE_MAX_TIMERS];
+static int num_timers = 0;
+static bool queries_created = false;
+
+/*____________________________________________________________________
+|
+| Function: Profile_Register
+|
+| Output: Returns the id of the named timer, creating it if needed.
+|   name must stay valid for the life of the program (e.g. a literal).
+|___________________________________________________________________*/
+
+int Profile_Register (const char *name)
+{
+  int i;
+
+  for (i=0; i<num_timers; i++)
+    if (strcmp(timers[i].name, name) == 0)
+      return i;
+
+  // Out of timers?  (should never happen) - share the last one
+  if (num_timers == PROFILE_MAX_TIMERS)
+    return PROFILE_MAX_TIMERS-1;
+
+  memset (&timers[num_timers], 0, sizeof(ProfileTimer));
+  timers[num_timers].name = name;
+  timers[num_timers].active_query = -1;
+  return num_timers++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Profile_Name
+|
+| Output: Returns the name of a timer.
+|___________________________________________________________________*/
+
+const char *Profile_Name (int id)
+{
+  return timers[id].name;
+}
+
+/*____________________________________________________________________
+|
+| Function: Profile_Now
+|
+| Output: Returns a high resolution monotonic CPU time in nanoseconds.
+|___________________________________________________________________*/
+
+long long Profile_Now ()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*____________________________________________________________________
+|
+| Function: Profile_PeakMemory
+|
+| Output: Returns the process' peak resident memory (working set on
+|   Windows) in bytes, or 0 if it can't be read.
+|___________________________________________________________________*/
+
+size_t Profile_PeakMemory ()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (NOT GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    return 0;
+  return pmc.PeakWorkingSetSize;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return (size_t)usage.ru_maxrss;             // bytes
+#else
+  return (size_t)usage.ru_maxrss * 1024;      // KB
+#endif
+#endif
+}
+
+/*____________________________________________________________________
+|
+| Function: Profile_AddSample
+|
+| Output: Adds a CPU time sample to a timer.
+|___________________________________________________________________*/
+
+void Profile_AddSample (int id, double ms)
+{
+  Stats_Add (&timers[id].cpu, ms);
+}
+
+/*____________________________________________________________________
+|
+| Function: Profile_GPUBegin
+|
+| Output: Starts a GPU timer query for the timer.  Skips this sample if
+|   all of the timer's queries are still waiting for results.
+|___________________________________________________________________*/
+
+void Profile_GPUBegin (int id)
+{
+  ProfileTimer *timer = &timers[id];
+
+  if (NOT glproc_timer_query)
+    return;
+
+  // Create this timer's query objects the first time through
+  if (timer->queries[0] == 0) {
+    pglGenQueries (GPU_QUERIES_IN_FLIGHT, timer->queries);
+    queries_created = true;
+  }
+
+  timer->active_query = -1;
+  if (timer->pending[timer->next_query])
+    return;
+  timer->active_query = timer->next_query;
+  pglBeginQuery (GL_TIME_ELAPSED, timer->queries[timer->active_query]);
+}
+
+/*____________________________________________________________________
+|
+| Function: Profile_GPUEnd
+|
+| Output: Ends the GPU timer query started by Profile_GPUBegin().
+|___________________________________________________________________*/
+
+void Profile_GPUEnd (int id)
+{
+  ProfileTimer *timer = &timers[id];
+
+  if (timer->active_query == -1)
+    return;
+  pglEndQuery (GL_TIME_ELAPSED);
+  timer->pending[timer->active_query] = true;
+  timer->next_query = (timer->active_query + 1) % GPU_QUERIES_IN_FLIGHT;
+  timer->active_query = -1;
+}
+
+/*____________________________________________________________________
+|
+| Function: Profile_EndFrame
+|
+| Output: Collects the results of any GPU queries that have finished,
+|   without waiting for the ones that haven't.
+|___________________________________________________________________*/
+
+void Profile_EndFrame ()
+{
+  GLint available;
+  GLuint64 ns;
+
+  if (NOT queries_created)
+    return;
+
+  for (int i=0; i<num_timers; i++)
+    for (int q=0; q<GPU_QUERIES_IN_FLIGHT; q++)
+      if (timers[i].pending[q]) {
+        pglGetQueryObjectiv (timers[i].queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+          pglGetQueryObjectui64v (timers[i].queries[q], GL_QUERY_RESULT, &ns);
+          Stats_Add (&timers[i].gpu, ns / 1.0e6);
+          timers[i].pending[q] = false;
+        }
+      }
+}
+
+/*____________________________________________________________________
+|
+| Function: Profile_WriteCSV
+|
+| Output: Writes one row per timer and clock (cpu/gpu) with samples:
+|     timer,clock,count,min_ms,avg_ms,p99_ms,max_ms
+|   count is the total # of samples; the other columns cover the last
+|   PROFILE_WINDOW samples.  Returns true on success.
+|___________________________________________________________________*/
+
+bool Profile_WriteCSV (const char *filename)
+{
+  FILE *fp = fopen (filename, "wt");
+  if (fp == 0)
+    return false;
+
+  fprintf (fp, "timer,clock,count,min_ms,avg_ms,p99_ms,max_ms\n");
+  for (int i=0; i<num_timers; i++) {
+    Stats_Write (fp, timers[i].name, "cpu", &timers[i].cpu);
+    Stats_Write (fp, timers[i].name, "gpu", &timers[i].gpu);
+  }
+  fclose (fp);
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Profile_Shutdown
+|
+| Output: Deletes the GPU query objects.
+|___________________________________________________________________*/
+
+void Profile_Shutdown ()
+{
+  if (queries_created) {
+    for (int i=0; i<num_timers; i++)
+      if (timers[i].queries[0]) {
+        pglDeleteQueries (GPU_QUERIES_IN_FLIGHT, timers[i].queries);
+        memset (timers[i].queries, 0, sizeof(timers[i].queries));
+        memset (timers[i].pending, 0, sizeof(timers[i].pending));
+      }
+    queries_created = false;
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: Stats_Add
+|
+| Output: Adds a sample to the ring buffer, replacing the oldest one.
+|___________________________________________________________________*/
+
+static void Stats_Add (ProfileStats *stats, double ms)
+{
+  stats->samples[stats->next] = ms;
+  stats->next = (stats->next + 1) % PROFILE_WINDOW;
+  if (stats->num_samples < PROFILE_WINDOW)
+    stats->num_samples++;
+  stats->count++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Stats_Write
+|
+| Output: Writes one CSV row of statistics, if there are any samples.
+|___________________________________________________________________*/
+
+static void Stats_Write (FILE *fp, const char *name, const char *type, ProfileStats *stats)
+{
+  double sorted[PROFILE_WINDOW], sum = 0;
+  int i, n = stats->num_samples;
+
+  if (n == 0)
+    return;
+
+  for (i=0; i<n; i++) {
+    sorted[i] = stats->samples[i];
+    sum += sorted[i];
+  }
+  std::sort (sorted, sorted + n);
+  // Nearest-rank 99th percentile
+  int p99 = (int)ceil(0.99 * n) - 1;
+
+  fprintf (fp, "%s,%s,%lld,%.4f,%.4f,%.4f,%.4f\n", name, type, stats->count,
+           sorted[0], sum / n, sorted[p99], sorted[n-1]);
+}
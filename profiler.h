@@ -0,0 +1,45 @@
+/*____________________________________________________________________
+|
+| File: profiler.h
+|
+| Include after trace.h (CPU timer scopes are also recorded as trace
+| events).
+|___________________________________________________________________*/
+
+#define PROFILE_MAX_TIMERS 64   // max # of named timers
+#define PROFILE_WINDOW     256  // # of most recent samples kept per timer for the statistics
+
+// Registers a named timer and returns its id (the same name always returns the same id)
+int  Profile_Register (const char *name);
+// Returns the name of a timer
+const char *Profile_Name (int id);
+// High resolution CPU clock, in nanoseconds
+long long Profile_Now ();
+// Returns the most memory the process has had resident so far, in bytes (0 if unknown)
+size_t Profile_PeakMemory ();
+// Adds a CPU time sample (in milliseconds) to a timer
+void Profile_AddSample (int id, double ms);
+// Starts/stops a GPU timer query for a timer (no-op if the context has no timer queries)
+void Profile_GPUBegin (int id);
+void Profile_GPUEnd (int id);
+// Collects finished GPU timer query results (call once per frame)
+void Profile_EndFrame ();
+// Writes count/min/avg/p99/max of the recent samples of every timer to a CSV file
+bool Profile_WriteCSV (const char *filename);
+// Deletes the GPU query objects (call while the context is still current)
+void Profile_Shutdown ();
+
+// Times the enclosing block on the CPU
+struct ProfileScope {
+  int id;
+  long long start;
+  ProfileScope (int id) : id(id) { Trace_Begin (Profile_Name(id)); start = Profile_Now(); }
+  ~ProfileScope () { Profile_AddSample (id, (Profile_Now() - start) / 1.0e6); Trace_End (Profile_Name(id)); }
+};
+
+// Times the GL commands issued in the enclosing block on the GPU (these can't be nested)
+struct ProfileGPUScope {
+  int id;
+  ProfileGPUScope (int id) : id(id) { Profile_GPUBegin (id); }
+  ~ProfileGPUScope () { Profile_GPUEnd (id); }
+};
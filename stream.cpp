@@ -0,0 +1,268 @@
+/*____________________________________________________________________
+|
+| File: stream.cpp
+|
+| Description: Worker pool for loading assets in the background.  The
+|   GL thread queues jobs under a mutex, since workers sleep on it until
+|   there is something to load.  Loaded jobs come back through a lock
+|   free list: each worker pushes with a compare-and-swap and the GL
+|   thread takes the whole list with one exchange, so neither side ever
+|   waits on the other.  The GL thread then finishes them (uploads the
+|   data) in load order, stopping each frame once its upload budget is
+|   used up, so a burst of loads is spread over several frames instead
+|   of stalling one.
+|
+| Functions: Stream_Init
+|            Stream_Submit
+|            Stream_Update
+|            Stream_Pending
+|            Stream_Shutdown
+|            Worker
+|            Collect
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "math3d.h"
+#include "cpu.h"
+#include "trace.h"
+#include "stream.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct StreamJob {
+  StreamLoadFn    load;
+  StreamFinishFn  finish;
+  void           *data;
+  StreamJob      *next;     // in the loaded list
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Worker ();
+static void Collect ();
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static std::vector<std::thread> workers;
+static std::mutex queue_mutex;
+static std::condition_variable queue_cv;
+static std::deque<StreamJob *> queue;             // waiting for a worker (guarded by queue_mutex)
+static bool stopping = false;                     // guarded by queue_mutex
+static std::atomic<StreamJob *> loaded (0);       // loaded by a worker, newest first
+
+// GL thread only
+static StreamJob *ready_head = 0, *ready_tail = 0;  // collected from loaded, oldest first
+static int pending = 0;
+
+/*____________________________________________________________________
+|
+| Function: Stream_Init
+|
+| Output: Starts the worker threads, if they aren't running.
+|___________________________________________________________________*/
+
+void Stream_Init (int num_threads)
+{
+  if (NOT workers.empty())
+    return;
+  if (num_threads <= 0)
+    num_threads = std::min (std::max (1, CPU_NumThreads() - 1), STREAM_MAX_THREADS);
+
+  stopping = false;
+  for (int i=0; i<num_threads; i++)
+    workers.push_back (std::thread (Worker));
+}
+
+/*____________________________________________________________________
+|
+| Function: Stream_Submit
+|
+| Output: Queues a job for the next free worker.
+|___________________________________________________________________*/
+
+void Stream_Submit (StreamLoadFn load, StreamFinishFn finish, void *data)
+{
+  StreamJob *job = new StreamJob;
+  job->load   = load;
+  job->finish = finish;
+  job->data   = data;
+  job->next   = 0;
+
+  Stream_Init (0);
+  pending++;
+  {
+    std::lock_guard<std::mutex> lock (queue_mutex);
+    queue.push_back (job);
+  }
+  queue_cv.notify_one ();
+}
+
+/*____________________________________________________________________
+|
+| Function: Stream_Update
+|
+| Output: Finishes loaded jobs in the order they were loaded, starting
+|   no more once budget bytes have been uploaded.  Returns the # of
+|   jobs finished.
+|___________________________________________________________________*/
+
+int Stream_Update (size_t budget)
+{
+  size_t bytes = 0;
+  int n = 0;
+
+  if (pending == 0)
+    return 0;
+
+  TraceScope trace("Stream_Update");
+  Collect ();
+  while (ready_head AND (n == 0 OR bytes < budget)) {
+    StreamJob *job = ready_head;
+    ready_head = job->next;
+    if (ready_head == 0)
+      ready_tail = 0;
+    bytes += job->finish (job->data, false);
+    delete job;
+    pending--;
+    n++;
+  }
+  return n;
+}
+
+/*____________________________________________________________________
+|
+| Function: Stream_Pending
+|
+| Output: Returns the # of jobs that haven't been finished yet.
+|___________________________________________________________________*/
+
+int Stream_Pending ()
+{
+  return pending;
+}
+
+/*____________________________________________________________________
+|
+| Function: Stream_Shutdown
+|
+| Output: Stops the workers (each finishes loading the job it is on)
+|   and discards every job not finished yet.
+|___________________________________________________________________*/
+
+void Stream_Shutdown ()
+{
+  {
+    std::lock_guard<std::mutex> lock (queue_mutex);
+    stopping = true;
+  }
+  queue_cv.notify_all ();
+  for (size_t i=0; i<workers.size(); i++)
+    workers[i].join ();
+  workers.clear ();
+
+  // Jobs no worker got to, then jobs loaded but not finished
+  for (size_t i=0; i<queue.size(); i++) {
+    queue[i]->finish (queue[i]->data, true);
+    delete queue[i];
+  }
+  queue.clear ();
+  Collect ();
+  while (ready_head) {
+    StreamJob *job = ready_head;
+    ready_head = job->next;
+    job->finish (job->data, true);
+    delete job;
+  }
+  ready_tail = 0;
+  pending = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Worker
+|
+| Output: Loads queued jobs until the pool is shut down.
+|___________________________________________________________________*/
+
+static void Worker ()
+{
+  for (;;) {
+    StreamJob *job;
+    {
+      std::unique_lock<std::mutex> lock (queue_mutex);
+      queue_cv.wait (lock, [] { return stopping OR NOT queue.empty(); });
+      if (stopping)
+        return;
+      job = queue.front ();
+      queue.pop_front ();
+    }
+
+    {
+      TraceScope trace("stream load");
+      job->load (job->data);
+    }
+
+    // Push it on the loaded list (the release makes the loaded data visible to the GL thread)
+    StreamJob *head = loaded.load (std::memory_order_relaxed);
+    do
+      job->next = head;
+    while (NOT loaded.compare_exchange_weak (head, job, std::memory_order_release, std::memory_order_relaxed));
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: Collect
+|
+| Output: Takes everything on the loaded list and appends it, oldest
+|   first, to the ready list.
+|___________________________________________________________________*/
+
+static void Collect ()
+{
+  StreamJob *list = loaded.exchange (0, std::memory_order_acquire);
+
+  // The list is newest first - reverse it
+  StreamJob *reversed = 0;
+  while (list) {
+    StreamJob *next = list->next;
+    list->next = reversed;
+    reversed = list;
+    list = next;
+  }
+  if (reversed == 0)
+    return;
+
+  if (ready_tail)
+    ready_tail->next = reversed;
+  else
+    ready_head = reversed;
+  for (ready_tail = reversed; ready_tail->next; ready_tail = ready_tail->next)
+    ;
+}
@@ -0,0 +1,30 @@
+/*____________________________________________________________________
+|
+| File: stream.h
+|
+| Background loading.  Jobs are loaded on a pool of worker threads and
+| then finished (uploaded to GL) on the GL thread by Stream_Update(), a
+| few per frame.
+|___________________________________________________________________*/
+
+#define STREAM_MAX_THREADS    4           // max # of worker threads
+#define STREAM_UPLOAD_BUDGET  (4 << 20)   // default # of bytes Stream_Update() uploads per frame
+
+// Loads a job's data on a worker thread (reading and decoding only, no GL calls)
+typedef void   (*StreamLoadFn) (void *data);
+// Finishes a job on the GL thread and returns the # of bytes it uploaded.  If discard is
+//  true (the pool is shutting down) it should only free the data
+typedef size_t (*StreamFinishFn) (void *data, bool discard);
+
+// Starts the worker threads (0 = one per core, leaving one for the GL thread).  Called by
+//  Stream_Submit() if needed
+void Stream_Init (int num_threads);
+// Queues a job: load(data) runs on a worker, then finish(data,false) in a later Stream_Update()
+void Stream_Submit (StreamLoadFn load, StreamFinishFn finish, void *data);
+// Finishes loaded jobs, oldest first, until budget bytes have been uploaded (at least one
+//  job is finished if any is ready).  Call once per frame on the GL thread.  Returns the # finished
+int  Stream_Update (size_t budget);
+// Returns the # of jobs submitted and not finished yet
+int  Stream_Pending ();
+// Waits for the jobs being loaded, discards the rest and stops the worker threads
+void Stream_Shutdown ();
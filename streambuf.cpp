@@ -0,0 +1,236 @@
+/*____________________________________________________________________
+|
+| File: streambuf.cpp
+|
+| Description: Streaming vertex buffer.  Each StreamBuf_Map() takes the
+|   next free range of the buffer, mapped unsynchronized (GL doesn't
+|   wait for draws still reading earlier ranges, which are never
+|   written again).  When the buffer is full it is orphaned with
+|   glBufferData(0): the driver hands back fresh storage and frees the
+|   old once the GPU is done with it, and filling starts over at the
+|   front.  A range too big for the buffer grows it.
+|
+|   Without glMapBufferRange() the range is written to client memory
+|   and copied with glBufferSubData(); without buffer objects at all
+|   the client memory is drawn from directly (client arrays are read
+|   when each draw is made, so it is reused at once).
+|
+| Functions: StreamBuf_Init
+|            StreamBuf_Free
+|            StreamBuf_Map
+|            StreamBuf_Unmap
+|            StreamBuf_Bind
+|            StreamBuf_Unbind
+|            StreamBuf_Pointer
+|            Reserve
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <GL/glut.h>
+#include "math3d.h"
+#include "memtrack.h"
+#include "glproc.h"
+#include "glcheck.h"
+#include "streambuf.h"
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static bool Reserve (StreamBuffer *sb, size_t bytes);
+
+/*____________________________________________________________________
+|
+| Function: StreamBuf_Init
+|
+| Output: Creates a streaming buffer of STREAMBUF_MIN_SIZE bytes, a
+|   buffer object if the GL has them.  Returns false if out of memory.
+|___________________________________________________________________*/
+
+bool StreamBuf_Init (StreamBuffer *sb)
+{
+  memset (sb, 0, sizeof(StreamBuffer));
+  if (NOT glproc_vbo)
+    return Reserve (sb, STREAMBUF_MIN_SIZE);
+
+  pglGenBuffers (1, &sb->id);
+  GL_STATE(pglBindBuffer (GL_ARRAY_BUFFER, sb->id));
+  GL_STATE(pglBufferData (GL_ARRAY_BUFFER, STREAMBUF_MIN_SIZE, 0, GL_STREAM_DRAW));
+  GL_STATE(pglBindBuffer (GL_ARRAY_BUFFER, 0));
+  sb->size = STREAMBUF_MIN_SIZE;
+  Mem_Count (MEM_GPU, (long long)sb->size);
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: StreamBuf_Free
+|
+| Output: Frees a streaming buffer.
+|___________________________________________________________________*/
+
+void StreamBuf_Free (StreamBuffer *sb)
+{
+  if (sb->id) {
+    pglDeleteBuffers (1, &sb->id);
+    Mem_Count (MEM_GPU, -(long long)sb->size);
+  }
+  Mem_Free (sb->memory);
+  memset (sb, 0, sizeof(StreamBuffer));
+}
+
+/*____________________________________________________________________
+|
+| Function: StreamBuf_Map
+|
+| Output: Returns where to write the next bytes bytes of a streaming
+|   buffer, or 0 if out of memory, and sets offset to where they are in
+|   the buffer.
+|___________________________________________________________________*/
+
+void *StreamBuf_Map (StreamBuffer *sb, size_t bytes, size_t *offset)
+{
+  char *p = 0;
+
+  *offset = 0;
+  if (sb->id == 0) {
+    if (NOT Reserve(sb, bytes))
+      return 0;
+    sb->map_offset = 0;
+    sb->map_bytes = bytes;
+    sb->mapped = false;
+    return sb->memory;
+  }
+
+  GL_STATE(pglBindBuffer (GL_ARRAY_BUFFER, sb->id));
+  // Grow the buffer, or start over in fresh storage once it's full
+  if (bytes > sb->size) {
+    size_t size = std::max (bytes, 2 * sb->size);
+    GL_STATE(pglBufferData (GL_ARRAY_BUFFER, size, 0, GL_STREAM_DRAW));
+    Mem_Count (MEM_GPU, (long long)size - (long long)sb->size);
+    sb->size = size;
+    sb->used = 0;
+  }
+  else if (sb->used + bytes > sb->size) {
+    GL_STATE(pglBufferData (GL_ARRAY_BUFFER, sb->size, 0, GL_STREAM_DRAW));
+    sb->used = 0;
+  }
+  sb->map_offset = sb->used;
+  sb->map_bytes = bytes;
+  sb->used = std::min (sb->size, (sb->used + bytes + STREAMBUF_ALIGNMENT - 1) & ~(size_t)(STREAMBUF_ALIGNMENT - 1));
+
+  if (glproc_map_range)
+    p = (char *) pglMapBufferRange (GL_ARRAY_BUFFER, sb->map_offset, bytes,
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+  sb->mapped = (p != 0);
+  if (p == 0 AND Reserve(sb, bytes))
+    p = sb->memory;
+  GL_STATE(pglBindBuffer (GL_ARRAY_BUFFER, 0));
+
+  if (p == 0)
+    sb->map_bytes = 0;
+  *offset = sb->map_offset;
+  return p;
+}
+
+/*____________________________________________________________________
+|
+| Function: StreamBuf_Unmap
+|
+| Output: Hands the range written since StreamBuf_Map() to GL.
+|___________________________________________________________________*/
+
+void StreamBuf_Unmap (StreamBuffer *sb)
+{
+  if (sb->id AND sb->map_bytes) {
+    GL_STATE(pglBindBuffer (GL_ARRAY_BUFFER, sb->id));
+    // A mapping lost to a display change leaves one frame's range undefined (it's rewritten next frame)
+    if (sb->mapped)
+      GL_UPLOAD(pglUnmapBuffer (GL_ARRAY_BUFFER), sb->map_bytes);
+    else
+      GL_UPLOAD(pglBufferSubData (GL_ARRAY_BUFFER, sb->map_offset, sb->map_bytes, sb->memory), sb->map_bytes);
+    GL_STATE(pglBindBuffer (GL_ARRAY_BUFFER, 0));
+  }
+  sb->map_bytes = 0;
+  sb->mapped = false;
+}
+
+/*____________________________________________________________________
+|
+| Function: StreamBuf_Bind
+|
+| Output: Binds a streaming buffer's buffer object, if it has one.
+|___________________________________________________________________*/
+
+void StreamBuf_Bind (StreamBuffer *sb)
+{
+  if (sb->id)
+    GL_STATE(pglBindBuffer (GL_ARRAY_BUFFER, sb->id));
+}
+
+/*____________________________________________________________________
+|
+| Function: StreamBuf_Unbind
+|
+| Output: Unbinds a streaming buffer's buffer object, if it has one.
+|___________________________________________________________________*/
+
+void StreamBuf_Unbind (StreamBuffer *sb)
+{
+  if (sb->id)
+    GL_STATE(pglBindBuffer (GL_ARRAY_BUFFER, 0));
+}
+
+/*____________________________________________________________________
+|
+| Function: StreamBuf_Pointer
+|
+| Output: Returns the pointer gl*Pointer() takes for data at offset in
+|   a streaming buffer: the offset itself with a buffer object bound,
+|   else the address in client memory.
+|___________________________________________________________________*/
+
+const void *StreamBuf_Pointer (StreamBuffer *sb, size_t offset)
+{
+  if (sb->id)
+    return (const char *)0 + offset;
+  return sb->memory + offset;
+}
+
+/*____________________________________________________________________
+|
+| Function: Reserve
+|
+| Output: Makes a streaming buffer's client memory at least bytes
+|   long.  Returns false if out of memory.
+|___________________________________________________________________*/
+
+static bool Reserve (StreamBuffer *sb, size_t bytes)
+{
+  if (bytes <= sb->memory_size)
+    return true;
+  size_t size = std::max (bytes, std::max ((size_t)STREAMBUF_MIN_SIZE, 2 * sb->memory_size));
+  char *memory = (char *) Mem_Alloc (MEM_MESH, size);
+  if (memory == 0)
+    return false;
+  Mem_Free (sb->memory);
+  sb->memory = memory;
+  sb->memory_size = size;
+  return true;
+}
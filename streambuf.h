@@ -0,0 +1,40 @@
+/*____________________________________________________________________
+|
+| File: streambuf.h
+|
+| Streaming vertex buffer: a buffer object written anew every frame
+| (such as with blended morph targets), filled front to back and
+| orphaned when full so the GPU can keep drawing from the old storage.
+| With no vertex buffer objects it is client memory instead.  Include
+| after glproc.h.
+|___________________________________________________________________*/
+
+#define STREAMBUF_MIN_SIZE  (1 << 20)   // bytes a buffer starts with
+#define STREAMBUF_ALIGNMENT 64          // each Map() starts on a multiple of this
+
+struct StreamBuffer {
+  GLuint  id;               // buffer object, 0 = client memory
+  size_t  size;             // bytes it holds
+  size_t  used;             // bytes handed out since it was last orphaned
+  char   *memory;           // client memory, or where writes are staged when the buffer can't be mapped
+  size_t  memory_size;
+  size_t  map_offset;       // the range being written, map_bytes = 0 if none
+  size_t  map_bytes;
+  bool    mapped;           // the range is mapped (rather than staged)
+};
+
+// Creates a buffer (call with a GL context current).  Returns false if out of memory
+bool  StreamBuf_Init (StreamBuffer *sb);
+// Frees it
+void  StreamBuf_Free (StreamBuffer *sb);
+// Returns where to write bytes bytes (0 if out of memory) and sets offset to where they will be
+//  in the buffer.  What was written before is left for draws already made
+void *StreamBuf_Map (StreamBuffer *sb, size_t bytes, size_t *offset);
+// Hands the bytes written since StreamBuf_Map() to GL
+void  StreamBuf_Unmap (StreamBuffer *sb);
+// Binds the buffer (or no buffer, for client memory) for gl*Pointer() calls
+void  StreamBuf_Bind (StreamBuffer *sb);
+// Unbinds it
+void  StreamBuf_Unbind (StreamBuffer *sb);
+// Returns the pointer to give gl*Pointer() for data at offset, with the buffer bound
+const void *StreamBuf_Pointer (StreamBuffer *sb, size_t offset);
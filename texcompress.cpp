@@ -0,0 +1,577 @@
+/*____________________________________________________________________
+|
+| File: texcompress.cpp
+|
+| Description: BC1/BC3 texture compression.  Each 4x4 block of pixels
+|   is stored as two RGB565 endpoint colors and a 2-bit index per pixel
+|   selecting the endpoints or one of two colors between them (BC1, 8
+|   bytes per block).  BC3 adds a block of alpha: two 8-bit endpoints
+|   and a 3-bit index per pixel (16 bytes per block).
+|
+|   How the endpoints are chosen depends on the quality setting: the
+|   bounding box of the block's colors (fast), the extent of the colors
+|   along their principal axis (normal), or the principal axis followed
+|   by least squares refinement of the endpoints (high).
+|
+| Functions: TexCompress_Size
+|            TexCompress_Encode
+|            TexCompress_Decode
+|            TexCompress_RMSE
+|            TexCompress_GLFormat
+|            TexCompress_Name
+|            EncodeJob
+|            EncodeRows
+|            EncodeColorBlock
+|            EncodeAlphaBlock
+|            ChooseEndpoints
+|            RefineEndpoints
+|            FitIndices
+|            DecodeColorBlock
+|            DecodeAlphaBlock
+|            ToRGB565
+|            FromRGB565
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <GL/glut.h>
+#include "math3d.h"
+#include "glproc.h"
+#include "cpu.h"
+#include "job.h"
+#include "trace.h"
+#include "texcompress.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define BLOCK_ROWS_PER_JOB 8
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+// The 16 pixels of a block, as RGBA
+typedef unsigned char Block[16][4];
+
+struct EncodeWork {
+  unsigned char *pixels;
+  int            width, height, channels;
+  TexFormat      format;
+  int            quality;
+  unsigned char *out;
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void EncodeJob (void *data, int by0, int by1);
+static void EncodeRows (unsigned char *pixels, int width, int height, int channels, TexFormat format,
+                        int quality, unsigned char *out, int by0, int by1);
+static void EncodeColorBlock (Block block, int quality, unsigned char *out);
+static void EncodeAlphaBlock (Block block, unsigned char *out);
+static void ChooseEndpoints (Block block, int quality, float c0[3], float c1[3]);
+static void RefineEndpoints (Block block, unsigned indices, float c0[3], float c1[3]);
+static unsigned FitIndices (Block block, unsigned short e0, unsigned short e1, int *error);
+static void DecodeColorBlock (unsigned char *in, bool bc1, Block block);
+static void DecodeAlphaBlock (unsigned char *in, Block block);
+static unsigned short ToRGB565 (float c[3]);
+static void FromRGB565 (unsigned short c, int rgb[3]);
+
+/*____________________________________________________________________
+|
+| Function: TexCompress_Size
+|
+| Output: Returns the # of bytes of a width x height image in a format.
+|   Compressed images are a whole # of 4x4 blocks.
+|___________________________________________________________________*/
+
+int TexCompress_Size (int width, int height, TexFormat format)
+{
+  int blocks = ((width + 3) / 4) * ((height + 3) / 4);
+
+  switch (format) {
+    case TEXFMT_BC1: return blocks * 8;
+    case TEXFMT_BC3: return blocks * 16;
+    default:         return width * height * 3;
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: TexCompress_Encode
+|
+| Output: Compresses an image to BC1 or BC3, blocks in row order
+|   starting with the first row of pixels (the same order as the rows).
+|___________________________________________________________________*/
+
+void TexCompress_Encode (unsigned char *pixels, int width, int height, int channels,
+                         TexFormat format, int quality, unsigned char *out)
+{
+  TraceScope trace("TexCompress_Encode");
+
+  // Bands of block rows are encoded as jobs
+  EncodeWork work = { pixels, width, height, channels, format, quality, out };
+  Job_ParallelFor ((height + 3) / 4, BLOCK_ROWS_PER_JOB, EncodeJob, &work);
+}
+
+/*____________________________________________________________________
+|
+| Function: TexCompress_Decode
+|
+| Output: Decompresses a BC1 or BC3 image.  With 3 channels the alpha
+|   is dropped.
+|___________________________________________________________________*/
+
+void TexCompress_Decode (unsigned char *blocks, int width, int height, TexFormat format,
+                         int channels, unsigned char *pixels)
+{
+  Block block;
+  int block_size = format == TEXFMT_BC3 ? 16 : 8;
+
+  for (int by=0; by<height; by+=4)
+    for (int bx=0; bx<width; bx+=4, blocks+=block_size) {
+      if (format == TEXFMT_BC3) {
+        DecodeColorBlock (blocks + 8, false, block);
+        DecodeAlphaBlock (blocks, block);
+      }
+      else
+        DecodeColorBlock (blocks, true, block);
+      // Copy the part of the block inside the image
+      for (int y=0; y<4 AND by+y<height; y++)
+        for (int x=0; x<4 AND bx+x<width; x++)
+          memcpy (pixels + ((size_t)(by + y) * width + bx + x) * channels, block[y*4+x], channels);
+    }
+}
+
+/*____________________________________________________________________
+|
+| Function: TexCompress_RMSE
+|
+| Output: Returns the root mean square error between two images.
+|___________________________________________________________________*/
+
+double TexCompress_RMSE (unsigned char *a, unsigned char *b, int width, int height, int channels)
+{
+  size_t n = (size_t)width * height * channels;
+  double sum = 0;
+
+  for (size_t i=0; i<n; i++) {
+    int d = a[i] - b[i];
+    sum += d * d;
+  }
+  return n ? sqrt(sum / n) : 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: TexCompress_GLFormat
+|
+| Output: Returns the GL internal format for a compressed format.
+|___________________________________________________________________*/
+
+unsigned TexCompress_GLFormat (TexFormat format)
+{
+  switch (format) {
+    case TEXFMT_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case TEXFMT_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    default:         return GL_RGB;
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: TexCompress_Name
+|
+| Output: Returns the name of a format.
+|___________________________________________________________________*/
+
+const char *TexCompress_Name (TexFormat format)
+{
+  switch (format) {
+    case TEXFMT_BC1: return "BC1";
+    case TEXFMT_BC3: return "BC3";
+    default:         return "RGB";
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: EncodeJob
+|
+| Output: Compresses block rows by0 up to (not including) by1 of a
+|   TexCompress_Encode() job.
+|___________________________________________________________________*/
+
+static void EncodeJob (void *data, int by0, int by1)
+{
+  EncodeWork *work = (EncodeWork *) data;
+  EncodeRows (work->pixels, work->width, work->height, work->channels, work->format, work->quality, work->out, by0, by1);
+}
+
+/*____________________________________________________________________
+|
+| Function: EncodeRows
+|
+| Output: Compresses block rows by0 up to (not including) by1.  Blocks
+|   that hang over the edge of the image repeat its last row/column.
+|___________________________________________________________________*/
+
+static void EncodeRows (unsigned char *pixels, int width, int height, int channels, TexFormat format,
+                        int quality, unsigned char *out, int by0, int by1)
+{
+  Block block;
+  int block_size = format == TEXFMT_BC3 ? 16 : 8;
+  int blocks_per_row = (width + 3) / 4;
+
+  out += (size_t)by0 * blocks_per_row * block_size;
+  for (int by=by0; by<by1; by++)
+    for (int bx=0; bx<blocks_per_row; bx++, out+=block_size) {
+      // Gather the block's pixels as RGBA
+      for (int y=0; y<4; y++)
+        for (int x=0; x<4; x++) {
+          int px = std::min (bx * 4 + x, width - 1);
+          int py = std::min (by * 4 + y, height - 1);
+          unsigned char *p = pixels + ((size_t)py * width + px) * channels;
+          block[y*4+x][0] = p[0];
+          block[y*4+x][1] = p[1];
+          block[y*4+x][2] = p[2];
+          block[y*4+x][3] = channels == 4 ? p[3] : 255;
+        }
+      if (format == TEXFMT_BC3) {
+        EncodeAlphaBlock (block, out);
+        EncodeColorBlock (block, quality, out + 8);
+      }
+      else
+        EncodeColorBlock (block, quality, out);
+    }
+}
+
+/*____________________________________________________________________
+|
+| Function: EncodeColorBlock
+|
+| Output: Writes the 8-byte color part of a block (always in 4 color
+|   mode, so it is valid for both BC1 and BC3).
+|___________________________________________________________________*/
+
+static void EncodeColorBlock (Block block, int quality, unsigned char *out)
+{
+  float c0[3], c1[3];
+  int error;
+
+  ChooseEndpoints (block, quality, c0, c1);
+  unsigned short e0 = ToRGB565 (c0);
+  unsigned short e1 = ToRGB565 (c1);
+  unsigned indices = FitIndices (block, e0, e1, &error);
+
+  // Least squares refinement of the endpoints for the chosen indices (keep it if it's better)
+  if (quality >= TEXQ_HIGH) {
+    for (int pass=0; pass<2 AND error > 0; pass++) {
+      int new_error;
+      RefineEndpoints (block, indices, c0, c1);
+      unsigned short n0 = ToRGB565 (c0);
+      unsigned short n1 = ToRGB565 (c1);
+      unsigned new_indices = FitIndices (block, n0, n1, &new_error);
+      if (new_error >= error)
+        break;
+      e0 = n0;
+      e1 = n1;
+      indices = new_indices;
+      error = new_error;
+    }
+  }
+
+  // 4 color mode needs e0 > e1: swap the endpoints (and indices 0<->1, 2<->3) if needed
+  if (e0 < e1) {
+    std::swap (e0, e1);
+    indices ^= 0x55555555;
+  }
+  else if (e0 == e1)
+    indices = 0;
+
+  out[0] = e0 & 0xFF;
+  out[1] = e0 >> 8;
+  out[2] = e1 & 0xFF;
+  out[3] = e1 >> 8;
+  out[4] = indices & 0xFF;
+  out[5] = (indices >> 8) & 0xFF;
+  out[6] = (indices >> 16) & 0xFF;
+  out[7] = indices >> 24;
+}
+
+/*____________________________________________________________________
+|
+| Function: EncodeAlphaBlock
+|
+| Output: Writes the 8-byte BC3 alpha part of a block, using the 8
+|   alpha mode (6 values between the block's min and max alpha).
+|___________________________________________________________________*/
+
+static void EncodeAlphaBlock (Block block, unsigned char *out)
+{
+  int i, a0 = 0, a1 = 255;
+  unsigned long long indices = 0;
+
+  for (i=0; i<16; i++) {
+    a0 = std::max (a0, (int)block[i][3]);
+    a1 = std::min (a1, (int)block[i][3]);
+  }
+  if (a0 > a1) {
+    // Palette order is a0, a1, then the 6 values from a0 to a1
+    static const int order[8] = { 0, 2, 3, 4, 5, 6, 7, 1 };
+    for (i=0; i<16; i++) {
+      // Nearest of the 8 evenly spaced values from a0 (step 0) to a1 (step 7)
+      int step = ((a0 - block[i][3]) * 14 + (a0 - a1)) / (2 * (a0 - a1));
+      indices |= (unsigned long long)order[step] << (3 * i);
+    }
+  }
+
+  out[0] = (unsigned char) a0;
+  out[1] = (unsigned char) a1;
+  for (i=0; i<6; i++)
+    out[2+i] = (unsigned char) (indices >> (8 * i));
+}
+
+/*____________________________________________________________________
+|
+| Function: ChooseEndpoints
+|
+| Output: Picks the 2 endpoint colors of a block.
+|___________________________________________________________________*/
+
+static void ChooseEndpoints (Block block, int quality, float c0[3], float c1[3])
+{
+  int i, j;
+
+  if (quality == TEXQ_FAST) {
+    // Bounding box of the colors, inset by 1/16 of its size (the extremes are rarely used)
+    float lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+    for (i=0; i<16; i++)
+      for (j=0; j<3; j++) {
+        lo[j] = std::min (lo[j], (float)block[i][j]);
+        hi[j] = std::max (hi[j], (float)block[i][j]);
+      }
+    for (j=0; j<3; j++) {
+      float inset = (hi[j] - lo[j]) / 16;
+      c0[j] = hi[j] - inset;
+      c1[j] = lo[j] + inset;
+    }
+    return;
+  }
+
+  // Mean and covariance of the colors
+  float mean[3] = { 0, 0, 0 }, cov[6] = { 0, 0, 0, 0, 0, 0 };
+  for (i=0; i<16; i++)
+    for (j=0; j<3; j++)
+      mean[j] += block[i][j] / 16.0f;
+  for (i=0; i<16; i++) {
+    float r = block[i][0] - mean[0], g = block[i][1] - mean[1], b = block[i][2] - mean[2];
+    cov[0] += r * r;  cov[1] += r * g;  cov[2] += r * b;
+    cov[3] += g * g;  cov[4] += g * b;  cov[5] += b * b;
+  }
+
+  // Principal axis by power iteration, starting from the luminance direction
+  float axis[3] = { 0.30f, 0.59f, 0.11f };
+  for (int iter=0; iter<8; iter++) {
+    float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+    float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+    float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+    float len = std::max (std::max (fabsf(x), fabsf(y)), fabsf(z));
+    if (len < 1e-6f)
+      break;    // all the colors are the same
+    axis[0] = x / len;
+    axis[1] = y / len;
+    axis[2] = z / len;
+  }
+  float len_sq = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+  // Extent of the colors along the axis
+  float lo = 0, hi = 0;
+  for (i=0; i<16; i++) {
+    float t = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+    lo = std::min (lo, t);
+    hi = std::max (hi, t);
+  }
+  for (j=0; j<3; j++) {
+    c0[j] = std::min (255.0f, std::max (0.0f, mean[j] + axis[j] * hi / len_sq));
+    c1[j] = std::min (255.0f, std::max (0.0f, mean[j] + axis[j] * lo / len_sq));
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: RefineEndpoints
+|
+| Output: Solves for the endpoints that best fit the block's colors
+|   with the given indices (least squares).  Leaves the endpoints as
+|   they are if all the indices give the same weight.
+|___________________________________________________________________*/
+
+static void RefineEndpoints (Block block, unsigned indices, float c0[3], float c1[3])
+{
+  // Weight of endpoint 0 for each index (index 2 is 2/3 c0 + 1/3 c1, index 3 the reverse)
+  static const float w0[4] = { 1, 0, 2.0f/3, 1.0f/3 };
+  float aa = 0, ab = 0, bb = 0, ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+
+  for (int i=0; i<16; i++) {
+    float a = w0[(indices >> (2 * i)) & 3];
+    float b = 1 - a;
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int j=0; j<3; j++) {
+      ax[j] += a * block[i][j];
+      bx[j] += b * block[i][j];
+    }
+  }
+  float det = aa * bb - ab * ab;
+  if (fabsf(det) < 1e-6f)
+    return;
+  for (int j=0; j<3; j++) {
+    c0[j] = std::min (255.0f, std::max (0.0f, (ax[j] * bb - bx[j] * ab) / det));
+    c1[j] = std::min (255.0f, std::max (0.0f, (bx[j] * aa - ax[j] * ab) / det));
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: FitIndices
+|
+| Output: Returns the nearest palette entry for each pixel (2 bits per
+|   pixel, first pixel in the low bits) for 4 color mode endpoints e0
+|   and e1.  Sets error to the total squared error.
+|___________________________________________________________________*/
+
+static unsigned FitIndices (Block block, unsigned short e0, unsigned short e1, int *error)
+{
+  int palette[4][3];
+  unsigned indices = 0;
+
+  FromRGB565 (e0, palette[0]);
+  FromRGB565 (e1, palette[1]);
+  for (int j=0; j<3; j++) {
+    palette[2][j] = (2 * palette[0][j] + palette[1][j]) / 3;
+    palette[3][j] = (palette[0][j] + 2 * palette[1][j]) / 3;
+  }
+
+  *error = 0;
+  for (int i=0; i<16; i++) {
+    int best = 0, best_d = 0x7FFFFFFF;
+    for (int k=0; k<4; k++) {
+      int dr = block[i][0] - palette[k][0];
+      int dg = block[i][1] - palette[k][1];
+      int db = block[i][2] - palette[k][2];
+      int d = dr * dr + dg * dg + db * db;
+      if (d < best_d) {
+        best_d = d;
+        best = k;
+      }
+    }
+    indices |= (unsigned)best << (2 * i);
+    *error += best_d;
+  }
+  return indices;
+}
+
+/*____________________________________________________________________
+|
+| Function: DecodeColorBlock
+|
+| Output: Decodes the 8-byte color part of a block into RGB (alpha is
+|   set to 255, or 0 for BC1's transparent index).
+|___________________________________________________________________*/
+
+static void DecodeColorBlock (unsigned char *in, bool bc1, Block block)
+{
+  int palette[4][4];
+  unsigned short e0 = in[0] | (in[1] << 8);
+  unsigned short e1 = in[2] | (in[3] << 8);
+  unsigned indices = in[4] | (in[5] << 8) | (in[6] << 16) | ((unsigned)in[7] << 24);
+
+  FromRGB565 (e0, palette[0]);
+  FromRGB565 (e1, palette[1]);
+  palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+  for (int j=0; j<3; j++) {
+    if (e0 > e1 OR NOT bc1) {
+      palette[2][j] = (2 * palette[0][j] + palette[1][j]) / 3;
+      palette[3][j] = (palette[0][j] + 2 * palette[1][j]) / 3;
+    }
+    else {
+      palette[2][j] = (palette[0][j] + palette[1][j]) / 2;
+      palette[3][j] = 0;
+      palette[3][3] = 0;
+    }
+  }
+  for (int i=0; i<16; i++)
+    for (int j=0; j<4; j++)
+      block[i][j] = (unsigned char) palette[(indices >> (2 * i)) & 3][j];
+}
+
+/*____________________________________________________________________
+|
+| Function: DecodeAlphaBlock
+|
+| Output: Decodes the 8-byte BC3 alpha part of a block.
+|___________________________________________________________________*/
+
+static void DecodeAlphaBlock (unsigned char *in, Block block)
+{
+  int palette[8];
+  unsigned long long indices = 0;
+
+  palette[0] = in[0];
+  palette[1] = in[1];
+  if (palette[0] > palette[1])
+    for (int k=1; k<7; k++)
+      palette[k+1] = ((7 - k) * palette[0] + k * palette[1]) / 7;
+  else {
+    for (int k=1; k<5; k++)
+      palette[k+1] = ((5 - k) * palette[0] + k * palette[1]) / 5;
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+  for (int i=0; i<6; i++)
+    indices |= (unsigned long long)in[2+i] << (8 * i);
+  for (int i=0; i<16; i++)
+    block[i][3] = (unsigned char) palette[(indices >> (3 * i)) & 7];
+}
+
+/*____________________________________________________________________
+|
+| Function: ToRGB565, FromRGB565
+|
+| Output: Converts a color to/from 5:6:5 bits (expanding back to 8 bits
+|   the way the hardware does, by repeating the high bits).
+|___________________________________________________________________*/
+
+static unsigned short ToRGB565 (float c[3])
+{
+  int r = (int) (c[0] * 31 / 255 + 0.5f);
+  int g = (int) (c[1] * 63 / 255 + 0.5f);
+  int b = (int) (c[2] * 31 / 255 + 0.5f);
+  return (unsigned short) ((r << 11) | (g << 5) | b);
+}
+
+static void FromRGB565 (unsigned short c, int rgb[3])
+{
+  int r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
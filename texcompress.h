@@ -0,0 +1,30 @@
+/*____________________________________________________________________
+|
+| File: texcompress.h
+|
+| BC1 (DXT1) and BC3 (DXT5) block compression of RGB or RGBA images,
+| for glCompressedTexImage2D() with the S3TC formats.
+|___________________________________________________________________*/
+
+enum TexFormat { TEXFMT_RGB, TEXFMT_BC1, TEXFMT_BC3 };
+
+// Encoder quality: speed/quality trade-off for choosing each block's endpoint colors
+#define TEXQ_FAST    0    // bounding box of the block's colors
+#define TEXQ_NORMAL  1    // principal axis of the block's colors
+#define TEXQ_HIGH    2    // principal axis, then refined by least squares
+
+// Returns the # of bytes a width x height image takes in a format
+int  TexCompress_Size (int width, int height, TexFormat format);
+// Compresses an image (channels = 3 for RGB, 4 for RGBA) to BC1 or BC3.  Rows of
+//  blocks are split into jobs (see job.h).  out must hold TexCompress_Size() bytes
+void TexCompress_Encode (unsigned char *pixels, int width, int height, int channels,
+                         TexFormat format, int quality, unsigned char *out);
+// Decompresses a BC1 or BC3 image (channels = 3 or 4)
+void TexCompress_Decode (unsigned char *blocks, int width, int height, TexFormat format,
+                         int channels, unsigned char *pixels);
+// Returns the root mean square error between two images (over all channels)
+double TexCompress_RMSE (unsigned char *a, unsigned char *b, int width, int height, int channels);
+// Returns the GL internal format of a compressed format (GL_COMPRESSED_*_S3TC_*)
+unsigned TexCompress_GLFormat (TexFormat format);
+// Returns a format's name ("RGB", "BC1", "BC3")
+const char *TexCompress_Name (TexFormat format);
@@ -0,0 +1,360 @@
+/*____________________________________________________________________
+|
+| File: texfile.cpp
+|
+| Description: Cooked texture files.  The first time a BMP texture is
+|   used (or after it changes) it is converted once: decoded, mip
+|   mapped, compressed and written with a header describing every
+|   level.  After that, loading is a memory map of the cooked file (or
+|   a lookup in an asset pack) and one GL call per level, with no
+|   per-pixel work on the CPU.
+|
+| Functions: TexFile_Open
+|            TexFile_Level
+|            TexFile_Close
+|            TexFile_Cook
+|            TexFile_CookImage
+|            TexFile_Name
+|            MapFile
+|            IsUpToDate
+|            SourceInfo
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include "math3d.h"
+#include "memtrack.h"
+#include "LoadBMPFile.h"
+#include "mipmap.h"
+#include "texcompress.h"
+#include "pack.h"
+#include "trace.h"
+#include "texfile.h"
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static bool MapFile (char *filename, bool search_packs, TexFile *tf);
+static bool IsUpToDate (TexFile *tf, char *image_filename, TexFormat format, int quality, bool mipmaps);
+static bool SourceInfo (char *image_filename, unsigned *size, unsigned long long *time);
+
+/*____________________________________________________________________
+|
+| Function: TexFile_Open
+|
+| Output: Maps the cooked texture for an image, cooking it if needed.
+|   Returns true on success.
+|___________________________________________________________________*/
+
+bool TexFile_Open (char *image_filename, TexFormat format, int quality, bool mipmaps, TexFile *tf)
+{
+  char filename[512];
+
+  TraceScope trace("TexFile_Open");
+
+  memset (tf, 0, sizeof(TexFile));
+  TexFile_Name (image_filename, filename, sizeof(filename));
+
+  // Use the cooked file if it matches the image and the settings
+  if (MapFile(filename, true, tf)) {
+    if (IsUpToDate(tf, image_filename, format, quality, mipmaps))
+      return true;
+    bool packed = NOT tf->file.mapping;
+    TexFile_Close (tf);
+    // One in a pack may be older than the one on disk
+    if (packed AND MapFile(filename, false, tf)) {
+      if (IsUpToDate(tf, image_filename, format, quality, mipmaps))
+        return true;
+      TexFile_Close (tf);
+    }
+  }
+
+  // Otherwise (re)cook it
+  if (NOT TexFile_Cook(image_filename, filename, format, quality, mipmaps))
+    return false;
+  if (NOT MapFile(filename, false, tf)) {
+    printf ("%s: could not map the cooked texture\n", filename);
+    return false;
+  }
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: TexFile_Level
+|
+| Output: Returns a pointer to a level's data.
+|___________________________________________________________________*/
+
+unsigned char *TexFile_Level (TexFile *tf, int level)
+{
+  return tf->base + tf->header->levels[level].offset;
+}
+
+/*____________________________________________________________________
+|
+| Function: TexFile_Close
+|
+| Output: Unmaps a texture file (or frees one made in memory).
+|___________________________________________________________________*/
+
+void TexFile_Close (TexFile *tf)
+{
+  if (tf->base == 0)
+    return;
+  if (tf->in_memory)
+    Mem_Free (tf->base);
+  else
+    Pack_CloseFile (&tf->file);
+  memset (tf, 0, sizeof(TexFile));
+}
+
+/*____________________________________________________________________
+|
+| Function: TexFile_Cook
+|
+| Output: Loads a BMP file, cooks it (see TexFile_CookImage) and writes
+|   the result to a cooked texture file.  Returns true on success.
+|___________________________________________________________________*/
+
+bool TexFile_Cook (char *image_filename, char *filename, TexFormat format, int quality, bool mipmaps)
+{
+  TexFile tf;
+  unsigned char *rgb;
+  int width, height;
+  unsigned long long source_time;
+
+  TraceScope trace("TexFile_Cook");
+
+  if (NOT loadBMPfile(image_filename, &width, &height, &rgb))
+    return false;
+  bool ok = TexFile_CookImage (filename, rgb, width, height, format, quality, mipmaps, &tf);
+  Mem_Free (rgb);
+  if (NOT ok)
+    return false;
+
+  // Remember which version of the image it was cooked from
+  SourceInfo (image_filename, &tf.header->source_size, &source_time);
+  tf.header->source_time_lo = (unsigned) source_time;
+  tf.header->source_time_hi = (unsigned) (source_time >> 32);
+
+  // Write the file under another name and then replace the old one, which may still be
+  // mapped (by a texture streaming its mip levels from it)
+  char temp[1024];
+  snprintf (temp, sizeof(temp), "%s.tmp", filename);
+  FILE *fp = fopen (temp, "wb");
+  ok = fp != 0;
+  if (ok) {
+    ok = fwrite(tf.base, 1, tf.size, fp) == tf.size;
+    ok = (fclose(fp) == 0) AND ok;
+  }
+#ifdef _WIN32
+  if (ok)
+    remove (filename);
+#endif
+  if (ok)
+    ok = rename (temp, filename) == 0;
+  if (NOT ok) {
+    printf ("%s: could not write the cooked texture\n", filename);
+    remove (temp);
+  }
+  TexFile_Close (&tf);
+  return ok;
+}
+
+/*____________________________________________________________________
+|
+| Function: TexFile_CookImage
+|
+| Output: Builds a cooked texture in memory from an RGB image: builds
+|   its mip chain (if mipmaps) and compresses the levels (unless format
+|   is TEXFMT_RGB).  Prints the compression error of level 0 (name is
+|   only used for this).  Returns true on success.
+|___________________________________________________________________*/
+
+bool TexFile_CookImage (char *name, unsigned char *rgb, int width, int height, TexFormat format,
+                        int quality, bool mipmaps, TexFile *tf)
+{
+  MipLevel levels[MIP_MAX_LEVELS];
+  int num_levels, i;
+
+  memset (tf, 0, sizeof(TexFile));
+  auto start = std::chrono::steady_clock::now ();
+
+  // Build the mip chain
+  if (mipmaps)
+    num_levels = Mipmap_Build (rgb, width, height, levels);
+  else {
+    memset (levels, 0, sizeof(levels));
+    levels[0].width  = width;
+    levels[0].height = height;
+    levels[0].data   = rgb;
+    num_levels = 1;
+  }
+
+  // Lay out the file
+  TexFileHeader header;
+  memset (&header, 0, sizeof(header));
+  memcpy (header.magic, TEXFILE_MAGIC, 4);
+  header.version    = TEXFILE_VERSION;
+  header.endianness = TEXFILE_ENDIANNESS;
+  header.format     = format;
+  header.gl_format  = TexCompress_GLFormat (format);
+  header.quality    = format == TEXFMT_RGB ? 0 : quality;
+  header.num_levels = num_levels;
+  unsigned offset = (sizeof(header) + TEXFILE_ALIGNMENT - 1) & ~(TEXFILE_ALIGNMENT - 1);
+  for (i=0; i<num_levels; i++) {
+    header.levels[i].width  = levels[i].width;
+    header.levels[i].height = levels[i].height;
+    header.levels[i].offset = offset;
+    header.levels[i].size   = TexCompress_Size (levels[i].width, levels[i].height, format);
+    offset = (offset + header.levels[i].size + TEXFILE_ALIGNMENT - 1) & ~(TEXFILE_ALIGNMENT - 1);
+  }
+
+  // Fill in the header and the level data (compressed if needed)
+  tf->base = (unsigned char *) Mem_Calloc (MEM_TEXTURE, offset);
+  if (tf->base == 0) {
+    if (mipmaps)
+      Mipmap_Free (levels);
+    return false;
+  }
+  tf->size = offset;
+  tf->in_memory = true;
+  tf->header = (TexFileHeader *) tf->base;
+  memcpy (tf->header, &header, sizeof(header));
+  for (i=0; i<num_levels; i++) {
+    unsigned char *dst = TexFile_Level (tf, i);
+    if (format == TEXFMT_RGB)
+      memcpy (dst, levels[i].data, header.levels[i].size);
+    else
+      TexCompress_Encode (levels[i].data, levels[i].width, levels[i].height, 3, format, quality, dst);
+  }
+  double cook_ms = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  // Compare level 0 with the original
+  if (format != TEXFMT_RGB) {
+    unsigned char *decoded = (unsigned char *) Mem_Alloc (MEM_TEXTURE, (size_t)width * height * 3);
+    if (decoded) {
+      TexCompress_Decode (TexFile_Level(tf, 0), width, height, format, 3, decoded);
+      double rmse = TexCompress_RMSE (rgb, decoded, width, height, 3);
+      printf ("%s: %s quality %d, %d levels in %.1f ms, RMSE %.2f (PSNR %.1f dB)\n",
+              name, TexCompress_Name(format), quality, num_levels, cook_ms,
+              rmse, rmse > 0 ? 20 * log10(255 / rmse) : 99.0);
+      Mem_Free (decoded);
+    }
+  }
+
+  if (mipmaps)
+    Mipmap_Free (levels);
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: TexFile_Name
+|
+| Output: Sets filename to the image name with its extension replaced
+|   by .ktc.
+|___________________________________________________________________*/
+
+void TexFile_Name (char *image_filename, char *filename, int size)
+{
+  const char *dot = strrchr (image_filename, '.');
+  const char *slash = strpbrk (dot ? dot : image_filename, "/\\");
+  int len = (dot AND slash == 0) ? (int)(dot - image_filename) : (int)strlen(image_filename);
+
+  snprintf (filename, size, "%.*s.ktc", len, image_filename);
+}
+
+/*____________________________________________________________________
+|
+| Function: MapFile
+|
+| Output: Maps a cooked texture file read-only (looking in the packs
+|   first if search_packs is set) and checks that it is one (magic,
+|   version, byte order, and every level inside the file).  Returns
+|   true on success.
+|___________________________________________________________________*/
+
+static bool MapFile (char *filename, bool search_packs, TexFile *tf)
+{
+  memset (tf, 0, sizeof(TexFile));
+
+  bool found = search_packs ? Pack_ReadFile (filename, &tf->file) : Pack_MapFile (filename, &tf->file);
+  if (NOT found)
+    return false;
+  if (tf->file.size < sizeof(TexFileHeader)) {
+    Pack_CloseFile (&tf->file);
+    return false;
+  }
+  tf->base = (unsigned char *) tf->file.data;
+  tf->size = tf->file.size;
+  tf->header = (TexFileHeader *) tf->base;
+
+  // Check it's a texture file this code can use as is
+  TexFileHeader *h = tf->header;
+  bool ok = memcmp(h->magic, TEXFILE_MAGIC, 4) == 0 AND h->version == TEXFILE_VERSION AND
+            h->endianness == TEXFILE_ENDIANNESS AND h->num_levels >= 1 AND h->num_levels <= MIP_MAX_LEVELS;
+  for (unsigned i=0; ok AND i<h->num_levels; i++)
+    ok = (size_t)h->levels[i].offset + h->levels[i].size <= tf->size;
+  if (NOT ok) {
+    printf ("%s: not a valid cooked texture, recooking\n", filename);
+    TexFile_Close (tf);
+  }
+  return ok;
+}
+
+/*____________________________________________________________________
+|
+| Function: IsUpToDate
+|
+| Output: Returns true if a mapped texture file was cooked from the
+|   current version of the image with the same settings.
+|___________________________________________________________________*/
+
+static bool IsUpToDate (TexFile *tf, char *image_filename, TexFormat format, int quality, bool mipmaps)
+{
+  TexFileHeader *h = tf->header;
+  unsigned size;
+  unsigned long long time;
+
+  if (h->format != (unsigned)format OR (format != TEXFMT_RGB AND h->quality != (unsigned)quality))
+    return false;
+  if ((h->num_levels > 1) != mipmaps AND (h->levels[0].width > 1 OR h->levels[0].height > 1))
+    return false;
+  // If the image is missing, use the cooked file as it is
+  if (NOT SourceInfo(image_filename, &size, &time))
+    return true;
+  return h->source_size == size AND h->source_time_lo == (unsigned)time AND h->source_time_hi == (unsigned)(time >> 32);
+}
+
+/*____________________________________________________________________
+|
+| Function: SourceInfo
+|
+| Output: Gets the size and modification time of a file (see
+|   Pack_FileInfo).  Returns true on success.
+|___________________________________________________________________*/
+
+static bool SourceInfo (char *image_filename, unsigned *size, unsigned long long *time)
+{
+  unsigned long long bytes;
+
+  bool ok = Pack_FileInfo (image_filename, &bytes, time);
+  *size = (unsigned) bytes;
+  return ok;
+}
@@ -0,0 +1,62 @@
+/*____________________________________________________________________
+|
+| File: texfile.h
+|
+| Cooked texture files (.ktc): a texture in its final GL format with its
+| whole mip chain, laid out so the file can be memory mapped and each
+| level passed straight to glTexImage2D/glCompressedTexImage2D.  A cooked
+| texture in an asset pack is used straight from the pack.  Include after
+| mipmap.h, texcompress.h and pack.h.
+|___________________________________________________________________*/
+
+#define TEXFILE_MAGIC       "KTC1"
+#define TEXFILE_VERSION     1
+#define TEXFILE_ENDIANNESS  0x04030201    // reads back differently on a big endian machine
+#define TEXFILE_ALIGNMENT   64            // each level starts on a multiple of this
+
+// One mip level in the file
+struct TexFileLevel {
+  unsigned width, height;
+  unsigned offset;            // from the start of the file
+  unsigned size;              // in bytes
+};
+
+// File header (all fields are little endian 32-bit words)
+struct TexFileHeader {
+  char         magic[4];          // TEXFILE_MAGIC
+  unsigned     version;           // TEXFILE_VERSION
+  unsigned     endianness;        // TEXFILE_ENDIANNESS
+  unsigned     format;            // TexFormat
+  unsigned     gl_format;         // GL internal format (GL_RGB or GL_COMPRESSED_*)
+  unsigned     quality;           // encoder quality the levels were compressed with
+  unsigned     num_levels;
+  unsigned     source_size;       // size and modification time of the image it was cooked from (see Pack_FileInfo)
+  unsigned     source_time_lo, source_time_hi;
+  unsigned     reserved[6];
+  TexFileLevel levels[MIP_MAX_LEVELS];
+};
+
+// A mapped texture file
+struct TexFile {
+  TexFileHeader *header;      // 0 if not mapped
+  unsigned char *base;        // start of the file
+  size_t         size;
+  bool           in_memory;   // made by TexFile_CookImage() rather than mapped
+  PackFile       file;        // where a mapped file's data is
+};
+
+// Maps a cooked texture for image_filename (a BMP file), from a pack or from disk, cooking
+//  it first if it's missing or out of date.  RGB levels have tightly packed rows.  Returns true on success
+bool TexFile_Open (char *image_filename, TexFormat format, int quality, bool mipmaps, TexFile *tf);
+// Returns a level's data (in the mapped file)
+unsigned char *TexFile_Level (TexFile *tf, int level);
+// Unmaps a texture file (or frees one made in memory)
+void TexFile_Close (TexFile *tf);
+// Converts a BMP file to a cooked texture file.  Returns true on success
+bool TexFile_Cook (char *image_filename, char *filename, TexFormat format, int quality, bool mipmaps);
+// Cooks an RGB image in memory, in the same layout as a file (free with TexFile_Close).
+//  name is only used in messages.  Returns true on success
+bool TexFile_CookImage (char *name, unsigned char *rgb, int width, int height, TexFormat format,
+                        int quality, bool mipmaps, TexFile *tf);
+// Returns the cooked file name for an image (the image name with a .ktc extension)
+void TexFile_Name (char *image_filename, char *filename, int size);
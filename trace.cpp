@@ -0,0 +1,197 @@
+/*____________________________________________________________________
+|
+| File: trace.cpp
+|
+| Description: Lightweight begin/end event tracing.  Each thread records
+|   into its own ring buffer, so recording takes no locks: the owning
+|   thread is the only writer and publishes each event by advancing an
+|   atomic head index.  When a buffer fills up the oldest events are
+|   overwritten.  The events of all threads can be dumped as Chrome
+|   trace event JSON at any time.
+|
+| Functions: Trace_Begin
+|            Trace_End
+|            Trace_WriteJSON
+|            GetThreadBuffer
+|            Record
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include "math3d.h"
+#include "trace.h"
+#include "json.h"
+#include "profiler.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct TraceEvent {
+  const char *name;
+  long long   time;   // ns (Profile_Now() clock)
+  char        phase;  // 'B' = begin, 'E' = end
+};
+
+struct TraceBuffer {
+  TraceEvent             events[TRACE_BUFFER_SIZE];
+  std::atomic<unsigned>  head;   // total # of events ever recorded (next slot is head % TRACE_BUFFER_SIZE)
+  int                    tid;
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static TraceBuffer *GetThreadBuffer ();
+static void Record (const char *name, char phase);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static std::atomic<TraceBuffer *> buffers[TRACE_MAX_THREADS];   // one per thread that has recorded an event
+static std::atomic<int> num_buffers (0);
+static thread_local TraceBuffer *thread_buffer = 0;
+
+/*____________________________________________________________________
+|
+| Function: Trace_Begin, Trace_End
+|
+| Output: Records the start or end of an event on the calling thread.
+|___________________________________________________________________*/
+
+void Trace_Begin (const char *name)
+{
+  Record (name, 'B');
+}
+
+void Trace_End (const char *name)
+{
+  Record (name, 'E');
+}
+
+/*____________________________________________________________________
+|
+| Function: Trace_WriteJSON
+|
+| Output: Writes the events currently in every thread's ring buffer to
+|   a Chrome trace event JSON file, with times relative to the oldest
+|   event.  Threads may keep recording while this runs; events they
+|   record meanwhile may or may not be included.  Returns true on
+|   success.
+|___________________________________________________________________*/
+
+bool Trace_WriteJSON (const char *filename)
+{
+  int i, n = num_buffers.load (std::memory_order_acquire);
+  unsigned e, first[TRACE_MAX_THREADS], last[TRACE_MAX_THREADS];
+  TraceBuffer *buffer[TRACE_MAX_THREADS];
+  long long start = -1;
+  bool comma = false;
+
+  FILE *fp = fopen (filename, "wt");
+  if (fp == 0)
+    return false;
+
+  // Find the range of valid events in each buffer and the oldest event time
+  for (i=0; i<n; i++) {
+    // A thread that just claimed a slot may not have stored its buffer yet
+    buffer[i] = buffers[i].load (std::memory_order_acquire);
+    if (buffer[i] == 0) {
+      first[i] = last[i] = 0;
+      continue;
+    }
+    last[i]  = buffer[i]->head.load (std::memory_order_acquire);
+    first[i] = last[i] > TRACE_BUFFER_SIZE ? last[i] - TRACE_BUFFER_SIZE : 0;
+    if (last[i] > first[i]) {
+      long long t = buffer[i]->events[first[i] & (TRACE_BUFFER_SIZE-1)].time;
+      if (start == -1 OR t < start)
+        start = t;
+    }
+  }
+
+  fprintf (fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (i=0; i<n; i++)
+    for (e=first[i]; e!=last[i]; e++) {
+      TraceEvent *event = &buffer[i]->events[e & (TRACE_BUFFER_SIZE-1)];
+      fprintf (fp, "%s{\"name\":", comma ? ",\n" : "");
+      JSON_WriteString (fp, event->name);
+      fprintf (fp, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+               event->phase, (event->time - start) / 1000.0, buffer[i]->tid);
+      comma = true;
+    }
+  fprintf (fp, "\n]}\n");
+  fclose (fp);
+
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: GetThreadBuffer
+|
+| Output: Returns the calling thread's ring buffer, creating it the
+|   first time the thread records an event (0 if out of buffers).
+|   Buffers are never freed, so they can be dumped after a thread ends.
+|___________________________________________________________________*/
+
+static TraceBuffer *GetThreadBuffer ()
+{
+  if (thread_buffer == 0) {
+    int i = num_buffers.load (std::memory_order_relaxed);
+    if (i >= TRACE_MAX_THREADS)
+      return 0;
+    TraceBuffer *buffer = (TraceBuffer *) calloc (1, sizeof(TraceBuffer));
+    if (buffer == 0)
+      return 0;
+    buffer->head.store (0, std::memory_order_relaxed);
+    // Claim a slot (another thread may be claiming one at the same time)
+    while (NOT num_buffers.compare_exchange_weak (i, i+1))
+      if (i >= TRACE_MAX_THREADS) {
+        free (buffer);
+        return 0;
+      }
+    buffer->tid = i + 1;
+    // Publish it (with its tid) to Trace_WriteJSON()
+    buffers[i].store (buffer, std::memory_order_release);
+    thread_buffer = buffer;
+  }
+  return thread_buffer;
+}
+
+/*____________________________________________________________________
+|
+| Function: Record
+|
+| Output: Appends an event to the calling thread's ring buffer.
+|___________________________________________________________________*/
+
+static void Record (const char *name, char phase)
+{
+  TraceBuffer *buffer = GetThreadBuffer ();
+  if (buffer == 0)
+    return;
+
+  unsigned head = buffer->head.load (std::memory_order_relaxed);
+  TraceEvent *event = &buffer->events[head & (TRACE_BUFFER_SIZE-1)];
+  event->name  = name;
+  event->time  = Profile_Now ();
+  event->phase = phase;
+  // Publish the event
+  buffer->head.store (head + 1, std::memory_order_release);
+}
@@ -0,0 +1,20 @@
+/*____________________________________________________________________
+|
+| File: trace.h
+|___________________________________________________________________*/
+
+#define TRACE_MAX_THREADS 64        // max # of threads that can record events
+#define TRACE_BUFFER_SIZE (1<<16)   // # of events kept per thread (must be a power of 2)
+
+// Records the start/end of a named event on the calling thread (name must outlive the trace, e.g. a literal)
+void Trace_Begin (const char *name);
+void Trace_End (const char *name);
+// Writes all recorded events as Chrome trace event JSON (open in chrome://tracing or ui.perfetto.dev)
+bool Trace_WriteJSON (const char *filename);
+
+// Records the enclosing block as one event
+struct TraceScope {
+  const char *name;
+  TraceScope (const char *name) : name(name) { Trace_Begin (name); }
+  ~TraceScope () { Trace_End (name); }
+};
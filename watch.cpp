@@ -0,0 +1,332 @@
+/*____________________________________________________________________
+|
+| File: watch.cpp
+|
+| Description: File change notification.  On Linux each directory with
+|   a watched file gets an inotify watch, so a change costs nothing
+|   until it happens and Watch_Poll() is one non-blocking read.  The
+|   directory is watched rather than the file because editors often
+|   save by writing a new file and renaming it over the old one, which
+|   would leave a watch on the file pointing at the old inode.  inotify
+|   gives every spelling of a directory the same watch, so directories
+|   are kept by watch, each counting the files in it, and an event is
+|   matched against every file on its watch.  A save can also take
+|   several writes, so a file is only reported once it has been left
+|   alone for WATCH_SETTLE_MS.  Elsewhere (or if inotify can't be
+|   started) the files' sizes and modification times are polled every
+|   WATCH_POLL_MS.
+|
+| Functions: Watch_Add
+|            Watch_Remove
+|            Watch_Poll
+|            Watch_Shutdown
+|            ReadEvents
+|            PollFiles
+|            FileInfo
+|            NowMs
+|___________________________________________________________________*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/inotify.h>
+#define WATCH_INOTIFY
+#endif
+#include "math3d.h"
+#include "pack.h"
+#include "watch.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct WatchedFile {
+  std::string path;
+  std::string dir, name;      // path split at the last separator
+  int         wd;             // inotify watch on its directory (-1 = none)
+  int         refs;
+  long long   changed_at;     // time of the last change not reported yet (ms), 0 = none
+  long long   size, mtime;    // polling: last seen size and modification time
+};
+
+struct WatchedDir {
+  int         wd;             // inotify watch (one per directory, however it's spelled)
+  int         files;          // # of watched files in it
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void ReadEvents (long long now);
+static void PollFiles (long long now);
+static bool FileInfo (const char *path, long long *size, long long *mtime);
+static long long NowMs ();
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static std::vector<WatchedFile> files;
+static std::vector<WatchedDir> dirs;
+static int inotify_fd = -1;
+static bool inotify_tried = false;
+static long long last_poll = 0;
+
+/*____________________________________________________________________
+|
+| Function: Watch_Add
+|
+| Output: Starts watching a file, or adds a reference if it's already
+|   watched.  Returns true on success.
+|___________________________________________________________________*/
+
+bool Watch_Add (const char *path)
+{
+  WatchedFile f;
+  size_t i;
+
+  for (i=0; i<files.size(); i++)
+    if (files[i].path == path) {
+      files[i].refs++;
+      return true;
+    }
+
+  f.path = path;
+  size_t slash = f.path.find_last_of ("/\\");
+  f.dir  = slash == std::string::npos ? "." : f.path.substr (0, slash ? slash : 1);
+  f.name = slash == std::string::npos ? f.path : f.path.substr (slash + 1);
+  f.wd   = -1;
+  f.refs = 1;
+  f.changed_at = 0;
+  FileInfo (path, &f.size, &f.mtime);
+
+#ifdef WATCH_INOTIFY
+  if (NOT inotify_tried) {
+    inotify_tried = true;
+    inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0)
+      printf ("Watch: inotify isn't available, polling instead\n");
+  }
+  if (inotify_fd >= 0) {
+    char *real = realpath (f.dir.c_str(), 0);
+    if (real) {
+      f.dir = real;
+      free (real);
+    }
+    // Written and closed, renamed into place, or touched (a directory already watched,
+    // under any name, gets its watch back)
+    f.wd = inotify_add_watch (inotify_fd, f.dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB);
+    if (f.wd < 0) {
+      printf ("%s: could not watch %s\n", path, f.dir.c_str());
+      return false;
+    }
+    for (i=0; i<dirs.size(); i++)
+      if (dirs[i].wd == f.wd)
+        break;
+    if (i == dirs.size()) {
+      WatchedDir d;
+      d.wd    = f.wd;
+      d.files = 0;
+      dirs.push_back (d);
+    }
+    dirs[i].files++;
+  }
+#endif
+
+  files.push_back (f);
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: Watch_Remove
+|
+| Output: Removes a reference to a watched file, and stops watching it
+|   (and its directory, if nothing else in it is watched) if it was the
+|   last.
+|___________________________________________________________________*/
+
+void Watch_Remove (const char *path)
+{
+  for (size_t i=0; i<files.size(); i++) {
+    if (files[i].path != path)
+      continue;
+    if (--files[i].refs > 0)
+      return;
+#ifdef WATCH_INOTIFY
+    if (inotify_fd >= 0)
+      for (size_t j=0; j<dirs.size(); j++)
+        if (dirs[j].wd == files[i].wd AND --dirs[j].files == 0) {
+          inotify_rm_watch (inotify_fd, dirs[j].wd);
+          dirs.erase (dirs.begin() + j);
+          break;
+        }
+#endif
+    files.erase (files.begin() + i);
+    return;
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: Watch_Poll
+|
+| Output: Reports each watched file that changed and has since been
+|   left alone for WATCH_SETTLE_MS.  Returns the # reported.
+|___________________________________________________________________*/
+
+int Watch_Poll (WatchFn changed)
+{
+  std::vector<std::string> settled;
+
+  if (files.empty())
+    return 0;
+
+  long long now = NowMs ();
+  if (inotify_fd >= 0)
+    ReadEvents (now);
+  else if (now - last_poll >= WATCH_POLL_MS) {
+    PollFiles (now);
+    last_poll = now;
+  }
+
+  for (size_t i=0; i<files.size(); i++)
+    if (files[i].changed_at AND now - files[i].changed_at >= WATCH_SETTLE_MS) {
+      files[i].changed_at = 0;
+      settled.push_back (files[i].path);
+    }
+  // changed() may add or remove watches
+  for (size_t i=0; i<settled.size(); i++)
+    changed (settled[i].c_str());
+  return (int)settled.size ();
+}
+
+/*____________________________________________________________________
+|
+| Function: Watch_Shutdown
+|
+| Output: Stops watching every file.
+|___________________________________________________________________*/
+
+void Watch_Shutdown ()
+{
+#ifdef WATCH_INOTIFY
+  if (inotify_fd >= 0)
+    close (inotify_fd);
+  inotify_fd = -1;
+#endif
+  inotify_tried = false;
+  files.clear ();
+  dirs.clear ();
+  last_poll = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: ReadEvents
+|
+| Output: Reads the inotify events queued since the last call (without
+|   waiting) and marks the files they name as changed (every file of
+|   that name on the event's watch, whatever its path's spelling).
+|___________________________________________________________________*/
+
+static void ReadEvents (long long now)
+{
+#ifdef WATCH_INOTIFY
+  // Events are variable length, each name padded to keep the next aligned
+  alignas(struct inotify_event) char buffer[4096];
+  ssize_t n;
+
+  while ((n = read (inotify_fd, buffer, sizeof(buffer))) > 0) {
+    for (char *p=buffer; p<buffer+n; p+=sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+      struct inotify_event *e = (struct inotify_event *)p;
+      // Events were lost, so anything may have changed
+      if (e->mask & IN_Q_OVERFLOW) {
+        for (size_t i=0; i<files.size(); i++)
+          files[i].changed_at = now;
+        continue;
+      }
+      if (e->len == 0)
+        continue;
+      for (size_t i=0; i<files.size(); i++)
+        if (files[i].wd == e->wd AND files[i].name == e->name)
+          files[i].changed_at = now;
+    }
+  }
+#endif
+}
+
+/*____________________________________________________________________
+|
+| Function: PollFiles
+|
+| Output: Marks the files whose size or modification time has changed
+|   since they were last checked.
+|___________________________________________________________________*/
+
+static void PollFiles (long long now)
+{
+  long long size, mtime;
+
+  for (size_t i=0; i<files.size(); i++) {
+    WatchedFile *f = &files[i];
+    FileInfo (f->path.c_str(), &size, &mtime);
+    if (size != f->size OR mtime != f->mtime) {
+      f->size  = size;
+      f->mtime = mtime;
+      f->changed_at = now;
+    }
+  }
+}
+
+/*____________________________________________________________________
+|
+| Function: FileInfo
+|
+| Output: Gets a file's size and modification time (see Pack_FileInfo,
+|   both -1 if it's missing).  Returns true if it exists.
+|___________________________________________________________________*/
+
+static bool FileInfo (const char *path, long long *size, long long *mtime)
+{
+  unsigned long long bytes, time;
+
+  if (NOT Pack_FileInfo(path, &bytes, &time)) {
+    *size = *mtime = -1;
+    return false;
+  }
+  *size  = (long long) bytes;
+  *mtime = (long long) time;
+  return true;
+}
+
+/*____________________________________________________________________
+|
+| Function: NowMs
+|
+| Output: Returns a steady time in milliseconds (never 0).
+|___________________________________________________________________*/
+
+static long long NowMs ()
+{
+  using namespace std::chrono;
+  return duration_cast<milliseconds> (steady_clock::now().time_since_epoch()).count() + 1;
+}
@@ -0,0 +1,24 @@
+/*____________________________________________________________________
+|
+| File: watch.h
+|
+| Watches files for changes (inotify on Linux, polling elsewhere), so
+| assets can be reloaded while the program runs.
+|___________________________________________________________________*/
+
+#define WATCH_SETTLE_MS   50      // a change is reported once the file has been left alone this long
+#define WATCH_POLL_MS     250     // without inotify, how often the files are checked
+
+// Called by Watch_Poll() with the path of a file that changed
+typedef void (*WatchFn) (const char *path);
+
+// Starts watching a file (the same path can be added more than once, and needs as many
+//  Watch_Remove() calls).  Returns true on success
+bool Watch_Add (const char *path);
+// Stops watching a file
+void Watch_Remove (const char *path);
+// Calls changed() for each watched file that has changed and settled since the last call.
+//  Never blocks, so it can be called every frame.  Returns the # of files reported
+int  Watch_Poll (WatchFn changed);
+// Stops watching every file
+void Watch_Shutdown ();